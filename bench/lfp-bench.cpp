@@ -0,0 +1,459 @@
+/*
+ * Benchmarks for the hot paths of lfp: sequential reads and re-reads, seeks,
+ * and index building, for the tapeimage and rp66 protocols over the memfile and cfile
+ * leaves.
+ *
+ * The files are synthetic, with fixed-size records, and generated on every
+ * run. Results are written to stdout as JSON, so they can be stored and
+ * compared across versions:
+ *
+ *     lfp-bench --records 100000 --record-size 1024 > results.json
+ *
+ * Timings are wall-clock, and for the seek benchmarks the average over all
+ * seeks in a run.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <lfp/lfp.h>
+#include <lfp/memfile.h>
+#include <lfp/rp66.h>
+#include <lfp/tapeimage.h>
+
+namespace {
+
+struct config {
+    std::int64_t records     = 20000;
+    std::int64_t record_size = 1024;
+    std::int64_t seeks       = 1000;
+    std::string  tmpfile     = "lfp-bench.tmp";
+};
+
+enum class format { tapeimage, rp66 };
+enum class leaf   { memfile, cfile };
+
+const char* name(format fmt) {
+    return fmt == format::tapeimage ? "tapeimage" : "rp66";
+}
+
+const char* name(leaf l) {
+    return l == leaf::memfile ? "memfile" : "cfile";
+}
+
+void put_u32_le(std::vector< unsigned char >& out, std::uint32_t x) {
+    for (int i = 0; i < 4; ++i)
+        out.push_back(static_cast< unsigned char >(x >> (8 * i)));
+}
+
+void put_payload(std::vector< unsigned char >& out, std::int64_t n) {
+    for (std::int64_t i = 0; i < n; ++i)
+        out.push_back(static_cast< unsigned char >(i));
+}
+
+/*
+ * A tape image of fixed-size records, terminated by a file mark. Tape image
+ * headers are 32-bit offsets, so the file must be smaller than 4GB.
+ */
+std::vector< unsigned char > make_tapeimage(const config& cfg) {
+    const auto total = (12 + cfg.record_size) * cfg.records + 12;
+    if (total > std::int64_t(UINT32_MAX))
+        throw std::invalid_argument("tapeimage file would be larger than 4GB");
+
+    std::vector< unsigned char > out;
+    out.reserve(total);
+    std::uint32_t prev = 0;
+    for (std::int64_t i = 0; i <= cfg.records; ++i) {
+        const auto last = i == cfg.records;
+        const auto len = last ? 0 : cfg.record_size;
+        const auto here = std::uint32_t(out.size());
+        put_u32_le(out, last ? 1 : 0);
+        put_u32_le(out, prev);
+        put_u32_le(out, std::uint32_t(here + 12 + len));
+        put_payload(out, len);
+        prev = here;
+    }
+    return out;
+}
+
+/*
+ * A sequence of Visible Records. The length of a Visible Record is 16 bits,
+ * so the record size is capped at what fits.
+ */
+std::vector< unsigned char > make_rp66(const config& cfg) {
+    const auto len = (std::min)(cfg.record_size, std::int64_t(0xFFFF - 4));
+    std::vector< unsigned char > out;
+    out.reserve((4 + len) * cfg.records);
+    for (std::int64_t i = 0; i < cfg.records; ++i) {
+        const auto vrl = std::uint16_t(len + 4);
+        out.push_back(static_cast< unsigned char >(vrl >> 8));
+        out.push_back(static_cast< unsigned char >(vrl));
+        out.push_back(0xFF);
+        out.push_back(0x01);
+        put_payload(out, len);
+    }
+    return out;
+}
+
+std::int64_t logical_size(format fmt, const config& cfg) {
+    if (fmt == format::tapeimage)
+        return cfg.records * cfg.record_size;
+    return cfg.records * (std::min)(cfg.record_size, std::int64_t(0xFFFF - 4));
+}
+
+/*
+ * A file, generated once, that can be opened any number of times with fresh
+ * (cold) handles.
+ */
+class source {
+public:
+    source(format f, leaf l, const config& cfg) :
+        fmt(f),
+        lf(l),
+        path(cfg.tmpfile),
+        bytes(f == format::tapeimage ? make_tapeimage(cfg) : make_rp66(cfg))
+    {
+        if (this->lf != leaf::cfile)
+            return;
+
+        std::FILE* fp = std::fopen(this->path.c_str(), "wb");
+        if (not fp)
+            throw std::runtime_error("unable to create " + this->path);
+        const auto n = std::fwrite(this->bytes.data(), 1, this->bytes.size(), fp);
+        std::fclose(fp);
+        if (n != this->bytes.size())
+            throw std::runtime_error("unable to write " + this->path);
+    }
+
+    ~source() {
+        if (this->lf == leaf::cfile)
+            std::remove(this->path.c_str());
+    }
+
+    source(const source&) = delete;
+    source& operator = (const source&) = delete;
+
+    lfp_protocol* open() const {
+        lfp_protocol* inner = nullptr;
+        if (this->lf == leaf::memfile) {
+            inner = lfp_memfile_openview(this->bytes.data(), this->bytes.size());
+        } else {
+            std::FILE* fp = std::fopen(this->path.c_str(), "rb");
+            if (not fp)
+                throw std::runtime_error("unable to open " + this->path);
+            inner = lfp_cfile(fp);
+        }
+
+        if (not inner)
+            throw std::runtime_error("unable to open leaf protocol");
+
+        auto* outer = this->fmt == format::tapeimage
+                    ? lfp_tapeimage_open(inner)
+                    : lfp_rp66_open(inner);
+        if (not outer) {
+            lfp_close(inner);
+            throw std::runtime_error("unable to open protocol");
+        }
+        return outer;
+    }
+
+    void build_index(lfp_protocol* f) const {
+        const auto err = this->fmt == format::tapeimage
+                       ? lfp_tapeimage_build_index(f, nullptr, nullptr)
+                       : lfp_rp66_build_index(f, nullptr, nullptr);
+        check(f, err);
+    }
+
+    static void check(lfp_protocol* f, int err) {
+        if (err == LFP_OK or err == LFP_OKINCOMPLETE or err == LFP_EOF)
+            return;
+        const auto* msg = lfp_errormsg(f);
+        throw std::runtime_error(msg ? msg : "unknown error");
+    }
+
+    format fmt;
+    leaf lf;
+
+private:
+    std::string path;
+    std::vector< unsigned char > bytes;
+};
+
+using timer = std::chrono::steady_clock;
+
+double seconds_since(timer::time_point start) {
+    const auto elapsed = timer::now() - start;
+    return std::chrono::duration< double >(elapsed).count();
+}
+
+/*
+ * The results are collected as pre-formatted JSON objects, and joined when
+ * printed.
+ */
+class report {
+public:
+    void add(const source& src, const std::string& fields) {
+        char head[128];
+        std::snprintf(head, sizeof(head),
+            "{ \"format\": \"%s\", \"leaf\": \"%s\", ",
+            name(src.fmt), name(src.lf));
+        this->results.push_back(head + fields + " }");
+    }
+
+    void print(const config& cfg) const {
+        std::printf("{\n");
+        std::printf("  \"config\": {\n");
+        std::printf("    \"records\": %lld,\n", (long long)cfg.records);
+        std::printf("    \"record-size\": %lld,\n", (long long)cfg.record_size);
+        std::printf("    \"seeks\": %lld\n", (long long)cfg.seeks);
+        std::printf("  },\n");
+        std::printf("  \"results\": [\n");
+        for (std::size_t i = 0; i < this->results.size(); ++i) {
+            const auto* sep = i + 1 == this->results.size() ? "" : ",";
+            std::printf("    %s%s\n", this->results[i].c_str(), sep);
+        }
+        std::printf("  ]\n");
+        std::printf("}\n");
+    }
+
+private:
+    std::vector< std::string > results;
+};
+
+#if defined(__GNUC__)
+__attribute__((format(printf, 1, 2)))
+#endif
+std::string fields(const char* fmt, ...) {
+    char buffer[512];
+    va_list args;
+    va_start(args, fmt);
+    std::vsnprintf(buffer, sizeof(buffer), fmt, args);
+    va_end(args);
+    return buffer;
+}
+
+/*
+ * Read from the current position to end-of-file, chunk bytes at a time, and
+ * return the number of bytes read
+ */
+std::int64_t read_all(lfp_protocol* f, std::vector< unsigned char >& buffer) {
+    const auto chunk = std::int64_t(buffer.size());
+    std::int64_t total = 0;
+    while (true) {
+        std::int64_t nread = 0;
+        const auto err = lfp_readinto(f, buffer.data(), chunk, &nread);
+        source::check(f, err);
+        total += nread;
+        if (err == LFP_EOF or nread == 0)
+            return total;
+    }
+}
+
+/*
+ * Read the whole file front-to-back, chunk bytes at a time, with a cold
+ * index, i.e. indexing as a side effect of reading.
+ */
+void bench_readinto(const source& src, std::int64_t chunk, report& out) {
+    auto buffer = std::vector< unsigned char >(chunk);
+    auto* f = src.open();
+
+    const auto start = timer::now();
+    const auto total = read_all(f, buffer);
+    const auto elapsed = seconds_since(start);
+    lfp_close(f);
+
+    out.add(src, fields(
+        "\"benchmark\": \"readinto\", \"chunk\": %lld, \"bytes\": %lld, "
+        "\"seconds\": %.6f, \"mb-per-second\": %.2f",
+        (long long)chunk, (long long)total, elapsed,
+        total / elapsed / (1024.0 * 1024.0)));
+}
+
+/*
+ * Read the whole file twice on the same handle, first with a cold index, and
+ * then again after seeking back to the start. The second pass only crosses
+ * records that are already indexed, and should be no slower than the first.
+ * The seeks made on the leaf during the second pass are reported too.
+ */
+void bench_reread(const source& src, std::int64_t chunk, report& out) {
+    auto buffer = std::vector< unsigned char >(chunk);
+    auto* f = src.open();
+
+    auto start = timer::now();
+    const auto total = read_all(f, buffer);
+    const auto first = seconds_since(start);
+
+    lfp_protocol* leaf = nullptr;
+    source::check(f, lfp_peek(f, &leaf));
+    lfp_stats before;
+    lfp_stats_get(leaf, &before);
+
+    start = timer::now();
+    source::check(f, lfp_seek(f, 0));
+    read_all(f, buffer);
+    const auto second = seconds_since(start);
+
+    lfp_stats after;
+    lfp_stats_get(leaf, &after);
+    lfp_close(f);
+
+    out.add(src, fields(
+        "\"benchmark\": \"reread\", \"chunk\": %lld, \"bytes\": %lld, "
+        "\"first-seconds\": %.6f, \"second-seconds\": %.6f, "
+        "\"second-over-first\": %.3f, \"leaf-seeks\": %lld",
+        (long long)chunk, (long long)total, first, second, second / first,
+        (long long)(after.seeks - before.seeks)));
+}
+
+/*
+ * Seek to random offsets and read a few bytes.
+ *
+ * With a hot index, the index is built before the clock starts, and seeks
+ * only have to look up the record. With a cold index, every seek is made on a
+ * freshly opened handle, and pays for indexing up to the target.
+ */
+void bench_seek(const source& src,
+                std::int64_t size,
+                std::int64_t seeks,
+                bool hot,
+                report& out) {
+    auto rng = std::mt19937(2020);
+    auto dist = std::uniform_int_distribution< std::int64_t >(0, size - 1);
+    unsigned char buffer[16];
+
+    lfp_protocol* f = nullptr;
+    if (hot) {
+        f = src.open();
+        src.build_index(f);
+    }
+
+    /* cold seeks re-index from scratch, which is slow, so do fewer */
+    const auto count = hot ? seeks : (std::max)(seeks / 100, std::int64_t(1));
+
+    double elapsed = 0;
+    for (std::int64_t i = 0; i < count; ++i) {
+        if (not hot)
+            f = src.open();
+
+        const auto n = dist(rng);
+        const auto start = timer::now();
+        source::check(f, lfp_seek(f, n));
+        std::int64_t nread = 0;
+        const auto len = (std::min)(std::int64_t(sizeof(buffer)), size - n);
+        source::check(f, lfp_readinto(f, buffer, len, &nread));
+        elapsed += seconds_since(start);
+
+        if (not hot)
+            lfp_close(f);
+    }
+
+    if (hot)
+        lfp_close(f);
+
+    out.add(src, fields(
+        "\"benchmark\": \"seek\", \"index\": \"%s\", \"seeks\": %lld, "
+        "\"seconds\": %.6f, \"us-per-seek\": %.3f",
+        hot ? "hot" : "cold", (long long)count, elapsed,
+        elapsed / count * 1e6));
+}
+
+void bench_build_index(const source& src,
+                       std::int64_t records,
+                       report& out) {
+    auto* f = src.open();
+    const auto start = timer::now();
+    src.build_index(f);
+    const auto elapsed = seconds_since(start);
+    lfp_close(f);
+
+    out.add(src, fields(
+        "\"benchmark\": \"build-index\", \"records\": %lld, "
+        "\"seconds\": %.6f, \"records-per-second\": %.0f",
+        (long long)records, elapsed, records / elapsed));
+}
+
+void usage(const char* argv0) {
+    std::fprintf(stderr,
+        "usage: %s [--records N] [--record-size N] [--seeks N] [--tmpfile PATH]\n"
+        "\n"
+        "  --records      number of records in the generated files\n"
+        "  --record-size  size of each record, in bytes\n"
+        "  --seeks        number of random seeks with a hot index\n"
+        "  --tmpfile      where to write the file for the cfile benchmarks\n",
+        argv0);
+}
+
+std::int64_t positive(const char* arg) {
+    char* end = nullptr;
+    const auto x = std::strtoll(arg, &end, 10);
+    if (end == arg or *end != '\0' or x <= 0)
+        throw std::invalid_argument(std::string("expected positive integer, got ") + arg);
+    return x;
+}
+
+config parse_args(int argc, char** argv) {
+    config cfg;
+    for (int i = 1; i < argc; ++i) {
+        const auto arg = std::string(argv[i]);
+        if (arg == "-h" or arg == "--help") {
+            usage(argv[0]);
+            std::exit(EXIT_SUCCESS);
+        }
+
+        if (i + 1 == argc) {
+            usage(argv[0]);
+            std::exit(EXIT_FAILURE);
+        }
+
+        const auto* value = argv[++i];
+        if      (arg == "--records")     cfg.records     = positive(value);
+        else if (arg == "--record-size") cfg.record_size = positive(value);
+        else if (arg == "--seeks")       cfg.seeks       = positive(value);
+        else if (arg == "--tmpfile")     cfg.tmpfile     = value;
+        else {
+            usage(argv[0]);
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    return cfg;
+}
+
+}
+
+int main(int argc, char** argv) try {
+    const auto cfg = parse_args(argc, argv);
+    const std::int64_t chunks[] = { 64, 4096, 64 * 1024, 1024 * 1024 };
+
+    report out;
+    for (const auto fmt : { format::tapeimage, format::rp66 }) {
+        for (const auto lf : { leaf::memfile, leaf::cfile }) {
+            const source src(fmt, lf, cfg);
+            const auto size = logical_size(fmt, cfg);
+
+            for (const auto chunk : chunks)
+                bench_readinto(src, chunk, out);
+
+            bench_reread(src, 4096, out);
+
+            bench_seek(src, size, cfg.seeks, false, out);
+            bench_seek(src, size, cfg.seeks, true,  out);
+            bench_build_index(src, cfg.records, out);
+        }
+    }
+
+    out.print(cfg);
+    return EXIT_SUCCESS;
+} catch (const std::exception& e) {
+    std::fprintf(stderr, "lfp-bench: %s\n", e.what());
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,74 @@
+#ifndef LFP_ARENA_H
+#define LFP_ARENA_H
+
+#include <lfp/lfp.h>
+
+/** \file arena.h */
+
+#if (__cplusplus)
+extern "C" {
+#endif
+
+/** A pool of memory for protocols, and their record indices
+ *
+ * Opening a protocol stack allocates every layer, and its buffers and record
+ * index, and closing it releases them again. That is fine for a few large
+ * files, but in tight loops over many small files the allocator shows up in
+ * the profile. An arena keeps the memory that is released, and hands it out
+ * again to the next protocol of a similar size, so that once it is warm,
+ * opening, reading, and closing files does no heap allocation.
+ *
+ * An arena is only used on the threads where it is made current with
+ * `lfp_arena_use()`. Memory is returned to the arena it came from when it is
+ * released, from any thread, so protocols can be closed anywhere.
+ *
+ * Example
+ * -------
+ *
+ * \code{.c}
+ * lfp_arena* arena = lfp_arena_new();
+ * lfp_arena_use(arena);
+ * for (int i = 0; i < n; ++i) {
+ *     lfp_protocol* f = lfp_tapeimage_open(lfp_memfile_openview(p[i], len[i]));
+ *     ...
+ *     lfp_close(f);
+ * }
+ * lfp_arena_use(NULL);
+ * lfp_arena_free(arena);
+ * \endcode
+ */
+typedef struct lfp_arena lfp_arena;
+
+/** Create a new, empty arena
+ *
+ * \retval NULL The arena could not be created
+ */
+LFP_API
+lfp_arena* lfp_arena_new(void);
+
+/** Allocate protocols from arena on the calling thread
+ *
+ * Protocols opened on this thread after this call, and the record indices
+ * they build, are allocated from arena. Pass `NULL` to go back to the heap.
+ *
+ * Returns the arena that was current before, or `NULL`, so that it can be
+ * restored.
+ */
+LFP_API
+lfp_arena* lfp_arena_use(lfp_arena* arena);
+
+/** Release an arena
+ *
+ * Release the memory kept by arena. Protocols allocated from it can still be
+ * used and closed, and the arena is destroyed when the last one is gone.
+ * arena must no longer be current on any thread, except the calling one, on
+ * which it is made not current.
+ */
+LFP_API
+void lfp_arena_free(lfp_arena* arena);
+
+#if (__cplusplus)
+} // extern "C"
+#endif
+
+#endif // LFP_ARENA_H
@@ -0,0 +1,70 @@
+#ifndef LFP_AUTO_H
+#define LFP_AUTO_H
+
+#include <lfp/lfp.h>
+
+/** \file auto.h */
+
+#if (__cplusplus)
+extern "C" {
+#endif
+
+/** The protocols stacked by `lfp_open_auto()` */
+enum lfp_auto_layers {
+    /** The file is gzip-compressed, and opened with the gzip protocol */
+    LFP_AUTO_GZIP      = 1,
+    /** The file is a tape image, and opened with the tapeimage protocol */
+    LFP_AUTO_TAPEIMAGE = 2,
+    /** The Visible Envelope starts with a Storage Unit Label, which is skipped */
+    LFP_AUTO_SUL       = 4,
+    /** The file is a Visible Envelope, and opened with the rp66 protocol */
+    LFP_AUTO_RP66      = 8,
+};
+
+/** Open a file with the protocols its format needs
+ *
+ * Read the first few kilobytes of f once, recognise the layers from them,
+ * and build the stack of protocols over f, from the bottom up:
+ *
+ * - gzip, if the file starts with the gzip magic bytes, and lfp is built with
+ *   zlib. The decompressed bytes are then recognised the same way
+ * - tapeimage, if the file starts with a plausible record header
+ * - rp66, if the file (or tape image) starts with a Visible Record header,
+ *   or with a Storage Unit Label followed by one. The label is skipped, as
+ *   `lfp_rp66_open()` expects
+ *
+ * This replaces trying `lfp_tapeimage_open()`, reading, and peeling it off
+ * again when it fails, which reads and parses the headers several times.
+ * Here, the probed bytes are kept in a thin layer right over f (and over
+ * gzip), which replays them to the protocols stacked on top, so the headers
+ * are read from f only once. Once the bytes are consumed, or the protocols
+ * seek away from them, the layer passes everything straight through to f.
+ *
+ * \code{.c}
+ * int layers;
+ * lfp_protocol* f = lfp_open_auto(lfp_cfile(fopen(path, "rb")), &layers);
+ * if (!(layers & LFP_AUTO_RP66)) ...
+ * \endcode
+ *
+ * The returned protocol is used like any other stack, and closing it closes
+ * f. `lfp_peel()` goes through the layers as usual, including the replay
+ * layers. With a Storage Unit Label, the label is the first 80 bytes under
+ * the rp66 protocol, and can be read with `lfp_pread()` on the protocol
+ * found with `lfp_peek()`.
+ *
+ * Files in no recognised format are returned with only the replay layer,
+ * and layers set to 0.
+ *
+ * \param layers if not `NULL`, the lfp_auto_layers that were stacked
+ *
+ * \retval NULL f is `NULL`, or could not be read. The caller still owns f,
+ *              but it is no longer at the same position.
+ */
+LFP_API
+lfp_protocol* lfp_open_auto(lfp_protocol* f, int* layers);
+
+#if (__cplusplus)
+} // extern "C"
+#endif
+
+#endif // LFP_AUTO_H
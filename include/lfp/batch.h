@@ -0,0 +1,148 @@
+#ifndef LFP_BATCH_H
+#define LFP_BATCH_H
+
+#include <lfp/lfp.h>
+
+/** \file batch.h */
+
+#if (__cplusplus)
+extern "C" {
+#endif
+
+/** Group the job by the device the file is on, from `stat()` */
+#define LFP_INDEX_DEVICE_AUTO (-1)
+
+/** The index of one protocol in a file indexed by `lfp_index_batch()` */
+struct lfp_index_result {
+    /** The number of records, as with `lfp_tapeimage_build_index()` */
+    int64_t records;
+    /** The logical size, as with `lfp_tapeimage_build_index()` */
+    int64_t size;
+    /**
+     * The index exported with `lfp_index_export()`, or `NULL` if the file has
+     * no such protocol. Released by `lfp_index_batch_free()`.
+     */
+    void* index;
+    /** The size of index, in bytes */
+    int64_t index_size;
+};
+typedef struct lfp_index_result lfp_index_result;
+
+/** A file to index with `lfp_index_batch()`
+ *
+ * The fields marked in are set by the caller, and the rest are set by
+ * `lfp_index_batch()`. Zero-initialise the struct before filling it in.
+ */
+struct lfp_index_job {
+    /** in: the path of the file */
+    const char* path;
+
+    /**
+     * in: if not `NULL`, called to open the file, instead of opening path
+     * with the cfile protocol. It is called on a worker thread, with ctx and
+     * path, and should return the leaf protocol, or `NULL` if the file can't
+     * be opened. This is how to index files over other leaves, like mmap or
+     * http.
+     */
+    lfp_protocol* (*open)(void* ctx, const char* path);
+    /** in: passed on to open */
+    void* ctx;
+
+    /**
+     * in: the device, or any other group of files that should share a
+     * concurrency limit. Jobs with the same device are never run more than
+     * per_device at a time. With `LFP_INDEX_DEVICE_AUTO`, the device is found
+     * with `stat()` on path, where available.
+     */
+    int64_t device;
+
+    /**
+     * out: LFP_OK if the file was indexed, LFP_INVALID_ARGS if it is neither
+     * a tape image nor a Visible Envelope, or the status of the first failure
+     */
+    int status;
+    /**
+     * out: a description of the failure, or `NULL`. Released by
+     * `lfp_index_batch_free()`.
+     */
+    char* errmsg;
+    /** out: the lfp_auto_layers found in the file */
+    int layers;
+    /** out: the index of the tapeimage protocol, if any */
+    lfp_index_result tapeimage;
+    /** out: the index of the rp66 protocol, if any */
+    lfp_index_result rp66;
+};
+typedef struct lfp_index_job lfp_index_job;
+
+/** Index many files concurrently
+ *
+ * Open every file in jobs with `lfp_open_auto()`, build the index of its
+ * tapeimage and rp66 protocols, like `lfp_tapeimage_build_index()` and
+ * `lfp_rp66_build_index()`, and export them with `lfp_index_export()`. The
+ * files are indexed concurrently, by a pool of threads, which is what makes
+ * cataloguing large numbers of files fast - indexing is mostly waiting for
+ * small reads of record headers, and many of them can be in flight at once.
+ *
+ * Disks, and spinning disks in particular, get slower with too many readers
+ * at once, so no more than per_device jobs on the same device run at the
+ * same time. Jobs are started in order, skipping the ones whose device is
+ * busy.
+ *
+ * Failures are per file, and reported in the job, so one broken file does
+ * not stop the batch.
+ *
+ * The indices are for the protocols as `lfp_open_auto()` stacks them, and
+ * are imported by opening the same protocols by hand, and importing right
+ * after opening each one. Skipping the storage unit label reads from the
+ * tape image, so do it after the tapeimage import:
+ *
+ * \code{.c}
+ * lfp_protocol* tif = lfp_tapeimage_open(leaf);
+ * lfp_index_import(tif, job.tapeimage.index, job.tapeimage.index_size);
+ * if (job.layers & LFP_AUTO_SUL) lfp_seek(tif, 80);
+ * lfp_protocol* ve = lfp_rp66_open(tif);
+ * lfp_index_import(ve, job.rp66.index, job.rp66.index_size);
+ * \endcode
+ *
+ * Example
+ * -------
+ *
+ * \code{.c}
+ * lfp_index_job jobs[2];
+ * memset(jobs, 0, sizeof(jobs));
+ * jobs[0].path = "a.dlis";
+ * jobs[1].path = "b.dlis";
+ * jobs[0].device = jobs[1].device = LFP_INDEX_DEVICE_AUTO;
+ * lfp_index_batch(jobs, 2, 8, 2);
+ * ...
+ * lfp_index_batch_free(jobs, 2);
+ * \endcode
+ *
+ * \param threads    the number of threads, or 0 for one per core. The
+ *                   calling thread is one of them
+ * \param per_device the maximum concurrent jobs per device, or 0 for no limit
+ *
+ * \retval LFP_OK All the jobs are done, see the status of each
+ * \retval LFP_INVALID_ARGS jobs is `NULL`, or count, threads, or per_device is
+ *                          negative
+ */
+LFP_API
+int lfp_index_batch(lfp_index_job* jobs,
+                    int count,
+                    int threads,
+                    int per_device);
+
+/** Release the indices and messages of a batch
+ *
+ * Release everything `lfp_index_batch()` allocated for the jobs, and set the
+ * pointers to `NULL`. jobs itself is owned by the caller.
+ */
+LFP_API
+void lfp_index_batch_free(lfp_index_job* jobs, int count);
+
+#if (__cplusplus)
+} // extern "C"
+#endif
+
+#endif // LFP_BATCH_H
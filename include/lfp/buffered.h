@@ -0,0 +1,56 @@
+#ifndef LFP_BUFFERED_H
+#define LFP_BUFFERED_H
+
+#include <lfp/lfp.h>
+
+/** \file buffered.h */
+
+#if (__cplusplus)
+extern "C" {
+#endif
+
+/** Read-ahead buffering protocol
+ *
+ * The buffered protocol wraps any other protocol, and serves reads from an
+ * in-memory window of read-ahead data. Small reads, like the record headers
+ * read by the tapeimage and rp66 protocols, are then served from memory
+ * instead of going to the underlying protocol one at a time. This is very
+ * effective when every read has a high latency, like on network file systems
+ * or object store-backed mounts, and should be stacked right on top of the
+ * leaf protocol:
+ *
+ * \code{.cpp}
+ * lfp_protocol* f = lfp_cfile_open(fp);
+ * lfp_protocol* b = lfp_buffered_open(f, 0, 0);
+ * lfp_protocol* t = lfp_tapeimage_open(b);
+ * \endcode
+ *
+ * The window is refilled via a single large read whenever it is exhausted,
+ * and the reads are aligned so that they end on blocksize boundaries of the
+ * underlying protocol. Reads larger than the window bypass the buffer
+ * altogether. Seeks within the window only move the read position, and seeks
+ * outside it discard the window and are forwarded to the underlying protocol.
+ *
+ * Offsets are those of the underlying protocol. `lfp_ptell()` accounts for
+ * the unconsumed read-ahead, which is exact when the underlying protocol is a
+ * leaf. `lfp_peel()` will seek the underlying protocol back to the position
+ * of the buffered protocol, but `lfp_peek()` does not (and can not), so a
+ * peeked protocol may be positioned after the current position.
+ *
+ * \param blocksize alignment of reads, in bytes. If 0, a default of 4096 is
+ *                  used
+ * \param readahead size of the window, in bytes. It is rounded up to a
+ *                  multiple of blocksize. If 0, a default of 64K is used
+ *
+ * \retval NULL the protocol could not be opened, e.g. negative sizes.
+ */
+LFP_API
+lfp_protocol* lfp_buffered_open(lfp_protocol*,
+                                int64_t blocksize,
+                                int64_t readahead);
+
+#if (__cplusplus)
+} // extern "C"
+#endif
+
+#endif // LFP_BUFFERED_H
@@ -0,0 +1,65 @@
+#ifndef LFP_CACHE_H
+#define LFP_CACHE_H
+
+#include <lfp/lfp.h>
+
+/** \file cache.h */
+
+#if (__cplusplus)
+extern "C" {
+#endif
+
+/** Block cache protocol for random access
+ *
+ * The cache protocol wraps any other protocol, and keeps the most recently
+ * used blocks of it in memory. Blocks are blocksize bytes, at offsets that
+ * are multiples of blocksize in the underlying protocol, and the least
+ * recently used block is evicted when the cache grows past capacity bytes.
+ *
+ * Where the buffered protocol (see buffered.h) only keeps a window around the
+ * current position, the cache is for workloads that jump back and forth
+ * between a few parts of the file, like reading the tables at the start of a
+ * file between reads of curve data further out. Jumps back to a cached block
+ * are then served from memory, without seeking or reading the underlying
+ * protocol. Like buffered, it should be stacked right on top of the leaf
+ * protocol:
+ *
+ * \code{.cpp}
+ * lfp_protocol* f = lfp_cfile_open(fp);
+ * lfp_protocol* c = lfp_cache_open(f, 0, 0);
+ * lfp_protocol* t = lfp_tapeimage_open(c);
+ * \endcode
+ *
+ * Handles made with `lfp_dup()` share the cache, so blocks read through one
+ * handle are cached for all of them. The shared cache is thread safe, and so
+ * is `lfp_pread()`, provided the underlying protocol supports it.
+ *
+ * The underlying protocol must support `lfp_tell()` and `lfp_seek()`, and
+ * offsets are those of the underlying protocol. A seek to an offset that is
+ * not cached is forwarded to the underlying protocol, so that invalid offsets
+ * are reported right away. `lfp_ptell()` is exact when the underlying
+ * protocol is a leaf, and `lfp_peel()` moves the underlying protocol to the
+ * position of the cache. Like buffered, `lfp_peek()` does not, so a peeked
+ * protocol may be positioned anywhere.
+ *
+ * Views made by `lfp_readview()` that fit in one block point straight into
+ * the cache, and are valid until the next call on the handle.
+ *
+ * \param blocksize size and alignment of cached blocks, in bytes. If 0, a
+ *                  default of 64K is used
+ * \param capacity  memory budget for the cache, in bytes. At least one block
+ *                  is always cached. If 0, a default of 16M is used
+ *
+ * \retval NULL the protocol could not be opened, e.g. negative sizes, or the
+ *              underlying protocol does not support tell
+ */
+LFP_API
+lfp_protocol* lfp_cache_open(lfp_protocol*,
+                             int64_t blocksize,
+                             int64_t capacity);
+
+#if (__cplusplus)
+} // extern "C"
+#endif
+
+#endif // LFP_CACHE_H
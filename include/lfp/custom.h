@@ -0,0 +1,119 @@
+#ifndef LFP_CUSTOM_H
+#define LFP_CUSTOM_H
+
+#include <stddef.h>
+
+#include <lfp/lfp.h>
+
+/** \file custom.h */
+
+#if (__cplusplus)
+extern "C" {
+#endif
+
+/** Functions of a custom leaf protocol
+ *
+ * A custom leaf is a set of C functions over an opaque context, which makes
+ * it possible to plug any source of bytes under the other protocols, like
+ * shared memory, an application cache, or a file object from another
+ * language, without implementing the C++ interface in protocol.hpp, which
+ * is not stable between versions.
+ *
+ * Every function gets the ctx passed to `lfp_custom_open()`, and returns an
+ * `lfp_status`. Only read is required, and the other functions can be
+ * `NULL`, in which case the corresponding lfp function returns
+ * `LFP_NOTIMPLEMENTED`. Failures should be reported with a status like
+ * `LFP_IOERROR`, and described by errmsg.
+ *
+ * The struct will only ever grow at the end. Set size to `sizeof
+ * (lfp_custom_ops)`, and functions added in later versions of lfp are then
+ * treated as `NULL` for programs compiled against this one. Zero-initialise
+ * the struct before filling it in, to be safe.
+ */
+struct lfp_custom_ops {
+    /** Set to `sizeof (lfp_custom_ops)` */
+    size_t size;
+
+    /**
+     * Read up to len bytes into dst, and write the number of bytes read to
+     * nread, like `lfp_readinto()`. Must return LFP_OK when all len bytes
+     * were read, and LFP_EOF when end-of-file cut the read short. nread is
+     * never `NULL`. Required.
+     */
+    int (*read)(void* ctx, void* dst, int64_t len, int64_t* nread);
+
+    /**
+     * Read up to len bytes at offset, without moving the position, like
+     * `lfp_pread()`. It must be safe to call concurrently with itself.
+     */
+    int (*pread)(void* ctx,
+                 void* dst,
+                 int64_t len,
+                 int64_t offset,
+                 int64_t* nread);
+
+    /** Move the position to the (absolute) byte offset n */
+    int (*seek)(void* ctx, int64_t n);
+
+    /** Write the current position to n */
+    int (*tell)(void* ctx, int64_t* n);
+
+    /**
+     * Make view point to up to len bytes at the current position, and move
+     * past them, like `lfp_readview()`. This is what makes zero-copy reads
+     * possible - the tapeimage and rp66 protocols pass views of their
+     * underlying protocol on, when a read does not cross a record. The view
+     * must stay valid until the next call. Without readview, views are read
+     * into a buffer with read.
+     */
+    int (*readview)(void* ctx,
+                    const void** view,
+                    int64_t len,
+                    int64_t* nread);
+
+    /**
+     * Release ctx. Called exactly once, by `lfp_close()`, and its status is
+     * returned from `lfp_close()`.
+     */
+    int (*close)(void* ctx);
+
+    /**
+     * Describe the last failure, for `lfp_errormsg()`. The string is copied
+     * right away. If `NULL`, failures are described by their status only.
+     */
+    const char* (*errmsg)(void* ctx);
+};
+typedef struct lfp_custom_ops lfp_custom_ops;
+
+/** Open a custom leaf protocol
+ *
+ * Make a leaf protocol that calls the functions in ops. The functions are
+ * copied, and ops does not have to outlive the protocol, but ctx does, and is
+ * owned by the protocol until it is closed.
+ *
+ * The position is that of the functions, and `lfp_ptell()` is the same as
+ * `lfp_tell()`. `lfp_eof()` is true after a read that returned LFP_EOF,
+ * until the next seek.
+ *
+ * \code{.c}
+ * lfp_custom_ops ops = { 0 };
+ * ops.size = sizeof(ops);
+ * ops.read = shm_read;
+ * ops.seek = shm_seek;
+ * ops.tell = shm_tell;
+ * ops.readview = shm_readview;
+ * ops.close = shm_close;
+ * lfp_protocol* f = lfp_tapeimage_open(lfp_custom_open(&ops, shm));
+ * \endcode
+ *
+ * \retval NULL ops is `NULL`, its size is too small, or it has no read. ctx
+ *              is not closed.
+ */
+LFP_API
+lfp_protocol* lfp_custom_open(const lfp_custom_ops* ops, void* ctx);
+
+#if (__cplusplus)
+} // extern "C"
+#endif
+
+#endif // LFP_CUSTOM_H
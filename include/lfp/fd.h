@@ -0,0 +1,87 @@
+#ifndef LFP_FD_H
+#define LFP_FD_H
+
+#include <lfp/lfp.h>
+
+/** \file fd.h */
+
+#if (__cplusplus)
+extern "C" {
+#endif
+
+/** Flags for the fd protocol
+ *
+ * The access pattern hints are passed on to the operating system
+ * (`posix_fadvise()`, or re-opening the handle with the equivalent
+ * `CreateFile()` flags on Windows), and only affect performance, never
+ * correctness. Combine with `LFP_FD_DIRECT` with bitwise or.
+ */
+enum lfp_fd_flags {
+    /** No particular access pattern, let the operating system decide */
+    LFP_FD_NORMAL     = 0,
+    /** The file will be read front-to-back, read-ahead aggressively */
+    LFP_FD_SEQUENTIAL = 1,
+    /** The file will be read in random order, don't read ahead */
+    LFP_FD_RANDOM     = 2,
+    /**
+     * Bypass the page cache (`O_DIRECT`, `F_NOCACHE`, or
+     * `FILE_FLAG_NO_BUFFERING`). Reads are aligned internally, so any offset
+     * and length can still be read.
+     */
+    LFP_FD_DIRECT     = 4,
+};
+
+/** File descriptor protocol
+ *
+ * This protocol reads from an open file descriptor with `pread()`, and keeps
+ * the file position itself, so the file offset of the descriptor is not used
+ * after the protocol is opened. Unlike the cfile protocol, there is no stdio
+ * locking or buffering, and every `lfp_readinto()` is a single system call
+ * straight into the destination buffer. For buffering, stack the buffered
+ * protocol on top.
+ *
+ * Like the cfile protocol, the file is considered to start at the current
+ * offset of fd, seeking past end-of-file is allowed, and end-of-file is not
+ * reported until a read goes past the end. Descriptors that can't seek, like
+ * pipes, can be read from, but not seeked in.
+ *
+ * With `LFP_FD_DIRECT`, reads bypass the page cache. This is useful for
+ * streaming through very large files once, where caching them would only
+ * push out the pages of everything else on the machine, but is usually
+ * slower for anything else. It requires a seekable file on a file system
+ * that supports direct I/O. Reads go through an aligned buffer owned by the
+ * protocol, and `lfp_pread()` through one per thread, so that concurrent
+ * preads are still safe.
+ *
+ * The protocol takes ownership of fd, which is closed by `lfp_close()`. If
+ * the protocol can't be opened, the caller still owns fd.
+ *
+ * \param fd    a file descriptor, open for reading
+ * \param flags a combination of lfp_fd_flags
+ *
+ * \retval NULL the protocol could not be opened over fd
+ */
+LFP_API
+lfp_protocol* lfp_fd_open(int fd, int flags);
+
+#if defined(_WIN32)
+/** File handle protocol
+ *
+ * The Windows `HANDLE` equivalent of `lfp_fd_open()`, with the same
+ * semantics. The handle must be opened for synchronous (not overlapped)
+ * reads, and ownership of it is transferred to the protocol.
+ *
+ * \param handle a HANDLE, open for reading
+ * \param flags  a combination of lfp_fd_flags
+ *
+ * \retval NULL the protocol could not be opened over handle
+ */
+LFP_API
+lfp_protocol* lfp_handle_open(void* handle, int flags);
+#endif
+
+#if (__cplusplus)
+} // extern "C"
+#endif
+
+#endif // LFP_FD_H
@@ -0,0 +1,68 @@
+#ifndef LFP_GZIP_H
+#define LFP_GZIP_H
+
+#include <lfp/lfp.h>
+
+/** \file gzip.h */
+
+#if (__cplusplus)
+extern "C" {
+#endif
+
+/** Protocol for reading gzip-compressed files in place
+ *
+ * The gzip protocol wraps another protocol with gzip-compressed contents,
+ * and reads the decompressed bytes. This makes it possible to open
+ * compressed archives directly, without decompressing them to a temporary
+ * file first:
+ *
+ * \code{.cpp}
+ * lfp_protocol* f = lfp_cfile_open(std::fopen("archive.tif.gz", "rb"));
+ * lfp_protocol* g = lfp_gzip_open(f, 0);
+ * lfp_protocol* t = lfp_tapeimage_open(g);
+ * \endcode
+ *
+ * Files with multiple gzip members, like the output of pigz or bgzip, or
+ * files concatenated with cat, are read as one.
+ *
+ * Random access in a compressed stream is not possible in general, so the
+ * protocol records seek points as the file is read, at deflate block
+ * boundaries about spacing decompressed bytes apart, and at the start of
+ * every gzip member. Every point keeps the 32K of decompressed history it
+ * needs, so the points take up about 32K / spacing of the decompressed size.
+ *
+ * Seeking forward decompresses up to the target, from the closest seek point
+ * before it, if that is further ahead than the current position. Seeking
+ * backward restarts the decompressor at the closest seek point before the
+ * target. So the first pass over a file costs a full decompression, but
+ * afterwards, going back costs at most spacing bytes of decompression. The
+ * underlying protocol should be buffered, as is cfile, and must support
+ * `lfp_seek()` for seeking backward. Forward reads and seeks only need it to
+ * be readable, so streams like pipes can be decompressed too.
+ *
+ * The decompressed bytes are the file, as far as the protocols above are
+ * concerned, so `lfp_ptell()` is the same as `lfp_tell()`, and offsets in
+ * e.g. tape image headers are offsets into the decompressed file. The size of
+ * the decompressed file is not known until it has been read, and seeks past
+ * the end fail with `LFP_INVALID_ARGS`, after moving to the end.
+ *
+ * Corrupt data is reported as `LFP_PROTOCOL_FATAL_ERROR`, and a truncated
+ * file as `LFP_UNEXPECTED_EOF`.
+ *
+ * This protocol is only available when lfp is built with zlib, see the
+ * LFP_GZIP CMake option, otherwise `lfp_gzip_open()` always returns `NULL`.
+ *
+ * \param spacing minimum distance between seek points, in decompressed bytes.
+ *                If 0, a default of 1M is used
+ *
+ * \retval NULL the protocol could not be opened, e.g. a negative spacing, or
+ *              lfp is built without zlib.
+ */
+LFP_API
+lfp_protocol* lfp_gzip_open(lfp_protocol*, int64_t spacing);
+
+#if (__cplusplus)
+} // extern "C"
+#endif
+
+#endif // LFP_GZIP_H
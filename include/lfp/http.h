@@ -0,0 +1,75 @@
+#ifndef LFP_HTTP_H
+#define LFP_HTTP_H
+
+#include <lfp/lfp.h>
+
+/** \file http.h */
+
+#if (__cplusplus)
+extern "C" {
+#endif
+
+/** Open a remote file over HTTP range requests
+ *
+ * The http protocol is a leaf protocol for files behind a URL, like objects
+ * in S3, Azure Blob Storage or Google Cloud Storage. The file is read in
+ * blocks of blocksize bytes, each fetched with a range request (`GET` with a
+ * `Range` header), so the server must support range requests.
+ *
+ * Round-trips, not bandwidth, are usually what makes remote files slow, so
+ * the protocol works hard to make as few of them as possible:
+ *
+ * - The blocks a read needs are fetched with a single request, so large or
+ *   adjacent reads are coalesced.
+ * - Up to parallel requests are kept in flight, for the blocks after the one
+ *   being read, so that reading one block overlaps with fetching the next.
+ * - The read-ahead follows seeks. When the tapeimage or rp66 protocols chase
+ *   record headers to build their index, any header within parallel blocks
+ *   of the last one is already fetched, or on its way.
+ *
+ * Blocks far behind the read position are dropped, and requests for blocks
+ * that are no longer ahead of it are cancelled. Stack the cache protocol
+ * (see cache.h) on top to keep blocks around for random access.
+ *
+ * Requests are made with libcurl, and the url can be anything libcurl
+ * supports range requests for. Authentication is up to the caller, and is
+ * passed in the url (pre-signed S3 and GCS urls, Azure SAS tokens), or as
+ * extra request headers, e.g. `"Authorization: Bearer <token>"`. Requests
+ * are not signed by lfp.
+ *
+ * The size of the file is looked up when it is opened, and the file must not
+ * change while it is read. Seeking past the end is allowed, like for cfile,
+ * and reads past the end report `LFP_EOF`. Requests that fail, or that the
+ * server answers with anything but the range asked for, report
+ * `LFP_IOERROR`.
+ *
+ * Reads are driven by the calling thread - blocks are only received while in
+ * `lfp_readinto()`. Stack the prefetch protocol (see prefetch.h) on top to
+ * receive on a background thread instead. `lfp_pread()` makes its own
+ * request, on its own connection, and is thread safe. A duplicate made with
+ * `lfp_dup()` opens its own connections.
+ *
+ * This protocol is only available when lfp is built with the LFP_HTTP CMake
+ * option, otherwise `lfp_http_open()` always returns `NULL`.
+ *
+ * \param url       the file to open
+ * \param headers   extra request headers as "Name: value", terminated by
+ *                  `NULL`, or `NULL` for no extra headers. They are copied.
+ * \param blocksize size of a block, in bytes. If 0, a default of 1M is used
+ * \param parallel  the number of requests in flight. If 0, a default of 4 is
+ *                  used
+ *
+ * \retval NULL the file could not be opened, e.g. it does not exist, its size
+ *              is unknown, negative sizes, or lfp is built without LFP_HTTP.
+ */
+LFP_API
+lfp_protocol* lfp_http_open(const char* url,
+                            const char* const* headers,
+                            int64_t blocksize,
+                            int parallel);
+
+#if (__cplusplus)
+} // extern "C"
+#endif
+
+#endif // LFP_HTTP_H
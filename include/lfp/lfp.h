@@ -66,6 +66,74 @@ extern "C" {
 struct lfp_protocol;
 typedef struct lfp_protocol lfp_protocol;
 
+/** Buffer descriptor for vectored reads
+ *
+ * Similar to the POSIX `struct iovec`, it describes a buffer of len bytes
+ * starting at base. See `lfp_readv()`.
+ */
+struct lfp_iovec {
+    void* base;
+    int64_t len;
+};
+typedef struct lfp_iovec lfp_iovec;
+
+/** I/O statistics for a single protocol
+ *
+ * The counters describe the calls made *to* a protocol, and are kept by every
+ * protocol in a stack. Counters that don't apply to a protocol, like the
+ * index counters for the leaf protocols, are always zero. See
+ * `lfp_stats_get()`.
+ */
+struct lfp_stats {
+    /** Calls to readinto, readview, readv and pread */
+    int64_t reads;
+    /** Bytes returned by reads */
+    int64_t bytes_read;
+    /** Calls to seek */
+    int64_t seeks;
+    /** Seeks to the record the protocol was already in */
+    int64_t seeks_in_record;
+    /** Seeks to another record that was already indexed */
+    int64_t seeks_indexed;
+    /** Seeks past the index, which had to read headers to find the record */
+    int64_t seeks_chased;
+    /** Record headers read from the underlying protocol */
+    int64_t headers_read;
+    /** Records in the index */
+    int64_t index_records;
+    /** Memory allocated for the index, in bytes */
+    int64_t index_bytes;
+    /** Time spent in reads and seeks, in nanoseconds */
+    int64_t time_ns;
+    /**
+     * Time spent in the underlying protocol, in nanoseconds. This is usually
+     * a part of time_ns, but protocols that read on a background thread,
+     * like prefetch, can spend more time in it than they are called for.
+     */
+    int64_t inner_time_ns;
+};
+typedef struct lfp_stats lfp_stats;
+
+/** Description of a single record
+ *
+ * Filled in by `lfp_record_next()`, straight from the record index of
+ * protocols like tapeimage and rp66.
+ */
+struct lfp_record {
+    /** Logical offset of the first byte of the record, as reported by
+     *  `lfp_tell()` */
+    int64_t offset;
+    /** Length of the record, not including its header */
+    int64_t length;
+    /** Offset of the record header in the underlying protocol, as reported by
+     *  `lfp_tell()` on it */
+    int64_t header_offset;
+    /** Type of the record. For tapeimage, 0 for a record and 1 for a file
+     *  mark. Always 0 for rp66 */
+    int type;
+};
+typedef struct lfp_record lfp_record;
+
 /** Status codes for return values
  *
  * Unless very explicitly documented otherwise, public functions in lfp return
@@ -201,6 +269,87 @@ int lfp_close(lfp_protocol*);
 LFP_API
 int lfp_readinto(lfp_protocol*, void* dst, int64_t len, int64_t* nread);
 
+/** Read len bytes, and get a pointer to them
+ *
+ * Read up to len bytes, like `lfp_readinto()`, but instead of copying them
+ * into a caller-provided buffer, view is set to point to the bytes. The
+ * number of bytes read is written to nread, and the status codes are the same
+ * as for `lfp_readinto()`.
+ *
+ * This is useful for parsing small pieces of a file in place. When the bytes
+ * are already in memory, e.g. with the memfile or mmap protocols, no copy is
+ * made at all, and layered protocols such as tapeimage and rp66 pass the view
+ * from the underlying protocol through when the read does not cross a record
+ * boundary. All other reads are buffered in the handle, so this function
+ * works with all protocols.
+ *
+ * The bytes are owned by the handle and must not be modified. The view is
+ * only valid until the next call to any lfp function on this handle, or when
+ * it is closed.
+ *
+ * \retval LFP_OK Success
+ * \retval LFP_OKINCOMPLETE Successful, but incomplete read
+ * \retval LFP_EOF Successful, but end of file was reach during the read
+ */
+LFP_API
+int lfp_readview(lfp_protocol*, const void** view, int64_t len, int64_t* nread);
+
+/** Read into multiple buffers
+ *
+ * Scatter read, like POSIX `readv()` - read bytes into the count buffers in
+ * iov, in order, filling each buffer completely before moving on to the next
+ * one. The total number of bytes read is written to nread. The status codes
+ * are the same as for `lfp_readinto()`, and the read stops early under the
+ * same conditions.
+ *
+ * A single `lfp_readv()` is equivalent to a sequence of `lfp_readinto()`
+ * calls, one per buffer, but protocols can pass the buffers through to the
+ * underlying protocol in fewer calls.
+ *
+ * nread can be `NULL`.
+ *
+ * \retval LFP_OK Success
+ * \retval LFP_OKINCOMPLETE Successful, but incomplete read
+ * \retval LFP_EOF Successful, but end of file was reach during the read
+ * \retval LFP_INVALID_ARGS count, or the length of a buffer, is negative
+ */
+LFP_API
+int lfp_readv(lfp_protocol*, const lfp_iovec* iov, int count, int64_t* nread);
+
+/** Read len bytes at offset, without using or moving the file position
+ *
+ * Read up to len bytes starting at the (absolute) byte offset, like
+ * `lfp_seek()` followed by `lfp_readinto()`, except that the position of the
+ * handle is neither used nor changed. The status codes are the same as for
+ * `lfp_readinto()`.
+ *
+ * Unlike the other functions, `lfp_pread()` can be called from multiple
+ * threads on the same handle at the same time. It is not safe to call it
+ * concurrently with any other function on the handle, and when concurrent
+ * calls fail, `lfp_errormsg()` is not reliable - the status codes are.
+ *
+ * The leaf protocols implement this with positional reads. The tapeimage and
+ * rp66 protocols translate offset through the record index, but never add to
+ * the index, as that would not be thread safe. Reads that start past the end
+ * of the indexed part of the file fail with `LFP_INVALID_ARGS`, and reads that
+ * cross it are incomplete, unless the whole file is indexed, in which case
+ * they return `LFP_EOF` like `lfp_readinto()`. Build the index before
+ * reading, e.g. with `lfp_tapeimage_build_index()`.
+ *
+ * \retval LFP_OK Success
+ * \retval LFP_OKINCOMPLETE Successful, but incomplete read
+ * \retval LFP_EOF Successful, but end of file was reach during the read
+ * \retval LFP_INVALID_ARGS len or offset is negative, or the offset is not
+ *                          indexed
+ * \retval LFP_NOTIMPLEMENTED The protocol does not support positional reads
+ */
+LFP_API
+int lfp_pread(lfp_protocol*,
+              void* dst,
+              int64_t len,
+              int64_t offset,
+              int64_t* nread);
+
 /** Set the file position to (absolute) byte offset n
  *
  * Protocols are not required to implement seek, e.g. file streams (pipes) are
@@ -274,6 +423,35 @@ int lfp_peel(lfp_protocol* outer, lfp_protocol** inner);
 LFP_API
 int lfp_peek(lfp_protocol* outer, lfp_protocol** inner);
 
+/** Duplicate a protocol stack into an independent handle
+ *
+ * Make a new handle for the same file, with every protocol in the stack
+ * duplicated. The duplicate starts at the same position as the original, but
+ * the handles are otherwise independent. They each have their own position,
+ * and leaf protocols their own file handle, so that they can be read and
+ * seeked concurrently from different threads. Both handles must be closed
+ * with `lfp_close()`.
+ *
+ * Protocols that build a record index, like tapeimage and rp66, share the
+ * index discovered so far with the duplicate, instead of making every handle
+ * find the same headers again. The index is shared copy-on-write, so when a
+ * handle discovers new records, it gets its own copy, and never disturbs the
+ * others. To share as much as possible, build the index before duplicating,
+ * e.g. with `lfp_tapeimage_build_index()`.
+ *
+ * The cfile protocol duplicates by opening the file again, which is only
+ * possible for seekable files, and on some platforms.
+ *
+ * \param f   Protocol to duplicate
+ * \param dup Reference to the duplicate
+ *
+ * \retval LFP_OK Success
+ * \retval LFP_NOTIMPLEMENTED Some protocol in the stack can not be duplicated
+ * \retval LFP_NOTSUPPORTED The file can not be opened again, e.g. a pipe
+ */
+LFP_API
+int lfp_dup(lfp_protocol* f, lfp_protocol** dup);
+
 /** Checks if the end of file is reached
  *
  * This does not return a `lfp_status` code.
@@ -284,6 +462,108 @@ int lfp_peek(lfp_protocol* outer, lfp_protocol** inner);
 LFP_API
 int lfp_eof(lfp_protocol*);
 
+/** Export the record index
+ *
+ * Protocols like tapeimage and rp66 build an index of the record headers as
+ * they are read, which makes seeks into already-visited parts of the file
+ * cheap. Building the index for far offsets means reading every header
+ * before it, which for large files means thousands of small reads.
+ *
+ * This function serializes the index built so far into a compact binary blob,
+ * which can be stored with the file and imported with `lfp_index_import()`
+ * the next time the file is opened. Only the outer-most protocol's index is
+ * exported.
+ *
+ * If dst is `NULL`, the size of the blob is written to size, and nothing
+ * else happens. This can be used to allocate a large enough buffer.
+ *
+ * \param dst buffer of len bytes, or `NULL`
+ * \param len size of dst
+ * \param size the size of the blob
+ *
+ * \retval LFP_OK Success
+ * \retval LFP_INVALID_ARGS dst is too small to hold the blob
+ * \retval LFP_NOTIMPLEMENTED The protocol has no index
+ */
+LFP_API
+int lfp_index_export(lfp_protocol*, void* dst, int64_t len, int64_t* size);
+
+/** Import a record index
+ *
+ * Import a record index exported by `lfp_index_export()`, so that it does not
+ * have to be rebuilt. The index must be imported before anything is read
+ * from the protocol, and it must be opened the same way (i.e. over the same
+ * stack of protocols and at the same offset) as when it was exported.
+ *
+ * The index is validated against the file - its size, and a checksum of a
+ * sample of the headers - so that stale indices are rejected, in which case
+ * the protocol is left unchanged.
+ *
+ * \retval LFP_OK Success
+ * \retval LFP_INVALID_ARGS The blob is malformed or does not match the file
+ * \retval LFP_NOTIMPLEMENTED The protocol has no index
+ */
+LFP_API
+int lfp_index_import(lfp_protocol*, const void* src, int64_t len);
+
+/** Get the I/O statistics of a protocol
+ *
+ * Every protocol counts the reads and seeks made to it, and the time spent
+ * in them. The counters are always on, and cheap enough to stay that way.
+ * They only describe this protocol - to see how the time is spread over a
+ * stack, walk it with `lfp_peek()`:
+ *
+ *     lfp_stats stats;
+ *     lfp_protocol* f = outer;
+ *     while (f) {
+ *         lfp_stats_get(f, &stats);
+ *         ...
+ *         if (lfp_peek(f, &f) != LFP_OK) break;
+ *     }
+ *
+ * The counters are updated without locking, so concurrent calls to
+ * `lfp_pread()` are counted correctly, but the stats are not a consistent
+ * snapshot while calls are in flight.
+ *
+ * \retval LFP_OK Success
+ */
+LFP_API
+int lfp_stats_get(lfp_protocol*, lfp_stats* stats);
+
+/** Reset the I/O statistics of a protocol
+ *
+ * Reset the counters of this protocol, but not the protocol it wraps. The
+ * index size is not a counter, and is not reset.
+ *
+ * \retval LFP_OK Success
+ */
+LFP_API
+int lfp_stats_reset(lfp_protocol*);
+
+/** Move to the next record
+ *
+ * Move to the start of the record after the one the protocol is currently
+ * in, and describe it. For a newly opened protocol, this is the first record.
+ * The rest of the current record is skipped, and its bytes are not read, so
+ * records can be scanned by their headers alone:
+ *
+ *     lfp_record rec;
+ *     while (lfp_record_next(f, &rec) == LFP_OK) {
+ *         if (interesting(&rec))
+ *             lfp_readinto(f, buffer, rec.length, NULL);
+ *     }
+ *
+ * Headers are read, and added to the index, as needed. After a successful
+ * call, `lfp_tell()` reports rec.offset. A tapeimage file mark is reported as
+ * a record of its own, and ends the iteration.
+ *
+ * \retval LFP_OK Success
+ * \retval LFP_EOF There are no more records. rec is not changed
+ * \retval LFP_NOTIMPLEMENTED The protocol has no records
+ */
+LFP_API
+int lfp_record_next(lfp_protocol*, lfp_record* rec);
+
 /** Get last set error message
  *
  * Obtain a human-readable error message, or `NULL` if no error is set. This
@@ -22,9 +22,43 @@ extern "C" {
  *
  * [1] https://docs.python.org/3/library/io.html#io.StringIO
  */
+LFP_API
 lfp_protocol* lfp_memfile_open();
+LFP_API
 lfp_protocol* lfp_memfile_openwith(const unsigned char*, size_t);
 
+/*
+ * Open a memfile as a view of the len bytes at p, without copying them.
+ *
+ * The memory is *borrowed*, not owned - it must stay valid and unchanged until
+ * lfp_close() is called on the memfile, or on any protocol stacked on top of
+ * it. lfp will never write to, or free, the memory.
+ *
+ * This is useful when the file is already in memory, e.g. downloaded from
+ * object storage or mapped by the caller, as opening it does no allocation
+ * and no copy.
+ */
+LFP_API
+lfp_protocol* lfp_memfile_openview(const unsigned char* p, size_t len);
+
+/*
+ * Open a memfile as a view of the len bytes at p, and take ownership of them.
+ *
+ * Like lfp_memfile_openview(), the bytes are not copied, but when the memfile
+ * is closed, release(ctx) is called exactly once to release the memory. For
+ * malloc'd buffers, this is simply:
+ *
+ *     lfp_memfile_adopt(p, len, free, p);
+ *
+ * If release is NULL, this is equivalent to lfp_memfile_openview(). If NULL is
+ * returned, ownership is not transferred, and release is never called.
+ */
+LFP_API
+lfp_protocol* lfp_memfile_adopt(const unsigned char* p,
+                                size_t len,
+                                void (*release)(void* ctx),
+                                void* ctx);
+
 #if (__cplusplus)
 } // extern "C"
 #endif
@@ -0,0 +1,55 @@
+#ifndef LFP_MMAP_H
+#define LFP_MMAP_H
+
+#include <lfp/lfp.h>
+
+/** \file mmap.h */
+
+#if (__cplusplus)
+extern "C" {
+#endif
+
+/** Access pattern hints for the mmap protocol
+ *
+ * The hints are passed on to the operating system (`posix_madvise()` or the
+ * equivalent `CreateFile()` flags on Windows), and only affect performance,
+ * never correctness.
+ */
+enum lfp_mmap_advice {
+    /** No particular access pattern, let the operating system decide */
+    LFP_MMAP_NORMAL = 0,
+    /** The file will be read front-to-back, read-ahead aggressively */
+    LFP_MMAP_SEQUENTIAL,
+    /** The file will be read in random order, don't read ahead */
+    LFP_MMAP_RANDOM,
+};
+
+/** Memory-mapped file protocol
+ *
+ * This protocol maps the file at path into (read-only) memory, and serves
+ * `lfp_readinto()`, `lfp_seek()`, and `lfp_tell()` from the mapping. Unlike
+ * the cfile protocol, reads are a single memcpy with no stdio locking,
+ * buffering or system calls, which makes it a good leaf for large on-disk
+ * files.
+ *
+ * The mmap protocol is a drop-in replacement for the cfile protocol, and
+ * behaves like it - seeking past end-of-file is allowed, and end-of-file is
+ * not reported until a read goes past the end. The file is considered to
+ * start at byte 0, and the file size is fixed when the protocol is opened.
+ *
+ * Changing or truncating the file while it is mapped is undefined behaviour,
+ * and may crash the program.
+ *
+ * \param path path to the file
+ * \param advice access pattern hint, one of lfp_mmap_advice
+ *
+ * \retval NULL the file could not be opened or mapped
+ */
+LFP_API
+lfp_protocol* lfp_mmap_open(const char* path, int advice);
+
+#if (__cplusplus)
+} // extern "C"
+#endif
+
+#endif // LFP_MMAP_H
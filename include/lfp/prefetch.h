@@ -0,0 +1,52 @@
+#ifndef LFP_PREFETCH_H
+#define LFP_PREFETCH_H
+
+#include <lfp/lfp.h>
+
+/** \file prefetch.h */
+
+#if (__cplusplus)
+extern "C" {
+#endif
+
+/** Background prefetching protocol
+ *
+ * The prefetch protocol wraps any other protocol, and reads from it on a
+ * background thread, so that I/O overlaps with whatever the caller does
+ * between reads. The thread keeps up to blocks blocks of blocksize bytes read
+ * ahead of the caller, which drains them with `lfp_readinto()`. This is
+ * useful for sequential streaming, when the consumer of the data is CPU bound
+ * and would otherwise sit idle waiting for the next read.
+ *
+ * Errors from the underlying protocol are held back until the caller has
+ * consumed all the data that was read before the error. Then they are
+ * reported by `lfp_readinto()` with the original status code, and the error
+ * message is available from `lfp_errormsg()`.
+ *
+ * Seeking forward into data that has already been prefetched is cheap, but
+ * any other seek stops the background thread, seeks the underlying protocol,
+ * and starts prefetching again from the new position. Stopping (on seek,
+ * peel, and close) waits for a read that is already in progress to complete,
+ * but no new reads are started.
+ *
+ * Offsets are those of the underlying protocol. `lfp_ptell()` is exact when
+ * the underlying protocol is a leaf. `lfp_peel()` stops prefetching and seeks
+ * the underlying protocol back to the position of the prefetch protocol. The
+ * protocol returned by `lfp_peek()` is used by the background thread, and
+ * must not be read from or seeked.
+ *
+ * \param blocksize size of each read, in bytes. If 0, a default of 1M is used
+ * \param blocks    number of blocks to read ahead. If 0, a default of 4 is
+ *                  used
+ *
+ * \retval NULL the protocol could not be opened, e.g. negative sizes, or the
+ *              thread could not be started.
+ */
+LFP_API
+lfp_protocol* lfp_prefetch_open(lfp_protocol*, int64_t blocksize, int blocks);
+
+#if (__cplusplus)
+} // extern "C"
+#endif
+
+#endif // LFP_PREFETCH_H
@@ -1,18 +1,108 @@
 #ifndef LFP_INTERNAL_HPP
 #define LFP_INTERNAL_HPP
 
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <exception>
 #include <stdexcept>
 #include <memory>
+#include <new>
 #include <string>
+#include <type_traits>
+#include <vector>
 
 #include <lfp/lfp.h>
 
 /** \file protocol.hpp */
 
+namespace lfp {
+
+/**
+ * The I/O counters kept by every protocol, as reported in lfp_stats.
+ *
+ * They are atomics so that concurrent pread() calls can update them, but
+ * only ever with relaxed ordering, which costs about as much as updating
+ * plain counters.
+ */
+struct counters {
+    std::atomic< std::int64_t > reads           { 0 };
+    std::atomic< std::int64_t > bytes_read      { 0 };
+    std::atomic< std::int64_t > seeks           { 0 };
+    std::atomic< std::int64_t > seeks_in_record { 0 };
+    std::atomic< std::int64_t > seeks_indexed   { 0 };
+    std::atomic< std::int64_t > seeks_chased    { 0 };
+    std::atomic< std::int64_t > headers_read    { 0 };
+    std::atomic< std::int64_t > time_ns         { 0 };
+
+    static void add(std::atomic< std::int64_t >& c, std::int64_t n = 1)
+    noexcept (true) {
+        c.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    static std::int64_t get(const std::atomic< std::int64_t >& c)
+    noexcept (true) {
+        return c.load(std::memory_order_relaxed);
+    }
+
+    void reset() noexcept (true);
+};
+
+/**
+ * Allocate n bytes from the arena that is current on this thread (see
+ * lfp_arena_use), or from the heap if there is none. The memory must be
+ * released with arena_deallocate(), which can be called from any thread,
+ * and returns it to where it came from.
+ */
+void* arena_allocate(std::size_t n) noexcept (false);
+void arena_deallocate(void* p) noexcept (true);
+
+/**
+ * An allocator for containers whose elements should come from the current
+ * arena, like record indices and read buffers. It is stateless, as every
+ * allocation remembers its arena, so containers can be copied, moved and
+ * swapped freely, also between threads with different arenas.
+ */
+template< typename T >
+class arena_allocator {
+public:
+    static_assert(alignof(T) <= alignof(std::max_align_t),
+                  "arena memory is only aligned for std::max_align_t");
+
+    using value_type = T;
+    using is_always_equal = std::true_type;
+
+    arena_allocator() = default;
+    template< typename U >
+    arena_allocator(const arena_allocator< U >&) noexcept (true) {}
+
+    T* allocate(std::size_t n) noexcept (false) {
+        if (n > std::size_t(-1) / sizeof(T))
+            throw std::bad_alloc();
+        return static_cast< T* >(arena_allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t) noexcept (true) {
+        arena_deallocate(p);
+    }
+};
+
+template< typename T, typename U >
+bool operator == (const arena_allocator< T >&, const arena_allocator< U >&)
+noexcept (true) {
+    return true;
+}
+
+template< typename T, typename U >
+bool operator != (const arena_allocator< T >&, const arena_allocator< U >&)
+noexcept (true) {
+    return false;
+}
+
+}
+
 /**
  * The functions of this class roughly correspond to the public interface in
  * lfp.h, but with C++-isms. Since it is not exposed in the ABI except through
@@ -45,6 +135,61 @@ public:
             std::int64_t* bytes_read)
         noexcept (false) = 0;
 
+    /** \copybrief lfp_readview
+     *
+     * The default implementation reads into a buffer owned by the protocol,
+     * and sets view to point to it, which works for all protocols.
+     *
+     * Protocols that already have the bytes in memory, or can get a view
+     * from the underlying protocol, should override this to avoid the copy.
+     * The view must remain valid until the next operation on the protocol.
+     *
+     * \param view set to point to the bytes read
+     * \param len maximum length of data to be read
+     * \param bytes_read number of bytes actually read
+     */
+    virtual lfp_status readview(
+            const void** view,
+            std::int64_t len,
+            std::int64_t* bytes_read)
+        noexcept (false);
+
+    /** \copybrief lfp_readv
+     *
+     * The default implementation calls readinto() once per buffer, so it
+     * works for all protocols. Protocols should override it when they can
+     * pass several buffers to the underlying protocol or device at once.
+     *
+     * \param iov buffers to read into, in order
+     * \param count number of buffers
+     * \param bytes_read total number of bytes read into the buffers
+     */
+    virtual lfp_status readv(
+            const lfp_iovec* iov,
+            int count,
+            std::int64_t* bytes_read)
+        noexcept (false);
+
+    /** \copybrief lfp_pread
+     *
+     * Implementations must not use or change the position of the protocol,
+     * and must be safe to call concurrently with other calls to pread().
+     *
+     * If this is not implemented, `lfp_pread()` will return
+     * `LFP_NOTIMPLEMENTED`.
+     *
+     * \param dst output buffer
+     * \param len maximum length of data to be read
+     * \param offset the offset of the first byte to read
+     * \param bytes_read number of bytes actually read
+     */
+    virtual lfp_status pread(
+            void* dst,
+            std::int64_t len,
+            std::int64_t offset,
+            std::int64_t* bytes_read)
+        noexcept (false);
+
     /*
      * Whenever read operations return OKINCOMPLETE, it could be because the
      * read succeeded, but the file is at EOF (probably the most common cause).
@@ -90,16 +235,95 @@ public:
      */
     virtual lfp_protocol* peek() const noexcept (false) = 0;
 
+    /** \copybrief lfp_dup
+     *
+     * Return a new, independent protocol for the same file, at the same
+     * position. Layered protocols should duplicate the protocol they wrap.
+     *
+     * If this is not implemented, `lfp_dup()` will return
+     * `LFP_NOTIMPLEMENTED`.
+     */
+    virtual lfp_protocol* dup() noexcept (false);
+
+    /** \copybrief lfp_index_export
+     *
+     * Serialize the record index, so that it can be imported with
+     * index_import() when the file is opened again. The format is specific
+     * to the protocol, and the blob should be treated as opaque.
+     *
+     * If this is not implemented, `lfp_index_export()` will return
+     * `LFP_NOTIMPLEMENTED`.
+     */
+    virtual std::vector< unsigned char > index_export() noexcept (false);
+
+    /** \copybrief lfp_index_import
+     *
+     * Restore a record index serialized by index_export(). Implementations
+     * must validate the blob, and that it matches the underlying file, and
+     * leave the protocol unchanged if it does not.
+     *
+     * If this is not implemented, `lfp_index_import()` will return
+     * `LFP_NOTIMPLEMENTED`.
+     */
+    virtual void index_import(const void* src, std::int64_t len)
+        noexcept (false);
+
+    /** \copybrief lfp_record_next
+     *
+     * Move to the start of the next record, and describe it. Returns LFP_EOF
+     * if there are no more records, and leaves rec unchanged.
+     *
+     * If this is not implemented, `lfp_record_next()` will return
+     * `LFP_NOTIMPLEMENTED`.
+     */
+    virtual lfp_status record_next(lfp_record* rec) noexcept (false);
+
+    /** \copybrief lfp_stats_get
+     *
+     * The default implementation reports the counters in iostats, and takes
+     * the time spent in the underlying protocol from the one returned by
+     * peek(). Protocols with a record index should override this, and add
+     * the size of the index.
+     */
+    virtual lfp_stats stats() const noexcept (false);
+
+    /** \copybrief lfp_stats_reset */
+    void reset_stats() noexcept (true);
+
     /** \copybrief lfp_errormsg */
     const char* errmsg() noexcept (true);
 
-    /** Set the error message */
-    void errmsg(std::string) noexcept (false);
+    /** Set the error message
+     *
+     * The message is copied into a buffer in the protocol, and cut short if
+     * it does not fit, so that setting it never allocates.
+     */
+    void errmsg(const char*) noexcept (true);
+    void errmsg(const std::string&) noexcept (true);
+
+    /**
+     * Protocols are allocated from the current arena, see lfp_arena_use(), so
+     * that opening and closing them does no heap allocation once the arena
+     * is warm.
+     */
+    static void* operator new (std::size_t n) noexcept (false);
+    static void operator delete (void* p) noexcept (true);
 
     virtual ~lfp_protocol() = default;
 
+protected:
+    /**
+     * The counters reported by stats(). Reads and seeks are counted by
+     * putting an lfp::read_probe or lfp::seek_probe at the top of them,
+     * the rest are up to the protocol.
+     */
+    lfp::counters iostats;
+
 private:
-    std::string error_message;
+    static constexpr const std::size_t errmsg_size = 512;
+    char error_message[errmsg_size] = {};
+    std::vector< unsigned char, lfp::arena_allocator< unsigned char > >
+        view_buffer;
 };
 
 namespace lfp {
@@ -266,6 +490,74 @@ inline const void* advance(const void* p, std::ptrdiff_t n) noexcept (true) {
 
 /** @} */
 
+/** Count a read
+ *
+ * Count a call to one of the read functions, the bytes it read, and the time
+ * spent in it, when the probe goes out of scope. If bytes_read is `nullptr`,
+ * it is redirected to the probe, so that the bytes can still be counted. It
+ * is set to zero up front, so that reads that throw are counted correctly.
+ *
+ *     lfp_status readinto(void* dst, std::int64_t len, std::int64_t* nread) {
+ *         read_probe probe(this->iostats, nread);
+ *         ...
+ *     }
+ */
+class read_probe {
+public:
+    read_probe(counters& c, std::int64_t*& bytes_read) noexcept (true) :
+        stats(c),
+        start(std::chrono::steady_clock::now())
+    {
+        if (!bytes_read)
+            bytes_read = &this->fallback;
+        *bytes_read = 0;
+        this->nread = bytes_read;
+    }
+
+    ~read_probe() {
+        const auto elapsed = std::chrono::steady_clock::now() - this->start;
+        const auto ns = std::chrono::duration_cast< std::chrono::nanoseconds >(
+            elapsed
+        );
+        counters::add(this->stats.reads);
+        counters::add(this->stats.bytes_read, *this->nread);
+        counters::add(this->stats.time_ns, ns.count());
+    }
+
+private:
+    counters& stats;
+    std::int64_t* nread;
+    std::int64_t fallback = 0;
+    std::chrono::steady_clock::time_point start;
+};
+
+/** Count a seek
+ *
+ * Count a call to seek, and the time spent in it, when the probe goes out of
+ * scope. How the seek was resolved (seeks_in_record and so on) is up to the
+ * protocol to count.
+ */
+class seek_probe {
+public:
+    explicit seek_probe(counters& c) noexcept (true) :
+        stats(c),
+        start(std::chrono::steady_clock::now())
+    {}
+
+    ~seek_probe() {
+        const auto elapsed = std::chrono::steady_clock::now() - this->start;
+        const auto ns = std::chrono::duration_cast< std::chrono::nanoseconds >(
+            elapsed
+        );
+        counters::add(this->stats.seeks);
+        counters::add(this->stats.time_ns, ns.count());
+    }
+
+private:
+    counters& stats;
+    std::chrono::steady_clock::time_point start;
+};
+
 /** Base class for lfp exceptions */
 class error : public std::runtime_error {
 public:
@@ -42,8 +42,44 @@ extern "C" {
  *
  * [1] http://w3.energistics.org/RP66/V1/Toc/main.html
  */
+LFP_API
 lfp_protocol* lfp_rp66_open(lfp_protocol*);
 
+/** Open a Visible Envelope that is read forwards only, like a pipe
+ *
+ * Like `lfp_rp66_open()`, but the underlying protocol is never seeked, and
+ * only the last few thousand Visible Record headers are kept, so that memory
+ * stays constant no matter how much is read. `lfp_seek()` forwards reads up
+ * to the target, and `lfp_seek()` backwards, `lfp_pread()`, `lfp_dup()`, and
+ * the index functions return `LFP_NOTSUPPORTED`.
+ *
+ * Use over `lfp_tapeimage_open_stream()`, or directly over a leaf that can
+ * only be read.
+ */
+LFP_API
+lfp_protocol* lfp_rp66_open_stream(lfp_protocol*);
+
+/** Index the whole Visible Envelope
+ *
+ * The rp66 protocol normally builds its index of Visible Record headers
+ * lazily, as the file is read and seeked. This function instead walks all the
+ * headers up front, in a single pass, from the last indexed Visible Record
+ * and up to end-of-file. Headers are read in large batches, so files with
+ * many small Visible Records are indexed at close to sequential read speed.
+ * Afterwards, `lfp_seek()` to any offset in the file is cheap.
+ *
+ * The position of the protocol is not changed.
+ *
+ * \param records if not `NULL`, the number of Visible Records
+ * \param size    if not `NULL`, the logical size of the file, i.e. the offset
+ *                of the end of the last Visible Record
+ *
+ * \retval LFP_OK Success
+ * \retval LFP_INVALID_ARGS The protocol is not a Visible Envelope
+ */
+LFP_API
+int lfp_rp66_build_index(lfp_protocol*, int64_t* records, int64_t* size);
+
 #if (__cplusplus)
 } // extern "C"
 #endif
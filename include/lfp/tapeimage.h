@@ -15,7 +15,7 @@ extern "C" {
  * is segmented into records, each preceeded by a record marker of three 4-byte
  * little-endian integers - a record type, offset of the previous record, and
  * offset of the next record. All offsets are absolute, so the file size is
- * limited to 4GB.
+ * limited to 4GB, unless the file is opened with `lfp_tapeimage_open_large()`.
  *
  * The tapeimage protocol provides a view of as if the record markers were not
  * present. `lfp_seek()` and `lfp_tell()` consider offsets as if the file had
@@ -26,8 +26,131 @@ extern "C" {
  * protocol. Note that it is not possible to open the protocol in the middle of
  * a record.
  */
+LFP_API
 lfp_protocol* lfp_tapeimage_open(lfp_protocol*);
 
+/** Open a tape image that may be larger than 4GB
+ *
+ * Tape images larger than 4GB are still written with 32-bit offsets, which
+ * wrap around every 4GB. `lfp_tapeimage_open()` considers such files corrupt,
+ * as a record that ends before it starts is usually a sign of a broken
+ * header.
+ *
+ * This function opens a tape image that instead takes a wrapped offset to
+ * mean that the record crosses a 4GB boundary. The full 64-bit offsets are
+ * reconstructed from the position of each header, so large files can be read
+ * and seeked as any other tape image. As records themselves are limited to
+ * 4GB, this is unambiguous for files that are not corrupt, but some broken
+ * headers are no longer detected.
+ *
+ * Indices exported with `lfp_index_export()` should be imported into a
+ * protocol opened the same way.
+ */
+LFP_API
+lfp_protocol* lfp_tapeimage_open_large(lfp_protocol*);
+
+/** Open a tape image that is read forwards only, like a pipe or tape drive
+ *
+ * The tapeimage protocol normally keeps the header of every record it has
+ * seen, so that it can seek back to it, and seeks the underlying protocol
+ * to get around. Neither works for streams, which can be arbitrarily long,
+ * and can not seek.
+ *
+ * This function opens a tape image that never seeks the underlying protocol,
+ * and only keeps the last few headers, so that memory stays constant no
+ * matter how much is read. `lfp_seek()` forwards reads up to the target,
+ * and `lfp_seek()` backwards, `lfp_pread()`, `lfp_dup()`, and the index
+ * functions return `LFP_NOTSUPPORTED`. Headers are still validated, and
+ * recovered from, like in `lfp_tapeimage_open()`.
+ *
+ * Streams can be of any size, so offsets that wrap around at 4GB are taken
+ * to cross a 4GB boundary, like in `lfp_tapeimage_open_large()`.
+ *
+ * Stack rp66 on top with `lfp_rp66_open_stream()`, which does not seek either.
+ */
+LFP_API
+lfp_protocol* lfp_tapeimage_open_stream(lfp_protocol*);
+
+/** Index the whole tape image
+ *
+ * The tapeimage protocol normally builds its index of record headers lazily,
+ * as the file is read and seeked. This function instead walks all the headers
+ * up front, in a single pass, from the last indexed record and up to the
+ * first file mark or end-of-file. Headers are read in large batches, so
+ * files with many small records are indexed at close to sequential read
+ * speed. Afterwards, `lfp_seek()` to any offset in the file is cheap.
+ *
+ * The position of the protocol is not changed.
+ *
+ * \param records if not `NULL`, the number of records, including the file
+ *                mark
+ * \param size    if not `NULL`, the logical size of the file, i.e. the offset
+ *                of the end of the last record
+ *
+ * \retval LFP_OK Success
+ * \retval LFP_INVALID_ARGS The protocol is not a tape image
+ */
+LFP_API
+int lfp_tapeimage_build_index(lfp_protocol*, int64_t* records, int64_t* size);
+
+/** Find the logical files in a tape image
+ *
+ * A tape image can hold several logical files, each ended by a file mark.
+ * `lfp_tapeimage_open()` only ever sees one of them, so this function walks
+ * the header chain of the tape image in f, from its current position, and
+ * reports the offsets at which the logical files start. The headers are
+ * found as by `lfp_tapeimage_build_index()`, which reads the file in large
+ * batches, so small record bodies are read along with the headers, and only
+ * large records are seeked past. A file mark right after another marks the
+ * end of the tape, and is not counted as a file.
+ *
+ * Note that f is the underlying protocol, not a tape image. The offsets are
+ * as reported by `lfp_tell()` on f, so to open a file directly, seek f to the
+ * offset and call `lfp_tapeimage_open()`.
+ *
+ * The position of f is not changed.
+ *
+ * \param offsets if not `NULL`, the offsets of the first len files, where
+ *                `offsets[0]` is the current position of f
+ * \param len     the capacity of offsets
+ * \param count   if not `NULL`, the number of logical files, which may be
+ *                larger than len
+ *
+ * \retval LFP_OK Success
+ * \retval LFP_INVALID_ARGS len is negative
+ *
+ * Example
+ * -------
+ * Open the last logical file:
+ * \code{.cpp}
+ * int64_t count;
+ * lfp_tapeimage_files(f, NULL, 0, &count);
+ * int64_t* offsets = malloc(count * sizeof(int64_t));
+ * lfp_tapeimage_files(f, offsets, count, NULL);
+ * lfp_seek(f, offsets[count - 1]);
+ * lfp_protocol* tif = lfp_tapeimage_open(f);
+ * \endcode
+ */
+LFP_API
+int lfp_tapeimage_files(lfp_protocol* f,
+                        int64_t* offsets,
+                        int64_t len,
+                        int64_t* count);
+
+/** Open the logical file at index file in a tape image
+ *
+ * Open a tape image starting at the start of logical file number file,
+ * counting from zero at the current position of f. The files before it are
+ * walked as with `lfp_tapeimage_files()`, but the walk stops as soon as the
+ * file is found.
+ *
+ * Like `lfp_tapeimage_open()`, this function takes ownership of f on
+ * success. If there are not that many files, or the tape image can't be
+ * read, this function returns `NULL`, and f is put back where it was.
+ */
+LFP_API
+lfp_protocol* lfp_tapeimage_open_file(lfp_protocol* f, int file);
+
 #if (__cplusplus)
 } // extern "C"
 #endif
@@ -0,0 +1,123 @@
+#ifndef LFP_URING_H
+#define LFP_URING_H
+
+#include <lfp/lfp.h>
+
+/** \file uring.h */
+
+#if (__cplusplus)
+extern "C" {
+#endif
+
+/** A queue of asynchronous reads, backed by io_uring
+ *
+ * The queue is shared by any number of fd protocols (see `lfp_fd_open()`),
+ * so that a single thread can keep many reads in flight against many files,
+ * without a thread per file blocking in `lfp_readinto()`. Reads are queued
+ * with `lfp_readinto_async()`, and their completions collected with
+ * `lfp_uring_poll()`.
+ *
+ * io_uring is Linux only, and only available when lfp is built with the
+ * LFP_IO_URING CMake option. Otherwise, `lfp_uring_open()` returns `NULL`,
+ * and the other functions report `LFP_NOTSUPPORTED`.
+ *
+ * A queue is not thread safe, and should only be used from one thread
+ * at the time.
+ */
+typedef struct lfp_uring lfp_uring;
+
+/** The result of an asynchronous read, see `lfp_uring_poll()` */
+struct lfp_completion {
+    /** The user_data passed to `lfp_readinto_async()` */
+    void* user_data;
+    /**
+     * The status of the read, as for `lfp_readinto()` - LFP_OK when len
+     * bytes were read, LFP_EOF when the read went past end-of-file, or
+     * LFP_IOERROR, in which case `lfp_uring_errormsg()` describes the error
+     */
+    int status;
+    /** The number of bytes read into dst */
+    int64_t bytes_read;
+};
+typedef struct lfp_completion lfp_completion;
+
+/** Open a queue for asynchronous reads
+ *
+ * \param entries the number of reads that can be submitted to the kernel at
+ *                once, or 0 for the default (256). Up to twice as many reads
+ *                can be in flight.
+ *
+ * \retval NULL io_uring is not available, or the queue could not be set up
+ */
+LFP_API
+lfp_uring* lfp_uring_open(int entries);
+
+/** Close the queue
+ *
+ * Wait for the reads in flight to complete, and release the queue. The
+ * completions of those reads are discarded.
+ */
+LFP_API
+void lfp_uring_close(lfp_uring*);
+
+/** Queue a read of len bytes into dst, without waiting for it
+ *
+ * The read starts at the current position of f, and the position is moved
+ * len bytes forward right away, as if the read had already completed, so
+ * that reads queued back-to-back read consecutive parts of the file. Reads
+ * complete in any order, and must be matched to their completion by
+ * user_data. dst must stay valid until the read completes.
+ *
+ * Reads are submitted to the kernel in batches, on the next
+ * `lfp_uring_poll()`, or when the submission queue is full.
+ *
+ * Only the fd protocol supports asynchronous reads, and not when opened
+ * with `LFP_FD_DIRECT`.
+ *
+ * \retval LFP_OKINCOMPLETE The read is queued, and the bytes will be
+ *                          available when it completes
+ * \retval LFP_NOTSUPPORTED f is not an fd protocol, or io_uring is not
+ *                          available
+ * \retval LFP_RUNTIME_ERROR Too many reads are in flight - poll for
+ *                           completions, and try again
+ */
+LFP_API
+int lfp_readinto_async(lfp_uring*,
+                       lfp_protocol* f,
+                       void* dst,
+                       int64_t len,
+                       void* user_data);
+
+/** Submit queued reads, and collect completions
+ *
+ * Submit all queued reads, wait until at least wait reads have completed
+ * (or all of them, if fewer are in flight), and write up to max completions
+ * to out. With wait = 0 this never blocks, and can be used to submit reads
+ * without waiting for them.
+ *
+ * \param out   completions, with room for max entries
+ * \param max   the capacity of out
+ * \param wait  the number of completions to wait for
+ * \param count the number of completions written to out
+ *
+ * \retval LFP_OK Success
+ * \retval LFP_NOTSUPPORTED io_uring is not available
+ * \retval LFP_IOERROR Submitting or waiting failed, see
+ *                     `lfp_uring_errormsg()`
+ */
+LFP_API
+int lfp_uring_poll(lfp_uring*,
+                   lfp_completion* out,
+                   int max,
+                   int wait,
+                   int* count);
+
+/** The error message of the last failed poll or read */
+LFP_API
+const char* lfp_uring_errormsg(lfp_uring*);
+
+#if (__cplusplus)
+} // extern "C"
+#endif
+
+#endif // LFP_URING_H
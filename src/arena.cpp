@@ -0,0 +1,174 @@
+#include <ciso646>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+#include <lfp/arena.h>
+#include <lfp/protocol.hpp>
+
+namespace lfp { namespace {
+
+/*
+ * Memory is handed out in blocks of power-of-two sizes, from 64 bytes to
+ * 32MB, and released blocks are kept in one free list per size. Anything
+ * larger comes straight from the heap, as it is too rare to be worth keeping.
+ */
+constexpr const std::size_t smallest = 64;
+constexpr const int classes = 20;
+constexpr const std::size_t largest = smallest << (classes - 1);
+
+/*
+ * Every block starts with a tag that says where it came from, so that it can
+ * be released from anywhere, without knowing the arena or the size. The tag
+ * is as large as the strictest alignment, so that what comes after it is
+ * aligned like memory from operator new.
+ */
+struct alignas(std::max_align_t) tag {
+    lfp_arena* owner;
+    int size_class;
+};
+
+thread_local lfp_arena* current = nullptr;
+
+int class_of(std::size_t n) noexcept (true) {
+    int klass = 0;
+    while ((smallest << klass) < n)
+        klass += 1;
+    return klass;
+}
+
+}
+
+}
+
+struct lfp_arena {
+    std::mutex mtx;
+    /* the released blocks of every size, linked through their first bytes */
+    void* free[lfp::classes] = {};
+    /* the blocks handed out and not yet released */
+    std::int64_t live = 0;
+    /* set by lfp_arena_free, after which blocks are not kept */
+    bool released = false;
+};
+
+namespace lfp { namespace {
+
+/*
+ * Return a block to its arena, or just drop the arena's count of it when
+ * block is nullptr, and destroy the arena if it was released and this was
+ * the last block
+ */
+void give_back(lfp_arena* arena, tag* block) noexcept (true) {
+    bool destroy = false;
+    {
+        std::lock_guard< std::mutex > lock(arena->mtx);
+        if (block and arena->released) {
+            ::operator delete(block);
+        } else if (block) {
+            const auto klass = block->size_class;
+            *reinterpret_cast< void** >(block) = arena->free[klass];
+            arena->free[klass] = block;
+        }
+        arena->live -= 1;
+        destroy = arena->released and arena->live == 0;
+    }
+
+    if (destroy)
+        delete arena;
+}
+
+}
+
+void* arena_allocate(std::size_t n) noexcept (false) {
+    auto* arena = current;
+    const auto size = n + sizeof(tag);
+
+    if (not arena or size < n or size > largest) {
+        auto* t = ::new (::operator new(size)) tag;
+        t->owner = nullptr;
+        t->size_class = -1;
+        return t + 1;
+    }
+
+    const auto klass = class_of(size);
+    void* block = nullptr;
+    {
+        std::lock_guard< std::mutex > lock(arena->mtx);
+        if (arena->released) {
+            /* the arena is going away, so don't give it more blocks */
+            arena = nullptr;
+        } else {
+            block = arena->free[klass];
+            if (block)
+                arena->free[klass] = *static_cast< void** >(block);
+            arena->live += 1;
+        }
+    }
+
+    if (not block) {
+        try {
+            block = ::operator new(arena ? smallest << klass : size);
+        } catch (...) {
+            if (arena) give_back(arena, nullptr);
+            throw;
+        }
+    }
+
+    auto* t = ::new (block) tag;
+    t->owner = arena;
+    t->size_class = arena ? klass : -1;
+    return t + 1;
+}
+
+void arena_deallocate(void* p) noexcept (true) {
+    if (not p) return;
+
+    auto* t = static_cast< tag* >(p) - 1;
+    auto* arena = t->owner;
+    if (not arena) {
+        ::operator delete(t);
+        return;
+    }
+
+    give_back(arena, t);
+}
+
+}
+
+lfp_arena* lfp_arena_new() {
+    try {
+        return new lfp_arena();
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+lfp_arena* lfp_arena_use(lfp_arena* arena) {
+    auto* previous = lfp::current;
+    lfp::current = arena;
+    return previous;
+}
+
+void lfp_arena_free(lfp_arena* arena) {
+    if (not arena) return;
+    if (lfp::current == arena)
+        lfp::current = nullptr;
+
+    bool destroy = false;
+    {
+        std::lock_guard< std::mutex > lock(arena->mtx);
+        arena->released = true;
+        for (auto& head : arena->free) {
+            while (head) {
+                auto* next = *static_cast< void** >(head);
+                ::operator delete(head);
+                head = next;
+            }
+        }
+        destroy = arena->live == 0;
+    }
+
+    if (destroy)
+        delete arena;
+}
@@ -0,0 +1,384 @@
+#include <algorithm>
+#include <cassert>
+#include <ciso646>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <lfp/auto.h>
+#include <lfp/gzip.h>
+#include <lfp/protocol.hpp>
+#include <lfp/rp66.h>
+#include <lfp/tapeimage.h>
+
+namespace lfp { namespace {
+
+/*
+ * Enough for a few tape image headers, a storage unit label, and the first
+ * visible record header, and for most small files as a whole
+ */
+constexpr const std::int64_t probe_size = 4096;
+
+/*
+ * The bytes probed from the start of a protocol, replayed to the protocols
+ * above it, so that they don't have to be read again. The replay ends when a
+ * read goes past the probed bytes, or a seek goes outside of them, and from
+ * then on everything goes straight to the underlying protocol.
+ *
+ * start is the tell of the underlying protocol before the probe, or -1 if it
+ * can't tell, in which case seeks are not replayed either.
+ */
+class replay : public lfp_protocol {
+public:
+    replay(lfp_protocol*,
+           std::vector< unsigned char > bytes,
+           std::int64_t start) noexcept (true);
+
+    void close() noexcept (false) override;
+    lfp_status readinto(void* dst, std::int64_t len, std::int64_t* bytes_read)
+        noexcept (false) override;
+    lfp_status readview(const void** view,
+                        std::int64_t len,
+                        std::int64_t* bytes_read)
+        noexcept (false) override;
+    lfp_status pread(void* dst,
+                     std::int64_t len,
+                     std::int64_t offset,
+                     std::int64_t* bytes_read)
+        noexcept (false) override;
+
+    int eof() const noexcept (false) override;
+
+    void seek(std::int64_t) noexcept (false) override;
+    std::int64_t tell() const noexcept (false) override;
+    std::int64_t ptell() const noexcept (false) override;
+    lfp_protocol* peel() noexcept (false) override;
+    lfp_protocol* peek() const noexcept (false) override;
+
+    const std::vector< unsigned char >& probed() const noexcept (true);
+
+private:
+    std::vector< unsigned char > bytes;
+    std::int64_t start;
+    std::size_t pos = 0;
+    unique_lfp fp;
+
+    std::int64_t remaining() const noexcept (true);
+    void drop() noexcept (true);
+};
+
+replay::replay(
+        lfp_protocol* f,
+        std::vector< unsigned char > b,
+        std::int64_t s)
+noexcept (true) :
+    bytes(std::move(b)),
+    start(s),
+    fp(f)
+{}
+
+const std::vector< unsigned char >& replay::probed() const noexcept (true) {
+    return this->bytes;
+}
+
+std::int64_t replay::remaining() const noexcept (true) {
+    return std::int64_t(this->bytes.size() - this->pos);
+}
+
+/*
+ * Stop replaying. The underlying protocol is then wherever it was moved to
+ * last, and the probed bytes are not valid for it anymore.
+ */
+void replay::drop() noexcept (true) {
+    this->bytes.clear();
+    this->bytes.shrink_to_fit();
+    this->pos = 0;
+}
+
+void replay::close() noexcept (false) {
+    if (!this->fp) return;
+    this->fp.close();
+}
+
+lfp_status replay::readinto(
+        void* dst,
+        std::int64_t len,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    read_probe probe(this->iostats, bytes_read);
+    const auto k = (std::min)(len, this->remaining());
+    if (k > 0)
+        std::memcpy(dst, this->bytes.data() + this->pos, k);
+    this->pos += k;
+
+    if (k == len) {
+        *bytes_read = k;
+        return LFP_OK;
+    }
+
+    this->drop();
+    auto* p = static_cast< unsigned char* >(dst) + k;
+    std::int64_t n = 0;
+    const auto err = this->fp->readinto(p, len - k, &n);
+    *bytes_read = k + n;
+    return err;
+}
+
+lfp_status replay::readview(
+        const void** view,
+        std::int64_t len,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    /*
+     * A view can't be part probed bytes and part underlying protocol, so
+     * reads across the end are copied instead
+     */
+    if (len > this->remaining() and this->remaining() > 0)
+        return this->lfp_protocol::readview(view, len, bytes_read);
+
+    read_probe probe(this->iostats, bytes_read);
+    if (this->remaining() > 0) {
+        *view = this->bytes.data() + this->pos;
+        this->pos += len;
+        *bytes_read = len;
+        return LFP_OK;
+    }
+
+    this->drop();
+    return this->fp->readview(view, len, bytes_read);
+}
+
+lfp_status replay::pread(
+        void* dst,
+        std::int64_t len,
+        std::int64_t offset,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    /*
+     * pread must be safe to call concurrently, so it doesn't touch the
+     * probed bytes, which are dropped by reads
+     */
+    read_probe probe(this->iostats, bytes_read);
+    return this->fp->pread(dst, len, offset, bytes_read);
+}
+
+int replay::eof() const noexcept (false) {
+    return this->remaining() == 0 and this->fp->eof();
+}
+
+void replay::seek(std::int64_t n) noexcept (false) {
+    seek_probe probe(this->iostats);
+    const auto size = std::int64_t(this->bytes.size());
+    const auto replaying = this->start >= 0 and size > 0;
+    if (replaying and n >= this->start and n <= this->start + size) {
+        this->pos = std::size_t(n - this->start);
+        return;
+    }
+
+    this->drop();
+    this->fp->seek(n);
+}
+
+std::int64_t replay::tell() const noexcept (false) {
+    return this->fp->tell() - this->remaining();
+}
+
+std::int64_t replay::ptell() const noexcept (false) {
+    return this->fp->ptell() - this->remaining();
+}
+
+lfp_protocol* replay::peel() noexcept (false) {
+    assert(this->fp);
+    return this->fp.release();
+}
+
+lfp_protocol* replay::peek() const noexcept (false) {
+    assert(this->fp);
+    return this->fp.get();
+}
+
+/*
+ * The protocols stacked on f so far. If something fails before the stack is
+ * released, the protocols are taken apart again, without closing f, so that
+ * the caller still owns it.
+ */
+class stack {
+public:
+    explicit stack(lfp_protocol* f) noexcept (true) : top(f), leaf(f) {}
+    ~stack() {
+        while (this->top != this->leaf) {
+            auto* inner = this->top->peel();
+            delete this->top;
+            this->top = inner;
+        }
+    }
+
+    stack(const stack&) = delete;
+    stack& operator = (const stack&) = delete;
+
+    void push(lfp_protocol* p) noexcept (false) {
+        if (not p)
+            throw runtime_error("open_auto: unable to open protocol");
+        this->top = p;
+    }
+
+    lfp_protocol* release() noexcept (true) {
+        auto* p = this->top;
+        this->top = this->leaf;
+        return p;
+    }
+
+    /*
+     * Probe the first bytes of the top protocol, and put a replay of them
+     * on top
+     */
+    const std::vector< unsigned char >& probe() noexcept (false);
+
+    lfp_protocol* top;
+    /*
+     * The tell of the probed protocol, or 0 if it can't tell, which is where
+     * protocols opened on top of it consider the file to start
+     */
+    std::int64_t start = 0;
+
+private:
+    lfp_protocol* leaf;
+};
+
+const std::vector< unsigned char >& stack::probe() noexcept (false) {
+    std::int64_t start = -1;
+    try {
+        start = this->top->tell();
+    } catch (const lfp::error&) {}
+
+    auto bytes = std::vector< unsigned char >(probe_size);
+    std::int64_t n = 0;
+    this->top->readinto(bytes.data(), probe_size, &n);
+    bytes.resize(n);
+
+    auto* r = new replay(this->top, std::move(bytes), start);
+    this->top = r;
+    this->start = (std::max)(start, std::int64_t(0));
+    return r->probed();
+}
+
+std::uint32_t le32(const unsigned char* p) noexcept (true) {
+    return std::uint32_t(p[0])
+         | std::uint32_t(p[1]) << 8
+         | std::uint32_t(p[2]) << 16
+         | std::uint32_t(p[3]) << 24;
+}
+
+bool is_gzip(const std::vector< unsigned char >& b) noexcept (true) {
+    return b.size() >= 3 and b[0] == 0x1F and b[1] == 0x8B and b[2] == 0x08;
+}
+
+/*
+ * A record header with a known type, and offsets that go forward, starting
+ * at (absolute) offset at
+ */
+bool is_tapeimage(const std::vector< unsigned char >& b, std::int64_t at)
+noexcept (true) {
+    if (b.size() < 12) return false;
+    const auto type = le32(b.data() + 0);
+    const auto prev = std::int64_t(le32(b.data() + 4));
+    const auto next = std::int64_t(le32(b.data() + 8));
+    return type <= 1 and prev <= at and next >= at + 12;
+}
+
+/*
+ * The record bodies in probed tape image bytes, i.e. the bytes as seen
+ * through the tapeimage protocol, up to the first file mark or the end of the
+ * probe
+ */
+std::vector< unsigned char > bodies(const std::vector< unsigned char >& b,
+                                    std::int64_t at) {
+    std::vector< unsigned char > out;
+    std::size_t i = 0;
+    while (i + 12 <= b.size()) {
+        const auto type = le32(b.data() + i);
+        const auto next = std::int64_t(le32(b.data() + i + 8));
+        const auto len  = next - at - 12;
+        if (type != 0 or len < 0) break;
+
+        const auto begin = b.begin() + i + 12;
+        const auto end = b.begin() + (std::min)(i + 12 + len, b.size());
+        out.insert(out.end(), begin, end);
+        i += std::size_t(12 + len);
+        at = next;
+    }
+    return out;
+}
+
+/*
+ * The storage unit label has the DLIS version and structure at fixed offsets
+ */
+bool is_sul(const std::vector< unsigned char >& b) noexcept (true) {
+    if (b.size() < 80) return false;
+    return std::memcmp(b.data() + 4, "V1.00", 5) == 0
+       and std::memcmp(b.data() + 9, "RECORD", 6) == 0;
+}
+
+/*
+ * A visible record header at offset at, with the fixed format version
+ */
+bool is_visible_record(const std::vector< unsigned char >& b, std::size_t at)
+noexcept (true) {
+    if (b.size() < at + 4) return false;
+    const auto length = (b[at] << 8) | b[at + 1];
+    return length >= 4 and b[at + 2] == 0xFF and b[at + 3] == 0x01;
+}
+
+lfp_protocol* open_auto(lfp_protocol* f, int* layers) noexcept (false) {
+    stack s(f);
+    int found = 0;
+
+    const auto* bytes = &s.probe();
+    if (is_gzip(*bytes)) {
+        auto* g = lfp_gzip_open(s.top, 0);
+        /* without zlib, gzip comes back NULL, and the file is not recognised */
+        if (not g) {
+            if (layers) *layers = 0;
+            return s.release();
+        }
+        s.push(g);
+        found |= LFP_AUTO_GZIP;
+        bytes = &s.probe();
+    }
+
+    std::vector< unsigned char > body;
+    const auto at = s.start;
+    if (is_tapeimage(*bytes, at)) {
+        body = bodies(*bytes, at);
+        s.push(lfp_tapeimage_open(s.top));
+        found |= LFP_AUTO_TAPEIMAGE;
+        bytes = &body;
+    }
+
+    const auto sul = is_sul(*bytes);
+    if (is_visible_record(*bytes, sul ? 80 : 0)) {
+        if (sul) {
+            s.top->seek(s.top->tell() + 80);
+            found |= LFP_AUTO_SUL;
+        }
+        s.push(lfp_rp66_open(s.top));
+        found |= LFP_AUTO_RP66;
+    }
+
+    if (layers) *layers = found;
+    return s.release();
+}
+
+}
+
+}
+
+lfp_protocol* lfp_open_auto(lfp_protocol* f, int* layers) {
+    if (not f) return nullptr;
+
+    try {
+        return lfp::open_auto(f, layers);
+    } catch (...) {
+        return nullptr;
+    }
+}
@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <chrono>
+#include <ciso646>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fmt/format.h>
+
+#if !defined(_WIN32)
+    #include <sys/stat.h>
+    #include <sys/types.h>
+#endif
+
+#include <lfp/auto.h>
+#include <lfp/batch.h>
+#include <lfp/lfp.h>
+#include <lfp/rp66.h>
+#include <lfp/tapeimage.h>
+
+namespace lfp { namespace {
+
+/*
+ * Messages and indices are released with std::free by lfp_index_batch_free,
+ * so they're allocated with malloc
+ */
+char* copy_message(const std::string& msg) noexcept (true) {
+    auto* p = static_cast< char* >(std::malloc(msg.size() + 1));
+    if (p) std::memcpy(p, msg.c_str(), msg.size() + 1);
+    return p;
+}
+
+void fail(lfp_index_job& job, int status, const std::string& msg)
+noexcept (true) {
+    job.status = status;
+    try {
+        const auto path = job.path ? job.path : "(null)";
+        job.errmsg = copy_message(fmt::format("{}: {}", path, msg));
+    } catch (...) {
+        job.errmsg = nullptr;
+    }
+}
+
+std::int64_t device_of(const char* path) noexcept (true) {
+#if defined(_WIN32)
+    (void)path;
+    return 0;
+#else
+    struct stat st;
+    if (not path or ::stat(path, &st) != 0)
+        return 0;
+    return std::int64_t(st.st_dev);
+#endif
+}
+
+lfp_protocol* open_leaf(const lfp_index_job& job) noexcept (true) {
+    if (job.open)
+        return job.open(job.ctx, job.path);
+
+    if (not job.path) return nullptr;
+    std::FILE* fp = std::fopen(job.path, "rb");
+    if (not fp) return nullptr;
+
+    auto* f = lfp_cfile(fp);
+    if (not f) std::fclose(fp);
+    return f;
+}
+
+int export_index(lfp_protocol* f, lfp_index_result& result) noexcept (true) {
+    std::int64_t size = 0;
+    auto err = lfp_index_export(f, nullptr, 0, &size);
+    if (err != LFP_OK) return err;
+
+    void* blob = std::malloc(std::size_t((std::max)(size, std::int64_t(1))));
+    if (not blob) return LFP_RUNTIME_ERROR;
+
+    err = lfp_index_export(f, blob, size, &size);
+    if (err != LFP_OK) {
+        std::free(blob);
+        return err;
+    }
+
+    result.index = blob;
+    result.index_size = size;
+    return LFP_OK;
+}
+
+/*
+ * Build and export the index of f, which is a tapeimage if rp66 is false
+ */
+bool index(lfp_index_job& job,
+           lfp_protocol* f,
+           lfp_index_result& result,
+           bool rp66)
+noexcept (true) {
+    auto err = rp66
+        ? lfp_rp66_build_index(f, &result.records, &result.size)
+        : lfp_tapeimage_build_index(f, &result.records, &result.size);
+
+    if (err == LFP_OK)
+        err = export_index(f, result);
+
+    if (err != LFP_OK) {
+        fail(job, err, lfp_errormsg(f));
+        return false;
+    }
+    return true;
+}
+
+void run(lfp_index_job& job) noexcept (true) {
+    auto* leaf = open_leaf(job);
+    if (not leaf) {
+        fail(job, LFP_IOERROR, "unable to open file");
+        return;
+    }
+
+    int layers = 0;
+    auto* f = lfp_open_auto(leaf, &layers);
+    if (not f) {
+        fail(job, LFP_IOERROR, "unable to read file");
+        lfp_close(leaf);
+        return;
+    }
+    job.layers = layers;
+
+    lfp_protocol* tif = nullptr;
+    lfp_protocol* ve = nullptr;
+    if (layers & LFP_AUTO_RP66) {
+        ve = f;
+        if (layers & LFP_AUTO_TAPEIMAGE)
+            lfp_peek(f, &tif);
+    } else if (layers & LFP_AUTO_TAPEIMAGE) {
+        tif = f;
+    }
+
+    if (not tif and not ve) {
+        fail(job, LFP_INVALID_ARGS, "not a tape image or Visible Envelope");
+        lfp_close(f);
+        return;
+    }
+
+    /*
+     * The tape image goes first, so that the rp66 index is built on top of
+     * an already indexed tape image, which reads the headers in batches
+     */
+    const auto ok = (not tif or index(job, tif, job.tapeimage, false))
+                and (not ve  or index(job, ve,  job.rp66,      true));
+
+    if (ok) job.status = LFP_OK;
+    lfp_close(f);
+}
+
+/*
+ * Hand the jobs out in order, to any thread that asks, skipping the jobs
+ * whose device already has per_device jobs running
+ */
+class scheduler {
+public:
+    scheduler(lfp_index_job* jobs, int count, int per_device);
+
+    void work() noexcept (true);
+
+private:
+    lfp_index_job* jobs;
+    int per_device;
+    /* the device of each job, with LFP_INDEX_DEVICE_AUTO resolved */
+    std::vector< std::int64_t > devices;
+
+    std::mutex mtx;
+    std::condition_variable done;
+    std::list< int > pending;
+    std::map< std::int64_t, int > running;
+};
+
+scheduler::scheduler(lfp_index_job* j, int count, int pd) :
+    jobs(j),
+    per_device(pd)
+{
+    for (int i = 0; i < count; ++i) {
+        const auto device = this->jobs[i].device;
+        this->devices.push_back(device == LFP_INDEX_DEVICE_AUTO
+            ? device_of(this->jobs[i].path)
+            : device
+        );
+        this->pending.push_back(i);
+    }
+}
+
+void scheduler::work() noexcept (true) {
+    std::unique_lock< std::mutex > lock(this->mtx);
+    while (not this->pending.empty()) {
+        auto itr = std::find_if(
+            this->pending.begin(),
+            this->pending.end(),
+            [this](int i) {
+                const auto device = this->devices[i];
+                return this->per_device == 0
+                    or this->running[device] < this->per_device;
+            }
+        );
+
+        /*
+         * A timed wait, like in prefetch, as condition_variable::wait() needs
+         * a newer libstdc++ than the one lfp is often loaded next to
+         */
+        if (itr == this->pending.end()) {
+            this->done.wait_for(lock, std::chrono::milliseconds(100));
+            continue;
+        }
+
+        const auto i = *itr;
+        this->pending.erase(itr);
+        this->running[this->devices[i]] += 1;
+
+        lock.unlock();
+        run(this->jobs[i]);
+        lock.lock();
+
+        this->running[this->devices[i]] -= 1;
+        this->done.notify_all();
+    }
+}
+
+}
+
+}
+
+int lfp_index_batch(lfp_index_job* jobs,
+                    int count,
+                    int threads,
+                    int per_device) {
+    if (not jobs)       return LFP_INVALID_ARGS;
+    if (count < 0)      return LFP_INVALID_ARGS;
+    if (threads < 0)    return LFP_INVALID_ARGS;
+    if (per_device < 0) return LFP_INVALID_ARGS;
+
+    for (int i = 0; i < count; ++i) {
+        auto& job = jobs[i];
+        job.status = LFP_OK;
+        job.errmsg = nullptr;
+        job.layers = 0;
+        std::memset(&job.tapeimage, 0, sizeof(job.tapeimage));
+        std::memset(&job.rp66, 0, sizeof(job.rp66));
+    }
+
+    if (threads == 0)
+        threads = (std::max)(1, int(std::thread::hardware_concurrency()));
+    threads = (std::min)(threads, count);
+
+    try {
+        lfp::scheduler sched(jobs, count, per_device);
+
+        /*
+         * If threads can't be started, the ones that did, and the calling
+         * thread, get through the jobs anyway
+         */
+        std::vector< std::thread > pool;
+        pool.reserve(threads);
+        for (int i = 1; i < threads; ++i) {
+            try {
+                pool.emplace_back(&lfp::scheduler::work, &sched);
+            } catch (const std::system_error&) {
+                break;
+            }
+        }
+
+        sched.work();
+        for (auto& t : pool)
+            t.join();
+    } catch (...) {
+        return LFP_RUNTIME_ERROR;
+    }
+
+    return LFP_OK;
+}
+
+void lfp_index_batch_free(lfp_index_job* jobs, int count) {
+    if (not jobs) return;
+
+    for (int i = 0; i < count; ++i) {
+        auto& job = jobs[i];
+        std::free(job.errmsg);
+        std::free(job.tapeimage.index);
+        std::free(job.rp66.index);
+        job.errmsg = nullptr;
+        job.tapeimage.index = nullptr;
+        job.rp66.index = nullptr;
+    }
+}
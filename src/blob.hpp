@@ -0,0 +1,188 @@
+#ifndef LFP_BLOB_HPP
+#define LFP_BLOB_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include <lfp/protocol.hpp>
+
+/*
+ * Helpers for the serialized record indices of lfp_index_export() and
+ * lfp_index_import(). This is an internal header, and not installed.
+ *
+ * A blob is a fixed-size header followed by count protocol-specific entries:
+ *
+ *   magic           4 bytes, "LFPI"
+ *   version         uint16
+ *   tag             1 byte, identifies the protocol
+ *   flags           uint8, complete, and protocol-specific in the low bits
+ *   base zero       int64, tell() of the underlying protocol at open
+ *   physical zero   int64, ptell() of the underlying protocol at open
+ *   count           int64, number of entries
+ *   end             int64, base offset of the end of the last record
+ *   checksum        uint64, FNV-1a of a sample of the headers on disk
+ *
+ * All integers are little endian, regardless of the host.
+ */
+
+namespace lfp { namespace blob {
+
+constexpr const std::uint16_t version = 1;
+
+/*
+ * The index covers the whole file, which ends right after the last record,
+ * so there are no more headers to look for
+ */
+constexpr const std::uint8_t complete = 0x80;
+
+struct header {
+    char          tag   = 0;
+    std::uint8_t  flags = 0;
+    std::int64_t  base_zero = 0;
+    std::int64_t  physical_zero = 0;
+    std::int64_t  count = 0;
+    std::int64_t  end = 0;
+    std::uint64_t checksum = 0;
+
+    static constexpr const int size = 48;
+};
+
+/*
+ * 64-bit FNV-1a, which is plenty for detecting that a file has changed since
+ * the index was exported - it is not meant to withstand anything adversarial.
+ */
+class fnv1a {
+public:
+    void update(const void* src, std::size_t len) noexcept (true) {
+        const auto* p = static_cast< const unsigned char* >(src);
+        for (std::size_t i = 0; i < len; ++i) {
+            this->hash ^= p[i];
+            this->hash *= 0x100000001B3ULL;
+        }
+    }
+
+    std::uint64_t digest() const noexcept (true) {
+        return this->hash;
+    }
+
+private:
+    std::uint64_t hash = 0xCBF29CE484222325ULL;
+};
+
+class writer {
+public:
+    template < typename T >
+    void put(T x) noexcept (false) {
+        using U = typename std::make_unsigned< T >::type;
+        auto u = static_cast< U >(x);
+        for (std::size_t i = 0; i < sizeof(T); ++i) {
+            this->buffer.push_back(static_cast< unsigned char >(u & 0xFF));
+            u = static_cast< U >(u >> 8);
+        }
+    }
+
+    void put(const header& head) noexcept (false) {
+        this->buffer.insert(this->buffer.end(), { 'L', 'F', 'P', 'I' });
+        this->put(version);
+        this->put(head.tag);
+        this->put(head.flags);
+        this->put(head.base_zero);
+        this->put(head.physical_zero);
+        this->put(head.count);
+        this->put(head.end);
+        this->put(head.checksum);
+    }
+
+    void reserve(std::size_t n) noexcept (false) {
+        this->buffer.reserve(n);
+    }
+
+    std::vector< unsigned char > release() noexcept (true) {
+        return std::move(this->buffer);
+    }
+
+private:
+    std::vector< unsigned char > buffer;
+};
+
+class reader {
+public:
+    reader(const void* src, std::int64_t len) :
+        p(static_cast< const unsigned char* >(src)),
+        remaining(len)
+    {}
+
+    template < typename T >
+    T get() noexcept (false) {
+        if (this->remaining < std::int64_t(sizeof(T)))
+            throw invalid_args("index_import: unexpected end of index");
+
+        using U = typename std::make_unsigned< T >::type;
+        U u = 0;
+        for (std::size_t i = sizeof(T); i > 0; --i)
+            u = static_cast< U >((u << 8) | this->p[i - 1]);
+
+        this->p += sizeof(T);
+        this->remaining -= sizeof(T);
+        return static_cast< T >(u);
+    }
+
+    /*
+     * Read and validate the blob header - the magic, the version, the tag,
+     * and that the blob is exactly the right size for count entries of
+     * entry_size bytes.
+     */
+    header get_header(char tag, int entry_size) noexcept (false) {
+        if (this->remaining < header::size)
+            throw invalid_args("index_import: index too short");
+
+        if (std::memcmp(this->p, "LFPI", 4) != 0)
+            throw invalid_args("index_import: not an lfp index");
+        this->p += 4;
+        this->remaining -= 4;
+
+        const auto v = this->get< std::uint16_t >();
+        if (v != version) {
+            const auto msg = "index_import: unsupported version {}, expected {}";
+            throw invalid_args(fmt::format(msg, v, version));
+        }
+
+        header head;
+        head.tag           = this->get< char >();
+        head.flags         = this->get< std::uint8_t >();
+        head.base_zero     = this->get< std::int64_t >();
+        head.physical_zero = this->get< std::int64_t >();
+        head.count         = this->get< std::int64_t >();
+        head.end           = this->get< std::int64_t >();
+        head.checksum      = this->get< std::uint64_t >();
+
+        if (head.tag != tag) {
+            const auto msg = "index_import: index is for protocol '{}', "
+                             "expected '{}'";
+            throw invalid_args(fmt::format(msg, head.tag, tag));
+        }
+
+        if (head.count < 0 or this->remaining / entry_size != head.count
+                           or this->remaining % entry_size != 0) {
+            const auto msg = "index_import: size mismatch, {} bytes left for "
+                             "{} entries of {} bytes each";
+            throw invalid_args(fmt::format(
+                msg, this->remaining, head.count, entry_size));
+        }
+
+        return head;
+    }
+
+private:
+    const unsigned char* p;
+    std::int64_t remaining;
+};
+
+} }
+
+#endif // LFP_BLOB_HPP
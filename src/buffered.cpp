@@ -0,0 +1,343 @@
+#include <algorithm>
+#include <cassert>
+#include <ciso646>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include <lfp/buffered.h>
+#include <lfp/protocol.hpp>
+
+namespace lfp { namespace {
+
+/*
+ * A window of read-ahead over the underlying protocol.
+ *
+ * The window covers the offsets [start, end) of the underlying protocol, and
+ * the underlying protocol is always positioned at end. The read position pos
+ * is always inside the window, i.e. start <= pos <= end, and when pos == end
+ * the window is exhausted, and the next read will refill it.
+ */
+class buffered : public lfp_protocol {
+public:
+    buffered(lfp_protocol*, std::int64_t blocksize, std::int64_t readahead);
+
+    void close() noexcept (false) override;
+    lfp_status readinto(void* dst, std::int64_t len, std::int64_t* bytes_read)
+        noexcept (false) override;
+    lfp_status readview(const void** view,
+                        std::int64_t len,
+                        std::int64_t* bytes_read)
+        noexcept (false) override;
+    lfp_status pread(void* dst,
+                     std::int64_t len,
+                     std::int64_t offset,
+                     std::int64_t* bytes_read)
+        noexcept (false) override;
+
+    int eof() const noexcept (true) override;
+
+    void seek(std::int64_t) noexcept (false) override;
+    std::int64_t tell() const noexcept (true) override;
+    std::int64_t ptell() const noexcept (false) override;
+    lfp_protocol* peel() noexcept (false) override;
+    lfp_protocol* peek() const noexcept (false) override;
+    lfp_protocol* dup() noexcept (false) override;
+
+private:
+    /*
+     * Make a duplicate of other, over the duplicated underlying protocol f,
+     * with a copy of the window
+     */
+    buffered(const buffered& other, lfp_protocol* f);
+
+    /*
+     * The buffer is declared (and allocated) before fp, so that if the
+     * allocation fails, fp is not yet owned and closed by this protocol
+     */
+    std::vector< unsigned char > buffer;
+    std::int64_t blocksize;
+    unique_lfp fp;
+
+    std::int64_t start = 0;
+    std::int64_t end   = 0;
+    std::int64_t pos   = 0;
+    bool at_eof = false;
+
+    std::int64_t capacity() const noexcept (true);
+    std::int64_t buffered_bytes() const noexcept (true);
+    const unsigned char* window() const noexcept (true);
+    lfp_status fill() noexcept (false);
+};
+
+/*
+ * Get the tell of the underlying file if available, or a default 0, so that
+ * non-seekable streams can still be buffered.
+ */
+std::int64_t baseaddr(lfp_protocol* f) noexcept (true) {
+    try {
+        return f->tell();
+    } catch (const lfp::error&) {
+        return 0;
+    }
+}
+
+/*
+ * The window size, readahead rounded up to a multiple of blocksize
+ */
+std::size_t window_size(std::int64_t blocksize, std::int64_t readahead) {
+    assert(blocksize > 0);
+    assert(readahead > 0);
+    const auto blocks = (readahead + blocksize - 1) / blocksize;
+    return std::size_t(blocks * blocksize);
+}
+
+buffered::buffered(lfp_protocol* f,
+                   std::int64_t bs,
+                   std::int64_t readahead) :
+    buffer(window_size(bs, readahead)),
+    blocksize(bs),
+    fp(f)
+{
+    const auto zero = baseaddr(f);
+    this->start = zero;
+    this->end   = zero;
+    this->pos   = zero;
+}
+
+buffered::buffered(const buffered& other, lfp_protocol* f) :
+    buffer(other.buffer),
+    blocksize(other.blocksize),
+    fp(f),
+    start(other.start),
+    end(other.end),
+    pos(other.pos),
+    at_eof(other.at_eof)
+{}
+
+std::int64_t buffered::capacity() const noexcept (true) {
+    return std::int64_t(this->buffer.size());
+}
+
+std::int64_t buffered::buffered_bytes() const noexcept (true) {
+    return this->end - this->pos;
+}
+
+const unsigned char* buffered::window() const noexcept (true) {
+    return this->buffer.data() + (this->pos - this->start);
+}
+
+/*
+ * Refill the window from the underlying protocol. Unconsumed bytes are moved
+ * to the front, and the rest of the window is topped up with a single read,
+ * trimmed so that it ends on a block boundary.
+ */
+lfp_status buffered::fill() noexcept (false) {
+    const auto tail = this->buffered_bytes();
+    assert(tail < this->capacity());
+    if (tail > 0 and this->pos != this->start)
+        std::memmove(this->buffer.data(), this->window(), tail);
+    this->start = this->pos;
+
+    auto len = this->capacity() - tail;
+    const auto target  = this->end + len;
+    const auto aligned = target - target % this->blocksize;
+    if (aligned > this->end)
+        len = aligned - this->end;
+
+    std::int64_t n = 0;
+    const auto err = this->fp->readinto(this->buffer.data() + tail, len, &n);
+    this->end += n;
+    return err;
+}
+
+void buffered::close() noexcept (false) {
+    if (!this->fp) return;
+    this->fp.close();
+}
+
+lfp_status buffered::readinto(
+        void* dst,
+        std::int64_t len,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    read_probe probe(this->iostats, bytes_read);
+    auto* out = static_cast< unsigned char* >(dst);
+    std::int64_t n = 0;
+    lfp_status err = LFP_OK;
+
+    while (n < len) {
+        if (this->buffered_bytes() > 0) {
+            const auto k = (std::min)(len - n, this->buffered_bytes());
+            std::memcpy(out + n, this->window(), k);
+            this->pos += k;
+            n += k;
+            continue;
+        }
+
+        /*
+         * The window is exhausted, and the rest of the read would not fit
+         * anyway, so read straight into the destination rather than copying
+         * it through the window.
+         */
+        const auto remaining = len - n;
+        if (remaining >= this->capacity()) {
+            std::int64_t k = 0;
+            err = this->fp->readinto(out + n, remaining, &k);
+            n += k;
+            this->pos += k;
+            this->start = this->end = this->pos;
+            break;
+        }
+
+        err = this->fill();
+        if (this->buffered_bytes() == 0)
+            break;
+    }
+
+    if (bytes_read)
+        *bytes_read = n;
+
+    if (n == len)
+        return LFP_OK;
+
+    if (err == LFP_EOF)
+        this->at_eof = true;
+    return err;
+}
+
+lfp_status buffered::readview(
+        const void** view,
+        std::int64_t len,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    if (len > this->capacity())
+        return this->lfp_protocol::readview(view, len, bytes_read);
+
+    read_probe probe(this->iostats, bytes_read);
+    lfp_status err = LFP_OK;
+    while (this->buffered_bytes() < len) {
+        const auto before = this->end;
+        err = this->fill();
+        if (this->end == before)
+            break;
+    }
+
+    const auto n = (std::min)(len, this->buffered_bytes());
+    *view = this->window();
+    this->pos += n;
+
+    if (bytes_read)
+        *bytes_read = n;
+
+    if (n == len)
+        return LFP_OK;
+
+    if (err == LFP_EOF)
+        this->at_eof = true;
+    return err;
+}
+
+lfp_status buffered::pread(
+        void* dst,
+        std::int64_t len,
+        std::int64_t offset,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    read_probe probe(this->iostats, bytes_read);
+    /*
+     * The window is tied to the read position, so positional reads go
+     * straight to the underlying protocol
+     */
+    return this->fp->pread(dst, len, offset, bytes_read);
+}
+
+int buffered::eof() const noexcept (true) {
+    /*
+     * Like with FILE, end-of-file is not reported until a read goes past the
+     * end of the file, regardless of how far the read-ahead has gotten
+     */
+    return this->at_eof;
+}
+
+void buffered::seek(std::int64_t n) noexcept (false) {
+    seek_probe probe(this->iostats);
+    assert(n >= 0);
+    if (this->start <= n and n <= this->end) {
+        this->pos = n;
+        this->at_eof = false;
+        return;
+    }
+
+    this->fp->seek(n);
+    this->start = n;
+    this->end   = n;
+    this->pos   = n;
+    this->at_eof = false;
+}
+
+std::int64_t buffered::tell() const noexcept (true) {
+    return this->pos;
+}
+
+std::int64_t buffered::ptell() const noexcept (false) {
+    /*
+     * The underlying protocol has read ahead by the unconsumed part of the
+     * window
+     */
+    return this->fp->ptell() - this->buffered_bytes();
+}
+
+lfp_protocol* buffered::peel() noexcept (false) {
+    assert(this->fp);
+    /*
+     * Hand the underlying protocol back at the position of this protocol, as
+     * if the read-ahead never happened
+     */
+    if (this->buffered_bytes() > 0) {
+        this->fp->seek(this->pos);
+        this->start = this->end = this->pos;
+    }
+    return this->fp.release();
+}
+
+lfp_protocol* buffered::dup() noexcept (false) {
+    /*
+     * The underlying protocol is duplicated at the end of the window, so the
+     * window can be copied as-is
+     */
+    unique_lfp inner(this->fp->dup());
+    try {
+        auto* d = new buffered(*this, inner);
+        inner.release();
+        return d;
+    } catch (const std::bad_alloc&) {
+        throw runtime_error("buffered: unable to duplicate");
+    }
+}
+
+lfp_protocol* buffered::peek() const noexcept (false) {
+    assert(this->fp);
+    return this->fp.get();
+}
+
+}
+
+}
+
+lfp_protocol* lfp_buffered_open(lfp_protocol* f,
+                                std::int64_t blocksize,
+                                std::int64_t readahead) {
+    if (not f) return nullptr;
+    if (blocksize < 0 or readahead < 0) return nullptr;
+
+    if (blocksize == 0) blocksize = 4096;
+    if (readahead == 0) readahead = 64 * 1024;
+
+    try {
+        return new lfp::buffered(f, blocksize, readahead);
+    } catch (...) {
+        return nullptr;
+    }
+}
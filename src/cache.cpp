@@ -0,0 +1,442 @@
+#include <algorithm>
+#include <cassert>
+#include <ciso646>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <lfp/cache.h>
+#include <lfp/protocol.hpp>
+
+namespace lfp { namespace {
+
+/*
+ * A block of the underlying protocol, as read. Blocks are never modified once
+ * they are read, so they can be shared between handles and threads, and are
+ * kept alive by whoever is reading from them, even after they are evicted.
+ *
+ * A block is only shorter than the block size when the underlying protocol
+ * stopped early, and then status says why.
+ */
+struct block {
+    std::vector< unsigned char > data;
+    lfp_status status = LFP_OK;
+
+    std::int64_t size() const noexcept (true) {
+        return std::int64_t(this->data.size());
+    }
+};
+
+using block_ptr = std::shared_ptr< const block >;
+
+/*
+ * The least-recently-used cache of blocks, keyed by block number, i.e. the
+ * offset in the underlying protocol divided by the block size. The most
+ * recently used block is at the front of the list, and the map points into
+ * the list, so that both lookups and promotions are constant time.
+ *
+ * The cache is shared by all duplicates of a cache protocol, and is guarded
+ * by a mutex, which is only held for the lookup, and never while reading.
+ */
+class block_cache {
+public:
+    block_cache(std::int64_t blocksize, std::int64_t capacity);
+
+    std::int64_t blocksize() const noexcept (true);
+
+    block_ptr find(std::int64_t key) noexcept (false);
+    block_ptr insert(std::int64_t key, block_ptr blk) noexcept (false);
+
+private:
+    using entry = std::pair< std::int64_t, block_ptr >;
+
+    std::int64_t bs;
+    std::size_t max_blocks;
+
+    std::mutex mtx;
+    std::list< entry > lru;
+    std::unordered_map< std::int64_t, std::list< entry >::iterator > blocks;
+};
+
+block_cache::block_cache(std::int64_t blocksize, std::int64_t capacity) :
+    bs(blocksize),
+    max_blocks(std::size_t((std::max)(capacity / blocksize, std::int64_t(1))))
+{}
+
+std::int64_t block_cache::blocksize() const noexcept (true) {
+    return this->bs;
+}
+
+block_ptr block_cache::find(std::int64_t key) noexcept (false) {
+    std::lock_guard< std::mutex > lock(this->mtx);
+    const auto itr = this->blocks.find(key);
+    if (itr == this->blocks.end())
+        return nullptr;
+
+    this->lru.splice(this->lru.begin(), this->lru, itr->second);
+    return itr->second->second;
+}
+
+block_ptr block_cache::insert(std::int64_t key, block_ptr blk)
+noexcept (false) {
+    std::lock_guard< std::mutex > lock(this->mtx);
+    /*
+     * Another handle may have read the same block in the meantime, in which
+     * case the block already cached wins, so that all readers see the same
+     * bytes
+     */
+    const auto itr = this->blocks.find(key);
+    if (itr != this->blocks.end()) {
+        this->lru.splice(this->lru.begin(), this->lru, itr->second);
+        return itr->second->second;
+    }
+
+    this->lru.emplace_front(key, blk);
+    try {
+        this->blocks.emplace(key, this->lru.begin());
+    } catch (...) {
+        this->lru.pop_front();
+        throw;
+    }
+
+    while (this->lru.size() > this->max_blocks) {
+        this->blocks.erase(this->lru.back().first);
+        this->lru.pop_back();
+    }
+    return blk;
+}
+
+/*
+ * Serve reads from the block cache, and read whole blocks from the
+ * underlying protocol on misses.
+ *
+ * The position pos is that of the cache protocol, and the underlying
+ * protocol is only moved when a block has to be read. Its tell() is used to
+ * find out if it is already in place, which is the case for sequential reads.
+ */
+class cache : public lfp_protocol {
+public:
+    cache(lfp_protocol*, std::shared_ptr< block_cache >);
+
+    void close() noexcept (false) override;
+    lfp_status readinto(void* dst, std::int64_t len, std::int64_t* bytes_read)
+        noexcept (false) override;
+    lfp_status readview(const void** view,
+                        std::int64_t len,
+                        std::int64_t* bytes_read)
+        noexcept (false) override;
+    lfp_status pread(void* dst,
+                     std::int64_t len,
+                     std::int64_t offset,
+                     std::int64_t* bytes_read)
+        noexcept (false) override;
+
+    int eof() const noexcept (true) override;
+
+    void seek(std::int64_t) noexcept (false) override;
+    std::int64_t tell() const noexcept (true) override;
+    std::int64_t ptell() const noexcept (false) override;
+    lfp_protocol* peel() noexcept (false) override;
+    lfp_protocol* peek() const noexcept (false) override;
+    lfp_protocol* dup() noexcept (false) override;
+
+private:
+    std::shared_ptr< block_cache > blocks;
+    unique_lfp fp;
+
+    std::int64_t pos = 0;
+    bool at_eof = false;
+    /* the block the last readview points into */
+    block_ptr current;
+
+    std::int64_t blocksize() const noexcept (true);
+    block_ptr load(std::int64_t key) noexcept (false);
+    block_ptr load_at(std::int64_t key) noexcept (false);
+    lfp_status copy(unsigned char* dst,
+                    std::int64_t len,
+                    std::int64_t offset,
+                    std::int64_t* bytes_read,
+                    bool positional) noexcept (false);
+};
+
+/*
+ * Only complete blocks, and blocks cut short by end-of-file, describe the
+ * file. Other incomplete reads, e.g. on a blocked stream, are served once
+ * and read again next time.
+ */
+bool cacheable(const block& blk) noexcept (true) {
+    return blk.status == LFP_OK or blk.status == LFP_EOF;
+}
+
+cache::cache(lfp_protocol* f, std::shared_ptr< block_cache > c) :
+    blocks(std::move(c)),
+    fp(f),
+    pos(f->tell())
+{}
+
+std::int64_t cache::blocksize() const noexcept (true) {
+    return this->blocks->blocksize();
+}
+
+/*
+ * Get block key, and read it with seek + readinto on a miss
+ */
+block_ptr cache::load(std::int64_t key) noexcept (false) {
+    auto blk = this->blocks->find(key);
+    if (blk) return blk;
+
+    const auto start = key * this->blocksize();
+    auto fresh = std::make_shared< block >();
+    if (this->fp->eof() or this->fp->tell() != start) {
+        try {
+            this->fp->seek(start);
+        } catch (const lfp::error& e) {
+            /*
+             * Blocks are only read from the current position, or from a
+             * block boundary before it, and the current position is always
+             * a valid offset. If the boundary can't be seeked to, it is the
+             * current position, and the file ends right there, e.g. a
+             * memfile that was read to the last byte.
+             */
+            if (e.status() != LFP_INVALID_ARGS or start != this->pos)
+                throw;
+            fresh->status = LFP_EOF;
+            return fresh;
+        }
+    }
+
+    fresh->data.resize(this->blocksize());
+    std::int64_t n = 0;
+    fresh->status = this->fp->readinto(fresh->data.data(),
+                                       this->blocksize(),
+                                       &n);
+    fresh->data.resize(n);
+
+    if (not cacheable(*fresh))
+        return fresh;
+    return this->blocks->insert(key, std::move(fresh));
+}
+
+/*
+ * Get block key, and read it with pread on a miss, so that it can be called
+ * concurrently
+ */
+block_ptr cache::load_at(std::int64_t key) noexcept (false) {
+    auto blk = this->blocks->find(key);
+    if (blk) return blk;
+
+    auto fresh = std::make_shared< block >();
+    fresh->data.resize(this->blocksize());
+    std::int64_t n = 0;
+    fresh->status = this->fp->pread(fresh->data.data(),
+                                    this->blocksize(),
+                                    key * this->blocksize(),
+                                    &n);
+    fresh->data.resize(n);
+
+    if (not cacheable(*fresh))
+        return fresh;
+    return this->blocks->insert(key, std::move(fresh));
+}
+
+/*
+ * Copy len bytes at offset into dst, block by block. The read stops at the
+ * first short block, with the status the block was read with.
+ */
+lfp_status cache::copy(
+        unsigned char* dst,
+        std::int64_t len,
+        std::int64_t offset,
+        std::int64_t* bytes_read,
+        bool positional)
+noexcept (false) {
+    const auto bs = this->blocksize();
+    lfp_status err = LFP_OK;
+    std::int64_t n = 0;
+
+    while (n < len) {
+        const auto at   = offset + n;
+        const auto key  = at / bs;
+        const auto skip = at - key * bs;
+        const auto blk  = positional ? this->load_at(key) : this->load(key);
+
+        const auto avail = blk->size() - skip;
+        if (avail > 0) {
+            const auto k = (std::min)(len - n, avail);
+            std::memcpy(dst + n, blk->data.data() + skip, k);
+            n += k;
+            /*
+             * Only move the position as the bytes are copied, so that it is
+             * correct even if the next block can't be read
+             */
+            if (not positional)
+                this->pos += k;
+        }
+
+        if (n == len)
+            break;
+
+        if (blk->size() < bs or blk->status != LFP_OK) {
+            err = blk->status;
+            break;
+        }
+    }
+
+    *bytes_read = n;
+    if (n == len)
+        return LFP_OK;
+
+    return err;
+}
+
+void cache::close() noexcept (false) {
+    if (!this->fp) return;
+    this->fp.close();
+}
+
+lfp_status cache::readinto(
+        void* dst,
+        std::int64_t len,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    read_probe probe(this->iostats, bytes_read);
+    auto* out = static_cast< unsigned char* >(dst);
+    const auto err = this->copy(out, len, this->pos, bytes_read, false);
+    if (err == LFP_EOF)
+        this->at_eof = true;
+    return err;
+}
+
+lfp_status cache::readview(
+        const void** view,
+        std::int64_t len,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    const auto bs = this->blocksize();
+    const auto key  = this->pos / bs;
+    const auto skip = this->pos - key * bs;
+    if (skip + len > bs)
+        return this->lfp_protocol::readview(view, len, bytes_read);
+
+    read_probe probe(this->iostats, bytes_read);
+    this->current = this->load(key);
+    const auto& blk = *this->current;
+
+    const auto n = (std::max)(
+        std::int64_t(0),
+        (std::min)(len, blk.size() - skip)
+    );
+    *view = blk.data.data() + (std::min)(skip, blk.size());
+    *bytes_read = n;
+    this->pos += n;
+
+    if (n == len)
+        return LFP_OK;
+
+    if (blk.status == LFP_EOF)
+        this->at_eof = true;
+    return blk.status;
+}
+
+lfp_status cache::pread(
+        void* dst,
+        std::int64_t len,
+        std::int64_t offset,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    read_probe probe(this->iostats, bytes_read);
+    auto* out = static_cast< unsigned char* >(dst);
+    return this->copy(out, len, offset, bytes_read, true);
+}
+
+int cache::eof() const noexcept (true) {
+    return this->at_eof;
+}
+
+void cache::seek(std::int64_t n) noexcept (false) {
+    seek_probe probe(this->iostats);
+    assert(n >= 0);
+    /*
+     * Offsets in (or at the end of) a cached block are known to be valid,
+     * anything else is up to the underlying protocol to accept
+     */
+    const auto key = n / this->blocksize();
+    const auto blk = this->blocks->find(key);
+    if (not blk or n - key * this->blocksize() > blk->size())
+        this->fp->seek(n);
+
+    this->pos = n;
+    this->at_eof = false;
+}
+
+std::int64_t cache::tell() const noexcept (true) {
+    return this->pos;
+}
+
+std::int64_t cache::ptell() const noexcept (false) {
+    /*
+     * The underlying protocol is wherever the last block was read from, so
+     * adjust its ptell by how far that is from the current position
+     */
+    return this->fp->ptell() + (this->pos - this->fp->tell());
+}
+
+lfp_protocol* cache::peel() noexcept (false) {
+    assert(this->fp);
+    /*
+     * Hand the underlying protocol back at the position of this protocol, as
+     * if the reads were never cached
+     */
+    if (this->fp->tell() != this->pos)
+        this->fp->seek(this->pos);
+    return this->fp.release();
+}
+
+lfp_protocol* cache::peek() const noexcept (false) {
+    assert(this->fp);
+    return this->fp.get();
+}
+
+lfp_protocol* cache::dup() noexcept (false) {
+    /*
+     * The duplicate shares the cache, and only remembers the position. Its
+     * underlying protocol is moved when it reads its first uncached block.
+     */
+    unique_lfp inner(this->fp->dup());
+    try {
+        auto* d = new cache(inner, this->blocks);
+        inner.release();
+        d->pos = this->pos;
+        d->at_eof = this->at_eof;
+        return d;
+    } catch (const std::bad_alloc&) {
+        throw runtime_error("cache: unable to duplicate");
+    }
+}
+
+}
+
+}
+
+lfp_protocol* lfp_cache_open(lfp_protocol* f,
+                             std::int64_t blocksize,
+                             std::int64_t capacity) {
+    if (not f) return nullptr;
+    if (blocksize < 0 or capacity < 0) return nullptr;
+
+    if (blocksize == 0) blocksize = 64 * 1024;
+    if (capacity  == 0) capacity  = 16 * 1024 * 1024;
+
+    try {
+        auto blocks = std::make_shared< lfp::block_cache >(blocksize, capacity);
+        return new lfp::cache(f, std::move(blocks));
+    } catch (...) {
+        return nullptr;
+    }
+}
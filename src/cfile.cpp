@@ -6,11 +6,29 @@
 #include <cstring>
 #include <limits>
 #include <memory>
+#include <string>
 #include <type_traits>
 
 #include <fmt/format.h>
 #include <stdio.h>
 
+#if defined(_WIN32)
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <fcntl.h>
+    #include <io.h>
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <limits.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
 #include <lfp/protocol.hpp>
 #include <lfp/lfp.h>
 
@@ -102,6 +120,12 @@ public:
             std::int64_t len,
             std::int64_t* bytes_read)
         noexcept (false) override;
+    lfp_status pread(
+            void* dst,
+            std::int64_t len,
+            std::int64_t offset,
+            std::int64_t* bytes_read)
+        noexcept (false) override;
 
     int eof() const noexcept (false) override;
 
@@ -111,6 +135,7 @@ public:
 
     lfp_protocol* peel() noexcept (false) override;
     lfp_protocol* peek() const noexcept (false) override;
+    lfp_protocol* dup() noexcept (false) override;
 
 private:
     struct del {
@@ -144,6 +169,7 @@ lfp_status cfile::readinto(
         std::int64_t len,
         std::int64_t* bytes_read)
 noexcept (false) {
+    read_probe probe(this->iostats, bytes_read);
     const auto n = std::fread(dst, 1, len, this->fp.get());
     if (bytes_read)
         *bytes_read = n;
@@ -162,16 +188,78 @@ noexcept (false) {
     return LFP_OKINCOMPLETE;
 }
 
+/*
+ * Positional reads go straight to the file descriptor, and bypass the FILE
+ * buffer altogether. That's fine, as the FILE is only ever read from, and it
+ * leaves the FILE position alone.
+ */
+lfp_status cfile::pread(
+        void* dst,
+        std::int64_t len,
+        std::int64_t offset,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    read_probe probe(this->iostats, bytes_read);
+    if (this->zero == -1)
+        throw not_supported(this->ftell_errmsg);
+
+#if defined(_WIN32)
+    (void)dst;
+    (void)len;
+    (void)offset;
+    (void)bytes_read;
+    throw not_supported("pread: not supported for cfile on windows");
+#else
+    const auto fd = fileno(this->fp.get());
+    auto* out = static_cast< char* >(dst);
+    std::int64_t n = 0;
+    while (n < len) {
+        const auto k = ::pread(fd, out + n, len - n, this->zero + offset + n);
+        if (k > 0) {
+            n += k;
+            continue;
+        }
+
+        if (k == 0)
+            break;
+
+        if (errno == EINTR)
+            continue;
+
+        auto msg = "Unable to read from file: {}";
+        throw io_error(fmt::format(msg, std::strerror(errno)));
+    }
+
+    if (bytes_read)
+        *bytes_read = n;
+
+    if (n == len)
+        return LFP_OK;
+
+    return LFP_EOF;
+#endif
+}
+
 int cfile::eof() const noexcept (false) {
     return std::feof(this->fp.get());
 }
 
 void cfile::seek(std::int64_t n) noexcept (false) {
+    seek_probe probe(this->iostats);
     if (this->zero == -1)
         throw not_supported(this->ftell_errmsg);
 
     const auto pos = n + this->zero;
     assert(pos >= 0);
+
+    /*
+     * fseek throws away the stdio buffer even when the position does not
+     * change, so don't seek when the FILE is already there. Seeking also
+     * clears end-of-file, so that has to be done anyway.
+     */
+    if (not std::feof(this->fp.get()) and long_tell(this->fp.get()) == pos)
+        return;
+
     const auto err = long_seek(this->fp.get(), pos);
     if (err)
         throw io_error(std::strerror(errno));
@@ -199,6 +287,92 @@ lfp_protocol* cfile::peek() const noexcept (false) {
     throw lfp::leaf_protocol("peek: not supported for leaf protocol");
 }
 
+/*
+ * Open the file again, read-only, as a new, independent FILE.
+ *
+ * A plain dup() of the file descriptor is not enough, as the descriptors
+ * would share the file position, so the file must be opened anew. There is
+ * no portable way of doing that from a FILE, so this is only supported where
+ * the platform offers a way.
+ */
+std::FILE* reopen(std::FILE* fp) noexcept (false) {
+#if defined(_WIN32)
+    const auto h = reinterpret_cast< HANDLE >(_get_osfhandle(_fileno(fp)));
+    if (h == INVALID_HANDLE_VALUE)
+        throw not_supported("dup: unable to get file handle");
+
+    const auto share = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+    const auto r = ReOpenFile(h, GENERIC_READ, share, 0);
+    if (r == INVALID_HANDLE_VALUE)
+        throw io_error("dup: unable to reopen file");
+
+    const auto fd = _open_osfhandle(
+        reinterpret_cast< std::intptr_t >(r),
+        _O_RDONLY | _O_BINARY
+    );
+    if (fd == -1) {
+        CloseHandle(r);
+        throw io_error(std::strerror(errno));
+    }
+
+    auto* f = _fdopen(fd, "rb");
+    if (not f) {
+        const auto msg = std::string(std::strerror(errno));
+        _close(fd);
+        throw io_error(msg);
+    }
+    return f;
+#else
+    const auto orig = fileno(fp);
+    struct stat sb;
+    if (::fstat(orig, &sb) == -1)
+        throw io_error(std::strerror(errno));
+
+    if (not S_ISREG(sb.st_mode))
+        throw not_supported("dup: only supported for regular files");
+
+    #if defined(__linux__)
+        const auto path = fmt::format("/proc/self/fd/{}", orig);
+    #elif defined(F_GETPATH)
+        char buffer[PATH_MAX];
+        if (::fcntl(orig, F_GETPATH, buffer) == -1)
+            throw io_error(std::strerror(errno));
+        const auto path = std::string(buffer);
+    #else
+        throw not_supported("dup: unable to reopen files on this platform");
+        const auto path = std::string();
+    #endif
+
+    const auto fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        throw io_error(std::strerror(errno));
+
+    auto* f = fdopen(fd, "rb");
+    if (not f) {
+        const auto msg = std::string(std::strerror(errno));
+        ::close(fd);
+        throw io_error(msg);
+    }
+    return f;
+#endif
+}
+
+lfp_protocol* cfile::dup() noexcept (false) {
+    if (this->zero == -1)
+        throw not_supported(this->ftell_errmsg);
+
+    const auto pos = this->ptell();
+    auto fp = unique_file(reopen(this->fp.get()));
+    std::unique_ptr< cfile > d(new cfile(fp.get(), this->zero));
+    fp.release();
+
+    const auto err = long_seek(d->fp.get(), pos);
+    if (err)
+        throw io_error(std::strerror(errno));
+
+    return d.release();
+}
+
 }
 
 }
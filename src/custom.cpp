@@ -0,0 +1,242 @@
+#include <algorithm>
+#include <ciso646>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <fmt/format.h>
+
+#include <lfp/custom.h>
+#include <lfp/protocol.hpp>
+
+namespace lfp { namespace {
+
+/*
+ * A thin shell over the functions in lfp_custom_ops. All the state lives
+ * behind ctx, except end-of-file, which is derived from the status of reads.
+ */
+class custom : public lfp_protocol {
+public:
+    custom(const lfp_custom_ops& ops, void* ctx) noexcept (true);
+    ~custom() override;
+
+    void close() noexcept (false) override;
+    lfp_status readinto(void* dst, std::int64_t len, std::int64_t* bytes_read)
+        noexcept (false) override;
+    lfp_status readview(const void** view,
+                        std::int64_t len,
+                        std::int64_t* bytes_read)
+        noexcept (false) override;
+    lfp_status pread(void* dst,
+                     std::int64_t len,
+                     std::int64_t offset,
+                     std::int64_t* bytes_read)
+        noexcept (false) override;
+
+    int eof() const noexcept (true) override;
+
+    void seek(std::int64_t) noexcept (false) override;
+    std::int64_t tell() const noexcept (false) override;
+    std::int64_t ptell() const noexcept (false) override;
+    lfp_protocol* peel() noexcept (false) override;
+    lfp_protocol* peek() const noexcept (false) override;
+
+private:
+    lfp_custom_ops ops;
+    void* ctx;
+    bool closed = false;
+    bool at_eof = false;
+
+    [[noreturn]]
+    void fail(const char* what, int status) const noexcept (false);
+    lfp_status check_read(const char* what,
+                          int status,
+                          std::int64_t len,
+                          std::int64_t nread) noexcept (false);
+};
+
+custom::custom(const lfp_custom_ops& o, void* c) noexcept (true) :
+    ops(o),
+    ctx(c)
+{}
+
+custom::~custom() {
+    if (not this->closed and this->ops.close)
+        this->ops.close(this->ctx);
+}
+
+/*
+ * Throw the failed status, with the description from errmsg, if there is one
+ */
+void custom::fail(const char* what, int status) const noexcept (false) {
+    const char* msg = this->ops.errmsg ? this->ops.errmsg(this->ctx) : nullptr;
+    if (msg)
+        throw error(lfp_status(status), fmt::format("custom: {}: {}", what, msg));
+
+    const auto generic = "custom: {}: failed with status {}";
+    throw error(lfp_status(status), fmt::format(generic, what, status));
+}
+
+/*
+ * Pass the successful statuses of a read on, and throw the rest. The byte
+ * count comes from outside of lfp, so make sure it makes sense before the
+ * bytes are used.
+ */
+lfp_status custom::check_read(
+        const char* what,
+        int status,
+        std::int64_t len,
+        std::int64_t nread)
+noexcept (false) {
+    switch (status) {
+        case LFP_OK:
+        case LFP_OKINCOMPLETE:
+            break;
+
+        case LFP_EOF:
+            this->at_eof = true;
+            break;
+
+        default:
+            this->fail(what, status);
+    }
+
+    if (nread < 0 or nread > len) {
+        const auto msg = "custom: {}: nread (= {}) not in [0, len (= {})]";
+        throw runtime_error(fmt::format(msg, what, nread, len));
+    }
+    return lfp_status(status);
+}
+
+void custom::close() noexcept (false) {
+    if (this->closed) return;
+    /*
+     * Never call close twice, even when it fails, as there's no telling what
+     * it released before failing
+     */
+    this->closed = true;
+    if (not this->ops.close) return;
+
+    const auto err = this->ops.close(this->ctx);
+    if (err != LFP_OK)
+        this->fail("close", err);
+}
+
+lfp_status custom::readinto(
+        void* dst,
+        std::int64_t len,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    read_probe probe(this->iostats, bytes_read);
+    const auto err = this->ops.read(this->ctx, dst, len, bytes_read);
+    return this->check_read("read", err, len, *bytes_read);
+}
+
+lfp_status custom::readview(
+        const void** view,
+        std::int64_t len,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    if (not this->ops.readview)
+        return this->lfp_protocol::readview(view, len, bytes_read);
+
+    read_probe probe(this->iostats, bytes_read);
+    const auto err = this->ops.readview(this->ctx, view, len, bytes_read);
+    return this->check_read("readview", err, len, *bytes_read);
+}
+
+lfp_status custom::pread(
+        void* dst,
+        std::int64_t len,
+        std::int64_t offset,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    if (not this->ops.pread)
+        return this->lfp_protocol::pread(dst, len, offset, bytes_read);
+
+    read_probe probe(this->iostats, bytes_read);
+    const auto err = this->ops.pread(this->ctx, dst, len, offset, bytes_read);
+    switch (err) {
+        case LFP_OK:
+        case LFP_OKINCOMPLETE:
+        case LFP_EOF:
+            break;
+
+        default:
+            this->fail("pread", err);
+    }
+
+    if (*bytes_read < 0 or *bytes_read > len) {
+        const auto msg = "custom: pread: nread (= {}) not in [0, len (= {})]";
+        throw runtime_error(fmt::format(msg, *bytes_read, len));
+    }
+    return lfp_status(err);
+}
+
+int custom::eof() const noexcept (true) {
+    return this->at_eof;
+}
+
+void custom::seek(std::int64_t n) noexcept (false) {
+    if (not this->ops.seek) {
+        this->lfp_protocol::seek(n);
+        return;
+    }
+
+    seek_probe probe(this->iostats);
+    const auto err = this->ops.seek(this->ctx, n);
+    if (err != LFP_OK)
+        this->fail("seek", err);
+    this->at_eof = false;
+}
+
+std::int64_t custom::tell() const noexcept (false) {
+    if (not this->ops.tell)
+        return this->lfp_protocol::tell();
+
+    std::int64_t n = -1;
+    const auto err = this->ops.tell(this->ctx, &n);
+    if (err != LFP_OK)
+        this->fail("tell", err);
+    return n;
+}
+
+std::int64_t custom::ptell() const noexcept (false) {
+    return this->tell();
+}
+
+lfp_protocol* custom::peel() noexcept (false) {
+    throw lfp::leaf_protocol("peel: not supported for leaf protocol");
+}
+
+lfp_protocol* custom::peek() const noexcept (false) {
+    throw lfp::leaf_protocol("peek: not supported for leaf protocol");
+}
+
+}
+
+}
+
+lfp_protocol* lfp_custom_open(const lfp_custom_ops* ops, void* ctx) {
+    if (not ops) return nullptr;
+
+    /*
+     * Copy as much of ops as the caller knows about, and leave the rest NULL,
+     * so that programs built against older headers keep working
+     */
+    const auto required = offsetof(lfp_custom_ops, read) + sizeof(ops->read);
+    if (ops->size < required) return nullptr;
+
+    lfp_custom_ops copy;
+    std::memset(&copy, 0, sizeof(copy));
+    std::memcpy(&copy, ops, (std::min)(ops->size, sizeof(copy)));
+    copy.size = sizeof(copy);
+    if (not copy.read) return nullptr;
+
+    try {
+        return new lfp::custom(copy, ctx);
+    } catch (...) {
+        return nullptr;
+    }
+}
@@ -0,0 +1,778 @@
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <ciso646>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+
+#if defined(_WIN32)
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <io.h>
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <limits.h>
+    #include <sys/types.h>
+    #include <sys/uio.h>
+    #include <unistd.h>
+#endif
+
+#include <lfp/protocol.hpp>
+#include <lfp/fd.h>
+
+#include "fd.hpp"
+
+namespace lfp { namespace {
+
+#if defined(_WIN32)
+using native = HANDLE;
+const native invalid_native = INVALID_HANDLE_VALUE;
+#else
+using native = int;
+const native invalid_native = -1;
+#endif
+
+/*
+ * Direct I/O requires the buffer, offset and length to be aligned to the
+ * logical block size of the device. 4K is a multiple of that for all devices
+ * in common use.
+ */
+constexpr const std::int64_t direct_alignment = 4096;
+constexpr const std::int64_t direct_buffer_size = 1024 * 1024;
+
+/*
+ * The start of the first aligned block in storage, which must be at least
+ * direct_buffer_size + direct_alignment long
+ */
+unsigned char* aligned_start(std::vector< unsigned char >& storage) noexcept (true) {
+    const auto p = reinterpret_cast< std::uintptr_t >(storage.data());
+    const auto skew = p % direct_alignment;
+    const auto offset = skew ? direct_alignment - skew : 0;
+    return storage.data() + offset;
+}
+
+/*
+ * The aligned bounce buffer for direct preads on this thread. Preads may run
+ * concurrently, with each other and with reads, so they can't share the
+ * buffer of the protocol.
+ */
+unsigned char* pread_buffer() noexcept (false) {
+    thread_local std::vector< unsigned char > storage;
+    if (storage.empty())
+        storage.resize(direct_buffer_size + direct_alignment);
+    return aligned_start(storage);
+}
+
+/*
+ * The largest read that is passed to the operating system in one call. Both
+ * read() and ReadFile() take narrower sizes than std::int64_t.
+ */
+constexpr const std::int64_t max_chunk = 1 << 30;
+
+/*
+ * An owned file descriptor (or HANDLE), which is closed on destruction
+ */
+class descriptor {
+public:
+    explicit descriptor(native h) noexcept (true) : h(h) {}
+    ~descriptor();
+
+    descriptor(const descriptor&) = delete;
+    descriptor& operator = (const descriptor&) = delete;
+
+    native get() const noexcept (true) { return this->h; }
+    native release() noexcept (true);
+    #if defined(_WIN32)
+    void reset(native) noexcept (false);
+    #endif
+    void close() noexcept (false);
+
+private:
+    native h = invalid_native;
+};
+
+/*
+ * A leaf protocol over a file descriptor.
+ *
+ * The position is kept by the protocol, and all reads are positional from
+ * zero + pos, so neither reads nor duplicates move the file offset of the
+ * descriptor. Descriptors that can't seek (zero == -1) are read with plain
+ * read() instead, and don't support seek, tell or pread.
+ */
+class fdfile : public lfp_protocol {
+public:
+    fdfile(native, int flags, std::int64_t zero, std::string seek_errmsg)
+        noexcept (false);
+
+    void close() noexcept (false) override;
+    lfp_status readinto(
+            void* dst,
+            std::int64_t len,
+            std::int64_t* bytes_read)
+        noexcept (false) override;
+    lfp_status readv(
+            const lfp_iovec* iov,
+            int count,
+            std::int64_t* bytes_read)
+        noexcept (false) override;
+    lfp_status pread(
+            void* dst,
+            std::int64_t len,
+            std::int64_t offset,
+            std::int64_t* bytes_read)
+        noexcept (false) override;
+
+    int eof() const noexcept (true) override;
+
+    void seek(std::int64_t) noexcept (false) override;
+    std::int64_t tell() const noexcept (false) override;
+    std::int64_t ptell() const noexcept (false) override;
+
+    lfp_protocol* peel() noexcept (false) override;
+    lfp_protocol* peek() const noexcept (false) override;
+    lfp_protocol* dup() noexcept (false) override;
+
+    native reserve(std::int64_t len, std::int64_t* offset) noexcept (false);
+
+private:
+    /*
+     * The descriptor is declared (and so initialised) first, so that if
+     * opening fails, the destructor of the protocol doesn't close it
+     */
+    descriptor fd;
+    int flags = LFP_FD_NORMAL;
+    std::int64_t zero = 0;
+    std::int64_t pos = 0;
+    bool at_eof = false;
+    std::string seek_errmsg;
+
+    /*
+     * The aligned bounce buffer for direct I/O, which points into
+     * direct_storage
+     */
+    std::vector< unsigned char > direct_storage;
+    unsigned char* direct_buffer = nullptr;
+
+    std::int64_t read_full(void* dst, std::int64_t len, std::int64_t offset)
+        noexcept (false);
+    std::int64_t read_direct(void* dst,
+                             std::int64_t len,
+                             std::int64_t offset,
+                             unsigned char* buffer)
+        noexcept (false);
+    std::int64_t read_stream(void* dst, std::int64_t len) noexcept (false);
+};
+
+#if defined(_WIN32)
+
+std::string last_error() {
+    char* msg = nullptr;
+    const auto flags = FORMAT_MESSAGE_ALLOCATE_BUFFER
+                     | FORMAT_MESSAGE_FROM_SYSTEM
+                     | FORMAT_MESSAGE_IGNORE_INSERTS;
+    const auto len = FormatMessageA(
+        flags,
+        nullptr,
+        GetLastError(),
+        0,
+        reinterpret_cast< LPSTR >(&msg),
+        0,
+        nullptr
+    );
+
+    if (len == 0)
+        return "unknown error";
+
+    auto str = std::string(msg, len);
+    LocalFree(msg);
+    return str;
+}
+
+void close_native(native h) noexcept (false) {
+    if (!CloseHandle(h))
+        throw io_error(fmt::format("fd: unable to close: {}", last_error()));
+}
+
+/*
+ * The current offset of h, or -1 if h is not a (seekable) disk file, in which
+ * case msg describes why
+ */
+std::int64_t current_offset(native h, std::string& msg) noexcept (true) {
+    if (GetFileType(h) != FILE_TYPE_DISK) {
+        msg = "fd: handle is not seekable";
+        return -1;
+    }
+
+    LARGE_INTEGER zero;
+    LARGE_INTEGER cur;
+    zero.QuadPart = 0;
+    if (!SetFilePointerEx(h, zero, &cur, FILE_CURRENT)) {
+        msg = last_error();
+        return -1;
+    }
+    return cur.QuadPart;
+}
+
+/*
+ * Read at most len bytes at offset, returning 0 only at end-of-file
+ */
+std::int64_t read_at(native h, void* dst, std::int64_t len, std::int64_t offset)
+noexcept (false) {
+    OVERLAPPED ov = {};
+    ov.Offset     = DWORD(std::uint64_t(offset) & 0xFFFFFFFF);
+    ov.OffsetHigh = DWORD(std::uint64_t(offset) >> 32);
+
+    DWORD n = 0;
+    const auto chunk = DWORD((std::min)(len, max_chunk));
+    if (ReadFile(h, dst, chunk, &n, &ov))
+        return n;
+
+    if (GetLastError() == ERROR_HANDLE_EOF)
+        return 0;
+
+    const auto msg = "Unable to read from file: {}";
+    throw io_error(fmt::format(msg, last_error()));
+}
+
+std::int64_t read_from(native h, void* dst, std::int64_t len) noexcept (false) {
+    DWORD n = 0;
+    const auto chunk = DWORD((std::min)(len, max_chunk));
+    if (ReadFile(h, dst, chunk, &n, nullptr))
+        return n;
+
+    if (GetLastError() == ERROR_BROKEN_PIPE)
+        return 0;
+
+    const auto msg = "Unable to read from file: {}";
+    throw io_error(fmt::format(msg, last_error()));
+}
+
+native duplicate(native h) noexcept (false) {
+    HANDLE d = INVALID_HANDLE_VALUE;
+    const auto self = GetCurrentProcess();
+    if (!DuplicateHandle(self, h, self, &d, 0, FALSE, DUPLICATE_SAME_ACCESS))
+        throw io_error(fmt::format("dup: unable to duplicate handle: {}",
+                                   last_error()));
+    return d;
+}
+
+/*
+ * Windows only takes access hints and FILE_FLAG_NO_BUFFERING when the file is
+ * opened, so re-open the handle with them if any are set
+ */
+void apply_flags(descriptor& fd, int flags) noexcept (false) {
+    DWORD attrs = 0;
+    if (flags & LFP_FD_SEQUENTIAL) attrs |= FILE_FLAG_SEQUENTIAL_SCAN;
+    if (flags & LFP_FD_RANDOM)     attrs |= FILE_FLAG_RANDOM_ACCESS;
+    if (flags & LFP_FD_DIRECT)     attrs |= FILE_FLAG_NO_BUFFERING;
+    if (attrs == 0)
+        return;
+
+    const auto share = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+    const auto h = ReOpenFile(fd.get(), GENERIC_READ, share, attrs);
+    if (h == INVALID_HANDLE_VALUE) {
+        const auto msg = "fd: unable to re-open handle with flags: {}";
+        throw io_error(fmt::format(msg, last_error()));
+    }
+    fd.reset(h);
+}
+
+#else
+
+void close_native(native fd) noexcept (false) {
+    if (::close(fd) == -1)
+        throw io_error(fmt::format("fd: unable to close: {}",
+                                   std::strerror(errno)));
+}
+
+std::int64_t current_offset(native fd, std::string& msg) noexcept (true) {
+    const auto off = ::lseek(fd, 0, SEEK_CUR);
+    if (off == -1)
+        msg = std::strerror(errno);
+    return off;
+}
+
+std::int64_t read_at(native fd, void* dst, std::int64_t len, std::int64_t offset)
+noexcept (false) {
+    const auto chunk = (std::min)(len, max_chunk);
+    while (true) {
+        const auto n = ::pread(fd, dst, chunk, offset);
+        if (n >= 0)
+            return n;
+
+        if (errno == EINTR)
+            continue;
+
+        const auto msg = "Unable to read from file: {}";
+        throw io_error(fmt::format(msg, std::strerror(errno)));
+    }
+}
+
+std::int64_t read_from(native fd, void* dst, std::int64_t len) noexcept (false) {
+    const auto chunk = (std::min)(len, max_chunk);
+    while (true) {
+        const auto n = ::read(fd, dst, chunk);
+        if (n >= 0)
+            return n;
+
+        if (errno == EINTR)
+            continue;
+
+        const auto msg = "Unable to read from file: {}";
+        throw io_error(fmt::format(msg, std::strerror(errno)));
+    }
+}
+
+/*
+ * The duplicate shares the file offset with the original, but as neither
+ * uses it after the protocol is opened, they are still independent
+ */
+native duplicate(native fd) noexcept (false) {
+    const auto d = ::dup(fd);
+    if (d == -1)
+        throw io_error(fmt::format("dup: unable to duplicate descriptor: {}",
+                                   std::strerror(errno)));
+    return d;
+}
+
+void apply_flags(descriptor& fd, int flags) noexcept (false) {
+    if (flags & LFP_FD_DIRECT) {
+    #if defined(O_DIRECT)
+        const auto fl = ::fcntl(fd.get(), F_GETFL);
+        if (fl == -1 or ::fcntl(fd.get(), F_SETFL, fl | O_DIRECT) == -1) {
+            const auto msg = "fd: unable to enable direct I/O: {}";
+            throw not_supported(fmt::format(msg, std::strerror(errno)));
+        }
+    #elif defined(F_NOCACHE)
+        if (::fcntl(fd.get(), F_NOCACHE, 1) == -1) {
+            const auto msg = "fd: unable to enable direct I/O: {}";
+            throw not_supported(fmt::format(msg, std::strerror(errno)));
+        }
+    #else
+        throw not_supported("fd: direct I/O is not supported on this platform");
+    #endif
+    }
+
+    /*
+     * The advice is only a hint, and failing to apply it is harmless, so the
+     * return value is ignored
+     */
+    #if HAVE_POSIX_FADVISE
+        if (flags & LFP_FD_SEQUENTIAL)
+            posix_fadvise(fd.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+        else if (flags & LFP_FD_RANDOM)
+            posix_fadvise(fd.get(), 0, 0, POSIX_FADV_RANDOM);
+    #endif
+}
+
+#endif
+
+descriptor::~descriptor() {
+    /*
+     * The descriptor will always be closed when the destructor is invoked,
+     * but when close is invoked directly, errors will be propagated
+     */
+    try {
+        this->close();
+    } catch (...) {}
+}
+
+native descriptor::release() noexcept (true) {
+    const auto h = this->h;
+    this->h = invalid_native;
+    return h;
+}
+
+#if defined(_WIN32)
+void descriptor::reset(native h) noexcept (false) {
+    const auto old = this->h;
+    this->h = h;
+    if (old != invalid_native)
+        close_native(old);
+}
+#endif
+
+void descriptor::close() noexcept (false) {
+    if (this->h == invalid_native) return;
+    close_native(this->release());
+}
+
+fdfile::fdfile(native h,
+               int flags,
+               std::int64_t zero,
+               std::string seek_errmsg)
+noexcept (false) :
+    fd(h),
+    flags(flags),
+    zero(zero),
+    seek_errmsg(std::move(seek_errmsg))
+{
+    try {
+        if ((flags & LFP_FD_DIRECT) and zero == -1)
+            throw not_supported("fd: direct I/O requires a seekable file");
+
+        if (flags & LFP_FD_DIRECT) {
+            this->direct_storage.resize(direct_buffer_size + direct_alignment);
+            this->direct_buffer = aligned_start(this->direct_storage);
+        }
+
+        /*
+         * This may replace the descriptor (on Windows), so it must be the
+         * last thing that can fail
+         */
+        apply_flags(this->fd, flags);
+    } catch (...) {
+        /* the caller still owns the descriptor if the protocol can't be opened */
+        this->fd.release();
+        throw;
+    }
+}
+
+void fdfile::close() noexcept (false) {
+    this->fd.close();
+}
+
+/*
+ * Read len bytes at offset, or until end-of-file
+ */
+std::int64_t fdfile::read_full(void* dst,
+                               std::int64_t len,
+                               std::int64_t offset)
+noexcept (false) {
+    if (this->direct_buffer)
+        return this->read_direct(dst, len, offset, this->direct_buffer);
+
+    auto* out = static_cast< unsigned char* >(dst);
+    std::int64_t n = 0;
+    while (n < len) {
+        const auto k = read_at(this->fd.get(), out + n, len - n, offset + n);
+        if (k == 0)
+            break;
+        n += k;
+    }
+    return n;
+}
+
+/*
+ * Read through the aligned buffer, in aligned blocks that cover
+ * [offset, offset + len). A short read that is not a multiple of the
+ * alignment can only happen at end-of-file, and reading on from an unaligned
+ * offset would fail anyway.
+ */
+std::int64_t fdfile::read_direct(void* dst,
+                                 std::int64_t len,
+                                 std::int64_t offset,
+                                 unsigned char* buffer)
+noexcept (false) {
+    auto* out = static_cast< unsigned char* >(dst);
+    std::int64_t n = 0;
+    while (n < len) {
+        const auto at = offset + n;
+        const auto base = at - at % direct_alignment;
+        const auto skip = at - base;
+        const auto span = skip + (len - n);
+        const auto rounded = span + (direct_alignment - span % direct_alignment)
+                                  % direct_alignment;
+        const auto want = (std::min)(rounded, direct_buffer_size);
+
+        std::int64_t got = 0;
+        while (got < want) {
+            const auto k = read_at(
+                this->fd.get(),
+                buffer + got,
+                want - got,
+                base + got
+            );
+            got += k;
+            if (k == 0 or got % direct_alignment != 0)
+                break;
+        }
+
+        if (got <= skip)
+            break;
+
+        const auto k = (std::min)(got - skip, len - n);
+        std::memcpy(out + n, buffer + skip, k);
+        n += k;
+
+        if (got < want)
+            break;
+    }
+    return n;
+}
+
+std::int64_t fdfile::read_stream(void* dst, std::int64_t len) noexcept (false) {
+    auto* out = static_cast< unsigned char* >(dst);
+    std::int64_t n = 0;
+    while (n < len) {
+        const auto k = read_from(this->fd.get(), out + n, len - n);
+        if (k == 0)
+            break;
+        n += k;
+    }
+    return n;
+}
+
+lfp_status fdfile::readinto(
+        void* dst,
+        std::int64_t len,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    read_probe probe(this->iostats, bytes_read);
+    std::int64_t n = 0;
+    if (this->zero == -1) {
+        n = this->read_stream(dst, len);
+    } else {
+        n = this->read_full(dst, len, this->zero + this->pos);
+        this->pos += n;
+    }
+
+    if (bytes_read)
+        *bytes_read = n;
+
+    if (n == len)
+        return LFP_OK;
+
+    /*
+     * Like with FILE, end-of-file is not reported until a read goes past the
+     * end of the file
+     */
+    this->at_eof = true;
+    return LFP_EOF;
+}
+
+lfp_status fdfile::readv(
+        const lfp_iovec* iov,
+        int count,
+        std::int64_t* bytes_read)
+noexcept (false) {
+#if defined(_WIN32) || !HAVE_PREADV
+    return lfp_protocol::readv(iov, count, bytes_read);
+#else
+    if (this->zero == -1 or this->direct_buffer)
+        return lfp_protocol::readv(iov, count, bytes_read);
+
+    read_probe probe(this->iostats, bytes_read);
+
+    std::int64_t want = 0;
+    for (int i = 0; i < count; ++i)
+        want += iov[i].len;
+
+    /*
+     * Pass the buffers on to preadv() as-is, and on short reads, pick up from
+     * where it stopped
+     */
+    std::vector< struct iovec > vec;
+    std::int64_t total = 0;
+    int first = 0;
+    std::int64_t consumed = 0;
+    while (first < count) {
+        vec.clear();
+        const auto last = (std::min)(count, first + IOV_MAX);
+        for (int i = first; i < last; ++i) {
+            const auto skip = i == first ? consumed : 0;
+            struct iovec v;
+            v.iov_base = static_cast< unsigned char* >(iov[i].base) + skip;
+            v.iov_len  = std::size_t(iov[i].len - skip);
+            vec.push_back(v);
+        }
+
+        const auto offset = this->zero + this->pos + total;
+        const auto n = ::preadv(this->fd.get(), vec.data(), vec.size(), offset);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+
+            this->pos += total;
+            if (bytes_read)
+                *bytes_read = total;
+            const auto msg = "Unable to read from file: {}";
+            throw io_error(fmt::format(msg, std::strerror(errno)));
+        }
+
+        if (n == 0)
+            break;
+
+        total += n;
+        auto k = std::int64_t(n);
+        while (first < count and k >= iov[first].len - consumed) {
+            k -= iov[first].len - consumed;
+            consumed = 0;
+            ++first;
+        }
+        consumed += k;
+    }
+
+    this->pos += total;
+    if (bytes_read)
+        *bytes_read = total;
+
+    if (total == want)
+        return LFP_OK;
+
+    this->at_eof = true;
+    return LFP_EOF;
+#endif
+}
+
+lfp_status fdfile::pread(
+        void* dst,
+        std::int64_t len,
+        std::int64_t offset,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    read_probe probe(this->iostats, bytes_read);
+    if (this->zero == -1)
+        throw not_supported(this->seek_errmsg);
+
+    assert(offset >= 0);
+    const auto at = this->zero + offset;
+    const auto n = this->direct_buffer
+                 ? this->read_direct(dst, len, at, pread_buffer())
+                 : this->read_full(dst, len, at);
+    if (bytes_read)
+        *bytes_read = n;
+
+    if (n == len)
+        return LFP_OK;
+
+    return LFP_EOF;
+}
+
+int fdfile::eof() const noexcept (true) {
+    return this->at_eof;
+}
+
+void fdfile::seek(std::int64_t n) noexcept (false) {
+    seek_probe probe(this->iostats);
+    if (this->zero == -1)
+        throw not_supported(this->seek_errmsg);
+
+    assert(n >= 0);
+    this->pos = n;
+    this->at_eof = false;
+}
+
+std::int64_t fdfile::tell() const noexcept (false) {
+    if (this->zero == -1)
+        throw not_supported(this->seek_errmsg);
+    return this->pos;
+}
+
+std::int64_t fdfile::ptell() const noexcept (false) {
+    return this->zero + this->tell();
+}
+
+lfp_protocol* fdfile::peel() noexcept (false) {
+    throw lfp::leaf_protocol("peel: not supported for leaf protocol");
+}
+
+lfp_protocol* fdfile::peek() const noexcept (false) {
+    throw lfp::leaf_protocol("peek: not supported for leaf protocol");
+}
+
+lfp_protocol* fdfile::dup() noexcept (false) {
+    if (this->zero == -1)
+        throw not_supported(this->seek_errmsg);
+
+    descriptor d(duplicate(this->fd.get()));
+    std::unique_ptr< fdfile > f(
+        new fdfile(d.get(), this->flags, this->zero, this->seek_errmsg)
+    );
+    d.release();
+
+    f->pos = this->pos;
+    f->at_eof = this->at_eof;
+    return f.release();
+}
+
+native fdfile::reserve(std::int64_t len, std::int64_t* offset)
+noexcept (false) {
+    if (this->zero == -1)
+        throw not_supported(this->seek_errmsg);
+
+    if (this->direct_buffer)
+        throw not_supported("fd: reads outside the protocol are not "
+                            "supported with direct I/O");
+
+    *offset = this->zero + this->pos;
+    this->pos += len;
+    this->at_eof = false;
+    return this->fd.get();
+}
+
+lfp_protocol* open(native h, int flags) noexcept (false) {
+    std::string seek_errmsg;
+    const auto zero = current_offset(h, seek_errmsg);
+    return new fdfile(h, flags, zero, std::move(seek_errmsg));
+}
+
+}
+
+#if !defined(_WIN32)
+int reserve_read(lfp_protocol* f, std::int64_t len, std::int64_t* offset)
+noexcept (false) {
+    auto* fd = dynamic_cast< fdfile* >(f);
+    if (not fd)
+        throw not_supported("protocol is not an fd protocol");
+    return fd->reserve(len, offset);
+}
+#endif
+
+}
+
+#if defined(_WIN32)
+
+lfp_protocol* lfp_fd_open(int fd, int flags) {
+    const auto h = reinterpret_cast< HANDLE >(_get_osfhandle(fd));
+    if (h == INVALID_HANDLE_VALUE) return nullptr;
+
+    /*
+     * The protocol owns a HANDLE, not the descriptor, so give it a duplicate
+     * of the handle and close the descriptor (and its handle) right away
+     */
+    try {
+        lfp::descriptor d(lfp::duplicate(h));
+        auto* f = lfp::open(d.get(), flags);
+        d.release();
+        _close(fd);
+        return f;
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+lfp_protocol* lfp_handle_open(void* handle, int flags) {
+    if (not handle or handle == INVALID_HANDLE_VALUE) return nullptr;
+
+    try {
+        return lfp::open(static_cast< HANDLE >(handle), flags);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+#else
+
+lfp_protocol* lfp_fd_open(int fd, int flags) {
+    if (fd < 0) return nullptr;
+
+    try {
+        return lfp::open(fd, flags);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+#endif
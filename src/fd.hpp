@@ -0,0 +1,31 @@
+#ifndef LFP_FD_HPP
+#define LFP_FD_HPP
+
+#include <cstdint>
+
+#include <lfp/protocol.hpp>
+
+/*
+ * Internal hooks into the fd protocol, for the io_uring queue. This is an
+ * internal header, and not installed.
+ */
+
+namespace lfp {
+
+#if !defined(_WIN32)
+/*
+ * Reserve the next len bytes of the fd protocol f for a read that happens
+ * outside of it, e.g. an asynchronous one, and get the descriptor and the
+ * absolute offset to read from. The position of f is moved len bytes
+ * forward.
+ *
+ * Throws not_supported if f is not an fd protocol, or if it can't be read
+ * positionally at all.
+ */
+int reserve_read(lfp_protocol* f, std::int64_t len, std::int64_t* offset)
+    noexcept (false);
+#endif
+
+}
+
+#endif // LFP_FD_HPP
@@ -0,0 +1,496 @@
+#include <algorithm>
+#include <cassert>
+#include <ciso646>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <lfp/gzip.h>
+#include <lfp/protocol.hpp>
+
+#if LFP_GZIP
+
+#include <fmt/format.h>
+#include <zlib.h>
+
+namespace lfp { namespace {
+
+/*
+ * Deflate can refer back at most 32K, so that is the history a seek point
+ * needs to restart decompression
+ */
+constexpr const std::size_t window_size = 32 * 1024;
+constexpr const std::size_t input_size  = 64 * 1024;
+
+/*
+ * A place to restart decompression. Points inside a member are at deflate
+ * block boundaries, in the middle of a byte of compressed data, and need the
+ * 32K of decompressed history before them. Points at the start of a member
+ * need nothing, and have an empty window.
+ */
+struct point {
+    /* decompressed offset */
+    std::int64_t out = 0;
+    /* compressed offset, in the underlying protocol, of the next whole byte */
+    std::int64_t in = 0;
+    /* unused bits in the byte before in */
+    int bits = 0;
+    bool member = false;
+    std::vector< unsigned char > window;
+};
+
+/*
+ * The z_stream, which must be initialised before the underlying protocol is
+ * owned, so that a failure leaves it with the caller
+ */
+class inflater {
+public:
+    inflater() {
+        std::memset(&this->strm, 0, sizeof(this->strm));
+        /* 15 + 16 is a 32K window, and gzip headers */
+        if (inflateInit2(&this->strm, 15 + 16) != Z_OK)
+            throw runtime_error("gzip: unable to initialize zlib");
+    }
+
+    ~inflater() {
+        inflateEnd(&this->strm);
+    }
+
+    inflater(const inflater&) = delete;
+    inflater& operator = (const inflater&) = delete;
+
+    z_stream strm;
+};
+
+/*
+ * The decompressed bytes go into a window of twice the deflate history. The
+ * bytes before wpos are the latest output, and when the window is full, the
+ * last 32K is moved to the front, so that there is always as much history as
+ * deflate has, to copy into seek points. Bytes that are decompressed but not
+ * yet read are the pending bytes right before wpos, and more is only
+ * decompressed when there are none.
+ *
+ * Seeks back into the history just make the bytes pending again. Protocols
+ * on top, like tapeimage, step back a few bytes whenever a batched read
+ * overshoots a record, and restarting at a seek point every time would make
+ * reading them very slow.
+ *
+ * The states are:
+ *   inflating  decompressing a member, in gzip mode, or in raw deflate mode
+ *              when restarted from a point inside it
+ *   trailer    skipping the crc and size of a member, after raw deflate
+ *   between    at the end of a member, with more members, or end-of-file,
+ *              to come
+ *   done       the end of the file
+ */
+class gzip : public lfp_protocol {
+public:
+    gzip(lfp_protocol*, std::int64_t spacing);
+
+    void close() noexcept (false) override;
+    lfp_status readinto(void* dst, std::int64_t len, std::int64_t* bytes_read)
+        noexcept (false) override;
+
+    int eof() const noexcept (true) override;
+
+    void seek(std::int64_t) noexcept (false) override;
+    std::int64_t tell() const noexcept (false) override;
+    std::int64_t ptell() const noexcept (false) override;
+    lfp_protocol* peel() noexcept (false) override;
+    lfp_protocol* peek() const noexcept (false) override;
+
+private:
+    enum class state { inflating, trailer, between, done };
+
+    /*
+     * The buffers and the inflater are declared (and allocated) before fp,
+     * so that if the allocation fails, fp is not yet owned and closed by this
+     * protocol
+     */
+    std::vector< unsigned char > input;
+    std::vector< unsigned char > window;
+    inflater z;
+    std::int64_t spacing;
+    unique_lfp fp;
+
+    std::vector< point > points;
+
+    state st = state::inflating;
+    bool raw = false;
+    int trailer_left = 0;
+    bool at_eof = false;
+
+    /* where the next decompressed byte goes */
+    std::size_t wpos = 0;
+    std::int64_t pending = 0;
+    /* bytes decompressed, i.e. the decompressed offset of wpos */
+    std::int64_t out = 0;
+    /* compressed offset right after the last byte read into input */
+    std::int64_t in_end = 0;
+
+    const unsigned char* pending_bytes() const noexcept (true);
+    bool refill() noexcept (false);
+    bool step() noexcept (false);
+    void add_point(bool member) noexcept (false);
+    void restore(const point&) noexcept (false);
+    std::int64_t consumed() const noexcept (true);
+};
+
+/*
+ * Get the tell of the underlying file if available, or a default 0, so that
+ * non-seekable streams can still be decompressed.
+ */
+std::int64_t baseaddr(lfp_protocol* f) noexcept (true) {
+    try {
+        return f->tell();
+    } catch (const lfp::error&) {
+        return 0;
+    }
+}
+
+gzip::gzip(lfp_protocol* f, std::int64_t s) :
+    input(input_size),
+    window(2 * window_size),
+    spacing(s),
+    fp(f)
+{
+    this->in_end = baseaddr(f);
+
+    point start;
+    start.in = this->in_end;
+    start.member = true;
+    this->points.push_back(std::move(start));
+}
+
+const unsigned char* gzip::pending_bytes() const noexcept (true) {
+    return this->window.data() + this->wpos - this->pending;
+}
+
+std::int64_t gzip::consumed() const noexcept (true) {
+    return this->in_end - this->z.strm.avail_in;
+}
+
+/*
+ * Make sure there is input to decompress, and return false if there is none,
+ * i.e. the underlying protocol is at end-of-file, or blocked.
+ */
+bool gzip::refill() noexcept (false) {
+    auto& strm = this->z.strm;
+    if (strm.avail_in > 0)
+        return true;
+
+    std::int64_t n = 0;
+    this->fp->readinto(this->input.data(), this->input.size(), &n);
+    this->in_end += n;
+    strm.next_in = this->input.data();
+    strm.avail_in = uInt(n);
+    return n > 0;
+}
+
+void gzip::add_point(bool member) noexcept (false) {
+    point p;
+    p.out    = this->out;
+    p.in     = this->consumed();
+    p.bits   = member ? 0 : this->z.strm.data_type & 7;
+    p.member = member;
+
+    if (not member) {
+        const auto* w = this->window.data() + this->wpos;
+        const auto history = (std::min)(this->wpos, window_size);
+        p.window.assign(w - history, w);
+    }
+
+    this->points.push_back(std::move(p));
+}
+
+/*
+ * Move the decompression forward, and return false if no progress could be
+ * made because the underlying protocol is blocked. Must only be called when
+ * all pending bytes are read.
+ */
+bool gzip::step() noexcept (false) {
+    assert(this->pending == 0);
+    auto& strm = this->z.strm;
+
+    switch (this->st) {
+        case state::done:
+            return true;
+
+        case state::between: {
+            if (not this->refill()) {
+                if (this->fp->eof())
+                    this->st = state::done;
+                return this->st == state::done;
+            }
+
+            /*
+             * Anything but a new member, like zero padding, ends the file,
+             * like it does for gzip(1)
+             */
+            if (strm.next_in[0] != 0x1F) {
+                this->st = state::done;
+                return true;
+            }
+
+            if (this->out > this->points.back().out)
+                this->add_point(true);
+
+            if (inflateReset2(&strm, 15 + 16) != Z_OK)
+                throw runtime_error("gzip: unable to reset zlib");
+            this->raw = false;
+            this->st = state::inflating;
+            return true;
+        }
+
+        case state::trailer: {
+            if (not this->refill()) {
+                if (this->fp->eof())
+                    throw unexpected_eof("gzip: unexpected end of file");
+                return false;
+            }
+
+            const auto k = (std::min)(int(strm.avail_in), this->trailer_left);
+            strm.next_in  += k;
+            strm.avail_in -= k;
+            this->trailer_left -= k;
+            if (this->trailer_left == 0)
+                this->st = state::between;
+            return true;
+        }
+
+        case state::inflating:
+            break;
+    }
+
+    if (not this->refill()) {
+        if (this->fp->eof())
+            throw unexpected_eof("gzip: unexpected end of file");
+        return false;
+    }
+
+    if (this->wpos == this->window.size()) {
+        const auto* history = this->window.data() + this->wpos - window_size;
+        std::memmove(this->window.data(), history, window_size);
+        this->wpos = window_size;
+    }
+
+    const auto avail = uInt(this->window.size() - this->wpos);
+    strm.next_out  = this->window.data() + this->wpos;
+    strm.avail_out = avail;
+
+    /*
+     * Z_BLOCK makes inflate stop at every deflate block boundary, which is
+     * where seek points can be made
+     */
+    const auto err = inflate(&strm, Z_BLOCK);
+    const auto produced = avail - strm.avail_out;
+    this->wpos    += produced;
+    this->pending += produced;
+    this->out     += produced;
+
+    switch (err) {
+        case Z_OK:
+        case Z_BUF_ERROR:
+            break;
+
+        case Z_STREAM_END:
+            if (this->raw) {
+                this->st = state::trailer;
+                this->trailer_left = 8;
+            } else {
+                this->st = state::between;
+            }
+            return true;
+
+        case Z_MEM_ERROR:
+            throw runtime_error("gzip: out of memory");
+
+        default: {
+            const auto* msg = strm.msg ? strm.msg : "invalid compressed data";
+            const auto at = this->consumed();
+            throw protocol_fatal(fmt::format("gzip: {} (at {})", msg, at));
+        }
+    }
+
+    /*
+     * At the end of a block (128), but not the last one (64)
+     */
+    const auto boundary = (strm.data_type & 128) and not (strm.data_type & 64);
+    if (boundary and this->out >= this->points.back().out + this->spacing)
+        this->add_point(false);
+
+    return true;
+}
+
+/*
+ * Restart decompression at p
+ */
+void gzip::restore(const point& p) noexcept (false) {
+    auto& strm = this->z.strm;
+    const auto start = p.in - (p.bits ? 1 : 0);
+    this->fp->seek(start);
+    this->in_end = start;
+    strm.avail_in = 0;
+
+    const auto bits = p.member ? 15 + 16 : -15;
+    if (inflateReset2(&strm, bits) != Z_OK)
+        throw runtime_error("gzip: unable to reset zlib");
+    this->raw = not p.member;
+
+    if (p.bits) {
+        if (not this->refill())
+            throw unexpected_eof("gzip: unexpected end of file at seek point");
+        const int byte = strm.next_in[0];
+        strm.next_in  += 1;
+        strm.avail_in -= 1;
+        inflatePrime(&strm, p.bits, byte >> (8 - p.bits));
+    }
+
+    if (not p.member) {
+        inflateSetDictionary(&strm, p.window.data(), uInt(p.window.size()));
+        std::copy(p.window.begin(), p.window.end(), this->window.begin());
+    }
+
+    this->wpos = p.window.size();
+    this->pending = 0;
+    this->out = p.out;
+    this->st = state::inflating;
+}
+
+void gzip::close() noexcept (false) {
+    if (!this->fp) return;
+    this->fp.close();
+}
+
+lfp_status gzip::readinto(
+        void* dst,
+        std::int64_t len,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    read_probe probe(this->iostats, bytes_read);
+    auto* p = static_cast< unsigned char* >(dst);
+    std::int64_t n = 0;
+
+    while (n < len) {
+        if (this->pending > 0) {
+            const auto k = (std::min)(len - n, this->pending);
+            std::memcpy(p + n, this->pending_bytes(), k);
+            this->pending -= k;
+            n += k;
+            continue;
+        }
+
+        if (this->st == state::done)
+            break;
+
+        if (not this->step()) {
+            *bytes_read = n;
+            return LFP_OKINCOMPLETE;
+        }
+    }
+
+    *bytes_read = n;
+    if (n == len)
+        return LFP_OK;
+
+    this->at_eof = true;
+    return LFP_EOF;
+}
+
+int gzip::eof() const noexcept (true) {
+    return this->at_eof;
+}
+
+void gzip::seek(std::int64_t n) noexcept (false) {
+    seek_probe probe(this->iostats);
+    assert(n >= 0);
+
+    /*
+     * Going back into the history is just a matter of making the bytes
+     * pending again
+     */
+    const auto pos = this->tell();
+    const auto history = std::int64_t(this->wpos) - this->pending;
+    if (n <= pos and pos - n <= history) {
+        this->pending += pos - n;
+        this->at_eof = false;
+        return;
+    }
+
+    /*
+     * Restart at the closest point before n if going backwards, or if it
+     * saves decompressing the bytes up to it
+     */
+    auto itr = std::upper_bound(
+        this->points.begin(),
+        this->points.end(),
+        n,
+        [](std::int64_t x, const point& p) { return x < p.out; }
+    );
+    assert(itr != this->points.begin());
+    --itr;
+    if (n < pos or itr->out > pos)
+        this->restore(*itr);
+
+    this->at_eof = false;
+    while (this->tell() < n) {
+        if (this->pending > 0) {
+            const auto k = (std::min)(n - this->tell(), this->pending);
+            this->pending -= k;
+            continue;
+        }
+
+        if (this->st == state::done) {
+            const auto msg = "gzip: seek: offset (= {}) >= file size (= {})";
+            throw invalid_args(fmt::format(msg, n, this->out));
+        }
+
+        if (not this->step())
+            throw io_error("gzip: seek: the underlying protocol is blocked");
+    }
+}
+
+std::int64_t gzip::tell() const noexcept (false) {
+    return this->out - this->pending;
+}
+
+std::int64_t gzip::ptell() const noexcept (false) {
+    return this->tell();
+}
+
+lfp_protocol* gzip::peel() noexcept (false) {
+    assert(this->fp);
+    return this->fp.release();
+}
+
+lfp_protocol* gzip::peek() const noexcept (false) {
+    assert(this->fp);
+    return this->fp.get();
+}
+
+}
+
+}
+
+lfp_protocol* lfp_gzip_open(lfp_protocol* f, std::int64_t spacing) {
+    if (not f) return nullptr;
+    if (spacing < 0) return nullptr;
+    if (spacing == 0) spacing = 1024 * 1024;
+
+    try {
+        return new lfp::gzip(f, spacing);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+#else
+
+/*
+ * lfp is built without zlib, so there is nothing to decompress with
+ */
+lfp_protocol* lfp_gzip_open(lfp_protocol*, std::int64_t) {
+    return nullptr;
+}
+
+#endif
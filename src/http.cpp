@@ -0,0 +1,601 @@
+#include <algorithm>
+#include <cassert>
+#include <ciso646>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <lfp/http.h>
+#include <lfp/protocol.hpp>
+
+#if LFP_HTTP
+
+#include <curl/curl.h>
+#include <fmt/format.h>
+
+namespace lfp { namespace {
+
+struct easy_cleanup {
+    void operator () (CURL* c) noexcept (true) { curl_easy_cleanup(c); }
+};
+
+struct multi_cleanup {
+    void operator () (CURLM* c) noexcept (true) { curl_multi_cleanup(c); }
+};
+
+struct slist_free {
+    void operator () (curl_slist* l) noexcept (true) { curl_slist_free_all(l); }
+};
+
+using unique_easy  = std::unique_ptr< CURL, easy_cleanup >;
+using unique_multi = std::unique_ptr< CURLM, multi_cleanup >;
+using unique_slist = std::unique_ptr< curl_slist, slist_free >;
+
+/*
+ * The file on the other end, shared between duplicates
+ */
+struct endpoint {
+    std::string url;
+    unique_slist headers;
+    std::int64_t size = -1;
+    /* response codes only make sense for http(s), and not e.g. file:// */
+    bool http = false;
+};
+
+/*
+ * A range request for count blocks, starting at block first. The body is
+ * received into body, which is never allowed to grow past len, so a server
+ * that ignores the range header and sends the whole file is cut off early.
+ */
+struct transfer {
+    unique_easy easy;
+    std::int64_t first  = 0;
+    std::int64_t count  = 0;
+    std::int64_t offset = 0;
+    std::int64_t len    = 0;
+    std::vector< unsigned char > body;
+    char errbuf[CURL_ERROR_SIZE] = {};
+
+    bool covers(std::int64_t key) const noexcept (true) {
+        return this->first <= key and key < this->first + this->count;
+    }
+};
+
+std::size_t receive(char* p, std::size_t size, std::size_t n, void* userdata)
+noexcept (true) {
+    auto* t = static_cast< transfer* >(userdata);
+    const auto k = size * n;
+    /* returning less than k makes curl fail the transfer */
+    if (t->body.size() + k > std::size_t(t->len))
+        return 0;
+
+    try {
+        t->body.insert(t->body.end(), p, p + k);
+    } catch (...) {
+        return 0;
+    }
+    return k;
+}
+
+void setopt_common(CURL* easy, const endpoint& ep, char* errbuf) {
+    curl_easy_setopt(easy, CURLOPT_URL, ep.url.c_str());
+    curl_easy_setopt(easy, CURLOPT_HTTPHEADER, ep.headers.get());
+    curl_easy_setopt(easy, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(easy, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(easy, CURLOPT_ERRORBUFFER, errbuf);
+}
+
+/*
+ * Set up the request for len bytes at offset, but don't make it
+ */
+std::unique_ptr< transfer > make_transfer(const endpoint& ep,
+                                          std::int64_t offset,
+                                          std::int64_t len) {
+    assert(len > 0);
+    std::unique_ptr< transfer > t(new transfer());
+    t->easy.reset(curl_easy_init());
+    if (not t->easy)
+        throw runtime_error("http: unable to create request");
+
+    t->offset = offset;
+    t->len    = len;
+    t->body.reserve(std::size_t(len));
+
+    auto* easy = t->easy.get();
+    setopt_common(easy, ep, t->errbuf);
+    const auto range = fmt::format("{}-{}", offset, offset + len - 1);
+    curl_easy_setopt(easy, CURLOPT_RANGE, range.c_str());
+    curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, receive);
+    curl_easy_setopt(easy, CURLOPT_WRITEDATA, t.get());
+    curl_easy_setopt(easy, CURLOPT_PRIVATE, t.get());
+    return t;
+}
+
+/*
+ * Check that a finished transfer got exactly the range it asked for, and
+ * throw io_error otherwise
+ */
+void check(const endpoint& ep, const transfer& t, CURLcode result) {
+    if (ep.http) {
+        long code = 0;
+        curl_easy_getinfo(t.easy.get(), CURLINFO_RESPONSE_CODE, &code);
+        const auto whole = t.offset == 0 and t.len == ep.size;
+        if (code == 200 and not whole) {
+            const auto msg = "http: {}: expected 206 Partial Content, got 200 "
+                             "- does the server support range requests?";
+            throw io_error(fmt::format(msg, ep.url));
+        }
+    }
+
+    if (result != CURLE_OK) {
+        const auto* reason = t.errbuf[0] ? t.errbuf : curl_easy_strerror(result);
+        throw io_error(fmt::format("http: {}: {}", ep.url, reason));
+    }
+
+    if (std::int64_t(t.body.size()) != t.len) {
+        const auto msg = "http: {}: expected {} bytes at offset {}, got {}";
+        throw io_error(fmt::format(msg, ep.url, t.len, t.offset, t.body.size()));
+    }
+}
+
+void global_init() {
+    /*
+     * curl_global_init() is not thread safe in older versions of libcurl, so
+     * make sure it is only called once
+     */
+    static std::once_flag flag;
+    static CURLcode result = CURLE_OK;
+    std::call_once(flag, [] { result = curl_global_init(CURL_GLOBAL_DEFAULT); });
+    if (result != CURLE_OK)
+        throw runtime_error("http: unable to initialize libcurl");
+}
+
+/*
+ * Look up the size of the file with a HEAD request (or whatever no-body means
+ * for the scheme)
+ */
+std::shared_ptr< endpoint > connect(const char* url,
+                                    const char* const* headers) {
+    auto ep = std::make_shared< endpoint >();
+    ep->url = url;
+    for (auto* h = headers; h and *h; ++h) {
+        auto* l = curl_slist_append(ep->headers.get(), *h);
+        if (not l)
+            throw runtime_error("http: unable to copy headers");
+        ep->headers.release();
+        ep->headers.reset(l);
+    }
+
+    unique_easy easy(curl_easy_init());
+    if (not easy)
+        throw runtime_error("http: unable to create request");
+
+    char errbuf[CURL_ERROR_SIZE] = {};
+    setopt_common(easy.get(), *ep, errbuf);
+    curl_easy_setopt(easy.get(), CURLOPT_NOBODY, 1L);
+    const auto result = curl_easy_perform(easy.get());
+    if (result != CURLE_OK) {
+        const auto* reason = errbuf[0] ? errbuf : curl_easy_strerror(result);
+        throw io_error(fmt::format("http: {}: {}", ep->url, reason));
+    }
+
+    curl_off_t size = -1;
+    curl_easy_getinfo(easy.get(), CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &size);
+    if (size < 0)
+        throw not_supported(fmt::format("http: {}: size unknown", ep->url));
+    ep->size = std::int64_t(size);
+
+    const char* scheme = nullptr;
+    curl_easy_getinfo(easy.get(), CURLINFO_SCHEME, &scheme);
+    ep->http = scheme and (std::strcmp(scheme, "HTTP")  == 0
+                       or  std::strcmp(scheme, "HTTPS") == 0
+                       or  std::strcmp(scheme, "http")  == 0
+                       or  std::strcmp(scheme, "https") == 0);
+    return ep;
+}
+
+/*
+ * The file is split into blocks of bs bytes, numbered from 0, and the blocks
+ * are either ready (received and kept in ready), in flight (covered by one of
+ * the transfers), or not requested at all.
+ *
+ * Transfers are driven by a curl multi handle, but only from the calling
+ * thread, i.e. progress is only made while in a read. Blocks that arrive
+ * before they are needed wait in ready.
+ */
+class http : public lfp_protocol {
+public:
+    http(std::shared_ptr< const endpoint >, std::int64_t bs, int parallel);
+    ~http() override;
+
+    void close() noexcept (false) override;
+    lfp_status readinto(void* dst, std::int64_t len, std::int64_t* bytes_read)
+        noexcept (false) override;
+    lfp_status pread(void* dst,
+                     std::int64_t len,
+                     std::int64_t offset,
+                     std::int64_t* bytes_read)
+        noexcept (false) override;
+
+    int eof() const noexcept (true) override;
+
+    void seek(std::int64_t) noexcept (false) override;
+    std::int64_t tell() const noexcept (true) override;
+    std::int64_t ptell() const noexcept (true) override;
+    lfp_protocol* peel() noexcept (false) override;
+    lfp_protocol* peek() const noexcept (false) override;
+    lfp_protocol* dup() noexcept (false) override;
+
+private:
+    std::shared_ptr< const endpoint > ep;
+    std::int64_t bs;
+    int parallel;
+
+    /*
+     * The multi handle is declared before the transfers, so that the easy
+     * handles are cleaned up first
+     */
+    unique_multi multi;
+    std::list< std::unique_ptr< transfer > > transfers;
+    std::map< std::int64_t, std::vector< unsigned char > > ready;
+
+    std::int64_t pos = 0;
+    bool at_eof = false;
+
+    std::int64_t blocks() const noexcept (true);
+    bool requested(std::int64_t key) const noexcept (true);
+    void fetch(std::int64_t first, std::int64_t count) noexcept (false);
+    void request(std::int64_t first, std::int64_t last) noexcept (false);
+    void trim(std::int64_t key) noexcept (true);
+    void perform() noexcept (false);
+    void collect(std::int64_t key) noexcept (false);
+    void wait(std::int64_t key) noexcept (false);
+    void drop(std::list< std::unique_ptr< transfer > >::iterator)
+        noexcept (true);
+};
+
+http::http(std::shared_ptr< const endpoint > e, std::int64_t b, int p) :
+    ep(std::move(e)),
+    bs(b),
+    parallel(p),
+    multi(curl_multi_init())
+{
+    if (not this->multi)
+        throw runtime_error("http: unable to create request queue");
+}
+
+http::~http() {
+    while (not this->transfers.empty())
+        this->drop(this->transfers.begin());
+}
+
+std::int64_t http::blocks() const noexcept (true) {
+    return (this->ep->size + this->bs - 1) / this->bs;
+}
+
+bool http::requested(std::int64_t key) const noexcept (true) {
+    if (this->ready.count(key))
+        return true;
+
+    for (const auto& t : this->transfers) {
+        if (t->covers(key))
+            return true;
+    }
+    return false;
+}
+
+void http::drop(std::list< std::unique_ptr< transfer > >::iterator itr)
+noexcept (true) {
+    curl_multi_remove_handle(this->multi.get(), (*itr)->easy.get());
+    this->transfers.erase(itr);
+}
+
+/*
+ * Start a transfer for count blocks, starting at block first
+ */
+void http::fetch(std::int64_t first, std::int64_t count) noexcept (false) {
+    const auto offset = first * this->bs;
+    const auto len = (std::min)(count * this->bs, this->ep->size - offset);
+    auto t = make_transfer(*this->ep, offset, len);
+    t->first = first;
+    t->count = count;
+
+    this->transfers.push_back(std::move(t));
+    const auto err = curl_multi_add_handle(this->multi.get(),
+                                           this->transfers.back()->easy.get());
+    if (err != CURLM_OK) {
+        this->transfers.pop_back();
+        const auto msg = "http: unable to start request: {}";
+        throw runtime_error(fmt::format(msg, curl_multi_strerror(err)));
+    }
+}
+
+/*
+ * Request the blocks [first, last), which are about to be read, and the
+ * read-ahead after them. Blocks that are needed right away are coalesced
+ * into as few requests as possible, and the read-ahead is a request per
+ * block, so that they are fetched in parallel.
+ */
+void http::request(std::int64_t first, std::int64_t last) noexcept (false) {
+    this->trim(first);
+
+    auto key = first;
+    while (key < last) {
+        if (this->requested(key)) {
+            ++key;
+            continue;
+        }
+
+        auto end = key + 1;
+        while (end < last and not this->requested(end))
+            ++end;
+        this->fetch(key, end - key);
+        key = end;
+    }
+
+    const auto ahead = (std::min)(last + this->parallel, this->blocks());
+    for (key = last; key < ahead; ++key) {
+        if (std::int64_t(this->transfers.size()) >= this->parallel)
+            break;
+        if (not this->requested(key))
+            this->fetch(key, 1);
+    }
+
+    /* get the requests going, so they are in flight while this is read */
+    this->perform();
+    this->collect(first);
+}
+
+/*
+ * Drop blocks that are far behind or ahead of block key, and cancel the
+ * transfers that are only for such blocks, as the reader has moved on
+ */
+void http::trim(std::int64_t key) noexcept (true) {
+    const auto lo = key - this->parallel;
+    const auto hi = key + 2 * this->parallel;
+
+    for (auto itr = this->ready.begin(); itr != this->ready.end();) {
+        if (itr->first < lo or itr->first > hi)
+            itr = this->ready.erase(itr);
+        else
+            ++itr;
+    }
+
+    for (auto itr = this->transfers.begin(); itr != this->transfers.end();) {
+        const auto& t = **itr;
+        auto next = std::next(itr);
+        if (t.first + t.count <= lo or t.first > hi)
+            this->drop(itr);
+        itr = next;
+    }
+}
+
+void http::perform() noexcept (false) {
+    int running = 0;
+    const auto err = curl_multi_perform(this->multi.get(), &running);
+    if (err != CURLM_OK) {
+        const auto msg = "http: {}: {}";
+        throw io_error(fmt::format(msg, this->ep->url, curl_multi_strerror(err)));
+    }
+}
+
+/*
+ * Move the blocks of finished transfers to ready. Failed read-ahead is
+ * silently dropped, and will be requested again if it is needed, but if the
+ * transfer for block key failed, the error is thrown.
+ */
+void http::collect(std::int64_t key) noexcept (false) {
+    int remaining = 0;
+    while (auto* msg = curl_multi_info_read(this->multi.get(), &remaining)) {
+        if (msg->msg != CURLMSG_DONE)
+            continue;
+
+        const auto result = msg->data.result;
+        auto itr = std::find_if(
+            this->transfers.begin(),
+            this->transfers.end(),
+            [msg](const std::unique_ptr< transfer >& t) {
+                return t->easy.get() == msg->easy_handle;
+            }
+        );
+        assert(itr != this->transfers.end());
+
+        /*
+         * Take the transfer out of the list, so that it is cleaned up also
+         * when check() throws
+         */
+        std::unique_ptr< transfer > t = std::move(*itr);
+        curl_multi_remove_handle(this->multi.get(), t->easy.get());
+        this->transfers.erase(itr);
+
+        try {
+            check(*this->ep, *t, result);
+        } catch (const lfp::error&) {
+            if (t->covers(key))
+                throw;
+            continue;
+        }
+
+        const auto* body = t->body.data();
+        for (std::int64_t i = 0; i < t->count; ++i) {
+            const auto begin = i * this->bs;
+            const auto end = (std::min)(begin + this->bs, t->len);
+            this->ready[t->first + i].assign(body + begin, body + end);
+        }
+    }
+}
+
+void http::wait(std::int64_t key) noexcept (false) {
+    while (not this->ready.count(key)) {
+        if (not this->requested(key))
+            this->fetch(key, 1);
+
+        this->perform();
+        this->collect(key);
+        if (this->ready.count(key))
+            break;
+
+        const auto err = curl_multi_wait(this->multi.get(),
+                                         nullptr,
+                                         0,
+                                         1000,
+                                         nullptr);
+        if (err != CURLM_OK) {
+            const auto msg = "http: {}: {}";
+            const auto* reason = curl_multi_strerror(err);
+            throw io_error(fmt::format(msg, this->ep->url, reason));
+        }
+    }
+}
+
+void http::close() noexcept (false) {
+    while (not this->transfers.empty())
+        this->drop(this->transfers.begin());
+    this->ready.clear();
+}
+
+lfp_status http::readinto(
+        void* dst,
+        std::int64_t len,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    read_probe probe(this->iostats, bytes_read);
+    auto* out = static_cast< unsigned char* >(dst);
+
+    const auto end = (std::min)(this->pos + len, this->ep->size);
+    if (end > this->pos)
+        this->request(this->pos / this->bs, (end - 1) / this->bs + 1);
+
+    while (this->pos < end) {
+        const auto key = this->pos / this->bs;
+        this->wait(key);
+
+        const auto& blk = this->ready.at(key);
+        const auto skip = this->pos - key * this->bs;
+        const auto size = std::int64_t(blk.size());
+        const auto k = (std::min)(end - this->pos, size - skip);
+        std::memcpy(out + *bytes_read, blk.data() + skip, k);
+        this->pos += k;
+        *bytes_read += k;
+    }
+
+    if (*bytes_read == len)
+        return LFP_OK;
+
+    this->at_eof = true;
+    return LFP_EOF;
+}
+
+lfp_status http::pread(
+        void* dst,
+        std::int64_t len,
+        std::int64_t offset,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    read_probe probe(this->iostats, bytes_read);
+    /*
+     * The blocks and the multi handle belong to the read position, and can't
+     * be shared between threads, so make a separate, blocking request
+     */
+    const auto n = (std::max)(
+        std::int64_t(0),
+        (std::min)(len, this->ep->size - offset)
+    );
+
+    if (n > 0) {
+        auto t = make_transfer(*this->ep, offset, n);
+        const auto result = curl_easy_perform(t->easy.get());
+        check(*this->ep, *t, result);
+        std::memcpy(dst, t->body.data(), n);
+    }
+
+    *bytes_read = n;
+    if (n == len)
+        return LFP_OK;
+
+    return LFP_EOF;
+}
+
+int http::eof() const noexcept (true) {
+    return this->at_eof;
+}
+
+void http::seek(std::int64_t n) noexcept (false) {
+    seek_probe probe(this->iostats);
+    assert(n >= 0);
+    /*
+     * Nothing is requested until the next read, so a run of seeks is free,
+     * and the read-ahead starts from wherever the last one ended up
+     */
+    this->pos = n;
+    this->at_eof = false;
+}
+
+std::int64_t http::tell() const noexcept (true) {
+    return this->pos;
+}
+
+std::int64_t http::ptell() const noexcept (true) {
+    return this->pos;
+}
+
+lfp_protocol* http::peel() noexcept (false) {
+    throw lfp::leaf_protocol("peel: not supported for leaf protocol");
+}
+
+lfp_protocol* http::peek() const noexcept (false) {
+    throw lfp::leaf_protocol("peek: not supported for leaf protocol");
+}
+
+lfp_protocol* http::dup() noexcept (false) {
+    try {
+        auto* d = new http(this->ep, this->bs, this->parallel);
+        d->pos = this->pos;
+        d->at_eof = this->at_eof;
+        return d;
+    } catch (const std::bad_alloc&) {
+        throw runtime_error("http: unable to duplicate");
+    }
+}
+
+}
+
+}
+
+lfp_protocol* lfp_http_open(const char* url,
+                            const char* const* headers,
+                            std::int64_t blocksize,
+                            int parallel) {
+    if (not url) return nullptr;
+    if (blocksize < 0 or parallel < 0) return nullptr;
+
+    if (blocksize == 0) blocksize = 1024 * 1024;
+    if (parallel  == 0) parallel  = 4;
+
+    try {
+        lfp::global_init();
+        auto ep = lfp::connect(url, headers);
+        return new lfp::http(std::move(ep), blocksize, parallel);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+#else
+
+/*
+ * lfp is built without libcurl, so there is no way to make requests
+ */
+lfp_protocol* lfp_http_open(const char*, const char* const*, std::int64_t, int) {
+    return nullptr;
+}
+
+#endif
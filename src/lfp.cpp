@@ -2,6 +2,7 @@
 #include <ciso646>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 
 #include <fmt/format.h>
 
@@ -45,6 +46,95 @@ int lfp_readinto(lfp_protocol* f,
     return LFP_UNHANDLED_EXCEPTION;
 }
 
+int lfp_readview(lfp_protocol* f,
+        const void** view,
+        std::int64_t len,
+        std::int64_t* nread) try {
+    assert(view);
+    assert(f);
+
+    if (len < 0) {
+        f->errmsg(fmt::format("expected len (which is {}) >= 0", len));
+        return LFP_INVALID_ARGS;
+    }
+
+    return f->readview(view, len, nread);
+} catch (const lfp::error& e) {
+    f->errmsg(e.what());
+    return e.status();
+} catch (const std::exception& e) {
+    f->errmsg(e.what());
+    return LFP_UNHANDLED_EXCEPTION;
+} catch (...) {
+    assert(false);
+    f->errmsg("Unhandled error that does not derive from std::exception");
+    return LFP_UNHANDLED_EXCEPTION;
+}
+
+int lfp_readv(lfp_protocol* f,
+        const lfp_iovec* iov,
+        int count,
+        std::int64_t* nread) try {
+    assert(f);
+    assert(iov or count == 0);
+
+    if (count < 0) {
+        f->errmsg(fmt::format("expected count (which is {}) >= 0", count));
+        return LFP_INVALID_ARGS;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        if (iov[i].len < 0) {
+            const auto msg = "expected iov[{}].len (which is {}) >= 0";
+            f->errmsg(fmt::format(msg, i, iov[i].len));
+            return LFP_INVALID_ARGS;
+        }
+    }
+
+    return f->readv(iov, count, nread);
+} catch (const lfp::error& e) {
+    f->errmsg(e.what());
+    return e.status();
+} catch (const std::exception& e) {
+    f->errmsg(e.what());
+    return LFP_UNHANDLED_EXCEPTION;
+} catch (...) {
+    assert(false);
+    f->errmsg("Unhandled error that does not derive from std::exception");
+    return LFP_UNHANDLED_EXCEPTION;
+}
+
+int lfp_pread(lfp_protocol* f,
+        void* dst,
+        std::int64_t len,
+        std::int64_t offset,
+        std::int64_t* nread) try {
+    assert(f);
+    assert(dst or len == 0);
+
+    if (len < 0) {
+        f->errmsg(fmt::format("expected len (which is {}) >= 0", len));
+        return LFP_INVALID_ARGS;
+    }
+
+    if (offset < 0) {
+        f->errmsg(fmt::format("expected offset (which is {}) >= 0", offset));
+        return LFP_INVALID_ARGS;
+    }
+
+    return f->pread(dst, len, offset, nread);
+} catch (const lfp::error& e) {
+    f->errmsg(e.what());
+    return e.status();
+} catch (const std::exception& e) {
+    f->errmsg(e.what());
+    return LFP_UNHANDLED_EXCEPTION;
+} catch (...) {
+    assert(false);
+    f->errmsg("Unhandled error that does not derive from std::exception");
+    return LFP_UNHANDLED_EXCEPTION;
+}
+
 int lfp_seek(lfp_protocol* f, std::int64_t n) try {
     assert(f);
 
@@ -135,11 +225,126 @@ int lfp_peek(lfp_protocol* outer, lfp_protocol** inner) try {
     return e.status();
 }
 
+int lfp_dup(lfp_protocol* f, lfp_protocol** dup) try {
+    assert(f);
+    assert(dup);
+
+    *dup = f->dup();
+    return LFP_OK;
+} catch (const lfp::error& e) {
+    f->errmsg(e.what());
+    return e.status();
+} catch (const std::exception& e) {
+    f->errmsg(e.what());
+    return LFP_UNHANDLED_EXCEPTION;
+} catch (...) {
+    assert(false);
+    f->errmsg("Unhandled error that does not derive from std::exception");
+    return LFP_UNHANDLED_EXCEPTION;
+}
+
 int lfp_eof(lfp_protocol* f) {
     assert(f);
     return f->eof();
 }
 
+int lfp_index_export(lfp_protocol* f,
+        void* dst,
+        std::int64_t len,
+        std::int64_t* size) try {
+    assert(f);
+    assert(size);
+
+    const auto blob = f->index_export();
+    *size = blob.size();
+
+    if (!dst)
+        return LFP_OK;
+
+    if (len < std::int64_t(blob.size())) {
+        const auto msg = "index_export: buffer too small, len = {}, need {}";
+        f->errmsg(fmt::format(msg, len, blob.size()));
+        return LFP_INVALID_ARGS;
+    }
+
+    std::memcpy(dst, blob.data(), blob.size());
+    return LFP_OK;
+} catch (const lfp::error& e) {
+    f->errmsg(e.what());
+    return e.status();
+} catch (const std::exception& e) {
+    f->errmsg(e.what());
+    return LFP_UNHANDLED_EXCEPTION;
+} catch (...) {
+    assert(false);
+    f->errmsg("Unhandled error that does not derive from std::exception");
+    return LFP_UNHANDLED_EXCEPTION;
+}
+
+int lfp_index_import(lfp_protocol* f, const void* src, std::int64_t len) try {
+    assert(f);
+    assert(src or len == 0);
+
+    if (len < 0) {
+        f->errmsg(fmt::format("expected len (which is {}) >= 0", len));
+        return LFP_INVALID_ARGS;
+    }
+
+    f->index_import(src, len);
+    return LFP_OK;
+} catch (const lfp::error& e) {
+    f->errmsg(e.what());
+    return e.status();
+} catch (const std::exception& e) {
+    f->errmsg(e.what());
+    return LFP_UNHANDLED_EXCEPTION;
+} catch (...) {
+    assert(false);
+    f->errmsg("Unhandled error that does not derive from std::exception");
+    return LFP_UNHANDLED_EXCEPTION;
+}
+
+int lfp_stats_get(lfp_protocol* f, lfp_stats* stats) try {
+    assert(f);
+    assert(stats);
+
+    *stats = f->stats();
+    return LFP_OK;
+} catch (const lfp::error& e) {
+    f->errmsg(e.what());
+    return e.status();
+} catch (const std::exception& e) {
+    f->errmsg(e.what());
+    return LFP_UNHANDLED_EXCEPTION;
+} catch (...) {
+    assert(false);
+    f->errmsg("Unhandled error that does not derive from std::exception");
+    return LFP_UNHANDLED_EXCEPTION;
+}
+
+int lfp_stats_reset(lfp_protocol* f) {
+    assert(f);
+    f->reset_stats();
+    return LFP_OK;
+}
+
+int lfp_record_next(lfp_protocol* f, lfp_record* rec) try {
+    assert(f);
+    assert(rec);
+
+    return f->record_next(rec);
+} catch (const lfp::error& e) {
+    f->errmsg(e.what());
+    return e.status();
+} catch (const std::exception& e) {
+    f->errmsg(e.what());
+    return LFP_UNHANDLED_EXCEPTION;
+} catch (...) {
+    assert(false);
+    f->errmsg("Unhandled error that does not derive from std::exception");
+    return LFP_UNHANDLED_EXCEPTION;
+}
+
 const char* lfp_errormsg(lfp_protocol* f) try {
     assert(f);
     return f->errmsg();
@@ -147,6 +352,53 @@ const char* lfp_errormsg(lfp_protocol* f) try {
     return nullptr;
 }
 
+lfp_status lfp_protocol::readview(
+        const void** view,
+        std::int64_t len,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    assert(len >= 0);
+    if (this->view_buffer.size() < std::size_t(len)) {
+        try {
+            this->view_buffer.resize(len);
+        } catch (...) {
+            const auto msg = "readview: unable to allocate buffer of {} bytes";
+            throw lfp::runtime_error(fmt::format(msg, len));
+        }
+    }
+
+    *view = this->view_buffer.data();
+    return this->readinto(this->view_buffer.data(), len, bytes_read);
+}
+
+lfp_status lfp_protocol::readv(
+        const lfp_iovec* iov,
+        int count,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    /*
+     * Keep going as long as buffers are filled completely, but remember the
+     * status - tapeimage returns a recovery status for successful reads.
+     */
+    std::int64_t total = 0;
+    auto status = LFP_OK;
+    for (int i = 0; i < count; ++i) {
+        std::int64_t n = 0;
+        const auto err = this->readinto(iov[i].base, iov[i].len, &n);
+        total += n;
+
+        if (err != LFP_OK)
+            status = err;
+
+        if (n < iov[i].len)
+            break;
+    }
+
+    if (bytes_read)
+        *bytes_read = total;
+    return status;
+}
+
 void lfp_protocol::seek(std::int64_t) noexcept (false) {
     throw lfp::not_implemented("seek: not implemented for layer");
 }
@@ -159,18 +411,102 @@ std::int64_t lfp_protocol::ptell() const noexcept (false) {
     throw lfp::not_implemented("ptell: not implemented for layer");
 }
 
+lfp_status lfp_protocol::pread(
+        void*,
+        std::int64_t,
+        std::int64_t,
+        std::int64_t*)
+noexcept (false) {
+    throw lfp::not_implemented("pread: not implemented for layer");
+}
+
+lfp_protocol* lfp_protocol::dup() noexcept (false) {
+    throw lfp::not_implemented("dup: not implemented for layer");
+}
+
+std::vector< unsigned char > lfp_protocol::index_export() noexcept (false) {
+    throw lfp::not_implemented("index_export: not implemented for layer");
+}
+
+void lfp_protocol::index_import(const void*, std::int64_t) noexcept (false) {
+    throw lfp::not_implemented("index_import: not implemented for layer");
+}
+
+lfp_status lfp_protocol::record_next(lfp_record*) noexcept (false) {
+    throw lfp::not_implemented("record_next: not implemented for layer");
+}
+
+lfp_stats lfp_protocol::stats() const noexcept (false) {
+    using lfp::counters;
+
+    lfp_stats s;
+    std::memset(&s, 0, sizeof(s));
+    s.reads           = counters::get(this->iostats.reads);
+    s.bytes_read      = counters::get(this->iostats.bytes_read);
+    s.seeks           = counters::get(this->iostats.seeks);
+    s.seeks_in_record = counters::get(this->iostats.seeks_in_record);
+    s.seeks_indexed   = counters::get(this->iostats.seeks_indexed);
+    s.seeks_chased    = counters::get(this->iostats.seeks_chased);
+    s.headers_read    = counters::get(this->iostats.headers_read);
+    s.time_ns         = counters::get(this->iostats.time_ns);
+
+    /*
+     * The underlying protocol is only ever called by this one, so the time
+     * spent in it is the time spent in its reads and seeks
+     */
+    try {
+        const auto* inner = this->peek();
+        if (inner)
+            s.inner_time_ns = counters::get(inner->iostats.time_ns);
+    } catch (const lfp::error&) {
+        /* leaf protocol */
+    }
+
+    return s;
+}
+
+void lfp_protocol::reset_stats() noexcept (true) {
+    this->iostats.reset();
+}
+
 const char* lfp_protocol::errmsg() noexcept (true) {
-    if (this->error_message.empty())
+    if (this->error_message[0] == '\0')
         return nullptr;
-    return this->error_message.c_str();
+    return this->error_message;
+}
+
+void lfp_protocol::errmsg(const char* msg) noexcept (true) {
+    const auto len = msg ? std::strlen(msg) : 0;
+    const auto n = len < errmsg_size ? len : errmsg_size - 1;
+    if (n > 0) std::memcpy(this->error_message, msg, n);
+    this->error_message[n] = '\0';
 }
 
-void lfp_protocol::errmsg(std::string msg) noexcept (false) {
-    this->error_message = std::move(msg);
+void lfp_protocol::errmsg(const std::string& msg) noexcept (true) {
+    this->errmsg(msg.c_str());
+}
+
+void* lfp_protocol::operator new (std::size_t n) noexcept (false) {
+    return lfp::arena_allocate(n);
+}
+
+void lfp_protocol::operator delete (void* p) noexcept (true) {
+    lfp::arena_deallocate(p);
 }
 
 namespace lfp {
 
+void counters::reset() noexcept (true) {
+    this->reads.store(0, std::memory_order_relaxed);
+    this->bytes_read.store(0, std::memory_order_relaxed);
+    this->seeks.store(0, std::memory_order_relaxed);
+    this->seeks_in_record.store(0, std::memory_order_relaxed);
+    this->seeks_indexed.store(0, std::memory_order_relaxed);
+    this->seeks_chased.store(0, std::memory_order_relaxed);
+    this->headers_read.store(0, std::memory_order_relaxed);
+    this->time_ns.store(0, std::memory_order_relaxed);
+}
+
 error::error(lfp_status c, const std::string& msg) :
     runtime_error(msg),
     errc(c)
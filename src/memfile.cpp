@@ -1,6 +1,9 @@
 #include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <cassert>
+#include <memory>
+#include <new>
 #include <vector>
 
 #include <fmt/format.h>
@@ -11,18 +14,52 @@
 namespace lfp { namespace {
 
 /*
- * A fixed-size file in memory - is right now a vector, but could just as well
- * be a memory mapped file.
+ * A fixed-size file in memory. The bytes are either owned by the memfile
+ * (copied into a vector), or borrowed from the caller, in which case they are
+ * optionally released with a caller-provided function on close.
  *
  * It is largely intended for testing, but it can surely be used for other
  * things too.
- *
- * TODO: proper mmap implementation
  */
 class memfile : public lfp_protocol {
 public:
+    using release_fn = void (*)(void*);
+
     memfile() = default;
-    memfile(const unsigned char* p, std::size_t len) : mem(p, p + len) {}
+    memfile(const unsigned char* p, std::size_t len) :
+        memfile()
+    {
+        auto storage = std::make_shared< std::vector< unsigned char > >(
+            p,
+            p + len
+        );
+        this->mem = storage->data();
+        this->size = len;
+        this->owner = std::move(storage);
+    }
+    memfile(const unsigned char* p,
+            std::size_t len,
+            release_fn release,
+            void* ctx) :
+        mem(p),
+        size(len)
+    {
+        if (not release)
+            return;
+
+        /*
+         * The releaser is allocated before it is armed, so that a failed
+         * allocation never calls release
+         */
+        auto r = std::make_shared< releaser >();
+        r->release = release;
+        r->ctx = ctx;
+        this->owner = std::move(r);
+    }
+
+    memfile(const memfile&) = delete;
+    memfile& operator = (const memfile&) = delete;
+    ~memfile() override;
 
     void close() noexcept (true) override;
     lfp_status readinto(
@@ -30,6 +67,17 @@ public:
             std::int64_t len,
             std::int64_t* bytes_read)
         noexcept (true) override;
+    lfp_status readview(
+            const void** view,
+            std::int64_t len,
+            std::int64_t* bytes_read)
+        noexcept (true) override;
+    lfp_status pread(
+            void* dst,
+            std::int64_t len,
+            std::int64_t offset,
+            std::int64_t* bytes_read)
+        noexcept (true) override;
 
     int eof() const noexcept (true) override;
 
@@ -39,22 +87,86 @@ public:
 
     lfp_protocol* peel() noexcept (false) override;
     lfp_protocol* peek() const noexcept (false) override;
+    lfp_protocol* dup() noexcept (false) override;
 
 private:
-    std::vector< unsigned char > mem;
+    /*
+     * The uncounted readview(), so that readinto() can use it without
+     * counting the read twice
+     */
+    lfp_status view(const void** view, std::int64_t len, std::int64_t* nread)
+        noexcept (true);
+
+    struct releaser {
+        release_fn release = nullptr;
+        void* ctx = nullptr;
+
+        ~releaser() {
+            if (this->release)
+                this->release(this->ctx);
+        }
+    };
+
+    const unsigned char* mem = nullptr;
+    std::size_t size = 0;
     std::int64_t pos = 0;
+
+    /*
+     * Whatever keeps mem alive, i.e. the copied bytes or the releaser of
+     * adopted memory, or nothing for views. It is shared with duplicates, so
+     * that the memory is released when the last of them is closed.
+     */
+    std::shared_ptr< const void > owner;
 };
 
-void memfile::close() noexcept (true) {}
+memfile::~memfile() {
+    this->close();
+}
+
+void memfile::close() noexcept (true) {
+    /*
+     * close() is invoked by lfp_close(), and again by the destructor, but
+     * the borrowed memory must only be released once
+     */
+    this->owner.reset();
+}
 
 lfp_status memfile::readinto(void* p, std::int64_t len, std::int64_t* nread)
 noexcept (true) {
-    const auto remaining = std::int64_t(this->mem.size() - this->pos);
+    read_probe probe(this->iostats, nread);
+    const void* src = nullptr;
+    std::int64_t n = 0;
+    const auto err = this->view(&src, len, &n);
+    /* mem can be nullptr for empty files, which memcpy doesn't allow */
+    if (n > 0)
+        std::memcpy(p, src, n);
+
+    if (nread)
+        *nread = n;
+
+    return err;
+}
+
+lfp_status memfile::readview(
+        const void** view,
+        std::int64_t len,
+        std::int64_t* nread)
+noexcept (true) {
+    read_probe probe(this->iostats, nread);
+    return this->view(view, len, nread);
+}
+
+lfp_status memfile::view(
+        const void** view,
+        std::int64_t len,
+        std::int64_t* nread)
+noexcept (true) {
+    const auto remaining = std::int64_t(this->size - this->pos);
     const auto n = (std::min)(len, remaining);
     assert(n >= 0);
     assert(this->pos >= 0);
-    assert(std::size_t(this->pos + n) <= this->mem.size());
-    std::memcpy(p, this->mem.data() + this->pos, n);
+    assert(std::size_t(this->pos + n) <= this->size);
+    *view = this->mem + this->pos;
     this->pos += n;
 
     if (nread)
@@ -69,15 +181,40 @@ noexcept (true) {
         return LFP_OKINCOMPLETE;
 }
 
+lfp_status memfile::pread(
+        void* p,
+        std::int64_t len,
+        std::int64_t offset,
+        std::int64_t* nread)
+noexcept (true) {
+    read_probe probe(this->iostats, nread);
+    assert(offset >= 0);
+    const auto size = std::int64_t(this->size);
+    const auto remaining = (std::max)(size - offset, std::int64_t(0));
+    const auto n = (std::min)(len, remaining);
+    /* mem can be nullptr for empty files, which memcpy doesn't allow */
+    if (n > 0)
+        std::memcpy(p, this->mem + offset, n);
+
+    if (nread)
+        *nread = n;
+
+    if (n == len)
+        return LFP_OK;
+
+    return LFP_EOF;
+}
+
 int memfile::eof() const noexcept (true) {
-    return std::size_t(this->pos) == this->mem.size();
+    return std::size_t(this->pos) == this->size;
 }
 
 void memfile::seek(std::int64_t n) noexcept (false) {
+    seek_probe probe(this->iostats);
     assert(n >= 0);
-    if (std::size_t(n) >= this->mem.size()) {
+    if (std::size_t(n) >= this->size) {
         const auto msg = "memfile: seek: offset (= {}) >= file size (= {})";
-        throw invalid_args(fmt::format(msg, n, this->mem.size()));
+        throw invalid_args(fmt::format(msg, n, this->size));
     }
 
     this->pos = n;
@@ -102,6 +239,19 @@ lfp_protocol* memfile::peek() const noexcept (false) {
     throw lfp::leaf_protocol("peek: not supported for leaf protocol");
 }
 
+lfp_protocol* memfile::dup() noexcept (false) {
+    try {
+        auto* d = new memfile();
+        d->mem = this->mem;
+        d->size = this->size;
+        d->pos = this->pos;
+        d->owner = this->owner;
+        return d;
+    } catch (const std::bad_alloc&) {
+        throw runtime_error("memfile: unable to duplicate");
+    }
+}
+
 }
 
 }
@@ -121,3 +271,22 @@ lfp_protocol* lfp_memfile_openwith(const unsigned char* p, std::size_t len) {
         return nullptr;
     }
 }
+
+lfp_protocol* lfp_memfile_openview(const unsigned char* p, std::size_t len) {
+    try {
+        return new lfp::memfile(p, len, nullptr, nullptr);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+lfp_protocol* lfp_memfile_adopt(const unsigned char* p,
+                                std::size_t len,
+                                void (*release)(void*),
+                                void* ctx) {
+    try {
+        return new lfp::memfile(p, len, release, ctx);
+    } catch (...) {
+        return nullptr;
+    }
+}
@@ -0,0 +1,441 @@
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <ciso646>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <new>
+
+#include <fmt/format.h>
+
+#if defined(_WIN32)
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+#include <lfp/protocol.hpp>
+#include <lfp/mmap.h>
+
+namespace lfp { namespace {
+
+/*
+ * A read-only mapping of a file into memory.
+ *
+ * The file descriptor (or HANDLE) is only needed to set up the mapping, and
+ * the POSIX implementation closes it immediately. Windows require that the
+ * file and mapping handles outlive the view, so they're kept until unmap().
+ */
+class mapping {
+public:
+    mapping(const char* path, int advice) noexcept (false);
+    ~mapping();
+
+    mapping(const mapping&) = delete;
+    mapping& operator = (const mapping&) = delete;
+
+    void unmap() noexcept (false);
+
+    const unsigned char* mem = nullptr;
+    std::int64_t size = 0;
+
+private:
+    #if defined(_WIN32)
+    HANDLE file    = INVALID_HANDLE_VALUE;
+    HANDLE handle  = nullptr;
+    #endif
+};
+
+/*
+ * A read-only view of a mapped file. The mapping is shared with duplicates,
+ * and is unmapped when the last of them is closed.
+ */
+class mmapfile : public lfp_protocol {
+public:
+    explicit mmapfile(std::shared_ptr< mapping >) noexcept (true);
+
+    void close() noexcept (false) override;
+    lfp_status readinto(
+            void* dst,
+            std::int64_t len,
+            std::int64_t* bytes_read)
+        noexcept (true) override;
+    lfp_status readview(
+            const void** view,
+            std::int64_t len,
+            std::int64_t* bytes_read)
+        noexcept (true) override;
+    lfp_status pread(
+            void* dst,
+            std::int64_t len,
+            std::int64_t offset,
+            std::int64_t* bytes_read)
+        noexcept (true) override;
+
+    int eof() const noexcept (true) override;
+
+    void seek(std::int64_t) noexcept (true) override;
+    std::int64_t tell() const noexcept (true) override;
+    std::int64_t ptell() const noexcept (true) override;
+
+    lfp_protocol* peel() noexcept (false) override;
+    lfp_protocol* peek() const noexcept (false) override;
+    lfp_protocol* dup() noexcept (false) override;
+
+private:
+    /*
+     * The uncounted readview(), so that readinto() can use it without
+     * counting the read twice
+     */
+    lfp_status view(const void** view, std::int64_t len, std::int64_t* nread)
+        noexcept (true);
+
+    std::shared_ptr< mapping > map;
+    const unsigned char* mem = nullptr;
+    std::int64_t size = 0;
+    std::int64_t pos = 0;
+    bool at_eof = false;
+};
+
+#if defined(_WIN32)
+
+std::string last_error() {
+    char* msg = nullptr;
+    const auto flags = FORMAT_MESSAGE_ALLOCATE_BUFFER
+                     | FORMAT_MESSAGE_FROM_SYSTEM
+                     | FORMAT_MESSAGE_IGNORE_INSERTS;
+    const auto len = FormatMessageA(
+        flags,
+        nullptr,
+        GetLastError(),
+        0,
+        reinterpret_cast< LPSTR >(&msg),
+        0,
+        nullptr
+    );
+
+    if (len == 0)
+        return "unknown error";
+
+    auto str = std::string(msg, len);
+    LocalFree(msg);
+    return str;
+}
+
+mapping::mapping(const char* path, int advice) noexcept (false) {
+    DWORD flags = FILE_ATTRIBUTE_NORMAL;
+    switch (advice) {
+        case LFP_MMAP_SEQUENTIAL: flags |= FILE_FLAG_SEQUENTIAL_SCAN; break;
+        case LFP_MMAP_RANDOM:     flags |= FILE_FLAG_RANDOM_ACCESS;   break;
+        default: break;
+    }
+
+    this->file = CreateFileA(
+        path,
+        GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_DELETE,
+        nullptr,
+        OPEN_EXISTING,
+        flags,
+        nullptr
+    );
+
+    if (this->file == INVALID_HANDLE_VALUE)
+        throw io_error(fmt::format("mmap: unable to open: {}", last_error()));
+
+    LARGE_INTEGER filesize;
+    if (!GetFileSizeEx(this->file, &filesize)) {
+        const auto msg = last_error();
+        CloseHandle(this->file);
+        throw io_error(fmt::format("mmap: unable to get file size: {}", msg));
+    }
+
+    this->size = filesize.QuadPart;
+    /*
+     * Empty files cannot be mapped, but are perfectly valid files. Leave the
+     * mapping empty, and the protocol will report EOF on the first read.
+     */
+    if (this->size == 0)
+        return;
+
+    this->handle = CreateFileMappingA(
+        this->file,
+        nullptr,
+        PAGE_READONLY,
+        0,
+        0,
+        nullptr
+    );
+
+    if (!this->handle) {
+        const auto msg = last_error();
+        CloseHandle(this->file);
+        throw io_error(fmt::format("mmap: unable to map file: {}", msg));
+    }
+
+    auto* view = MapViewOfFile(this->handle, FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        const auto msg = last_error();
+        CloseHandle(this->handle);
+        CloseHandle(this->file);
+        throw io_error(fmt::format("mmap: unable to map file: {}", msg));
+    }
+
+    this->mem = static_cast< const unsigned char* >(view);
+}
+
+void mapping::unmap() noexcept (false) {
+    const auto* view = this->mem;
+    const auto handle = this->handle;
+    const auto file = this->file;
+    this->mem = nullptr;
+    this->handle = nullptr;
+    this->file = INVALID_HANDLE_VALUE;
+
+    if (view and !UnmapViewOfFile(view))
+        throw io_error(fmt::format("mmap: unable to unmap: {}", last_error()));
+
+    if (handle)                        CloseHandle(handle);
+    if (file != INVALID_HANDLE_VALUE)  CloseHandle(file);
+}
+
+#else
+
+mapping::mapping(const char* path, int advice) noexcept (false) {
+    const auto fd = ::open(path, O_RDONLY);
+    if (fd == -1) {
+        const auto msg = "mmap: unable to open: {}";
+        throw io_error(fmt::format(msg, std::strerror(errno)));
+    }
+
+    struct stat sb;
+    if (::fstat(fd, &sb) == -1) {
+        const auto msg = fmt::format("mmap: unable to stat: {}",
+                                     std::strerror(errno));
+        ::close(fd);
+        throw io_error(msg);
+    }
+
+    if (std::uint64_t(sb.st_size) > (std::numeric_limits< std::size_t >::max)()) {
+        ::close(fd);
+        throw not_supported("mmap: file too large to map on this platform");
+    }
+
+    this->size = sb.st_size;
+    /*
+     * Empty files cannot be mapped, but are perfectly valid files. Leave the
+     * mapping empty, and the protocol will report EOF on the first read.
+     */
+    if (this->size == 0) {
+        ::close(fd);
+        return;
+    }
+
+    auto* view = ::mmap(nullptr, this->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    /*
+     * The mapping holds its own reference to the file, so the descriptor can
+     * be closed right away.
+     */
+    ::close(fd);
+
+    if (view == MAP_FAILED) {
+        const auto msg = "mmap: unable to map file: {}";
+        throw io_error(fmt::format(msg, std::strerror(errno)));
+    }
+
+    /*
+     * The advice is only a hint, and failing to apply it is harmless, so
+     * the return value is ignored
+     */
+    switch (advice) {
+        case LFP_MMAP_SEQUENTIAL:
+            posix_madvise(view, this->size, POSIX_MADV_SEQUENTIAL);
+            break;
+        case LFP_MMAP_RANDOM:
+            posix_madvise(view, this->size, POSIX_MADV_RANDOM);
+            break;
+        default:
+            break;
+    }
+
+    this->mem = static_cast< const unsigned char* >(view);
+}
+
+void mapping::unmap() noexcept (false) {
+    auto* view = const_cast< unsigned char* >(this->mem);
+    this->mem = nullptr;
+
+    if (view and ::munmap(view, this->size) == -1) {
+        const auto msg = "mmap: unable to unmap: {}";
+        throw io_error(fmt::format(msg, std::strerror(errno)));
+    }
+}
+
+#endif
+
+mapping::~mapping() {
+    /*
+     * The mapping will always be released when the destructor is invoked,
+     * but when unmap is invoked directly, errors will be propagated
+     */
+    try {
+        this->unmap();
+    } catch (...) {}
+}
+
+mmapfile::mmapfile(std::shared_ptr< mapping > m) noexcept (true) :
+    map(std::move(m)),
+    mem(this->map->mem),
+    size(this->map->size)
+{}
+
+void mmapfile::close() noexcept (false) {
+    /*
+     * Only the last handle to close unmaps the file, and gets to report
+     * errors from it
+     */
+    auto m = std::move(this->map);
+    if (m and m.use_count() == 1)
+        m->unmap();
+}
+
+lfp_status mmapfile::readinto(void* dst, std::int64_t len, std::int64_t* nread)
+noexcept (true) {
+    read_probe probe(this->iostats, nread);
+    const void* src = nullptr;
+    std::int64_t n = 0;
+    const auto err = this->view(&src, len, &n);
+    if (n > 0)
+        std::memcpy(dst, src, n);
+
+    if (nread)
+        *nread = n;
+
+    return err;
+}
+
+lfp_status mmapfile::readview(
+        const void** view,
+        std::int64_t len,
+        std::int64_t* nread)
+noexcept (true) {
+    read_probe probe(this->iostats, nread);
+    return this->view(view, len, nread);
+}
+
+lfp_status mmapfile::view(
+        const void** view,
+        std::int64_t len,
+        std::int64_t* nread)
+noexcept (true) {
+    assert(this->pos >= 0);
+    const auto remaining = (std::max)(this->size - this->pos, std::int64_t(0));
+    const auto n = (std::min)(len, remaining);
+    assert(n >= 0);
+
+    *view = this->mem + (std::min)(this->pos, this->size);
+    this->pos += n;
+
+    if (nread)
+        *nread = n;
+
+    if (n == len)
+        return LFP_OK;
+
+    /*
+     * Like with FILE, end-of-file is not reported until a read goes past the
+     * end of the file
+     */
+    this->at_eof = true;
+    return LFP_EOF;
+}
+
+lfp_status mmapfile::pread(
+        void* dst,
+        std::int64_t len,
+        std::int64_t offset,
+        std::int64_t* nread)
+noexcept (true) {
+    read_probe probe(this->iostats, nread);
+    assert(offset >= 0);
+    const auto remaining = (std::max)(this->size - offset, std::int64_t(0));
+    const auto n = (std::min)(len, remaining);
+    if (n > 0)
+        std::memcpy(dst, this->mem + offset, n);
+
+    if (nread)
+        *nread = n;
+
+    if (n == len)
+        return LFP_OK;
+
+    return LFP_EOF;
+}
+
+int mmapfile::eof() const noexcept (true) {
+    return this->at_eof;
+}
+
+void mmapfile::seek(std::int64_t n) noexcept (true) {
+    seek_probe probe(this->iostats);
+    assert(n >= 0);
+    this->pos = n;
+    this->at_eof = false;
+}
+
+std::int64_t mmapfile::tell() const noexcept (true) {
+    return this->pos;
+}
+
+std::int64_t mmapfile::ptell() const noexcept (true) {
+    /*
+     * The mapping always starts at the beginning of the file, so ptell will
+     * always match logical tell.
+     */
+    return this->tell();
+}
+
+lfp_protocol* mmapfile::peel() noexcept (false) {
+    throw lfp::leaf_protocol("peel: not supported for leaf protocol");
+}
+
+lfp_protocol* mmapfile::peek() const noexcept (false) {
+    throw lfp::leaf_protocol("peek: not supported for leaf protocol");
+}
+
+lfp_protocol* mmapfile::dup() noexcept (false) {
+    try {
+        auto* d = new mmapfile(this->map);
+        d->pos = this->pos;
+        d->at_eof = this->at_eof;
+        return d;
+    } catch (const std::bad_alloc&) {
+        throw runtime_error("mmap: unable to duplicate");
+    }
+}
+
+}
+
+}
+
+lfp_protocol* lfp_mmap_open(const char* path, int advice) {
+    if (not path) return nullptr;
+
+    try {
+        auto map = std::make_shared< lfp::mapping >(path, advice);
+        return new lfp::mmapfile(std::move(map));
+    } catch (...) {
+        return nullptr;
+    }
+}
@@ -0,0 +1,448 @@
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <ciso646>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <lfp/prefetch.h>
+#include <lfp/protocol.hpp>
+
+namespace lfp { namespace {
+
+/*
+ * Blocks are read by a background thread into a ring of fixed-size buffers.
+ *
+ * The ring is shared between the consumer (the caller of readinto()) and the
+ * producer (the worker thread), and is guarded by mtx. The worker fills the
+ * slot at produced % count, and the consumer drains the one at consumed %
+ * count. As the worker never fills more than count slots ahead of the
+ * consumer, the slots themselves can be copied from without holding the
+ * lock.
+ *
+ * The underlying protocol is only ever touched by the worker thread while it
+ * runs. Everything else, like seek() and peel(), first stops the worker.
+ */
+class prefetch : public lfp_protocol {
+public:
+    prefetch(lfp_protocol*, std::int64_t blocksize, int blocks);
+    ~prefetch() override;
+
+    void close() noexcept (false) override;
+    lfp_status readinto(void* dst, std::int64_t len, std::int64_t* bytes_read)
+        noexcept (false) override;
+
+    int eof() const noexcept (true) override;
+
+    void seek(std::int64_t) noexcept (false) override;
+    std::int64_t tell() const noexcept (true) override;
+    std::int64_t ptell() const noexcept (false) override;
+    lfp_protocol* peel() noexcept (false) override;
+    lfp_protocol* peek() const noexcept (false) override;
+    lfp_protocol* dup() noexcept (false) override;
+
+private:
+    struct block {
+        std::vector< unsigned char > data;
+        std::int64_t len = 0;
+        /* ptell of the underlying protocol at the start of the block */
+        std::int64_t ptell = -1;
+    };
+
+    /*
+     * The ring is declared (and allocated) before fp, so that if the
+     * allocation fails, fp is not yet owned and closed by this protocol
+     */
+    std::vector< block > ring;
+    std::int64_t blocksize;
+    unique_lfp fp;
+
+    mutable std::mutex mtx;
+    std::condition_variable ready;
+    std::condition_variable space;
+    std::thread worker;
+
+    /* shared state, guarded by mtx */
+    std::uint64_t produced = 0;
+    std::uint64_t consumed = 0;
+    bool stopping = false;
+    bool done = false;
+    lfp_status done_status = LFP_OK;
+    std::string done_msg;
+    std::int64_t next_ptell = -1;
+    std::string ptell_msg;
+
+    /* consumer state */
+    std::int64_t offset = 0;
+    std::int64_t pos = 0;
+    bool at_eof = false;
+
+    void run() noexcept (true);
+    void start() noexcept (false);
+    void stop() noexcept (true);
+    void reset(std::int64_t n) noexcept (true);
+    std::int64_t prefetched() const noexcept (true);
+    void consume(std::int64_t n) noexcept (true);
+    std::int64_t try_ptell(std::string& msg) noexcept (true);
+};
+
+/*
+ * Wait for pred with timed waits, which libstdc++ implements inline in the
+ * headers. condition_variable::wait() moved into a newer symbol version of
+ * the runtime, which breaks loading lfp next to an older libstdc++, as is
+ * common in conda environments.
+ */
+template < typename Pred >
+void wait(std::condition_variable& cv,
+          std::unique_lock< std::mutex >& lock,
+          Pred pred) {
+    while (not cv.wait_for(lock, std::chrono::milliseconds(100), pred));
+}
+
+/*
+ * Get the tell of the underlying file if available, or a default 0, so that
+ * non-seekable streams can still be prefetched.
+ */
+std::int64_t baseaddr(lfp_protocol* f) noexcept (true) {
+    try {
+        return f->tell();
+    } catch (const lfp::error&) {
+        return 0;
+    }
+}
+
+prefetch::prefetch(lfp_protocol* f, std::int64_t bs, int blocks) :
+    ring(blocks),
+    blocksize(bs),
+    fp(f)
+{
+    assert(blocksize > 0);
+    assert(blocks > 0);
+
+    try {
+        for (auto& b : this->ring)
+            b.data.resize(blocksize);
+
+        this->reset(baseaddr(f));
+        this->next_ptell = this->try_ptell(this->ptell_msg);
+        this->start();
+    } catch (...) {
+        /* the caller still owns f if the protocol can't be opened */
+        this->fp.release();
+        throw;
+    }
+}
+
+prefetch::~prefetch() {
+    this->stop();
+}
+
+/*
+ * The ptell of the underlying protocol, or -1 if it's not available, in which
+ * case msg describes why.
+ */
+std::int64_t prefetch::try_ptell(std::string& msg) noexcept (true) {
+    try {
+        return this->fp->ptell();
+    } catch (const std::exception& e) {
+        msg = e.what();
+        return -1;
+    }
+}
+
+void prefetch::run() noexcept (true) {
+    std::unique_lock< std::mutex > lock(this->mtx);
+    while (true) {
+        wait(this->space, lock, [this] {
+            return this->stopping or (not this->done and
+                this->produced - this->consumed < this->ring.size());
+        });
+
+        if (this->stopping)
+            return;
+
+        auto& b = this->ring[this->produced % this->ring.size()];
+        b.ptell = this->next_ptell;
+        lock.unlock();
+
+        std::int64_t n = 0;
+        lfp_status status = LFP_OK;
+        std::string msg;
+        try {
+            status = this->fp->readinto(b.data.data(), this->blocksize, &n);
+        } catch (const lfp::error& e) {
+            status = e.status();
+            msg = e.what();
+        } catch (const std::exception& e) {
+            status = LFP_UNHANDLED_EXCEPTION;
+            msg = e.what();
+        } catch (...) {
+            status = LFP_UNHANDLED_EXCEPTION;
+            msg = "Unhandled error that does not derive from std::exception";
+        }
+        std::string ptell_msg;
+        const auto ptell = n > 0 ? this->try_ptell(ptell_msg) : b.ptell;
+
+        lock.lock();
+        b.len = n;
+        this->next_ptell = ptell;
+        if (ptell == -1 and not ptell_msg.empty())
+            this->ptell_msg = std::move(ptell_msg);
+        if (n > 0)
+            this->produced += 1;
+
+        /*
+         * Stop on end-of-file and errors. Incomplete reads (e.g. from a pipe)
+         * keep going, unless nothing at all was read, to not spin on a
+         * stream that has nothing to offer
+         */
+        if (status != LFP_OK and (status != LFP_OKINCOMPLETE or n == 0)) {
+            this->done = true;
+            this->done_status = status;
+            this->done_msg = std::move(msg);
+        }
+
+        this->ready.notify_one();
+    }
+}
+
+void prefetch::start() noexcept (false) {
+    this->worker = std::thread(&prefetch::run, this);
+}
+
+void prefetch::stop() noexcept (true) {
+    if (not this->worker.joinable())
+        return;
+
+    {
+        std::lock_guard< std::mutex > lock(this->mtx);
+        this->stopping = true;
+    }
+    this->space.notify_all();
+    this->worker.join();
+    this->stopping = false;
+}
+
+void prefetch::reset(std::int64_t n) noexcept (true) {
+    this->produced = 0;
+    this->consumed = 0;
+    this->done = false;
+    this->done_status = LFP_OK;
+    this->done_msg.clear();
+    this->offset = 0;
+    this->pos = n;
+    this->at_eof = false;
+}
+
+/*
+ * The number of bytes read from the underlying protocol, but not yet consumed.
+ * Only call with mtx held.
+ */
+std::int64_t prefetch::prefetched() const noexcept (true) {
+    std::int64_t n = -this->offset;
+    for (auto i = this->consumed; i < this->produced; ++i)
+        n += this->ring[i % this->ring.size()].len;
+    return n;
+}
+
+/*
+ * Move the read position n bytes forward, releasing blocks to the worker as
+ * they are exhausted. Only call with mtx held, and n <= prefetched().
+ */
+void prefetch::consume(std::int64_t n) noexcept (true) {
+    this->pos += n;
+    while (n > 0) {
+        const auto& b = this->ring[this->consumed % this->ring.size()];
+        const auto k = (std::min)(n, b.len - this->offset);
+        this->offset += k;
+        n -= k;
+
+        if (this->offset == b.len) {
+            this->offset = 0;
+            this->consumed += 1;
+            this->space.notify_one();
+        }
+    }
+}
+
+void prefetch::close() noexcept (false) {
+    this->stop();
+    if (!this->fp) return;
+    this->fp.close();
+}
+
+lfp_status prefetch::readinto(
+        void* dst,
+        std::int64_t len,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    read_probe probe(this->iostats, bytes_read);
+    auto* out = static_cast< unsigned char* >(dst);
+    std::int64_t n = 0;
+    lfp_status status = LFP_OK;
+
+    std::unique_lock< std::mutex > lock(this->mtx);
+    while (n < len) {
+        if (this->consumed < this->produced) {
+            const auto& b = this->ring[this->consumed % this->ring.size()];
+            const auto k = (std::min)(len - n, b.len - this->offset);
+            /*
+             * The worker does not touch this slot until it is consumed, so
+             * it's safe to copy from without holding the lock
+             */
+            lock.unlock();
+            std::memcpy(out + n, b.data.data() + this->offset, k);
+            lock.lock();
+
+            this->consume(k);
+            n += k;
+            continue;
+        }
+
+        if (this->done) {
+            status = this->done_status;
+            break;
+        }
+
+        wait(this->ready, lock, [this] {
+            return this->consumed < this->produced or this->done;
+        });
+    }
+
+    if (bytes_read)
+        *bytes_read = n;
+
+    if (n == len)
+        return LFP_OK;
+
+    switch (status) {
+        case LFP_EOF:
+            this->at_eof = true;
+            return LFP_EOF;
+
+        case LFP_OKINCOMPLETE:
+            /* let the worker try again */
+            this->done = false;
+            this->space.notify_one();
+            return LFP_OKINCOMPLETE;
+
+        default:
+            /*
+             * Hand out the data that was read before the error, and report
+             * the error itself on the next read
+             */
+            if (n > 0)
+                return LFP_OKINCOMPLETE;
+            throw lfp::error(status, this->done_msg);
+    }
+}
+
+int prefetch::eof() const noexcept (true) {
+    return this->at_eof;
+}
+
+void prefetch::seek(std::int64_t n) noexcept (false) {
+    seek_probe probe(this->iostats);
+    assert(n >= 0);
+    {
+        std::lock_guard< std::mutex > lock(this->mtx);
+        if (this->pos <= n and n - this->pos <= this->prefetched()) {
+            this->consume(n - this->pos);
+            this->at_eof = false;
+            return;
+        }
+    }
+
+    this->stop();
+    try {
+        this->fp->seek(n);
+    } catch (...) {
+        /* nothing has changed, so just pick up where the worker left off */
+        this->start();
+        throw;
+    }
+    this->reset(n);
+    this->next_ptell = this->try_ptell(this->ptell_msg);
+    this->start();
+}
+
+std::int64_t prefetch::tell() const noexcept (true) {
+    return this->pos;
+}
+
+std::int64_t prefetch::ptell() const noexcept (false) {
+    std::lock_guard< std::mutex > lock(this->mtx);
+    const auto ptell = this->consumed < this->produced
+        ? this->ring[this->consumed % this->ring.size()].ptell
+        : this->next_ptell;
+
+    if (ptell == -1)
+        throw not_supported(this->ptell_msg);
+
+    return ptell + (this->consumed < this->produced ? this->offset : 0);
+}
+
+lfp_protocol* prefetch::peel() noexcept (false) {
+    assert(this->fp);
+    this->stop();
+    /*
+     * Hand the underlying protocol back at the position of this protocol, as
+     * if the prefetching never happened
+     */
+    if (this->prefetched() > 0) {
+        this->fp->seek(this->pos);
+        this->reset(this->pos);
+    }
+    return this->fp.release();
+}
+
+lfp_protocol* prefetch::dup() noexcept (false) {
+    /*
+     * The underlying protocol belongs to the worker while it runs, so stop it
+     * while duplicating. The duplicate is moved back to the position of this
+     * protocol, and does its own prefetching from there.
+     */
+    this->stop();
+    try {
+        unique_lfp inner(this->fp->dup());
+        inner->seek(this->pos);
+        auto* d = new prefetch(inner, this->blocksize, int(this->ring.size()));
+        inner.release();
+        this->start();
+        return d;
+    } catch (...) {
+        this->start();
+        throw;
+    }
+}
+
+lfp_protocol* prefetch::peek() const noexcept (false) {
+    assert(this->fp);
+    return this->fp.get();
+}
+
+}
+
+}
+
+lfp_protocol* lfp_prefetch_open(lfp_protocol* f,
+                                std::int64_t blocksize,
+                                int blocks) {
+    if (not f) return nullptr;
+    if (blocksize < 0 or blocks < 0) return nullptr;
+
+    if (blocksize == 0) blocksize = 1024 * 1024;
+    if (blocks == 0)    blocks = 4;
+
+    try {
+        return new lfp::prefetch(f, blocksize, blocks);
+    } catch (...) {
+        return nullptr;
+    }
+}
@@ -1,6 +1,7 @@
 #include <cassert>
 #include <ciso646>
 #include <limits>
+#include <memory>
 #include <vector>
 #include <cstring>
 #include <cstdint>
@@ -11,12 +12,17 @@
 #include <lfp/protocol.hpp>
 #include <lfp/rp66.h>
 
+#include "blob.hpp"
+
 namespace lfp { namespace {
 
+/*
+ * The Visible Record Header, as it is stored in the index. The format version
+ * is always [0xFF 0x01], which is checked when the header is read, so it is
+ * not stored.
+ */
 struct header {
-    std::uint16_t  length;
-    unsigned char  format;
-    std::uint8_t   major;
+    std::uint16_t  length = 0;
 
     /*
      * Visible Records do not contain information about their own initial
@@ -35,6 +41,18 @@ struct header {
     static constexpr const int size = 4;
 };
 
+/*
+ * Load the big-endian 32-bit integer at p, i.e. a whole Visible Record
+ * Header, with the length in the high half and the format version in the low
+ * half. Compilers turn this into a single load and byte swap.
+ */
+std::uint32_t be32(const unsigned char* p) noexcept (true) {
+    return std::uint32_t(p[0]) << 24
+         | std::uint32_t(p[1]) << 16
+         | std::uint32_t(p[2]) << 8
+         | std::uint32_t(p[3]);
+}
+
 /**
  * Address translator between base offsets (provided by the underlying
  * layer) and logical offsets (presented to the user).
@@ -72,12 +90,86 @@ private:
 /*
  * The record headers already read by rp66, stored in an order
  * (lower-address first fashion).
+ *
+ * Archives can have tens of millions of Visible Records, so the index is
+ * stored compactly. Visible Records are laid out back-to-back, so a record
+ * starts where the one before it ends, and only the ends are stored. They are
+ * stored in fixed-size blocks, relative to the start of the block, and as a
+ * record is at most 64K, the relative ends of a whole block always fit in 32
+ * bits. That is 4 bytes per record, and the index grows by one block at a
+ * time, with no reallocation of the blocks already filled.
+ *
+ * The headers are materialized on the fly by the iterators, so the index
+ * looks like it stores headers. As iterators only refer to the blocks through
+ * their position, appending to an index that isn't shared does not invalidate
+ * them.
+ *
+ * A ghost node is inserted first, so that the first real header can find its
+ * offset like every other header, from the end of the one before it.
  */
-class record_index : private std::vector< header > {
-    using base = std::vector< header >;
+class record_index {
+    static constexpr const std::size_t block_size = 4096;
+
+    struct block {
+        /* the offset of the first record in the block */
+        std::int64_t start = 0;
+        /* the end of every record in the block, relative to start */
+        std::vector< std::uint32_t, arena_allocator< std::uint32_t > > ends;
+    };
+
+    struct storage {
+        std::vector< std::shared_ptr< block >,
+                     arena_allocator< std::shared_ptr< block > > > blocks;
+        std::int64_t count = 0;
+        /* the number of blocks dropped from the front, see forget() */
+        std::int64_t forgotten = 0;
+    };
 
 public:
-    using iterator = base::const_iterator;
+    class iterator {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type        = header;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = const header*;
+        using reference         = header;
+
+        /*
+         * The headers are not stored, so operator-> must hand out a pointer
+         * to a temporary
+         */
+        class arrow {
+        public:
+            explicit arrow(const header& h) : head(h) {}
+            const header* operator -> () const noexcept (true) {
+                return &this->head;
+            }
+        private:
+            header head;
+        };
+
+        iterator() = default;
+
+        header operator * () const noexcept (true);
+        arrow operator -> () const noexcept (true);
+
+        iterator& operator ++ () noexcept (true);
+        iterator& operator -- () noexcept (true);
+        iterator& operator += (difference_type) noexcept (true);
+        iterator operator + (difference_type) const noexcept (true);
+        difference_type operator - (const iterator&) const noexcept (true);
+
+        bool operator == (const iterator&) const noexcept (true);
+        bool operator != (const iterator&) const noexcept (true);
+        bool operator >= (const iterator&) const noexcept (true);
+
+    private:
+        friend class record_index;
+        iterator(const storage* s, difference_type p) : store(s), pos(p) {}
+
+        const storage* store = nullptr;
+        difference_type pos = 0;
+    };
 
     explicit record_index(address_map m);
     /*
@@ -94,17 +186,40 @@ public:
      */
     iterator find(std::int64_t n, iterator hint) const noexcept (false);
 
+    /*
+     * Append a header. It must start where the last header in the index
+     * ends.
+     */
     void append(const header& head) noexcept (false);
 
+    /*
+     * Forget all but the last two blocks, the one being filled and the one
+     * before it, so that the index of a stream stays small. Positions are
+     * unchanged, but the headers in forgotten blocks can no longer be found
+     * or iterated over.
+     */
+    void forget() noexcept (true);
+
     iterator last() const noexcept (true);
     std::size_t size() const noexcept (true);
     bool empty() const noexcept (true);
+    /* the memory allocated for the headers, in bytes */
+    std::size_t memory() const noexcept (true);
     iterator begin() const noexcept (true);
+    iterator end() const noexcept (true);
 
     iterator::difference_type index_of(const iterator&) const noexcept (true);
 
 private:
     address_map addr;
+
+    /*
+     * The blocks are shared with the indices of duplicated handles (see
+     * lfp_dup), and copied on write. Only the last block is ever written to,
+     * so the filled blocks stay shared, and appending never changes anything
+     * that is shared, so no handle can invalidate the iterators of another.
+     */
+    std::shared_ptr< storage > headers;
 };
 
 /**
@@ -171,7 +286,7 @@ private:
 
 class rp66 : public lfp_protocol {
 public:
-    rp66(lfp_protocol*);
+    rp66(lfp_protocol*, bool stream = false);
 
     // TODO: there must be a "reset" semantic for when there's a read error to
     // put it back into a valid state
@@ -179,6 +294,17 @@ public:
     void close() noexcept (false) override;
     lfp_status readinto(void* dst, std::int64_t len, std::int64_t* bytes_read)
         noexcept (false) override;
+    lfp_status readview(const void** view,
+                        std::int64_t len,
+                        std::int64_t* bytes_read)
+        noexcept (false) override;
+    lfp_status readv(const lfp_iovec* iov, int count, std::int64_t* bytes_read)
+        noexcept (false) override;
+    lfp_status pread(void* dst,
+                     std::int64_t len,
+                     std::int64_t offset,
+                     std::int64_t* bytes_read)
+        noexcept (false) override;
 
     int eof() const noexcept (true) override;
     std::int64_t tell() const noexcept (true) override;
@@ -186,15 +312,101 @@ public:
     void seek(std::int64_t) noexcept (false) override;
     lfp_protocol* peel() noexcept (false) override;
     lfp_protocol* peek() const noexcept (false) override;
+    lfp_protocol* dup() noexcept (false) override;
+
+    std::vector< unsigned char > index_export() noexcept (false) override;
+    void index_import(const void*, std::int64_t) noexcept (false) override;
+    lfp_stats stats() const noexcept (false) override;
+    lfp_status record_next(lfp_record*) noexcept (false) override;
+
+    /*
+     * Walk and index all headers up to end-of-file, and report the number of
+     * Visible Records and logical size of the file. The position of the read
+     * head is unchanged.
+     */
+    void build_index(std::int64_t* records, std::int64_t* size)
+        noexcept (false);
 
 private:
+    /*
+     * Make a duplicate of other, over the duplicated underlying protocol f,
+     * sharing the index and starting at the same position.
+     */
+    rp66(const rp66& other, lfp_protocol* f) noexcept (true);
+
+    /*
+     * Only read forwards, and never seek the underlying protocol, see
+     * lfp_rp66_open_stream. The index only keeps the last block or two of
+     * headers, and everything that needs the rest of it, or to seek, is not
+     * supported.
+     */
+    bool stream = false;
+    void require_seekable(const char* what) const noexcept (false);
+    void seek_forward(std::int64_t n) noexcept (false);
+    std::int64_t discard(std::int64_t n) noexcept (false);
+
     unique_lfp fp;
     address_map addr;
     record_index index;
     read_head current;
 
-    std::int64_t readinto(void*, std::int64_t) noexcept (false);
+    /*
+     * Read up to len bytes, but never past the end of the current record
+     * unless batched. bytes_read is incremented as bytes are copied, also
+     * when an error is thrown part-way through a batch.
+     */
+    std::int64_t readinto(void*, std::int64_t, std::int64_t& bytes_read)
+        noexcept (false);
+    std::int64_t readbatch(void*, std::int64_t, std::int64_t& bytes_read)
+        noexcept (false);
+    void advance_to_data() noexcept (false);
+    void skip_to(std::int64_t) noexcept (false);
+    void skip_record() noexcept (false);
     bool read_header_from_disk() noexcept (false);
+    bool header_read_ok(lfp_status err, std::int64_t n) const noexcept (false);
+    void index_header(const unsigned char* raw) noexcept (false);
+
+    /*
+     * Index the headers in buffer, which starts at the offset start and is len
+     * bytes long, for as long as they are valid. Returns the number of headers
+     * indexed, and leaves the first invalid header to index_header(), which
+     * reports it.
+     */
+    std::int64_t index_buffered(const unsigned char* buffer,
+                                std::int64_t start,
+                                std::int64_t len) noexcept (false);
+
+    /*
+     * build_index() reads this many bytes at a time, so that Visible Records
+     * smaller than this are indexed without a seek or read per header.
+     * Sequential reads up to this size are batched the same way.
+     */
+    static constexpr const std::int64_t index_batch_size = 64 * 1024;
+
+    std::vector< lfp_iovec, arena_allocator< lfp_iovec > > slice;
+
+    /*
+     * Sequential reads that cross Visible Records are read in batches, see
+     * tapeimage. Only done when the underlying file reports a tell().
+     */
+    bool batched = false;
+    std::vector< unsigned char, arena_allocator< unsigned char > > batch;
+
+    /*
+     * true when the index covers the whole file, i.e. indexing has hit
+     * end-of-file right where the next header would be.
+     */
+    bool indexed_all = false;
+
+    /*
+     * A checksum of the first headers, and a copy of the last header, exactly
+     * as they were read from disk. See tapeimage.
+     */
+    static constexpr const std::size_t sampled_headers = 8;
+    blob::fnv1a head_checksum;
+    unsigned char last_head[header::size] = {};
+
+    std::uint64_t checksum() const noexcept (true);
 };
 
 std::int64_t
@@ -222,20 +434,16 @@ record_index::record_index(address_map m) : addr(m) {
      * For the ghost node to be truly invisible we need to make sure base +
      * length == this->addr.zero() as this is what the next (first actual)
      * header uses to set its base.
-     *
-     * The values for format and major are set so that the ghost would never be
-     * accepted as a real header.
      */
     ghost.length = header::size;
     ghost.offset = this->addr.zero() - ghost.length;
-    ghost.format = 0x00;
-    ghost.major = 255;
     this->append(ghost);
 }
 
 bool record_index::contains(std::int64_t n) const noexcept (true) {
     const auto last = this->last();
-    return n < this->addr.logical(last->offset + last->length, this->size());
+    return n < this->addr.logical(last->offset + last->length,
+                                  this->index_of(last));
 }
 
 record_index::iterator
@@ -250,10 +458,12 @@ record_index::find(std::int64_t n, iterator hint) const noexcept (false) {
         const auto pos = this->index_of(hint);
         const auto end = this->addr.logical(hint->offset + hint->length, pos);
 
-        if (pos == 0)
+        if (pos <= 0)
             return n < end;
 
-        const auto begin = this->addr.logical(hint->offset + hint->length, pos - 1);
+        const auto prev = std::prev(hint);
+        const auto begin = this->addr.logical(prev->offset + prev->length,
+                                              pos - 1);
 
         return n >= begin and n < end;
     };
@@ -262,53 +472,42 @@ record_index::find(std::int64_t n, iterator hint) const noexcept (false) {
         return hint;
     }
 
-    const auto begin = this->begin();
-    const auto end   = this->end();
-
     /**
      * Look up the record containing the logical offset n in the index.
      *
      * seek() is a pretty common operation, and experience from dlisio [1]
      * shows that a poor algorithm here significantly slows down programs.
      *
-     * The algorithm actually makes two searches:
-     *
-     * Phase 1 is an approximating binary search that pretends the logical and
-     * phyiscal offset are the same. Since phyiscal offset >= logical offset,
-     * we know that the result is always correct or before the correct one in
-     * the ordered index.
-     *
-     * Phase 2 is a linear search from [cur, end) that is aware of the
-     * logical/base offset distinction. Because of the approximation, it
-     * should do fairly few hops.
+     * The logical end of a record depends on both its header and its position
+     * in the index, as every header before it is cut out. Both grow with the
+     * position, so the logical ends are sorted too, and a binary search over
+     * positions finds the record exactly.
      *
-     * The main reason for the two-phase search is that an elements' index is
-     * required to compare logical addresses to base ones, and upper_bound
-     * is oblivious to the current item's position.
+     * The record containing n is the first one that ends after n. Empty
+     * records end where the one before them ends, and are skipped.
      */
-
-    // phase 1
     const auto addr = this->addr;
-    auto less = [addr] (std::int64_t n, const header& h) noexcept (true) {
-        return n < addr.logical(h.offset + h.length, 0);
-    };
-    const auto lower = std::upper_bound(begin, end, n, less);
-
-    // phase 2
-    /*
-     * We found the right record when record->next > n. All hits after will
-     * also be a match, but this is ok since the search is in an ordered list.
-     */
-    auto pos = this->index_of(lower);
-    auto next_larger = [addr, n, pos] (const header& rec) mutable {
-        return n < addr.logical(rec.offset + rec.length, pos++);
-    };
+    const auto begin = this->begin();
+    auto first = std::int64_t(0);
+    auto count = std::int64_t(this->size());
+    while (count > 0) {
+        const auto step = count / 2;
+        const auto mid = first + step;
+        const auto& rec = *std::next(begin, mid);
+        if (n < addr.logical(rec.offset + rec.length, int(mid))) {
+            count = step;
+        } else {
+            first = mid + 1;
+            count -= step + 1;
+        }
+    }
 
-    const auto cur = std::find_if(lower, end, next_larger);
+    const auto cur = std::next(begin, first);
     if (cur >= this->end()) {
+        const auto last = this->last();
         const auto msg = "seek: n = {} not found in index, last indexed byte {}";
         throw std::logic_error(
-                fmt::format(msg, n, this->back().offset + this->back().length));
+                fmt::format(msg, n, last->offset + last->length));
     }
 
     return cur;
@@ -316,27 +515,81 @@ record_index::find(std::int64_t n, iterator hint) const noexcept (false) {
 
 void record_index::append(const header& head) noexcept (false) {
     try {
-        this->push_back(head);
+        if (not this->headers)
+            this->headers = std::allocate_shared< storage >(
+                arena_allocator< storage >()
+            );
+        else if (this->headers.use_count() > 1)
+            this->headers = std::allocate_shared< storage >(
+                arena_allocator< storage >(),
+                *this->headers
+            );
+
+        auto& blocks = this->headers->blocks;
+        const auto count = this->headers->count;
+        if (count % block_size == 0) {
+            auto next = std::allocate_shared< block >(
+                arena_allocator< block >()
+            );
+            next->start = head.offset;
+            next->ends.reserve(block_size);
+            blocks.push_back(std::move(next));
+        } else if (blocks.back().use_count() > 1) {
+            auto copy = std::allocate_shared< block >(
+                arena_allocator< block >(),
+                *blocks.back()
+            );
+            copy->ends.reserve(block_size);
+            blocks.back() = std::move(copy);
+        }
+
+        auto& b = *blocks.back();
+        assert(b.ends.empty() or b.start + b.ends.back() == head.offset);
+        b.ends.push_back(std::uint32_t(head.offset + head.length - b.start));
+        this->headers->count += 1;
     } catch (...) {
         throw runtime_error("rp66: unable to store header");
     }
 }
 
+void record_index::forget() noexcept (true) {
+    assert(this->headers.use_count() == 1);
+    auto& blocks = this->headers->blocks;
+    if (blocks.size() <= 2)
+        return;
+
+    const auto drop = blocks.size() - 2;
+    blocks.erase(blocks.begin(), blocks.begin() + drop);
+    this->headers->forgotten += drop;
+}
+
 record_index::iterator
 record_index::last() const noexcept (true) {
     return std::prev(this->end());
 }
 
 std::size_t record_index::size() const noexcept (true) {
-    return this->base::size() - 1;
+    return this->headers->count - 1;
 }
 
 bool record_index::empty() const noexcept (true) {
     return this->size() == 0;
 }
 
+std::size_t record_index::memory() const noexcept (true) {
+    const auto& blocks = this->headers->blocks;
+    auto n = sizeof(storage) + blocks.capacity() * sizeof(blocks.front());
+    for (const auto& b : blocks)
+        n += sizeof(block) + b->ends.capacity() * sizeof(b->ends.front());
+    return n;
+}
+
 record_index::iterator record_index::begin() const noexcept (true) {
-    return this->base::begin() + 1;
+    return iterator(this->headers.get(), 1);
+}
+
+record_index::iterator record_index::end() const noexcept (true) {
+    return iterator(this->headers.get(), this->headers->count);
 }
 
 record_index::iterator::difference_type
@@ -344,6 +597,68 @@ record_index::index_of(const iterator& itr) const noexcept (true) {
     return std::distance(this->begin(), itr);
 }
 
+header record_index::iterator::operator * () const noexcept (true) {
+    assert(this->store);
+    assert(0 <= this->pos and this->pos < this->store->count);
+    const auto nth = this->pos / block_size - this->store->forgotten;
+    const auto& b = *this->store->blocks[nth];
+    const auto i = this->pos % block_size;
+
+    header head;
+    head.offset = b.start + (i == 0 ? 0 : b.ends[i - 1]);
+    head.length = std::uint16_t(b.start + b.ends[i] - head.offset);
+    return head;
+}
+
+record_index::iterator::arrow
+record_index::iterator::operator -> () const noexcept (true) {
+    return arrow(**this);
+}
+
+record_index::iterator&
+record_index::iterator::operator ++ () noexcept (true) {
+    ++this->pos;
+    return *this;
+}
+
+record_index::iterator&
+record_index::iterator::operator -- () noexcept (true) {
+    --this->pos;
+    return *this;
+}
+
+record_index::iterator&
+record_index::iterator::operator += (difference_type n) noexcept (true) {
+    this->pos += n;
+    return *this;
+}
+
+record_index::iterator
+record_index::iterator::operator + (difference_type n) const noexcept (true) {
+    return iterator(this->store, this->pos + n);
+}
+
+record_index::iterator::difference_type
+record_index::iterator::operator - (const iterator& other)
+const noexcept (true) {
+    return this->pos - other.pos;
+}
+
+bool record_index::iterator::operator == (const iterator& other)
+const noexcept (true) {
+    return this->pos == other.pos;
+}
+
+bool record_index::iterator::operator != (const iterator& other)
+const noexcept (true) {
+    return this->pos != other.pos;
+}
+
+bool record_index::iterator::operator >= (const iterator& other)
+const noexcept (true) {
+    return this->pos >= other.pos;
+}
+
 read_head read_head::ghost(const base_type& b) noexcept (true) {
     auto x = read_head(b);
     x.remaining = 0;
@@ -406,12 +721,35 @@ std::int64_t baseaddr(lfp_protocol* f) noexcept (true) {
     }
 }
 
-rp66::rp66(lfp_protocol* f) :
+rp66::rp66(lfp_protocol* f, bool stream) :
+    stream(stream),
     fp(f),
     addr(baseaddr(f)),
     index(this->addr)
 {
     this->current = read_head::ghost(this->index.last());
+
+    /* batches are rewound with a seek when they overshoot */
+    if (stream)
+        return;
+
+    try {
+        this->fp->tell();
+        this->batched = true;
+    } catch (const lfp::error&) {}
+}
+
+rp66::rp66(const rp66& other, lfp_protocol* f) noexcept (true) :
+    stream(other.stream),
+    fp(f),
+    addr(other.addr),
+    index(other.index),
+    current(other.current),
+    batched(other.batched),
+    indexed_all(other.indexed_all),
+    head_checksum(other.head_checksum)
+{
+    std::memcpy(this->last_head, other.last_head, sizeof(this->last_head));
 }
 
 void rp66::close() noexcept (false) {
@@ -424,6 +762,19 @@ lfp_protocol* rp66::peel() noexcept (false) {
     return this->fp.release();
 }
 
+lfp_protocol* rp66::dup() noexcept (false) {
+    this->require_seekable("dup");
+
+    /*
+     * The underlying protocol is duplicated at the same position, so the
+     * read head can be copied as-is
+     */
+    unique_lfp inner(this->fp->dup());
+    auto* d = new rp66(*this, inner);
+    inner.release();
+    return d;
+}
+
 lfp_protocol* rp66::peek() const noexcept (false) {
     assert(this->fp);
     return this->fp.get();
@@ -434,16 +785,11 @@ lfp_status rp66::readinto(
         std::int64_t len,
         std::int64_t* bytes_read)
 noexcept (false) {
+    read_probe probe(this->iostats, bytes_read);
 
-    if (bytes_read)
-        *bytes_read = 0;
     std::int64_t to_read = len;
     while(true) {
-        const auto n = this->readinto(dst, to_read);
-
-        if (bytes_read)
-            *bytes_read += n;
-
+        const auto n = this->readinto(dst, to_read, *bytes_read);
         to_read -= n;
         dst = advance(dst, n);
 
@@ -465,6 +811,70 @@ noexcept (false) {
     }
 }
 
+/*
+ * Positional reads only ever read from the index, and never move the read
+ * head, so that they can run concurrently. See tapeimage.
+ */
+lfp_status rp66::pread(
+        void* dst,
+        std::int64_t len,
+        std::int64_t offset,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    read_probe probe(this->iostats, bytes_read);
+    assert(offset >= 0);
+    this->require_seekable("pread");
+    auto* out = static_cast< unsigned char* >(dst);
+    std::int64_t n = 0;
+
+    const auto finish = [&] (lfp_status err) {
+        if (bytes_read)
+            *bytes_read = n;
+        return err;
+    };
+
+    if (len == 0)
+        return finish(LFP_OK);
+
+    if (this->index.contains(offset)) {
+        auto itr = this->index.find(offset, this->index.begin());
+        for (; n < len and itr != this->index.end(); ++itr) {
+            const auto pos = this->index.index_of(itr);
+            const auto from = this->addr.base(offset + n, pos);
+            const auto end = itr->offset + itr->length;
+            const auto want = (std::min)(len - n, end - from);
+            if (want <= 0)
+                continue;
+
+            std::int64_t k = 0;
+            const auto err = this->fp->pread(out + n, want, from, &k);
+            n += k;
+            if (k == want)
+                continue;
+
+            if (err == LFP_EOF) {
+                const auto msg = "rp66: unexpected EOF when reading record "
+                                 "- got {} bytes, expected there to be {} more";
+                throw unexpected_eof(fmt::format(msg, k, end - from - k));
+            }
+            return finish(err);
+        }
+
+        if (n == len)
+            return finish(LFP_OK);
+    }
+
+    if (this->indexed_all)
+        return finish(LFP_EOF);
+
+    if (n > 0)
+        return finish(LFP_OKINCOMPLETE);
+
+    const auto msg = "rp66: pread: offset (= {}) is not indexed, "
+                     "build the index first";
+    throw invalid_args(fmt::format(msg, offset));
+}
+
 int rp66::eof() const noexcept (true) {
     /*
      * There is no trailing header information. I.e. the end of the last
@@ -475,6 +885,71 @@ int rp66::eof() const noexcept (true) {
     return this->fp->eof();
 }
 
+lfp_stats rp66::stats() const noexcept (false) {
+    auto s = this->lfp_protocol::stats();
+    s.index_records = this->index.size();
+    s.index_bytes = this->index.memory();
+    return s;
+}
+
+/*
+ * Move the underlying file to the end of the current record, i.e. to the
+ * next header, without reading the bytes left in it. The last byte is read
+ * rather than seeked past, as not all protocols support seeking to
+ * end-of-file, and it also checks that the record is not truncated.
+ */
+void rp66::skip_record() noexcept (false) {
+    const auto left = this->current.bytes_left();
+    if (this->stream) {
+        const auto n = this->discard(left);
+        if (n != left) {
+            const auto msg = "rp66: unexpected EOF when skipping record "
+                             "- expected there to be {} more bytes";
+            throw unexpected_eof(fmt::format(msg, left - n));
+        }
+        this->current.skip();
+        return;
+    }
+
+    auto skip = left;
+    if (left > header::size) {
+        this->fp->seek(this->current.tell() + left - 1);
+        skip = 1;
+    }
+
+    unsigned char buffer[header::size];
+    std::int64_t n = 0;
+    if (skip > 0)
+        this->fp->readinto(buffer, skip, &n);
+
+    if (n != skip) {
+        const auto msg = "rp66: unexpected EOF when skipping record "
+                         "- expected there to be {} more bytes";
+        throw unexpected_eof(fmt::format(msg, skip - n));
+    }
+
+    this->current.skip();
+}
+
+lfp_status rp66::record_next(lfp_record* rec) noexcept (false) {
+    this->skip_record();
+    if (this->current == this->index.last()) {
+        if (not this->read_header_from_disk())
+            return LFP_EOF;
+        this->current.move(this->index.last());
+    } else {
+        const auto next = this->current.next_record();
+        this->skip_to(next.tell());
+        this->current.move(next);
+    }
+
+    rec->offset        = this->tell();
+    rec->length        = this->current.bytes_left();
+    rec->header_offset = this->current->offset;
+    rec->type          = 0;
+    return LFP_OK;
+}
+
 std::int64_t rp66::tell() const noexcept (true) {
     const auto pos = this->index.index_of(this->current);
     return this->addr.logical(this->current.tell(), pos);
@@ -484,7 +959,64 @@ std::int64_t rp66::ptell() const noexcept (true) {
     return this->fp->ptell();
 }
 
+void rp66::require_seekable(const char* what) const noexcept (false) {
+    if (not this->stream)
+        return;
+
+    const auto msg = "rp66: {} is not supported in streams";
+    throw not_supported(fmt::format(msg, what));
+}
+
+/*
+ * Streams can only move forward, by reading, which also reads and checks the
+ * headers on the way
+ */
+void rp66::seek_forward(std::int64_t n) noexcept (false) {
+    auto left = n - this->tell();
+    if (left < 0) {
+        const auto msg = "rp66: can not seek backwards in a stream, "
+                         "from {} to {}";
+        throw not_supported(fmt::format(msg, this->tell(), n));
+    }
+
+    while (left > 0) {
+        const auto chunk = (std::min)(left, std::int64_t(index_batch_size));
+        this->batch.resize(chunk);
+        std::int64_t bytes_read = 0;
+        const auto k = this->readinto(this->batch.data(), chunk, bytes_read);
+        if (k == 0)
+            break;
+        left -= k;
+    }
+}
+
+/*
+ * Read and throw away n bytes from the underlying protocol, and return how
+ * many there were, to move past bytes without seeking
+ */
+std::int64_t rp66::discard(std::int64_t n) noexcept (false) {
+    std::int64_t discarded = 0;
+    while (discarded < n) {
+        const auto chunk = (std::min)(n - discarded,
+                                      std::int64_t(index_batch_size));
+        this->batch.resize(chunk);
+        std::int64_t k = 0;
+        this->fp->readinto(this->batch.data(), chunk, &k);
+        discarded += k;
+        if (k < chunk)
+            break;
+    }
+    return discarded;
+}
+
 void rp66::seek(std::int64_t n) noexcept (false) {
+    seek_probe probe(this->iostats);
+
+    if (this->stream) {
+        this->seek_forward(n);
+        return;
+    }
+
     /*
      * Have we already index'd the right section? If so, use it and seek there.
      */
@@ -493,8 +1025,25 @@ void rp66::seek(std::int64_t n) noexcept (false) {
         const auto next = this->index.find(n, this->current);
         const auto pos  = this->index.index_of(next);
         const auto real_offset = this->addr.base(n, pos);
-
-        this->fp->seek(real_offset);
+        counters::add(next == this->current
+            ? this->iostats.seeks_in_record
+            : this->iostats.seeks_indexed
+        );
+
+        /*
+         * Leave the underlying file alone when it is already in place, as it
+         * is when reading on from a seek to the current position. Seeks are
+         * not free even when they don't move - cfile throws away the stdio
+         * buffer, and layered protocols look up the record again. Not all
+         * protocols can tell, and then there's no telling where it is.
+         */
+        std::int64_t tell = -1;
+        try {
+            tell = this->fp->tell();
+        } catch (const lfp::error&) {}
+
+        if (this->fp->eof() or tell != real_offset)
+            this->fp->seek(real_offset);
         this->current.move(next);
         this->current.move(real_offset - this->current.tell());
         return;
@@ -503,6 +1052,7 @@ void rp66::seek(std::int64_t n) noexcept (false) {
      * target is past the already-index'd records, so follow the headers, and
      * index them as we go
      */
+    counters::add(this->iostats.seeks_chased);
     this->current.move(this->index.last());
     while (true) {
         const auto last = this->index.last();
@@ -552,13 +1102,174 @@ void rp66::seek(std::int64_t n) noexcept (false) {
     }
 }
 
-std::int64_t rp66::readinto(void* dst, std::int64_t len) noexcept (false) {
-    assert(this->current.bytes_left() >= 0);
-    std::int64_t n = 0;
+lfp_status rp66::readview(
+        const void** view,
+        std::int64_t len,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    /*
+     * When the read is entirely inside a single Visible Record, the bytes are
+     * contiguous in the underlying protocol, so its view can be passed
+     * through. Reads that span records must have the headers cut out, which
+     * means copying into a buffer.
+     */
+    if (len > 0) {
+        this->advance_to_data();
+        if (len <= this->current.bytes_left()) {
+            read_probe probe(this->iostats, bytes_read);
+            std::int64_t n = 0;
+            const auto err = this->fp->readview(view, len, &n);
+            this->current.move(n);
+            if (bytes_read)
+                *bytes_read = n;
+
+            if (n == len)
+                return LFP_OK;
+
+            if (this->eof()) {
+                const auto msg = "rp66: unexpected EOF when reading record "
+                                "- got {} bytes, expected there to be {} more";
+                throw unexpected_eof(
+                    fmt::format(msg, n, this->current.bytes_left()));
+            }
+
+            (void)err;
+            return LFP_OKINCOMPLETE;
+        }
+    }
+
+    return this->lfp_protocol::readview(view, len, bytes_read);
+}
+
+lfp_status rp66::readv(
+        const lfp_iovec* iov,
+        int count,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    /*
+     * Split the buffers at record boundaries, and pass all the (parts of)
+     * buffers that fit in the current Visible Record to the underlying protocol in
+     * a single call. (i, offset) is the first byte not yet read into.
+     */
+    read_probe probe(this->iostats, bytes_read);
+
+    int i = 0;
+    std::int64_t offset = 0;
+    while (true) {
+        while (i < count and offset == iov[i].len) {
+            ++i;
+            offset = 0;
+        }
 
+        if (i == count)
+            return LFP_OK;
+
+        this->advance_to_data();
+        if (this->eof()) {
+            if (this->current.exhausted())
+                return LFP_EOF;
+
+            const auto msg = "rp66: unexpected EOF when reading record "
+                             "- expected there to be {} more bytes";
+            throw unexpected_eof(fmt::format(msg, this->current.bytes_left()));
+        }
+
+        this->slice.clear();
+        std::int64_t left = this->current.bytes_left();
+        std::int64_t want = 0;
+        auto off = offset;
+        for (int k = i; k < count and left > 0; ++k, off = 0) {
+            const auto len = (std::min)(iov[k].len - off, left);
+            if (len == 0)
+                continue;
+
+            lfp_iovec buf;
+            buf.base = advance(iov[k].base, off);
+            buf.len  = len;
+            this->slice.push_back(buf);
+            left -= len;
+            want += len;
+        }
+
+        std::int64_t n = 0;
+        const auto err = this->fp->readv(
+            this->slice.data(),
+            int(this->slice.size()),
+            &n
+        );
+        assert(err == LFP_OKINCOMPLETE ? (n < want) : true);
+        assert(err == LFP_EOF ? (n < want) : true);
+        (void)err;
+
+        this->current.move(n);
+        if (bytes_read)
+            *bytes_read += n;
+
+        for (auto m = n; m > 0;) {
+            const auto len = (std::min)(iov[i].len - offset, m);
+            offset += len;
+            m -= len;
+            if (offset == iov[i].len) {
+                ++i;
+                offset = 0;
+            }
+        }
+
+        if (n == want)
+            continue;
+
+        if (this->eof()) {
+            if (this->current.exhausted())
+                return LFP_EOF;
+
+            const auto msg = "rp66: unexpected EOF when reading record "
+                             "- got {} bytes, expected there to be {} more";
+            throw unexpected_eof(
+                fmt::format(msg, n, this->current.bytes_left()));
+        }
+
+        if (n == 0)
+            return LFP_OKINCOMPLETE;
+    }
+}
+
+/*
+ * Move the underlying file forward to offset, which is usually right past the
+ * header of the next record. Gaps that short are read past rather than
+ * seeked over, which is usually cheaper, and does not rely on the underlying
+ * protocol supporting seeks to end-of-file, which is where the data of an
+ * empty, last record starts.
+ */
+void rp66::skip_to(std::int64_t offset) noexcept (false) {
+    std::int64_t tell = -1;
+    try {
+        tell = this->fp->tell();
+    } catch (const lfp::error&) {}
+
+    const auto gap = offset - tell;
+    if (tell != -1 and gap == 0)
+        return;
+
+    if (tell != -1 and gap > 0 and gap <= header::size) {
+        unsigned char skip[header::size];
+        std::int64_t n = 0;
+        this->fp->readinto(skip, gap, &n);
+        if (n == gap)
+            return;
+    }
+
+    this->fp->seek(offset);
+}
+
+void rp66::advance_to_data() noexcept (false) {
+    /*
+     * Move past exhausted (and empty) records, reading headers as needed.
+     * Afterwards, either the file is at EOF or the current record has bytes
+     * left.
+     */
     while (this->current.exhausted()) {
         if (this->eof())
-            return n;
+            return;
 
         if (this->current == this->index.last()) {
             auto updated = this->read_header_from_disk();
@@ -566,13 +1277,110 @@ std::int64_t rp66::readinto(void* dst, std::int64_t len) noexcept (false) {
                 this->current.move(this->index.last());
         } else {
             const auto next = this->current.next_record();
-            this->fp->seek(next.tell());
+            this->skip_to(next.tell());
             this->current.move(next);
         }
 
         /* might be EOF, or even empty records, so re-start  */
         continue;
     }
+}
+
+/*
+ * Read up to len bytes from the Visible Records starting at the read head,
+ * with a single read from the underlying file, parsing the headers on the
+ * way. If the batch ends in the middle of a header, the underlying file is
+ * moved back to the start of it. See tapeimage::readbatch.
+ */
+std::int64_t rp66::readbatch(void* dst,
+                             std::int64_t len,
+                             std::int64_t& bytes_read)
+noexcept (false) {
+    auto* out = static_cast< unsigned char* >(dst);
+    const auto size = len + header::size;
+    const auto start = this->current.tell();
+
+    this->batch.resize(size);
+    std::int64_t n = 0;
+    const auto err = this->fp->readinto(this->batch.data(), size, &n);
+
+    std::int64_t pos = 0;
+    std::int64_t copied = 0;
+    while (true) {
+        const auto k = (std::min)({
+            this->current.bytes_left(),
+            n - pos,
+            len - copied,
+        });
+        std::memcpy(out + copied, this->batch.data() + pos, k);
+        this->current.move(k);
+        pos += k;
+        copied += k;
+        bytes_read += k;
+
+        if (copied == len or not this->current.exhausted())
+            break;
+
+        if (pos == n) {
+            /* same as read_header_from_disk() at end-of-file */
+            if (err == LFP_EOF and this->current == this->index.last())
+                this->indexed_all = true;
+            break;
+        }
+
+        if (n - pos < header::size) {
+            if (err == LFP_EOF)
+                this->header_read_ok(err, n - pos);
+            break;
+        }
+
+        if (this->current == this->index.last()) {
+            try {
+                counters::add(this->iostats.headers_read);
+                this->index_header(this->batch.data() + pos);
+            } catch (...) {
+                /* leave the file right after the header, as if read alone */
+                if (pos + header::size < n)
+                    this->fp->seek(start + pos + header::size);
+                throw;
+            }
+            /* appending invalidates the read head, so move to index.last() */
+            this->current.move(this->index.last());
+        } else {
+            this->current.move(std::next(this->current));
+        }
+
+        pos += header::size;
+    }
+
+    if (pos < n)
+        this->fp->seek(start + pos);
+    return copied;
+}
+
+std::int64_t rp66::readinto(
+        void* dst,
+        std::int64_t len,
+        std::int64_t& bytes_read)
+noexcept (false) {
+    assert(this->current.bytes_left() >= 0);
+    std::int64_t n = 0;
+
+    /*
+     * Small reads that cross into the next Visible Record are read in one
+     * batch, see tapeimage::readinto.
+     */
+    const auto crosses = len > this->current.bytes_left();
+    const auto small = len <= index_batch_size;
+    if (this->batched and crosses and small and not this->eof()) {
+        n = this->readbatch(dst, len, bytes_read);
+        if (n > 0)
+            return n;
+    }
+
+    this->advance_to_data();
+    if (this->current.exhausted())
+        return n;
 
     assert(not this->current.exhausted());
     const auto to_read = (std::min)(len, this->current.bytes_left());
@@ -587,6 +1395,7 @@ std::int64_t rp66::readinto(void* dst, std::int64_t len) noexcept (false) {
     (void)err;
 
     this->current.move(n);
+    bytes_read += n;
 
     return n;
 }
@@ -596,9 +1405,25 @@ bool rp66::read_header_from_disk() noexcept (false) {
 
     std::int64_t n;
     unsigned char b[header::size];
-    auto err = this->fp->readinto(b, sizeof(b), &n);
+    const auto err = this->fp->readinto(b, sizeof(b), &n);
+    if (not this->header_read_ok(err, n)) {
+        this->indexed_all = true;
+        return false;
+    }
+
+    counters::add(this->iostats.headers_read);
+    this->index_header(b);
+    return true;
+}
+
+/*
+ * Check the result of reading a header. Returns false if the file ended
+ * cleanly before the header, and throws if the header is incomplete.
+ */
+bool rp66::header_read_ok(lfp_status err, std::int64_t n)
+const noexcept (false) {
     switch (err) {
-        case LFP_OK: break;
+        case LFP_OK: return true;
 
         case LFP_OKINCOMPLETE:
             throw io_error(
@@ -626,6 +1451,14 @@ bool rp66::read_header_from_disk() noexcept (false) {
                 "rp66: unhandled error code in read_header_from_disk"
             );
     }
+}
+
+/*
+ * Parse and validate the raw, on-disk header, and append it to the index.
+ */
+void rp66::index_header(const unsigned char* raw) noexcept (false) {
+    unsigned char b[header::size];
+    std::memcpy(b, raw, sizeof(b));
 
     // Check the makefile-provided IS_LITTLE_ENDIAN, or the one set by gcc
     #if (defined(IS_LITTLE_ENDIAN) || \
@@ -634,10 +1467,12 @@ bool rp66::read_header_from_disk() noexcept (false) {
     #endif
 
     header head;
+    unsigned char format;
+    std::uint8_t major;
 
     std::memcpy(&head.length, b + 0, sizeof(head.length));
-    std::memcpy(&head.format, b + 2, sizeof(head.format));
-    std::memcpy(&head.major,  b + 3, sizeof(head.major));
+    std::memcpy(&format,      b + 2, sizeof(format));
+    std::memcpy(&major,       b + 3, sizeof(major));
 
     /*
      * rp66v1 defines that the Format Version should _always_ be [0xFF 0x01].
@@ -646,7 +1481,7 @@ bool rp66::read_header_from_disk() noexcept (false) {
      * format). We therefore make this a strict requirement in the hopes that
      * it will help identify broken- and none VE files.
      */
-    if (head.format != 0xFF or head.major != 1) {
+    if (format != 0xFF or major != 1) {
         const auto msg = "rp66: Incorrect format version in Visible Record {}";
         throw protocol_fatal( fmt::format(msg, this->index.size() + 1) );
     }
@@ -668,11 +1503,325 @@ bool rp66::read_header_from_disk() noexcept (false) {
     head.offset = offset;
 
     this->index.append(head);
-    return true;
+    if (this->stream)
+        this->index.forget();
+    if (this->index.size() <= sampled_headers)
+        this->head_checksum.update(raw, header::size);
+    std::memcpy(this->last_head, raw, header::size);
 }
 
+std::int64_t rp66::index_buffered(const unsigned char* buffer,
+                                  std::int64_t start,
+                                  std::int64_t len)
+noexcept (false) {
+    /* the first header is at zero, which index_header() takes care of */
+    if (this->index.empty())
+        return 0;
+
+    std::int64_t count = 0;
+    auto at = this->index.last()->offset + this->index.last()->length;
+
+    while (at >= start and at + header::size <= start + len) {
+        const auto* raw = buffer + (at - start);
+        const auto vrh = be32(raw);
+
+        /* format version [0xFF 0x01], and a length of at least the header */
+        if ((vrh & 0xFFFF) != 0xFF01 or (vrh >> 16) < 4)
+            break;
+
+        header head;
+        head.length = std::uint16_t(vrh >> 16);
+        head.offset = at;
+
+        this->index.append(head);
+        if (this->index.size() <= sampled_headers)
+            this->head_checksum.update(raw, header::size);
+        std::memcpy(this->last_head, raw, header::size);
+        count += 1;
+
+        at += head.length;
+    }
+
+    return count;
 }
 
+void rp66::build_index(std::int64_t* records, std::int64_t* size)
+noexcept (false) {
+    this->require_seekable("build_index");
+
+    /*
+     * Appending to the index invalidates the read head, so remember where it
+     * is, and put it (and the underlying file) back afterwards, also when
+     * indexing fails.
+     */
+    const auto pos = this->index.index_of(this->current);
+    const auto remaining = this->current.bytes_left();
+    const auto restore = this->fp->tell();
+    const auto was_eof = this->fp->eof();
+
+    const auto reposition = [&] {
+        const auto itr = std::next(this->index.begin(), pos);
+        if (pos < 0) {
+            this->current = read_head::ghost(itr);
+        } else {
+            this->current.move(itr);
+            this->current.move(this->current.bytes_left() - remaining);
+        }
+
+        if (this->fp->tell() != restore or (this->fp->eof() and not was_eof))
+            this->fp->seek(restore);
+    };
+
+    try {
+        auto buffer = std::vector< unsigned char,
+                                   arena_allocator< unsigned char > >(
+            index_batch_size
+        );
+        std::int64_t buffer_start = 0;
+        std::int64_t buffer_len = 0;
+        bool reached_eof = false;
+
+        while (true) {
+            const auto last = this->index.last();
+            const auto at = last->offset + last->length;
+            const auto buffered = buffer_start <= at
+                and at + header::size <= buffer_start + buffer_len;
+
+            if (not buffered) {
+                /*
+                 * The last batch already hit end-of-file, so there are no
+                 * more headers. This also saves seeking to end-of-file, which
+                 * not all protocols support.
+                 */
+                if (reached_eof and at >= buffer_start + buffer_len) {
+                    this->indexed_all = true;
+                    break;
+                }
+
+                /*
+                 * Read through short gaps rather than seeking past them,
+                 * which is usually cheaper, and does not rely on the
+                 * underlying protocol supporting seeks to end-of-file.
+                 */
+                const auto tell = this->fp->tell();
+                const auto gap = at - tell;
+                const auto from = (gap >= 0 and gap < index_batch_size / 2)
+                                ? tell
+                                : at;
+                if (from != tell)
+                    this->fp->seek(from);
+
+                std::int64_t n = 0;
+                const auto err = this->fp->readinto(
+                    buffer.data(),
+                    buffer.size(),
+                    &n
+                );
+
+                buffer_start = from;
+                buffer_len = n;
+                reached_eof = err == LFP_EOF;
+
+                const auto available = (std::max)(from + n - at,
+                                                  std::int64_t(0));
+                if (available < header::size) {
+                    if (not this->header_read_ok(err, available)) {
+                        this->indexed_all = true;
+                        break;
+                    }
+                }
+            }
+
+            const auto n = this->index_buffered(buffer.data(),
+                                                buffer_start,
+                                                buffer_len);
+            if (n > 0) {
+                counters::add(this->iostats.headers_read, n);
+                continue;
+            }
+
+            counters::add(this->iostats.headers_read);
+            this->index_header(buffer.data() + (at - buffer_start));
+        }
+    } catch (...) {
+        reposition();
+        throw;
+    }
+
+    reposition();
+
+    const auto last = this->index.last();
+    *records = this->index.size();
+    *size = this->addr.logical(last->offset + last->length,
+                               this->index.index_of(last));
+}
+
+std::uint64_t rp66::checksum() const noexcept (true) {
+    auto hash = this->head_checksum;
+    if (this->index.size() > sampled_headers)
+        hash.update(this->last_head, sizeof(this->last_head));
+    return hash.digest();
+}
+
+std::vector< unsigned char > rp66::index_export() noexcept (false) {
+    this->require_seekable("index_export");
+    const auto last = this->index.last();
+
+    /*
+     * Visible Records carry no offsets, and the format version is fixed, so
+     * the lengths alone are enough to rebuild the index.
+     */
+    blob::header head;
+    head.tag           = 'R';
+    head.flags         = this->indexed_all ? blob::complete : 0;
+    head.base_zero     = this->addr.zero();
+    head.physical_zero = this->addr.zero();
+    head.count         = this->index.size();
+    head.end           = last->offset + last->length;
+    head.checksum      = this->checksum();
+
+    blob::writer w;
+    w.reserve(blob::header::size + sizeof(std::uint16_t) * this->index.size());
+    w.put(head);
+    for (auto itr = this->index.begin(); itr != this->index.end(); ++itr)
+        w.put(itr->length);
+    return w.release();
+}
+
+void rp66::index_import(const void* src, std::int64_t len) noexcept (false) {
+    this->require_seekable("index_import");
+    if (not this->index.empty()) {
+        throw invalid_args(
+            "index_import: the index must be imported before reading"
+        );
+    }
+
+    blob::reader r(src, len);
+    const auto head = r.get_header('R', sizeof(std::uint16_t));
+
+    if (head.base_zero != this->addr.zero()) {
+        const auto msg = "index_import: index is for a protocol opened at "
+                         "tell = {}, but this is at tell = {}";
+        throw invalid_args(fmt::format(msg, head.base_zero, this->addr.zero()));
+    }
+
+    record_index imported(this->addr);
+    std::int64_t offset = this->addr.zero();
+    for (std::int64_t i = 0; i < head.count; ++i) {
+        header h;
+        h.length = r.get< std::uint16_t >();
+        h.offset = offset;
+
+        if (h.length < header::size) {
+            const auto msg = "index_import: corrupt index, too short record "
+                             "length {} in Visible Record {}";
+            throw invalid_args(fmt::format(msg, h.length, i + 1));
+        }
+
+        offset += h.length;
+        imported.append(h);
+    }
+
+    if (offset != head.end)
+        throw invalid_args("index_import: corrupt index, end mismatch");
+
+    /*
+     * Check that the index matches the file, by re-reading the same headers
+     * that went into the checksum, and checking that the file is not
+     * truncated before the end of the last record. A complete index must
+     * also still end where the file does.
+     */
+    blob::fnv1a hash;
+    unsigned char last[header::size] = {};
+    const auto restore = this->fp->tell();
+    try {
+        const auto read = [this] (record_index::iterator itr,
+                                  unsigned char* dst,
+                                  std::int64_t len) {
+            this->fp->seek(itr->offset);
+            std::int64_t n = 0;
+            this->fp->readinto(dst, len, &n);
+            if (n != len)
+                throw invalid_args("unable to read header");
+        };
+
+        const auto sampled = (std::min)(imported.size(),
+                                        std::size_t(sampled_headers));
+        for (std::size_t i = 0; i < sampled; ++i) {
+            read(imported.begin() + i, last, sizeof(last));
+            hash.update(last, sizeof(last));
+        }
+
+        auto expected = hash;
+        if (imported.size() > sampled_headers) {
+            read(imported.last(), last, sizeof(last));
+            expected.update(last, sizeof(last));
+        }
+
+        if (expected.digest() != head.checksum)
+            throw invalid_args("checksum mismatch");
+
+        /*
+         * Read from the last byte, and not from the end, as not all protocols
+         * support seeking to end-of-file
+         */
+        if (not imported.empty()) {
+            unsigned char bytes[2];
+            const auto len = (head.flags & blob::complete) ? 2 : 1;
+            std::int64_t n = 0;
+            this->fp->seek(head.end - 1);
+            this->fp->readinto(bytes, len, &n);
+            if (n < 1)
+                throw invalid_args("file is smaller than the index");
+            if (n > 1)
+                throw invalid_args("file is larger than the index");
+        }
+
+        this->fp->seek(restore);
+    } catch (const lfp::error& e) {
+        this->fp->seek(restore);
+        const auto msg = "index_import: index does not match file: {}";
+        throw invalid_args(fmt::format(msg, e.what()));
+    }
+
+    this->index = std::move(imported);
+    this->current = read_head::ghost(std::prev(this->index.begin()));
+    this->head_checksum = hash;
+    std::memcpy(this->last_head, last, sizeof(last));
+    this->indexed_all = head.flags & blob::complete;
+}
+
+}
+
+}
+
+int lfp_rp66_build_index(lfp_protocol* f,
+        std::int64_t* records,
+        std::int64_t* size) try {
+    assert(f);
+
+    auto* rp66 = dynamic_cast< lfp::rp66* >(f);
+    if (not rp66) {
+        f->errmsg("rp66_build_index: protocol is not a visible envelope");
+        return LFP_INVALID_ARGS;
+    }
+
+    std::int64_t r = 0;
+    std::int64_t n = 0;
+    rp66->build_index(&r, &n);
+    if (records) *records = r;
+    if (size)    *size = n;
+    return LFP_OK;
+} catch (const lfp::error& e) {
+    f->errmsg(e.what());
+    return e.status();
+} catch (const std::exception& e) {
+    f->errmsg(e.what());
+    return LFP_UNHANDLED_EXCEPTION;
+} catch (...) {
+    assert(false);
+    f->errmsg("Unhandled error that does not derive from std::exception");
+    return LFP_UNHANDLED_EXCEPTION;
 }
 
 lfp_protocol* lfp_rp66_open(lfp_protocol* f) {
@@ -684,3 +1833,13 @@ lfp_protocol* lfp_rp66_open(lfp_protocol* f) {
         return nullptr;
     }
 }
+
+lfp_protocol* lfp_rp66_open_stream(lfp_protocol* f) {
+    if (not f) return nullptr;
+
+    try {
+        return new lfp::rp66(f, true);
+    } catch (...) {
+        return nullptr;
+    }
+}
@@ -4,6 +4,7 @@
 #include <cstdint>
 #include <cstring>
 #include <limits>
+#include <memory>
 #include <vector>
 
 #include <fmt/format.h>
@@ -11,16 +12,51 @@
 #include <lfp/protocol.hpp>
 #include <lfp/tapeimage.h>
 
+#include "blob.hpp"
+
 namespace lfp { namespace {
 
+/*
+ * A record header, with the 64-bit offsets of the records. On disk prev and
+ * next are 32-bit offsets, which in large files wrap around at 4GB, see
+ * lfp_tapeimage_open_large. The index stores them as they are on disk, and
+ * reconstructs the rest (see record_index).
+ */
 struct header {
     std::uint32_t type;
-    std::uint32_t prev;
-    std::uint32_t next;
+    std::int64_t prev;
+    std::int64_t next;
 
     static constexpr const int size = 12;
 };
 
+/*
+ * Reconstruct the 64-bit prev and next offsets of the header at the physical
+ * offset pos, from the 32-bit offsets stored on disk.
+ *
+ * A record is never longer than 4GB, as its length is computed from 32-bit
+ * offsets, so prev is the closest offset at or below pos, and next the
+ * closest offset at or above pos, that match the low 32 bits on disk.
+ */
+void unwrap(header& head, std::uint32_t prev, std::uint32_t next,
+            std::int64_t pos) noexcept (true) {
+    const auto low = std::uint32_t(pos);
+    head.prev = pos - std::uint32_t(low - prev);
+    head.next = pos + std::uint32_t(next - low);
+}
+
+/*
+ * Load the little-endian 32-bit integer at p. Compilers turn this into a
+ * single load (and a byte swap on big-endian), which is what makes
+ * index_buffered() cheaper than the memcpy-and-reverse in index_header().
+ */
+std::uint32_t le32(const unsigned char* p) noexcept (true) {
+    return std::uint32_t(p[0])
+         | std::uint32_t(p[1]) << 8
+         | std::uint32_t(p[2]) << 16
+         | std::uint32_t(p[3]) << 24;
+}
+
 /**
  * Address translator between base offsets (provided by the underlying
  * file), logical offsets (presented to the user) and physical offsets
@@ -61,6 +97,12 @@ public:
      */
     std::int64_t physical_zero() const noexcept (true);
 
+    /**
+     * Offset of protocol zero according to base level, i.e. the tell of the
+     * underlying file when the protocol was opened.
+     */
+    std::int64_t zero() const noexcept (true);
+
 private:
     std::int64_t bzero = 0;
     std::int64_t pzero = 0;
@@ -84,11 +126,77 @@ private:
  *  first header from the file, as prev(last) where last = ghost would then be
  *  outside the index.
  */
-class record_index : private std::vector< header > {
-    using base = std::vector< header >;
+class record_index {
+    /* a header as it is stored, with the low 32 bits of the offsets */
+    struct entry {
+        std::uint32_t type;
+        std::uint32_t prev;
+        std::uint32_t next;
+    };
+
+    /*
+     * Offsets only grow, and a record is less than 4GB, so headers cross into
+     * the next 4GB at most once each. The high bits of next are recovered by
+     * counting the crossings before the header, which are stored sparsely,
+     * as there are none in files smaller than 4GB. prev is the offset of the
+     * header before, which is the closest offset at or below the header's,
+     * that matches the low bits.
+     */
+    struct storage {
+        std::vector< entry, arena_allocator< entry > > entries;
+        /* the high bits of next of the first entry */
+        std::int64_t high = 0;
+        /* the entries with next in the 4GB after the one before them */
+        std::vector< std::size_t, arena_allocator< std::size_t > > wraps;
+
+        std::int64_t next(std::size_t i) const noexcept (true);
+    };
 
 public:
-    using iterator = base::const_iterator;
+    class iterator {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type        = header;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = const header*;
+        using reference         = header;
+
+        /*
+         * The headers are not stored, so operator-> must hand out a pointer
+         * to a temporary
+         */
+        class arrow {
+        public:
+            explicit arrow(const header& h) : head(h) {}
+            const header* operator -> () const noexcept (true) {
+                return &this->head;
+            }
+        private:
+            header head;
+        };
+
+        iterator() = default;
+
+        header operator * () const noexcept (true);
+        arrow operator -> () const noexcept (true);
+
+        iterator& operator ++ () noexcept (true);
+        iterator& operator -- () noexcept (true);
+        iterator& operator += (difference_type) noexcept (true);
+        iterator operator + (difference_type) const noexcept (true);
+        difference_type operator - (const iterator&) const noexcept (true);
+
+        bool operator == (const iterator&) const noexcept (true);
+        bool operator != (const iterator&) const noexcept (true);
+        bool operator >= (const iterator&) const noexcept (true);
+
+    private:
+        friend class record_index;
+        iterator(const storage* s, difference_type p) : store(s), pos(p) {}
+
+        const storage* store = nullptr;
+        difference_type pos = 0;
+    };
 
     explicit record_index(address_map m);
 
@@ -108,15 +216,34 @@ public:
 
     void append(const header&) noexcept (false);
 
+    /*
+     * Forget all but the last keep headers, once there are twice as many,
+     * so that the index of a stream stays small. Forgotten headers are still
+     * counted by size() and index_of(), so offsets are unchanged, but they
+     * can no longer be found or iterated over. keep must be at least 2.
+     */
+    void forget(std::size_t keep) noexcept (true);
+
     iterator last() const noexcept (true);
     std::size_t size() const noexcept (true);
     bool empty() const noexcept (true);
+    /* the memory allocated for the headers, in bytes */
+    std::size_t memory() const noexcept (true);
     iterator begin() const noexcept (true);
+    iterator end() const noexcept (true);
 
     iterator::difference_type index_of(const iterator&) const noexcept (true);
 
 private:
     address_map addr;
+
+    /*
+     * The headers are shared with the indices of duplicated handles (see
+     * lfp_dup), and copied on write. Appending never changes headers that
+     * are shared, so no handle can invalidate the iterators of another.
+     */
+    std::shared_ptr< storage > headers;
+    std::size_t forgotten = 0;
 };
 
 /**
@@ -183,7 +310,10 @@ private:
 
 class tapeimage : public lfp_protocol {
 public:
-    tapeimage(lfp_protocol*);
+    tapeimage(lfp_protocol*, bool large = false, bool stream = false);
+
+    static constexpr const std::uint32_t record = 0;
+    static constexpr const std::uint32_t file   = 1;
 
     // TODO: there must be a "reset" semantic for when there's a read error to
     // put it back into a valid state
@@ -191,6 +321,17 @@ public:
     void close() noexcept (false) override;
     lfp_status readinto(void* dst, std::int64_t len, std::int64_t* bytes_read)
         noexcept (false) override;
+    lfp_status readview(const void** view,
+                        std::int64_t len,
+                        std::int64_t* bytes_read)
+        noexcept (false) override;
+    lfp_status readv(const lfp_iovec* iov, int count, std::int64_t* bytes_read)
+        noexcept (false) override;
+    lfp_status pread(void* dst,
+                     std::int64_t len,
+                     std::int64_t offset,
+                     std::int64_t* bytes_read)
+        noexcept (false) override;
 
     int eof() const noexcept (true) override;
 
@@ -199,20 +340,120 @@ public:
     std::int64_t ptell() const noexcept (false) override;
     lfp_protocol* peel() noexcept (false) override;
     lfp_protocol* peek() const noexcept (false) override;
+    lfp_protocol* dup() noexcept (false) override;
+
+    std::vector< unsigned char > index_export() noexcept (false) override;
+    void index_import(const void*, std::int64_t) noexcept (false) override;
+    lfp_stats stats() const noexcept (false) override;
+    lfp_status record_next(lfp_record*) noexcept (false) override;
+
+    /*
+     * Walk and index all headers up to the first file mark, or end-of-file,
+     * and report the number of records and logical size of the file. The
+     * position of the read head is unchanged.
+     */
+    void build_index(std::int64_t* records, std::int64_t* size)
+        noexcept (false);
+
+    /*
+     * The offset in the underlying file right after the file mark that ends
+     * this file, or -1 if no file mark has been indexed (yet).
+     */
+    std::int64_t file_end() const noexcept (true);
 
 private:
-    static constexpr const std::uint32_t record = 0;
-    static constexpr const std::uint32_t file   = 1;
+    /*
+     * Make a duplicate of other, over the duplicated underlying protocol f,
+     * sharing the index and starting at the same position.
+     */
+    tapeimage(const tapeimage& other, lfp_protocol* f) noexcept (true);
+
+    /*
+     * Accept offsets that wrap around at 4GB, and reconstruct the 64-bit
+     * offsets in the index, see lfp_tapeimage_open_large.
+     */
+    bool large = false;
+
+    /*
+     * Only read forwards, and never seek the underlying file, see
+     * lfp_tapeimage_open_stream. The index only keeps the last
+     * stream_window headers or so, and everything that needs the rest of
+     * it, or to seek, is not supported.
+     */
+    bool stream = false;
+    static constexpr const std::size_t stream_window = 256;
+    void require_seekable(const char* what) const noexcept (false);
+    void seek_forward(std::int64_t n) noexcept (false);
+    std::int64_t discard(std::int64_t n) noexcept (false);
 
     address_map addr;
     unique_lfp fp;
     record_index index;
     read_head current;
 
-    std::int64_t readinto(void* dst, std::int64_t) noexcept (false);
+    /*
+     * Read up to len bytes, but never past the end of the current record
+     * unless batched. bytes_read is incremented as bytes are copied, also
+     * when an error is thrown part-way through a batch.
+     */
+    std::int64_t readinto(void* dst, std::int64_t, std::int64_t& bytes_read)
+        noexcept (false);
+    std::int64_t readbatch(void* dst, std::int64_t, std::int64_t& bytes_read)
+        noexcept (false);
+    void advance_to_data() noexcept (false);
+    void skip_to(std::int64_t) noexcept (false);
+    void skip_record() noexcept (false);
     bool read_header_from_disk() noexcept (false);
+    bool header_read_ok(lfp_status err, std::int64_t n) const noexcept (false);
+    void index_header(const unsigned char* raw) noexcept (false);
+
+    /*
+     * Index the headers in buffer, which starts at the logical offset start
+     * and is len bytes long, for as long as they are plainly valid. Returns
+     * the number of headers indexed, and leaves the first header that needs
+     * more than the common checks, or recovery, to index_header().
+     */
+    std::int64_t index_buffered(const unsigned char* buffer,
+                                std::int64_t start,
+                                std::int64_t len) noexcept (false);
+
+    /*
+     * build_index() reads this many bytes at a time, so that records smaller
+     * than this are indexed without a seek or read per header. Sequential
+     * reads up to this size are batched the same way.
+     */
+    static constexpr const std::int64_t index_batch_size = 64 * 1024;
 
     lfp_status recovery = LFP_OK;
+    std::vector< lfp_iovec, arena_allocator< lfp_iovec > > slice;
+
+    /*
+     * Sequential reads that cross records are read in batches, with headers
+     * and bodies parsed out of the same buffer. The batch may go past the
+     * last byte used, and the underlying file is then seeked back, so this
+     * is only done when it reports a tell().
+     */
+    bool batched = false;
+    std::vector< unsigned char, arena_allocator< unsigned char > > batch;
+
+    /*
+     * true when the index covers the whole file, i.e. indexing has reached a
+     * file mark or hit end-of-file right where the next header would be.
+     */
+    bool indexed_all = false;
+    bool fully_indexed() const noexcept (true);
+
+    /*
+     * A checksum of the first headers, and a copy of the last header, exactly
+     * as they were read from disk. Together with the index size they identify
+     * the file for index_import(), without having to re-read anything on
+     * export.
+     */
+    static constexpr const std::size_t sampled_headers = 8;
+    blob::fnv1a head_checksum;
+    unsigned char last_head[header::size] = {};
+
+    std::uint64_t checksum() const noexcept (true);
 };
 
 std::int64_t
@@ -237,6 +478,10 @@ std::int64_t address_map::physical_zero() const noexcept (true) {
     return this->pzero;
 }
 
+std::int64_t address_map::zero() const noexcept (true) {
+    return this->bzero;
+}
+
 record_index::record_index(address_map m) : addr(m) {
     header ghost;
     ghost.type = -1;
@@ -283,61 +528,43 @@ record_index::find(std::int64_t n, iterator hint) const noexcept (false) {
         return hint;
     }
 
-    const auto begin = this->begin();
-    const auto end   = this->end();
-
     /**
      * Look up the record containing the logical offset n in the index.
      *
      * seek() is a pretty common operation, and experience from dlisio [1]
      * shows that a poor algorithm here significantly slows down programs.
      *
-     * The algorithm actually makes two searches:
-     *
-     * Phase 1 is an approximating binary search that pretends the logical and
-     * base offsets are the same. Since base offset >= logical offset,
-     * we know that the result is always correct or before the correct one in
-     * the ordered index.
+     * The logical end of a record depends on both its header and its position
+     * in the index, as every header before it is cut out. Both grow with the
+     * position, so the logical ends are sorted too, and a binary search over
+     * positions finds the record exactly, without storing the logical offsets
+     * in the index.
      *
-     * Phase 2 is a linear search from [cur, end) that is aware of the
-     * logical/base offset distinction. Because of the approximation, it
-     * should do fairly few hops.
-     *
-     * The main reason for the two-phase search is that an elements' index is
-     * required to compare logical addresses to base ones, and upper_bound
-     * is oblivious to the current item's position.
+     * The record containing n is the first one that ends after n. Empty
+     * records end where the one before them ends, and are skipped.
      *
      * [1] https://github.com/equinor/dlisio
      */
-
-    // phase 1
     const auto addr = this->addr;
-    auto less = [addr] (std::int64_t n, const header& h) noexcept (true) {
-        return n < addr.logical(addr.from_physical(h.next), 0);
-    };
-    const auto lower = std::upper_bound(begin, end, n, less);
-
-    // phase 2
-    /*
-     * We found the right record when record->next > n. All hits after will
-     * also be a match, but this is ok since the search is in an ordered list.
-     *
-     * Using a mutable lambda to carry the header contribution is a pretty
-     * convoluted approach, but both the element *and* the header sizes need to
-     * be accounted for, and the latter is only available through the
-     * *position* in the index, which doesn't play so well with the std
-     * algorithms. The use of lambda + find-if is still valuable though, as it
-     * gives a clean error check if the offset n is somehow *not* in the index.
-     */
-    auto pos = this->index_of(lower);
-    auto next_larger = [addr, n, pos] (const header& rec) mutable {
-        return n < addr.logical(addr.from_physical(rec.next), pos++);
-    };
+    const auto begin = this->begin();
+    auto first = std::int64_t(0);
+    auto count = std::int64_t(this->size());
+    while (count > 0) {
+        const auto step = count / 2;
+        const auto mid = first + step;
+        const auto& rec = *std::next(begin, mid);
+        if (n < addr.logical(addr.from_physical(rec.next), int(mid))) {
+            count = step;
+        } else {
+            first = mid + 1;
+            count -= step + 1;
+        }
+    }
 
-    const auto cur = std::find_if(lower, end, next_larger);
+    const auto cur = std::next(begin, first);
     if (cur >= this->end()) {
         const auto msg = "seek: n = {} not found in index, end->next = {}";
-        throw std::logic_error(fmt::format(msg, n, this->back().next));
+        throw std::logic_error(fmt::format(msg, n, this->last()->next));
     }
 
     return cur;
@@ -345,7 +572,24 @@ record_index::find(std::int64_t n, iterator hint) const noexcept (false) {
 
 void record_index::append(const header& h) noexcept (false) {
     try {
-        this->push_back(h);
+        if (not this->headers or this->headers.use_count() > 1)
+            this->headers = this->headers
+                ? std::allocate_shared< storage >(arena_allocator< storage >(),
+                                                  *this->headers)
+                : std::allocate_shared< storage >(arena_allocator< storage >());
+
+        auto& store = *this->headers;
+        const auto high = h.next >> 32;
+        if (store.entries.empty())
+            store.high = high;
+        while (store.high + std::int64_t(store.wraps.size()) < high)
+            store.wraps.push_back(store.entries.size());
+
+        entry e;
+        e.type = h.type;
+        e.prev = std::uint32_t(h.prev);
+        e.next = std::uint32_t(h.next);
+        store.entries.push_back(e);
     } catch (...) {
         throw runtime_error("tapeimage: unable to store header");
     }
@@ -355,22 +599,139 @@ record_index::iterator record_index::last() const noexcept (true) {
     return std::prev(this->end());
 }
 
+void record_index::forget(std::size_t keep) noexcept (true) {
+    assert(keep >= 2);
+    assert(this->headers.use_count() == 1);
+    auto& store = *this->headers;
+    auto& h = store.entries;
+    const auto stored = h.size() - 2;
+    if (stored < 2 * keep)
+        return;
+
+    /*
+     * The last two forgotten headers take the place of the ghosts, so that
+     * the first header left still has the header before it, like any other
+     */
+    const auto drop = stored - keep;
+    store.high = store.next(drop) >> 32;
+    h[0] = h[drop];
+    h[1] = h[drop + 1];
+    h.erase(h.begin() + 2, h.begin() + 2 + drop);
+    this->forgotten += drop;
+
+    /* the crossings up to the new first entry are now in high */
+    auto& wraps = store.wraps;
+    const auto kept = std::upper_bound(wraps.begin(), wraps.end(), drop);
+    wraps.erase(wraps.begin(), kept);
+    for (auto& w : wraps)
+        w = w == drop + 1 ? 1 : w - drop;
+}
+
 std::size_t record_index::size() const noexcept (true) {
-    return this->base::size() - 2;
+    return this->headers->entries.size() - 2 + this->forgotten;
 }
 
 bool record_index::empty() const noexcept (true) {
     return this->size() == 0;
 }
 
+std::size_t record_index::memory() const noexcept (true) {
+    const auto& store = *this->headers;
+    return sizeof(storage)
+         + store.entries.capacity() * sizeof(entry)
+         + store.wraps.capacity() * sizeof(std::size_t);
+}
+
 record_index::iterator record_index::begin() const noexcept (true) {
     /* don't even consider the ghost nodes in [begin, end) */
-    return this->base::begin() + 2;
+    return iterator(this->headers.get(), 2);
+}
+
+record_index::iterator record_index::end() const noexcept (true) {
+    const auto& store = *this->headers;
+    return iterator(&store, store.entries.size());
+}
+
+std::int64_t record_index::storage::next(std::size_t i)
+const noexcept (true) {
+    auto high = this->high;
+    if (not this->wraps.empty()) {
+        const auto itr = std::upper_bound(this->wraps.begin(),
+                                          this->wraps.end(),
+                                          i);
+        high += std::distance(this->wraps.begin(), itr);
+    }
+    return (high << 32) | this->entries[i].next;
+}
+
+header record_index::iterator::operator * () const noexcept (true) {
+    assert(this->store);
+    assert(0 <= this->pos);
+    assert(std::size_t(this->pos) < this->store->entries.size());
+    const auto i = std::size_t(this->pos);
+    const auto& e = this->store->entries[i];
+
+    header head;
+    head.type = e.type;
+    head.next = this->store->next(i);
+    const auto at = i == 0 ? head.next : this->store->next(i - 1);
+    head.prev = at - std::uint32_t(std::uint32_t(at) - e.prev);
+    return head;
+}
+
+record_index::iterator::arrow
+record_index::iterator::operator -> () const noexcept (true) {
+    return arrow(**this);
+}
+
+record_index::iterator&
+record_index::iterator::operator ++ () noexcept (true) {
+    this->pos += 1;
+    return *this;
+}
+
+record_index::iterator&
+record_index::iterator::operator -- () noexcept (true) {
+    this->pos -= 1;
+    return *this;
+}
+
+record_index::iterator&
+record_index::iterator::operator += (difference_type n) noexcept (true) {
+    this->pos += n;
+    return *this;
+}
+
+record_index::iterator
+record_index::iterator::operator + (difference_type n) const noexcept (true) {
+    auto copy = *this;
+    return copy += n;
+}
+
+record_index::iterator::difference_type
+record_index::iterator::operator - (const iterator& o) const noexcept (true) {
+    return this->pos - o.pos;
+}
+
+bool record_index::iterator::operator == (const iterator& o)
+const noexcept (true) {
+    return this->pos == o.pos;
+}
+
+bool record_index::iterator::operator != (const iterator& o)
+const noexcept (true) {
+    return not (*this == o);
+}
+
+bool record_index::iterator::operator >= (const iterator& o)
+const noexcept (true) {
+    return this->pos >= o.pos;
 }
 
 record_index::iterator::difference_type
 record_index::index_of(const iterator& itr) const noexcept (true) {
-    return std::distance(this->begin(), itr);
+    return std::distance(this->begin(), itr)
+         + iterator::difference_type(this->forgotten);
 }
 
 read_head read_head::ghost(const base_type& b) noexcept (true) {
@@ -407,7 +768,8 @@ void read_head::move(const base_type& itr) noexcept (true) {
      */
     const auto base_offset = std::prev(itr)->next + header::size;
     read_head copy(itr);
-    copy.remaining = copy->next - base_offset;
+    /* the ghost nodes have no header in the file, and so no bytes left */
+    copy.remaining = (std::max)(copy->next - base_offset, std::int64_t(0));
     *this = copy;
 }
 
@@ -450,12 +812,38 @@ std::int64_t physicaladdr(lfp_protocol* f) noexcept (false) {
     }
 }
 
-tapeimage::tapeimage(lfp_protocol* f) :
+tapeimage::tapeimage(lfp_protocol* f, bool large, bool stream) :
+    large(large),
+    stream(stream),
     addr(baseaddr(f), physicaladdr(f)),
     fp(f),
     index(this->addr)
 {
     this->current = read_head::ghost(this->index.last());
+
+    /* batches are rewound with a seek when they overshoot */
+    if (stream)
+        return;
+
+    try {
+        this->fp->tell();
+        this->batched = true;
+    } catch (const lfp::error&) {}
+}
+
+tapeimage::tapeimage(const tapeimage& other, lfp_protocol* f) noexcept (true) :
+    large(other.large),
+    stream(other.stream),
+    addr(other.addr),
+    fp(f),
+    index(other.index),
+    current(other.current),
+    recovery(other.recovery),
+    batched(other.batched),
+    indexed_all(other.indexed_all),
+    head_checksum(other.head_checksum)
+{
+    std::memcpy(this->last_head, other.last_head, sizeof(this->last_head));
 }
 
 void tapeimage::close() noexcept (false) {
@@ -468,6 +856,19 @@ lfp_protocol* tapeimage::peel() noexcept (false) {
     return this->fp.release();
 }
 
+lfp_protocol* tapeimage::dup() noexcept (false) {
+    this->require_seekable("dup");
+
+    /*
+     * The underlying protocol is duplicated at the same position, so the
+     * read head can be copied as-is
+     */
+    unique_lfp inner(this->fp->dup());
+    auto* d = new tapeimage(*this, inner);
+    inner.release();
+    return d;
+}
+
 lfp_protocol* tapeimage::peek() const noexcept (false) {
     assert(this->fp);
     return this->fp.get();
@@ -478,16 +879,11 @@ lfp_status tapeimage::readinto(
         std::int64_t len,
         std::int64_t* bytes_read)
 noexcept (false) {
+    read_probe probe(this->iostats, bytes_read);
 
-    if (bytes_read)
-        *bytes_read = 0;
     std::int64_t to_read = len;
     while(true) {
-        const auto n = this->readinto(dst, to_read);
-
-        if (bytes_read)
-            *bytes_read += n;
-
+        const auto n = this->readinto(dst, to_read, *bytes_read);
         to_read -= n;
         dst = advance(dst, n);
 
@@ -514,10 +910,174 @@ noexcept (false) {
     }
 }
 
-std::int64_t tapeimage::readinto(void* dst, std::int64_t len) noexcept (false) {
-    assert(this->current.bytes_left() >= 0);
-    std::int64_t n = 0;
+lfp_status tapeimage::readview(
+        const void** view,
+        std::int64_t len,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    /*
+     * When the read is entirely inside a single record, the bytes are
+     * contiguous in the underlying protocol, so its view can be passed
+     * through. Reads that span records must have the headers cut out, which
+     * means copying into a buffer.
+     */
+    if (len > 0) {
+        this->advance_to_data();
+        if (not this->eof() and len <= this->current.bytes_left()) {
+            read_probe probe(this->iostats, bytes_read);
+            std::int64_t n = 0;
+            const auto err = this->fp->readview(view, len, &n);
+            this->current.move(n);
+            if (bytes_read)
+                *bytes_read = n;
+
+            if (n == len) {
+                if (this->recovery)
+                    return this->recovery;
+                return LFP_OK;
+            }
+
+            if (this->eof()) {
+                const auto msg = "tapeimage: unexpected EOF when reading record "
+                                "- got {} bytes, expected there to be {} more";
+                throw unexpected_eof(
+                    fmt::format(msg, n, this->current.bytes_left()));
+            }
+
+            (void)err;
+            return LFP_OKINCOMPLETE;
+        }
+    }
+
+    return this->lfp_protocol::readview(view, len, bytes_read);
+}
+
+lfp_status tapeimage::readv(
+        const lfp_iovec* iov,
+        int count,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    /*
+     * Split the buffers at record boundaries, and pass all the (parts of)
+     * buffers that fit in the current record to the underlying protocol in
+     * a single call. (i, offset) is the first byte not yet read into.
+     */
+    read_probe probe(this->iostats, bytes_read);
+
+    int i = 0;
+    std::int64_t offset = 0;
+    while (true) {
+        while (i < count and offset == iov[i].len) {
+            ++i;
+            offset = 0;
+        }
+
+        if (i == count)
+            return this->recovery ? this->recovery : LFP_OK;
+
+        this->advance_to_data();
+        if (this->eof()) {
+            if (this->current.exhausted())
+                return this->recovery ? this->recovery : LFP_EOF;
+
+            const auto msg = "tapeimage: unexpected EOF when reading record "
+                             "- expected there to be {} more bytes";
+            throw unexpected_eof(fmt::format(msg, this->current.bytes_left()));
+        }
 
+        this->slice.clear();
+        std::int64_t left = this->current.bytes_left();
+        std::int64_t want = 0;
+        auto off = offset;
+        for (int k = i; k < count and left > 0; ++k, off = 0) {
+            const auto len = (std::min)(iov[k].len - off, left);
+            if (len == 0)
+                continue;
+
+            lfp_iovec buf;
+            buf.base = advance(iov[k].base, off);
+            buf.len  = len;
+            this->slice.push_back(buf);
+            left -= len;
+            want += len;
+        }
+
+        std::int64_t n = 0;
+        const auto err = this->fp->readv(
+            this->slice.data(),
+            int(this->slice.size()),
+            &n
+        );
+        assert(err == LFP_OKINCOMPLETE ? (n < want) : true);
+        assert(err == LFP_EOF ? (n < want) : true);
+        (void)err;
+
+        this->current.move(n);
+        if (bytes_read)
+            *bytes_read += n;
+
+        for (auto m = n; m > 0;) {
+            const auto len = (std::min)(iov[i].len - offset, m);
+            offset += len;
+            m -= len;
+            if (offset == iov[i].len) {
+                ++i;
+                offset = 0;
+            }
+        }
+
+        if (n == want)
+            continue;
+
+        if (this->eof()) {
+            if (this->current.exhausted())
+                return this->recovery ? this->recovery : LFP_EOF;
+
+            const auto msg = "tapeimage: unexpected EOF when reading record "
+                             "- got {} bytes, expected there to be {} more";
+            throw unexpected_eof(
+                fmt::format(msg, n, this->current.bytes_left()));
+        }
+
+        if (n == 0)
+            return LFP_OKINCOMPLETE;
+    }
+}
+
+/*
+ * Move the underlying file forward to offset, which is usually right past the
+ * header of the next record. Gaps that short are read past rather than
+ * seeked over, which is usually cheaper, and does not rely on the underlying
+ * protocol supporting seeks to end-of-file, which is where the data of an
+ * empty, last record starts.
+ */
+void tapeimage::skip_to(std::int64_t offset) noexcept (false) {
+    std::int64_t tell = -1;
+    try {
+        tell = this->fp->tell();
+    } catch (const lfp::error&) {}
+
+    const auto gap = offset - tell;
+    if (tell != -1 and gap == 0)
+        return;
+
+    if (tell != -1 and gap > 0 and gap <= header::size) {
+        unsigned char skip[header::size];
+        std::int64_t n = 0;
+        this->fp->readinto(skip, gap, &n);
+        if (n == gap)
+            return;
+    }
+
+    this->fp->seek(offset);
+}
+
+void tapeimage::advance_to_data() noexcept (false) {
+    /*
+     * Move past exhausted (and empty) records, reading headers as needed.
+     * Afterwards, either the file is at EOF or the current record has bytes
+     * left.
+     */
     while (not this->eof() and this->current.exhausted()) {
         if (this->current == this->index.last()) {
             auto updated = this->read_header_from_disk();
@@ -525,14 +1085,129 @@ std::int64_t tapeimage::readinto(void* dst, std::int64_t len) noexcept (false) {
                 this->current.move(this->index.last());
         } else {
             const auto next = this->current.next_record();
-            this->fp->seek(this->addr.from_physical(next.ptell()));
+            this->skip_to(this->addr.from_physical(next.ptell()));
             this->current.move(next);
         }
 
         /* might be EOF, or even empty records, so re-start  */
         continue;
     }
+}
+
+/*
+ * Read up to len bytes from the records starting at the read head, with a
+ * single read from the underlying file. The batch is large enough to hold
+ * the rest of this record, and the header of the next one, but never more
+ * headers and bodies than len bytes of data could need.
+ *
+ * Headers found in the batch are appended to the index as they are parsed,
+ * and only the bodies are copied to dst. If the batch goes past the last byte
+ * used, e.g. past a file mark or into a header cut off by the end of the
+ * batch, the underlying file is moved back, so that it is positioned as if
+ * the records were read one at a time.
+ */
+std::int64_t tapeimage::readbatch(void* dst,
+                                  std::int64_t len,
+                                  std::int64_t& bytes_read)
+noexcept (false) {
+    auto* out = static_cast< unsigned char* >(dst);
+    const auto size = len + header::size;
+    const auto start = this->addr.from_physical(this->current.ptell());
+
+    this->batch.resize(size);
+    std::int64_t n = 0;
+    const auto err = this->fp->readinto(this->batch.data(), size, &n);
+
+    std::int64_t pos = 0;
+    std::int64_t copied = 0;
+    const auto rewind = [&] (std::int64_t at) {
+        if (at < n)
+            this->fp->seek(start + at);
+    };
+
+    while (true) {
+        const auto k = (std::min)({
+            this->current.bytes_left(),
+            n - pos,
+            len - copied,
+        });
+        std::memcpy(out + copied, this->batch.data() + pos, k);
+        this->current.move(k);
+        pos += k;
+        copied += k;
+        bytes_read += k;
+
+        if (copied == len or not this->current.exhausted())
+            break;
+
+        if (pos == n) {
+            /* same as read_header_from_disk() at end-of-file */
+            if (err == LFP_EOF and this->current == this->index.last())
+                this->indexed_all = true;
+            break;
+        }
+
+        if (n - pos < header::size) {
+            /*
+             * The batch ended in the middle of a header. Report a truncated
+             * file, otherwise leave the header for the next read
+             */
+            if (err == LFP_EOF)
+                this->header_read_ok(err, n - pos);
+            break;
+        }
+
+        if (this->current == this->index.last()) {
+            try {
+                counters::add(this->iostats.headers_read);
+                this->index_header(this->batch.data() + pos);
+            } catch (...) {
+                /* leave the file right after the header, as if read alone */
+                rewind(pos + header::size);
+                throw;
+            }
+            /* appending invalidates the read head, so move to index.last() */
+            this->current.move(this->index.last());
+        } else {
+            this->current.move(std::next(this->current));
+        }
+
+        pos += header::size;
+
+        if (this->current->type == tapeimage::file)
+            break;
+    }
+
+    rewind(pos);
+    return copied;
+}
+
+std::int64_t tapeimage::readinto(
+        void* dst,
+        std::int64_t len,
+        std::int64_t& bytes_read)
+noexcept (false) {
+    assert(this->current.bytes_left() >= 0);
+    std::int64_t n = 0;
+
+    /*
+     * Small reads that cross into the next record are read in one batch,
+     * instead of separate reads for the end of this record, the header of
+     * the next, and its body. Larger reads are dominated by the bodies, which
+     * are read straight into dst.
+     *
+     * If the batch does not make it to any data, e.g. because of a run of
+     * empty records, fall back to reading one header at a time.
+     */
+    const auto crosses = len > this->current.bytes_left();
+    const auto small = len <= index_batch_size;
+    if (this->batched and crosses and small and not this->eof()) {
+        n = this->readbatch(dst, len, bytes_read);
+        if (n > 0)
+            return n;
+    }
 
+    this->advance_to_data();
     if (this->eof())
         return n;
 
@@ -549,10 +1224,86 @@ std::int64_t tapeimage::readinto(void* dst, std::int64_t len) noexcept (false) {
     (void)err;
 
     this->current.move(n);
+    bytes_read += n;
 
     return n;
 }
 
+bool tapeimage::fully_indexed() const noexcept (true) {
+    return this->indexed_all
+        or (not this->index.empty()
+            and this->index.last()->type == tapeimage::file);
+}
+
+/*
+ * Positional reads only ever read from the index, and never move the read
+ * head, so that they can run concurrently. Offsets past the indexed part of
+ * the file can not be translated without reading (and appending) headers, so
+ * those reads are rejected, unless the whole file is known to be indexed.
+ */
+lfp_status tapeimage::pread(
+        void* dst,
+        std::int64_t len,
+        std::int64_t offset,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    read_probe probe(this->iostats, bytes_read);
+    assert(offset >= 0);
+    this->require_seekable("pread");
+    auto* out = static_cast< unsigned char* >(dst);
+    std::int64_t n = 0;
+
+    const auto finish = [&] (lfp_status err) {
+        if (bytes_read)
+            *bytes_read = n;
+        return err;
+    };
+
+    if (len == 0)
+        return finish(LFP_OK);
+
+    if (this->index.contains(offset)) {
+        auto itr = this->index.find(offset, this->index.begin());
+        for (; n < len and itr != this->index.end(); ++itr) {
+            if (itr->type == tapeimage::file)
+                break;
+
+            const auto pos = this->index.index_of(itr);
+            const auto from = this->addr.base(offset + n, pos);
+            const auto end = this->addr.from_physical(itr->next);
+            const auto want = (std::min)(len - n, end - from);
+            if (want <= 0)
+                continue;
+
+            std::int64_t k = 0;
+            const auto err = this->fp->pread(out + n, want, from, &k);
+            n += k;
+            if (k == want)
+                continue;
+
+            if (err == LFP_EOF) {
+                const auto msg = "tapeimage: unexpected EOF when reading record "
+                                 "- got {} bytes, expected there to be {} more";
+                throw unexpected_eof(fmt::format(msg, k, end - from - k));
+            }
+            return finish(err);
+        }
+
+        if (n == len)
+            return finish(LFP_OK);
+    }
+
+    if (this->fully_indexed())
+        return finish(this->recovery ? this->recovery : LFP_EOF);
+
+    if (n > 0)
+        return finish(LFP_OKINCOMPLETE);
+
+    const auto msg = "tapeimage: pread: offset (= {}) is not indexed, "
+                     "build the index first";
+    throw invalid_args(fmt::format(msg, offset));
+}
+
 // TODO: status instead of boolean?
 int tapeimage::eof() const noexcept (true) {
     // TODO: consider when this says record, but base file is EOF
@@ -573,12 +1324,27 @@ bool tapeimage::read_header_from_disk() noexcept (false) {
     }
 
     std::int64_t n;
-    unsigned char b[sizeof(std::uint32_t) * 3];
+    unsigned char b[header::size];
     const auto err = this->fp->readinto(b, sizeof(b), &n);
+    if (not this->header_read_ok(err, n)) {
+        this->indexed_all = true;
+        return false;
+    }
 
+    counters::add(this->iostats.headers_read);
+    this->index_header(b);
+    return true;
+}
+
+/*
+ * Check the result of reading a header. Returns false if the file ended
+ * cleanly before the header, and throws if the header is incomplete.
+ */
+bool tapeimage::header_read_ok(lfp_status err, std::int64_t n)
+const noexcept (false) {
     /* TODO: should also check INCOMPLETE */
     switch (err) {
-        case LFP_OK: break;
+        case LFP_OK: return true;
 
         case LFP_OKINCOMPLETE:
             /* For now, don't try to recover from this - if it is because the
@@ -610,6 +1376,14 @@ bool tapeimage::read_header_from_disk() noexcept (false) {
                 "tapeimage: unhandled error code in read_header"
             );
     }
+}
+
+/*
+ * Parse and validate the raw, on-disk header, and append it to the index.
+ */
+void tapeimage::index_header(const unsigned char* raw) noexcept (false) {
+    unsigned char b[header::size];
+    std::memcpy(b, raw, sizeof(b));
 
     // Check the makefile-provided IS_BIG_ENDIAN, or the one set by gcc
     #if (defined(IS_BIG_ENDIAN) || \
@@ -619,9 +1393,13 @@ bool tapeimage::read_header_from_disk() noexcept (false) {
         std::reverse(b + 8, b + 12);
     #endif
     header head;
+    std::uint32_t prev;
+    std::uint32_t next;
     std::memcpy(&head.type, b + 0 * 4, 4);
-    std::memcpy(&head.prev, b + 1 * 4, 4);
-    std::memcpy(&head.next, b + 2 * 4, 4);
+    std::memcpy(&prev,      b + 1 * 4, 4);
+    std::memcpy(&next,      b + 2 * 4, 4);
+    head.prev = prev;
+    head.next = next;
 
     const auto header_type_consistent = head.type == tapeimage::record or
                                         head.type == tapeimage::file;
@@ -646,15 +1424,26 @@ bool tapeimage::read_header_from_disk() noexcept (false) {
         head.type = tapeimage::record;
     }
 
-    if (head.next <= head.prev) {
+    /*
+     * Files over 4GB wrap the offsets around, which shows up as a record that
+     * ends before it starts, or before its own header. When opened for large
+     * files, take that to mean that the record crosses a 4GB boundary, and
+     * reconstruct all offsets from the position of the header.
+     */
+    const auto position = this->index.last()->next;
+    const auto wrapped = this->large and next < prev;
+    if (this->large)
+        unwrap(head, prev, next, position);
+
+    if ((next <= prev and not wrapped) or head.next < position) {
         /*
-         * There's no reasonable recovery if next is smaller than prev, as it's
-         * likely either the previous pointer which is broken, or this entire
-         * header.
+         * There's no reasonable recovery if next is smaller than prev, or
+         * points back into the file, as it's likely either the previous
+         * pointer which is broken, or this entire header.
          *
-         * This will happen for over 4GB files. As we do not support them at
-         * the moment, this check should detect them and prevent further
-         * invalid state.
+         * This will happen for over 4GB files, unless the protocol is opened
+         * with lfp_tapeimage_open_large. This check detects them and prevents
+         * further invalid state.
          *
          * At least for now, consider it a non-recoverable error.
          */
@@ -662,19 +1451,25 @@ bool tapeimage::read_header_from_disk() noexcept (false) {
             const auto msg = "file corrupt: header type is not 0 or 1, "
                              "head.next (= {}) <= head.prev (= {}). "
                              "File might be missing data";
-            throw protocol_fatal(fmt::format(msg, head.next, head.prev));
+            throw protocol_fatal(fmt::format(msg, next, prev));
         } else {
             if (head.type == tapeimage::record and
-                head.next == 0 and
-                head.prev == 0) {
+                next == 0 and
+                prev == 0) {
                 const auto msg =
                     "file corrupt: head.type == head.next == head.prev == 0. "
                     "File might be padded.";
-                throw protocol_fatal(fmt::format(msg, head.next, head.prev));
-            } else {
+                throw protocol_fatal(fmt::format(msg, next, prev));
+            } else if (next <= prev) {
                 const auto msg = "file corrupt: head.next (= {}) <= head.prev "
-                                 "(= {}). File size might be > 4GB";
-                throw protocol_fatal(fmt::format(msg, head.next, head.prev));
+                                 "(= {}). File size might be > 4GB, which "
+                                 "requires lfp_tapeimage_open_large";
+                throw protocol_fatal(fmt::format(msg, next, prev));
+            } else {
+                const auto msg = "file corrupt: head.next (= {}) is before "
+                                 "the header (at {}). File size might be > "
+                                 "4GB, which requires lfp_tapeimage_open_large";
+                throw protocol_fatal(fmt::format(msg, next, position));
             }
         }
     }
@@ -702,9 +1497,18 @@ bool tapeimage::read_header_from_disk() noexcept (false) {
                                 "be missing data"));
             }
             this->recovery = LFP_PROTOCOL_TRYRECOVERY;
-            this->errmsg(
-                fmt::format(msg, head.prev, back2.next,
-                            "Assigning expected .next value to .prev"));
+            /*
+             * Reading goes on after this, so format the warning in place
+             * rather than allocate a string for it
+             */
+            char warning[256];
+            const auto end = fmt::format_to_n(
+                warning, sizeof(warning) - 1,
+                msg, head.prev, back2.next,
+                "Assigning expected .next value to .prev"
+            );
+            *end.out = '\0';
+            this->errmsg(warning);
             head.prev = back2.next;
         }
     } else if (this->recovery and not this->index.empty()) {
@@ -726,22 +1530,381 @@ bool tapeimage::read_header_from_disk() noexcept (false) {
     }
 
     this->index.append(head);
-    return true;
+    if (this->stream)
+        this->index.forget(stream_window);
+    if (this->index.size() <= sampled_headers)
+        this->head_checksum.update(raw, header::size);
+    std::memcpy(this->last_head, raw, header::size);
+}
+
+std::int64_t tapeimage::index_buffered(const unsigned char* buffer,
+                                       std::int64_t start,
+                                       std::int64_t len)
+noexcept (false) {
+    /*
+     * Everything out of the ordinary goes through index_header(), so that
+     * errors, messages and recovery are exactly as when headers are indexed
+     * one at a time. That includes the first two headers, which have no
+     * back pointer to check, and large files, where offsets are unwrapped.
+     */
+    if (this->large or this->recovery or this->index.size() < 2)
+        return 0;
+
+    std::int64_t count = 0;
+    auto back = std::prev(this->index.last())->next;
+    auto position = this->index.last()->next;
+
+    while (true) {
+        const auto at = this->addr.from_physical(position);
+        if (at < start or at + header::size > start + len)
+            break;
+
+        const auto* raw = buffer + (at - start);
+        header head;
+        head.type = le32(raw + 0);
+        head.prev = le32(raw + 4);
+        head.next = le32(raw + 8);
+
+        /*
+         * The checks of index_header(), in one go. The back pointer is
+         * before the header, so next >= position implies next > prev.
+         */
+        const auto valid = head.type <= tapeimage::file
+                       and head.prev == back
+                       and head.next >= position;
+        if (not valid)
+            break;
+
+        this->index.append(head);
+        if (this->index.size() <= sampled_headers)
+            this->head_checksum.update(raw, header::size);
+        std::memcpy(this->last_head, raw, header::size);
+        count += 1;
+
+        if (head.type == tapeimage::file)
+            break;
+
+        back = position;
+        position = head.next;
+    }
+
+    return count;
+}
+
+void tapeimage::build_index(std::int64_t* records, std::int64_t* size)
+noexcept (false) {
+    this->require_seekable("build_index");
+
+    /*
+     * Appending to the index invalidates the read head, so remember where it
+     * is, and put it (and the underlying file) back afterwards, also when
+     * indexing fails.
+     */
+    const auto pos = this->index.index_of(this->current);
+    const auto remaining = this->current.bytes_left();
+    const auto restore = this->fp->tell();
+    const auto was_eof = this->fp->eof();
+
+    const auto reposition = [&] {
+        const auto itr = std::next(this->index.begin(), pos);
+        if (pos < 0) {
+            this->current = read_head::ghost(itr);
+        } else {
+            this->current.move(itr);
+            this->current.move(this->current.bytes_left() - remaining);
+        }
+
+        if (this->fp->tell() != restore or (this->fp->eof() and not was_eof))
+            this->fp->seek(restore);
+    };
+
+    try {
+        auto buffer = std::vector< unsigned char,
+                                   arena_allocator< unsigned char > >(
+            index_batch_size
+        );
+        std::int64_t buffer_start = 0;
+        std::int64_t buffer_len = 0;
+        bool reached_eof = false;
+
+        while (this->index.last()->type != tapeimage::file) {
+            const auto at = this->addr.from_physical(this->index.last()->next);
+            const auto buffered = buffer_start <= at
+                and at + header::size <= buffer_start + buffer_len;
+
+            if (not buffered) {
+                /*
+                 * The last batch already hit end-of-file, so there are no
+                 * more headers. This also saves seeking to end-of-file, which
+                 * not all protocols support.
+                 */
+                if (reached_eof and at >= buffer_start + buffer_len) {
+                    this->indexed_all = true;
+                    break;
+                }
+
+                /*
+                 * Read through short gaps rather than seeking past them,
+                 * which is usually cheaper, and does not rely on the
+                 * underlying protocol supporting seeks to end-of-file.
+                 */
+                const auto tell = this->fp->tell();
+                const auto gap = at - tell;
+                const auto from = (gap >= 0 and gap < index_batch_size / 2)
+                                ? tell
+                                : at;
+                if (from != tell)
+                    this->fp->seek(from);
+
+                std::int64_t n = 0;
+                const auto err = this->fp->readinto(
+                    buffer.data(),
+                    buffer.size(),
+                    &n
+                );
+
+                buffer_start = from;
+                buffer_len = n;
+                reached_eof = err == LFP_EOF;
+
+                const auto available = (std::max)(from + n - at,
+                                                  std::int64_t(0));
+                if (available < header::size) {
+                    if (not this->header_read_ok(err, available)) {
+                        this->indexed_all = true;
+                        break;
+                    }
+                }
+            }
+
+            const auto n = this->index_buffered(buffer.data(),
+                                                buffer_start,
+                                                buffer_len);
+            if (n > 0) {
+                counters::add(this->iostats.headers_read, n);
+                continue;
+            }
+
+            counters::add(this->iostats.headers_read);
+            this->index_header(buffer.data() + (at - buffer_start));
+        }
+    } catch (...) {
+        reposition();
+        throw;
+    }
+
+    reposition();
+
+    const auto last = this->index.last();
+    const auto end = this->addr.from_physical(last->next);
+    *records = this->index.size();
+    *size = this->addr.logical(end, this->index.index_of(last));
+}
+
+std::int64_t tapeimage::file_end() const noexcept (true) {
+    const auto last = this->index.last();
+    if (this->index.empty() or last->type != tapeimage::file)
+        return -1;
+    return this->addr.from_physical(last->next);
+}
+
+std::uint64_t tapeimage::checksum() const noexcept (true) {
+    auto hash = this->head_checksum;
+    if (this->index.size() > sampled_headers)
+        hash.update(this->last_head, sizeof(this->last_head));
+    return hash.digest();
+}
+
+std::vector< unsigned char > tapeimage::index_export() noexcept (false) {
+    this->require_seekable("index_export");
+    blob::header head;
+    head.tag           = 'T';
+    head.flags         = this->recovery ? 1 : 0;
+    if (this->indexed_all)
+        head.flags |= blob::complete;
+    head.base_zero     = this->addr.zero();
+    head.physical_zero = this->addr.physical_zero();
+    head.count         = this->index.size();
+    head.end           = this->addr.from_physical(this->index.last()->next);
+    head.checksum      = this->checksum();
+
+    blob::writer w;
+    w.reserve(blob::header::size + header::size * this->index.size());
+    w.put(head);
+    /*
+     * Store the offsets as they are on disk, so that indices of large files
+     * use the same format. index_import() undoes the wraparound again.
+     */
+    for (auto itr = this->index.begin(); itr != this->index.end(); ++itr) {
+        w.put(itr->type);
+        w.put(std::uint32_t(itr->prev));
+        w.put(std::uint32_t(itr->next));
+    }
+    return w.release();
+}
+
+void tapeimage::index_import(const void* src, std::int64_t len)
+noexcept (false) {
+    this->require_seekable("index_import");
+    if (not this->index.empty()) {
+        throw invalid_args(
+            "index_import: the index must be imported before reading"
+        );
+    }
+
+    blob::reader r(src, len);
+    const auto head = r.get_header('T', header::size);
+
+    if (head.base_zero != this->addr.zero()
+        or head.physical_zero != this->addr.physical_zero()) {
+        const auto msg = "index_import: index is for a protocol opened at "
+                         "(tell = {}, ptell = {}), but this is at "
+                         "(tell = {}, ptell = {})";
+        throw invalid_args(fmt::format(msg,
+            head.base_zero, head.physical_zero,
+            this->addr.zero(), this->addr.physical_zero()));
+    }
+
+    /*
+     * Decode the entries into a new index, and check that they are
+     * consistent, before touching the file.
+     */
+    record_index imported(this->addr);
+    for (std::int64_t i = 0; i < head.count; ++i) {
+        header h;
+        h.type = r.get< std::uint32_t >();
+        const auto prev = r.get< std::uint32_t >();
+        const auto next = r.get< std::uint32_t >();
+        h.prev = prev;
+        h.next = next;
+        if (this->large)
+            unwrap(h, prev, next, imported.last()->next);
+
+        const auto consistent =
+            (h.type == tapeimage::record or h.type == tapeimage::file)
+            and (next > prev or (this->large and next < prev))
+            and (i < 2 or h.prev == std::prev(imported.last())->next);
+
+        if (not consistent) {
+            const auto msg = "index_import: corrupt index, inconsistent "
+                             "header {} (type = {}, prev = {}, next = {})";
+            throw invalid_args(fmt::format(msg, i, h.type, h.prev, h.next));
+        }
+
+        imported.append(h);
+    }
+
+    if (this->addr.from_physical(imported.last()->next) != head.end)
+        throw invalid_args("index_import: corrupt index, end mismatch");
+
+    /*
+     * Check that the index matches the file, by re-reading the same headers
+     * that went into the checksum, and checking that the file is not
+     * truncated before the end of the last record. A complete index must
+     * also still end where the file does.
+     */
+    blob::fnv1a hash;
+    unsigned char last[header::size] = {};
+    const auto restore = this->fp->tell();
+    try {
+        const auto read = [this] (record_index::iterator itr,
+                                  unsigned char* dst,
+                                  std::int64_t len) {
+            this->fp->seek(this->addr.from_physical(std::prev(itr)->next));
+            std::int64_t n = 0;
+            this->fp->readinto(dst, len, &n);
+            if (n != len)
+                throw invalid_args("unable to read header");
+        };
+
+        const auto sampled = (std::min)(imported.size(),
+                                        std::size_t(sampled_headers));
+        for (std::size_t i = 0; i < sampled; ++i) {
+            read(imported.begin() + i, last, sizeof(last));
+            hash.update(last, sizeof(last));
+        }
+
+        auto expected = hash;
+        if (imported.size() > sampled_headers) {
+            read(imported.last(), last, sizeof(last));
+            expected.update(last, sizeof(last));
+        }
+
+        if (expected.digest() != head.checksum)
+            throw invalid_args("checksum mismatch");
+
+        /*
+         * Read from the last byte, and not from the end, as not all protocols
+         * support seeking to end-of-file
+         */
+        if (not imported.empty()) {
+            unsigned char bytes[2];
+            const auto len = (head.flags & blob::complete) ? 2 : 1;
+            std::int64_t n = 0;
+            this->fp->seek(head.end - 1);
+            this->fp->readinto(bytes, len, &n);
+            if (n < 1)
+                throw invalid_args("file is smaller than the index");
+            if (n > 1)
+                throw invalid_args("file is larger than the index");
+        }
+
+        this->fp->seek(restore);
+    } catch (const lfp::error& e) {
+        this->fp->seek(restore);
+        const auto msg = "index_import: index does not match file: {}";
+        throw invalid_args(fmt::format(msg, e.what()));
+    }
+
+    this->index = std::move(imported);
+    this->current = read_head::ghost(std::prev(this->index.begin()));
+    this->head_checksum = hash;
+    std::memcpy(this->last_head, last, sizeof(last));
+    this->indexed_all = head.flags & blob::complete;
+
+    if (head.flags & 1) {
+        this->recovery = LFP_PROTOCOL_TRYRECOVERY;
+        this->errmsg("tapeimage: index was built with protocol recovery");
+    }
 }
 
 void tapeimage::seek(std::int64_t n) noexcept (false) {
+    seek_probe probe(this->iostats);
     assert(n >= 0);
 
-    if ((std::numeric_limits<std::uint32_t>::max)() < n)
+    if (not this->large and (std::numeric_limits<std::uint32_t>::max)() < n)
         throw invalid_args("Too big seek offset. TIF protocol does not "
-                           "support files larger than 4GB");
+                           "support files larger than 4GB, unless opened "
+                           "with lfp_tapeimage_open_large");
+
+    if (this->stream) {
+        this->seek_forward(n);
+        return;
+    }
 
     if (this->index.contains(n)) {
         const auto next = this->index.find(n, this->current);
         const auto pos  = this->index.index_of(next);
         const auto base_offset = this->addr.base(n, pos);
+        counters::add(next == this->current
+            ? this->iostats.seeks_in_record
+            : this->iostats.seeks_indexed
+        );
+
+        /*
+         * Leave the underlying file alone when it is already in place, as it
+         * is when reading on from a seek to the current position. Seeks are
+         * not free even when they don't move - cfile throws away the stdio
+         * buffer, and layered protocols look up the record again. Not all
+         * protocols can tell, and then there's no telling where it is.
+         */
+        std::int64_t tell = -1;
+        try {
+            tell = this->fp->tell();
+        } catch (const lfp::error&) {}
 
-        this->fp->seek(base_offset);
+        if (this->fp->eof() or tell != base_offset)
+            this->fp->seek(base_offset);
         this->current.move(next);
         const auto current_tell =
             this->addr.from_physical(this->current.ptell());
@@ -754,6 +1917,7 @@ void tapeimage::seek(std::int64_t n) noexcept (false) {
      * The target is beyond what we have indexed, so chase the headers and add
      * them to the index as we go
      */
+    counters::add(this->iostats.seeks_chased);
     this->current.move(this->index.last());
     while (true) {
         const auto last = this->index.last();
@@ -816,6 +1980,124 @@ void tapeimage::seek(std::int64_t n) noexcept (false) {
     }
 }
 
+lfp_stats tapeimage::stats() const noexcept (false) {
+    auto s = this->lfp_protocol::stats();
+    s.index_records = this->index.size();
+    s.index_bytes = this->index.memory();
+    return s;
+}
+
+/*
+ * Move the underlying file to the end of the current record, i.e. to the
+ * next header, without reading the bytes left in it. The last byte is read
+ * rather than seeked past, as not all protocols support seeking to
+ * end-of-file, and it also checks that the record is not truncated.
+ */
+void tapeimage::skip_record() noexcept (false) {
+    const auto left = this->current.bytes_left();
+    if (this->stream) {
+        const auto n = this->discard(left);
+        if (n != left) {
+            const auto msg = "tapeimage: unexpected EOF when skipping record "
+                             "- expected there to be {} more bytes";
+            throw unexpected_eof(fmt::format(msg, left - n));
+        }
+        this->current.skip();
+        return;
+    }
+
+    auto skip = left;
+    if (left > header::size) {
+        this->fp->seek(this->addr.from_physical(this->current.ptell()) + left - 1);
+        skip = 1;
+    }
+
+    unsigned char buffer[header::size];
+    std::int64_t n = 0;
+    if (skip > 0)
+        this->fp->readinto(buffer, skip, &n);
+
+    if (n != skip) {
+        const auto msg = "tapeimage: unexpected EOF when skipping record "
+                         "- expected there to be {} more bytes";
+        throw unexpected_eof(fmt::format(msg, skip - n));
+    }
+
+    this->current.skip();
+}
+
+void tapeimage::require_seekable(const char* what) const noexcept (false) {
+    if (not this->stream)
+        return;
+
+    const auto msg = "tapeimage: {} is not supported in streams";
+    throw not_supported(fmt::format(msg, what));
+}
+
+/*
+ * Streams can only move forward, by reading, which also reads and checks the
+ * headers on the way
+ */
+void tapeimage::seek_forward(std::int64_t n) noexcept (false) {
+    auto left = n - this->tell();
+    if (left < 0) {
+        const auto msg = "tapeimage: can not seek backwards in a stream, "
+                         "from {} to {}";
+        throw not_supported(fmt::format(msg, this->tell(), n));
+    }
+
+    while (left > 0) {
+        const auto chunk = (std::min)(left, std::int64_t(index_batch_size));
+        this->batch.resize(chunk);
+        std::int64_t bytes_read = 0;
+        const auto k = this->readinto(this->batch.data(), chunk, bytes_read);
+        if (k == 0)
+            break;
+        left -= k;
+    }
+}
+
+/*
+ * Read and throw away n bytes from the underlying file, and return how many
+ * there were, to move past bytes without seeking
+ */
+std::int64_t tapeimage::discard(std::int64_t n) noexcept (false) {
+    std::int64_t discarded = 0;
+    while (discarded < n) {
+        const auto chunk = (std::min)(n - discarded,
+                                     std::int64_t(index_batch_size));
+        this->batch.resize(chunk);
+        std::int64_t k = 0;
+        this->fp->readinto(this->batch.data(), chunk, &k);
+        discarded += k;
+        if (k < chunk)
+            break;
+    }
+    return discarded;
+}
+
+lfp_status tapeimage::record_next(lfp_record* rec) noexcept (false) {
+    if (this->current->type == tapeimage::file)
+        return LFP_EOF;
+
+    this->skip_record();
+    if (this->current == this->index.last()) {
+        if (not this->read_header_from_disk())
+            return LFP_EOF;
+        this->current.move(this->index.last());
+    } else {
+        const auto next = this->current.next_record();
+        this->skip_to(this->addr.from_physical(next.ptell()));
+        this->current.move(next);
+    }
+
+    rec->offset        = this->tell();
+    rec->length        = this->current.bytes_left();
+    rec->header_offset = this->addr.from_physical(std::prev(this->current)->next);
+    rec->type          = int(this->current->type);
+    return this->recovery ? this->recovery : LFP_OK;
+}
+
 std::int64_t tapeimage::tell() const noexcept (false) {
     const auto pos = this->index.index_of(this->current);
     const auto base_tell = this->addr.from_physical(this->current.ptell());
@@ -826,8 +2108,159 @@ std::int64_t tapeimage::ptell() const noexcept (false) {
     return this->fp->ptell();
 }
 
+/*
+ * Walk the logical files of the tape image in f, from its current position,
+ * and collect the offsets (as reported by f->tell()) at which they start,
+ * stopping after max files. Each file is indexed by build_index() on a
+ * tapeimage that borrows f, which reads small records, bodies and all, in
+ * batches, and seeks past large ones. f is left at an unspecified position.
+ *
+ * A file mark right after another ends the tape, and is not counted as a
+ * file.
+ */
+std::vector< std::int64_t > find_files(lfp_protocol* f, std::int64_t max)
+noexcept (false) {
+    std::vector< std::int64_t > files;
+
+    while (std::int64_t(files.size()) < max) {
+        const auto start = f->tell();
+        tapeimage tif(f);
+        struct borrowed {
+            tapeimage& tif;
+            ~borrowed() { this->tif.peel(); }
+        } guard { tif };
+
+        lfp_record rec;
+        if (tif.record_next(&rec) == LFP_EOF)
+            break;
+        if (rec.type == int(tapeimage::file) and not files.empty())
+            break;
+
+        files.push_back(start);
+        if (std::int64_t(files.size()) == max)
+            break;
+
+        std::int64_t records = 0;
+        std::int64_t size = 0;
+        tif.build_index(&records, &size);
+        const auto end = tif.file_end();
+        if (end < 0)
+            break;
+
+        /*
+         * Check that there is something after the file mark, by reading the
+         * last byte of the mark and the first byte after it, rather than
+         * seeking to what may be end-of-file, which not all protocols support
+         */
+        unsigned char probe[2];
+        std::int64_t n = 0;
+        f->seek(end - 1);
+        f->readinto(probe, sizeof(probe), &n);
+        if (n < std::int64_t(sizeof(probe)))
+            break;
+        f->seek(end);
+    }
+
+    return files;
+}
+
+}
+
+}
+
+int lfp_tapeimage_build_index(lfp_protocol* f,
+        std::int64_t* records,
+        std::int64_t* size) try {
+    assert(f);
+
+    auto* tif = dynamic_cast< lfp::tapeimage* >(f);
+    if (not tif) {
+        f->errmsg("tapeimage_build_index: protocol is not a tape image");
+        return LFP_INVALID_ARGS;
+    }
+
+    std::int64_t r = 0;
+    std::int64_t n = 0;
+    tif->build_index(&r, &n);
+    if (records) *records = r;
+    if (size)    *size = n;
+    return LFP_OK;
+} catch (const lfp::error& e) {
+    f->errmsg(e.what());
+    return e.status();
+} catch (const std::exception& e) {
+    f->errmsg(e.what());
+    return LFP_UNHANDLED_EXCEPTION;
+} catch (...) {
+    assert(false);
+    f->errmsg("Unhandled error that does not derive from std::exception");
+    return LFP_UNHANDLED_EXCEPTION;
+}
+
+int lfp_tapeimage_files(lfp_protocol* f,
+        std::int64_t* offsets,
+        std::int64_t len,
+        std::int64_t* count) try {
+    assert(f);
+
+    if (len < 0) {
+        f->errmsg("tapeimage_files: len must be non-negative");
+        return LFP_INVALID_ARGS;
+    }
+
+    const auto start = f->tell();
+    const auto restore = [&] {
+        if (f->tell() != start)
+            f->seek(start);
+    };
+
+    std::vector< std::int64_t > files;
+    try {
+        files = lfp::find_files(f, std::numeric_limits< std::int64_t >::max());
+    } catch (...) {
+        restore();
+        throw;
+    }
+    restore();
+
+    const auto size = std::int64_t(files.size());
+    if (offsets)
+        std::copy_n(files.begin(), (std::min)(len, size), offsets);
+    if (count)
+        *count = size;
+    return LFP_OK;
+} catch (const lfp::error& e) {
+    f->errmsg(e.what());
+    return e.status();
+} catch (const std::exception& e) {
+    f->errmsg(e.what());
+    return LFP_UNHANDLED_EXCEPTION;
+} catch (...) {
+    assert(false);
+    f->errmsg("Unhandled error that does not derive from std::exception");
+    return LFP_UNHANDLED_EXCEPTION;
 }
 
+lfp_protocol* lfp_tapeimage_open_file(lfp_protocol* f, int file) {
+    if (not f) return nullptr;
+    if (file < 0) return nullptr;
+
+    std::int64_t start = 0;
+    try {
+        start = f->tell();
+        const auto files = lfp::find_files(f, std::int64_t(file) + 1);
+        if (std::int64_t(files.size()) > file) {
+            f->seek(files[file]);
+            return new lfp::tapeimage(f);
+        }
+    } catch (...) {}
+
+    /* the caller still owns f, so try to put it back where it was */
+    try {
+        if (f->tell() != start)
+            f->seek(start);
+    } catch (...) {}
+    return nullptr;
 }
 
 lfp_protocol* lfp_tapeimage_open(lfp_protocol* f) {
@@ -839,3 +2272,23 @@ lfp_protocol* lfp_tapeimage_open(lfp_protocol* f) {
         return nullptr;
     }
 }
+
+lfp_protocol* lfp_tapeimage_open_large(lfp_protocol* f) {
+    if (not f) return nullptr;
+
+    try {
+        return new lfp::tapeimage(f, true);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+lfp_protocol* lfp_tapeimage_open_stream(lfp_protocol* f) {
+    if (not f) return nullptr;
+
+    try {
+        return new lfp::tapeimage(f, true, true);
+    } catch (...) {
+        return nullptr;
+    }
+}
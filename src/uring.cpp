@@ -0,0 +1,507 @@
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <ciso646>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+
+#if LFP_IO_URING
+    #include <linux/io_uring.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+    #include <sys/uio.h>
+    #include <unistd.h>
+#endif
+
+#include <lfp/protocol.hpp>
+#include <lfp/uring.h>
+
+#include "fd.hpp"
+
+#if LFP_IO_URING
+
+namespace lfp { namespace {
+
+/*
+ * A read in flight. Its address is the user_data of the submission, and it
+ * lives until the read completes. Short reads are resubmitted for the rest,
+ * so a completion is only reported when len bytes are read, on end-of-file,
+ * or on error.
+ */
+struct request {
+    void* user_data;
+    int fd;
+    unsigned char* dst;
+    std::int64_t len;
+    std::int64_t offset;
+    std::int64_t done = 0;
+    struct iovec iov;
+};
+
+/*
+ * The largest read that is submitted at once
+ */
+constexpr const std::int64_t max_chunk = 1 << 30;
+
+/*
+ * glibc has no wrappers for the io_uring system calls, and liburing would be
+ * a dependency consumers have to find themselves, so the (small) part of it
+ * that is needed is done here
+ */
+int setup(unsigned entries, io_uring_params* p) noexcept (true) {
+    return int(::syscall(__NR_io_uring_setup, entries, p));
+}
+
+int enter(int fd, unsigned submit, unsigned wait, unsigned flags)
+noexcept (true) {
+    return int(::syscall(__NR_io_uring_enter, fd, submit, wait, flags,
+                         nullptr, 0));
+}
+
+template < typename T >
+T* at(void* base, std::uint32_t offset) noexcept (true) {
+    return reinterpret_cast< T* >(static_cast< char* >(base) + offset);
+}
+
+}
+
+}
+
+/*
+ * The submission and completion rings are shared with the kernel. The
+ * application owns the tail of the submission ring and the head of the
+ * completion ring, and the kernel the other ends, so the cross-ends are read
+ * with acquire, and the own ends published with release.
+ */
+struct lfp_uring {
+    explicit lfp_uring(unsigned entries) noexcept (false);
+    ~lfp_uring();
+
+    lfp_uring(const lfp_uring&) = delete;
+    lfp_uring& operator = (const lfp_uring&) = delete;
+
+    void queue(lfp::request*) noexcept (false);
+    int poll(lfp_completion* out, int max, int wait) noexcept (false);
+
+    std::string errmsg;
+
+private:
+    int fd = -1;
+
+    void* sq_ring = MAP_FAILED;
+    void* cq_ring = MAP_FAILED;
+    std::size_t sq_ring_size = 0;
+    std::size_t cq_ring_size = 0;
+    io_uring_sqe* sqes = static_cast< io_uring_sqe* >(MAP_FAILED);
+    std::size_t sqes_size = 0;
+
+    unsigned* sq_head  = nullptr;
+    unsigned* sq_tail  = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned  sq_mask  = 0;
+    unsigned  sq_entries = 0;
+
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    unsigned  cq_mask = 0;
+    unsigned  cq_entries = 0;
+
+    /* submissions in the ring, but not yet passed on to the kernel */
+    unsigned queued = 0;
+    /* requests submitted (or queued), and not yet completed */
+    std::int64_t inflight = 0;
+
+    void submit(unsigned wait) noexcept (false);
+    void push(lfp::request*) noexcept (false);
+    int resubmit(lfp::request*) noexcept (false);
+    void release() noexcept (true);
+};
+
+lfp_uring::lfp_uring(unsigned entries) noexcept (false) {
+    io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+    this->fd = lfp::setup(entries, &p);
+    if (this->fd == -1) {
+        const auto msg = "uring: unable to set up io_uring: {}";
+        throw lfp::not_supported(fmt::format(msg, std::strerror(errno)));
+    }
+
+    this->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    this->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    this->sqes_size    = p.sq_entries * sizeof(io_uring_sqe);
+
+    const auto single = bool(p.features & IORING_FEAT_SINGLE_MMAP);
+    if (single) {
+        this->sq_ring_size = (std::max)(this->sq_ring_size, this->cq_ring_size);
+        this->cq_ring_size = this->sq_ring_size;
+    }
+
+    const auto prot  = PROT_READ | PROT_WRITE;
+    const auto flags = MAP_SHARED | MAP_POPULATE;
+    this->sq_ring = ::mmap(nullptr, this->sq_ring_size, prot, flags,
+                           this->fd, IORING_OFF_SQ_RING);
+    if (this->sq_ring != MAP_FAILED) {
+        this->cq_ring = single
+            ? this->sq_ring
+            : ::mmap(nullptr, this->cq_ring_size, prot, flags,
+                     this->fd, IORING_OFF_CQ_RING);
+    }
+    if (this->cq_ring != MAP_FAILED) {
+        this->sqes = static_cast< io_uring_sqe* >(
+            ::mmap(nullptr, this->sqes_size, prot, flags,
+                   this->fd, IORING_OFF_SQES)
+        );
+    }
+
+    if (this->sqes == MAP_FAILED) {
+        const auto msg = fmt::format("uring: unable to map rings: {}",
+                                     std::strerror(errno));
+        this->release();
+        throw lfp::runtime_error(msg);
+    }
+
+    using lfp::at;
+    this->sq_head    = at< unsigned >(this->sq_ring, p.sq_off.head);
+    this->sq_tail    = at< unsigned >(this->sq_ring, p.sq_off.tail);
+    this->sq_array   = at< unsigned >(this->sq_ring, p.sq_off.array);
+    this->sq_mask    = *at< unsigned >(this->sq_ring, p.sq_off.ring_mask);
+    this->sq_entries = p.sq_entries;
+
+    this->cq_head    = at< unsigned >(this->cq_ring, p.cq_off.head);
+    this->cq_tail    = at< unsigned >(this->cq_ring, p.cq_off.tail);
+    this->cqes       = at< io_uring_cqe >(this->cq_ring, p.cq_off.cqes);
+    this->cq_mask    = *at< unsigned >(this->cq_ring, p.cq_off.ring_mask);
+    this->cq_entries = p.cq_entries;
+}
+
+lfp_uring::~lfp_uring() {
+    /*
+     * The kernel may still write into the buffers (and requests) of reads in
+     * flight, so they must all complete before the requests are freed
+     */
+    try {
+        lfp_completion discard[64];
+        while (this->inflight > 0)
+            this->poll(discard, 64, 1);
+    } catch (...) {}
+
+    this->release();
+}
+
+void lfp_uring::release() noexcept (true) {
+    if (this->sqes != MAP_FAILED)
+        ::munmap(this->sqes, this->sqes_size);
+    if (this->cq_ring != MAP_FAILED and this->cq_ring != this->sq_ring)
+        ::munmap(this->cq_ring, this->cq_ring_size);
+    if (this->sq_ring != MAP_FAILED)
+        ::munmap(this->sq_ring, this->sq_ring_size);
+    if (this->fd != -1)
+        ::close(this->fd);
+
+    this->sqes = static_cast< io_uring_sqe* >(MAP_FAILED);
+    this->cq_ring = MAP_FAILED;
+    this->sq_ring = MAP_FAILED;
+    this->fd = -1;
+}
+
+/*
+ * Pass the queued submissions on to the kernel, and wait until at least wait
+ * completions are available
+ */
+void lfp_uring::submit(unsigned wait) noexcept (false) {
+    while (this->queued > 0 or wait > 0) {
+        const auto flags = wait > 0 ? IORING_ENTER_GETEVENTS : 0;
+        const auto n = lfp::enter(this->fd, this->queued, wait, flags);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+
+            const auto msg = "uring: unable to submit: {}";
+            throw lfp::io_error(fmt::format(msg, std::strerror(errno)));
+        }
+
+        this->queued -= (std::min)(unsigned(n), this->queued);
+        /*
+         * enter only returns once the wait is satisfied, even if not all
+         * queued entries were consumed, and an enter that submits nothing
+         * would only spin
+         */
+        wait = 0;
+        if (n == 0)
+            break;
+    }
+}
+
+/*
+ * Put the (rest of the) read in the submission ring. If the ring is full,
+ * the queued entries are submitted first.
+ */
+void lfp_uring::push(lfp::request* req) noexcept (false) {
+    auto tail = *this->sq_tail;
+    auto head = __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head == this->sq_entries) {
+        this->submit(0);
+        head = __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE);
+        if (tail - head == this->sq_entries)
+            throw lfp::runtime_error("uring: submission queue is full");
+    }
+
+    const auto remaining = req->len - req->done;
+    req->iov.iov_base = req->dst + req->done;
+    req->iov.iov_len  = std::size_t((std::min)(remaining, lfp::max_chunk));
+
+    const auto index = tail & this->sq_mask;
+    auto* sqe = this->sqes + index;
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode    = IORING_OP_READV;
+    sqe->fd        = req->fd;
+    sqe->addr      = reinterpret_cast< std::uintptr_t >(&req->iov);
+    sqe->len       = 1;
+    sqe->off       = req->offset + req->done;
+    sqe->user_data = reinterpret_cast< std::uintptr_t >(req);
+
+    this->sq_array[index] = index;
+    __atomic_store_n(this->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    this->queued += 1;
+}
+
+void lfp_uring::queue(lfp::request* req) noexcept (false) {
+    /*
+     * Every read in flight needs a slot in the completion ring, or
+     * completions may be dropped by older kernels
+     */
+    if (this->inflight >= this->cq_entries) {
+        throw lfp::runtime_error(
+            "readinto_async: too many reads in flight, poll for completions"
+        );
+    }
+
+    this->push(req);
+    this->inflight += 1;
+}
+
+/*
+ * Put a partial or interrupted read back in the ring, and return LFP_OK, or
+ * the status it must be completed with, if that fails
+ */
+int lfp_uring::resubmit(lfp::request* req) noexcept (false) {
+    try {
+        this->push(req);
+        return LFP_OK;
+    } catch (const lfp::error& e) {
+        this->errmsg = fmt::format("readinto_async: {}", e.what());
+        return e.status();
+    }
+}
+
+int lfp_uring::poll(lfp_completion* out, int max, int wait) noexcept (false) {
+    int count = 0;
+    while (true) {
+        const auto target = (std::min)(std::int64_t(wait),
+                                       std::int64_t(count) + this->inflight);
+        const auto need = (std::max)(target - count, std::int64_t(0));
+
+        /*
+         * The completions already taken must reach the caller, so a failure
+         * once there are some only ends the wait
+         */
+        try {
+            this->submit(unsigned(need));
+        } catch (const lfp::error& e) {
+            if (count == 0) throw;
+            this->errmsg = e.what();
+            break;
+        }
+
+        auto head = *this->cq_head;
+        const auto tail = __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail and count < max) {
+            const auto cqe = this->cqes[head & this->cq_mask];
+            /*
+             * Hand every entry back to the kernel as soon as it is taken,
+             * before anything else is done with the request, so that it is
+             * never seen twice
+             */
+            head += 1;
+            __atomic_store_n(this->cq_head, head, __ATOMIC_RELEASE);
+
+            auto* req = reinterpret_cast< lfp::request* >(
+                std::uintptr_t(cqe.user_data)
+            );
+            const auto res = cqe.res;
+
+            int status = LFP_OK;
+            if (res == -EINTR or res == -EAGAIN) {
+                status = this->resubmit(req);
+                if (status == LFP_OK)
+                    continue;
+            } else if (res < 0) {
+                const auto msg = "readinto_async: unable to read: {}";
+                this->errmsg = fmt::format(msg, std::strerror(-res));
+                status = LFP_IOERROR;
+            } else if (res == 0) {
+                status = req->done == req->len ? LFP_OK : LFP_EOF;
+            } else {
+                req->done += res;
+                if (req->done < req->len) {
+                    status = this->resubmit(req);
+                    if (status == LFP_OK)
+                        continue;
+                }
+            }
+
+            out[count].user_data  = req->user_data;
+            out[count].status     = status;
+            out[count].bytes_read = req->done;
+            count += 1;
+            this->inflight -= 1;
+            delete req;
+        }
+
+        if (count >= target or count == max)
+            break;
+    }
+
+    /*
+     * Submit the resubmissions, without waiting for them. If that fails, they
+     * stay queued for the next poll.
+     */
+    try {
+        this->submit(0);
+    } catch (const lfp::error& e) {
+        if (count == 0) throw;
+        this->errmsg = e.what();
+    }
+    return count;
+}
+
+lfp_uring* lfp_uring_open(int entries) {
+    if (entries < 0) return nullptr;
+    if (entries == 0) entries = 256;
+
+    try {
+        return new lfp_uring(unsigned(entries));
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void lfp_uring_close(lfp_uring* ring) {
+    delete ring;
+}
+
+int lfp_readinto_async(lfp_uring* ring,
+                       lfp_protocol* f,
+                       void* dst,
+                       std::int64_t len,
+                       void* user_data) {
+    assert(ring);
+    assert(f);
+
+    if (len < 0) {
+        f->errmsg("readinto_async: len must be non-negative");
+        return LFP_INVALID_ARGS;
+    }
+
+    std::int64_t pos = -1;
+    try {
+        pos = f->tell();
+
+        auto req = std::unique_ptr< lfp::request >(new lfp::request());
+        req->user_data = user_data;
+        req->dst       = static_cast< unsigned char* >(dst);
+        req->len       = len;
+        req->fd        = lfp::reserve_read(f, len, &req->offset);
+
+        ring->queue(req.get());
+        req.release();
+        return LFP_OKINCOMPLETE;
+    } catch (const lfp::error& e) {
+        /* put f back, as if the read never happened */
+        if (pos != -1) {
+            try { f->seek(pos); } catch (...) {}
+        }
+        f->errmsg(fmt::format("readinto_async: {}", e.what()));
+        return e.status();
+    } catch (const std::exception& e) {
+        f->errmsg(e.what());
+        return LFP_UNHANDLED_EXCEPTION;
+    } catch (...) {
+        assert(false);
+        f->errmsg("Unhandled error that does not derive from std::exception");
+        return LFP_UNHANDLED_EXCEPTION;
+    }
+}
+
+int lfp_uring_poll(lfp_uring* ring,
+                   lfp_completion* out,
+                   int max,
+                   int wait,
+                   int* count) try {
+    assert(ring);
+
+    if (max < 0 or wait < 0 or (max > 0 and not out)) {
+        ring->errmsg = "uring_poll: invalid arguments";
+        return LFP_INVALID_ARGS;
+    }
+
+    const auto n = ring->poll(out, max, (std::min)(wait, max));
+    if (count)
+        *count = n;
+    return LFP_OK;
+} catch (const lfp::error& e) {
+    ring->errmsg = e.what();
+    return e.status();
+} catch (const std::exception& e) {
+    ring->errmsg = e.what();
+    return LFP_UNHANDLED_EXCEPTION;
+} catch (...) {
+    assert(false);
+    ring->errmsg = "Unhandled error that does not derive from std::exception";
+    return LFP_UNHANDLED_EXCEPTION;
+}
+
+const char* lfp_uring_errormsg(lfp_uring* ring) {
+    assert(ring);
+    if (ring->errmsg.empty()) return nullptr;
+    return ring->errmsg.c_str();
+}
+
+#else
+
+/*
+ * lfp is built without io_uring, so there is never a queue to use
+ */
+struct lfp_uring {};
+
+lfp_uring* lfp_uring_open(int) {
+    return nullptr;
+}
+
+void lfp_uring_close(lfp_uring*) {}
+
+int lfp_readinto_async(lfp_uring*,
+                       lfp_protocol* f,
+                       void*,
+                       std::int64_t,
+                       void*) {
+    assert(f);
+    f->errmsg("readinto_async: lfp is built without io_uring");
+    return LFP_NOTSUPPORTED;
+}
+
+int lfp_uring_poll(lfp_uring*, lfp_completion*, int, int, int*) {
+    return LFP_NOTSUPPORTED;
+}
+
+const char* lfp_uring_errormsg(lfp_uring*) {
+    return "uring: lfp is built without io_uring";
+}
+
+#endif
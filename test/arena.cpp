@@ -0,0 +1,232 @@
+#include <atomic>
+#include <ciso646>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include <lfp/arena.h>
+#include <lfp/lfp.h>
+#include <lfp/memfile.h>
+#include <lfp/rp66.h>
+#include <lfp/tapeimage.h>
+
+#include "utils.hpp"
+
+using namespace Catch::Matchers;
+
+/*
+ * Count every allocation in the test program, to check that there are none
+ * where there should be none. Only the difference between two readings on
+ * the same thread is meaningful.
+ *
+ * Replacing the allocation functions affects the whole program, which is why
+ * these tests are in their own executable. All the forms are replaced, so
+ * that everything is allocated and released the same way.
+ */
+namespace {
+std::atomic< long > allocations { 0 };
+
+void* allocate(std::size_t n) noexcept (true) {
+    allocations += 1;
+    return std::malloc(n == 0 ? 1 : n);
+}
+}
+
+void* operator new (std::size_t n) {
+    if (void* p = allocate(n))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[] (std::size_t n) {
+    if (void* p = allocate(n))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new (std::size_t n, const std::nothrow_t&) noexcept {
+    return allocate(n);
+}
+
+void* operator new[] (std::size_t n, const std::nothrow_t&) noexcept {
+    return allocate(n);
+}
+
+void operator delete (void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[] (void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete (void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[] (void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete (void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+void operator delete[] (void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+/*
+ * A tape image of a Visible Envelope, and the bytes of its logical records
+ */
+struct dlis {
+    dlis(int records) : file(storage_unit_label()) {
+        bytes ve;
+        for (int i = 0; i < records; ++i) {
+            const auto body = bytes(10 + i, i);
+            ve = ve + visible_record(body);
+            this->data = this->data + body;
+        }
+
+        std::vector< bytes > bodies;
+        bodies.push_back(this->file + bytes(ve.begin(), ve.begin() + 30));
+        bodies.push_back(bytes(ve.begin() + 30, ve.end()));
+        this->file = tapeimage(bodies);
+    }
+
+    bytes file;
+    bytes data;
+};
+
+/*
+ * Open, read and close the file, and return the status of the read, or -1 if
+ * the file could not be opened. warned is set if the tape image had to
+ * recover. Catch may allocate in its assertions, so there are none in here.
+ */
+int read_once(const bytes& file, bytes& out, bool& warned) {
+    auto* tif = lfp_tapeimage_open(
+        lfp_memfile_openview(file.data(), file.size())
+    );
+    if (not tif) return -1;
+    if (lfp_seek(tif, 80) != LFP_OK) {
+        lfp_close(tif);
+        return -1;
+    }
+    auto* ve = lfp_rp66_open(tif);
+    if (not ve) {
+        lfp_close(tif);
+        return -1;
+    }
+
+    std::int64_t nread = 0;
+    const auto err = lfp_readinto(ve, out.data(), out.size(), &nread);
+    out.resize(nread);
+    warned = lfp_errormsg(tif) != nullptr;
+    lfp_close(ve);
+    return err;
+}
+
+}
+
+TEST_CASE(
+    "Opening and reading files with an arena does not allocate",
+    "[arena]") {
+    const dlis d(20);
+    auto file = d.file;
+
+    bool recovers = false;
+    SECTION( "intact file" ) {}
+    SECTION( "file read in recovery" ) {
+        /* break the back pointer of the file mark */
+        file[file.size() - 8] += 1;
+        recovers = true;
+    }
+
+    auto* arena = lfp_arena_new();
+    REQUIRE(arena);
+    CHECK(lfp_arena_use(arena) == nullptr);
+
+    auto out = bytes(d.data.size() + 1);
+    bool warned = false;
+    for (int i = 0; i < 3; ++i) {
+        out.resize(d.data.size() + 1);
+        read_once(file, out, warned);
+    }
+
+    int err = LFP_OK;
+    const auto before = allocations.load();
+    for (int i = 0; i < 50; ++i) {
+        out.resize(d.data.size() + 1);
+        err = read_once(file, out, warned);
+    }
+    const auto after = allocations.load();
+
+    CHECK(lfp_arena_use(nullptr) == arena);
+    lfp_arena_free(arena);
+
+    CHECK(after - before == 0);
+    CHECK(err == LFP_EOF);
+    CHECK(warned == recovers);
+    CHECK_THAT(out, Equals(d.data));
+}
+
+TEST_CASE(
+    "Protocols outlive the arena, and can be closed on other threads",
+    "[arena]") {
+    const dlis d(5);
+
+    auto* arena = lfp_arena_new();
+    REQUIRE(arena);
+    lfp_arena_use(arena);
+    auto* tif = lfp_tapeimage_open(create_memfile_handle(d.file));
+    REQUIRE(tif);
+    std::int64_t records = -1;
+    CHECK(lfp_tapeimage_build_index(tif, &records, nullptr) == LFP_OK);
+    CHECK(records == 3);
+    lfp_arena_free(arena);
+
+    /* freeing also stopped using it */
+    CHECK(lfp_arena_use(nullptr) == nullptr);
+
+    CHECK(lfp_seek(tif, 80) == LFP_OK);
+    auto* ve = lfp_rp66_open(tif);
+    REQUIRE(ve);
+
+    auto out = bytes(d.data.size());
+    std::int64_t nread = 0;
+    int err = LFP_OK;
+    std::thread reader([&] {
+        err = lfp_readinto(ve, out.data(), out.size(), &nread);
+        lfp_close(ve);
+    });
+    reader.join();
+
+    CHECK(err == LFP_OK);
+    CHECK_THAT(out, Equals(d.data));
+}
+
+TEST_CASE(
+    "Error messages are cut short rather than allocated",
+    "[arena]") {
+    auto* f = lfp_memfile_open();
+    REQUIRE(f);
+
+    const auto err = lfp_seek(f, -1);
+    CHECK(err == LFP_INVALID_ARGS);
+    CHECK_THAT(lfp_errormsg(f), Contains("seek offset n < 0"));
+
+    const auto msg = std::string(10000, 'x');
+    f->errmsg(msg);
+    const auto stored = std::string(lfp_errormsg(f));
+    CHECK(stored.size() < msg.size());
+    CHECK(stored == msg.substr(0, stored.size()));
+
+    lfp_close(f);
+}
@@ -0,0 +1,178 @@
+#include <ciso646>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include <lfp/auto.h>
+#include <lfp/lfp.h>
+#include <lfp/memfile.h>
+
+#include "utils.hpp"
+
+using namespace Catch::Matchers;
+
+namespace {
+
+bytes iota_bytes(std::size_t size, unsigned char first) {
+    auto b = bytes(size);
+    for (std::size_t i = 0; i < size; ++i)
+        b[i] = first + i;
+    return b;
+}
+
+bytes read_all(lfp_protocol* f, std::int64_t max) {
+    auto out = bytes(max);
+    std::int64_t nread = -1;
+    const auto err = lfp_readinto(f, out.data(), max, &nread);
+    CHECK((err == LFP_OK or err == LFP_EOF));
+    out.resize(nread);
+    return out;
+}
+
+lfp_stats leaf_stats(lfp_protocol* f) {
+    lfp_protocol* inner = f;
+    while (lfp_peek(inner, &inner) == LFP_OK) {}
+    lfp_stats stats;
+    REQUIRE(lfp_stats_get(inner, &stats) == LFP_OK);
+    return stats;
+}
+
+}
+
+TEST_CASE(
+    "Opening NULL returns NULL",
+    "[auto]") {
+    int layers = -1;
+    CHECK(!lfp_open_auto(nullptr, &layers));
+    CHECK(layers == -1);
+}
+
+TEST_CASE(
+    "Tape images of Visible Envelopes are opened as tapeimage and rp66",
+    "[auto][tapeimage][rp66]") {
+    const auto a = iota_bytes(20, 0);
+    const auto b = iota_bytes(30, 20);
+    const auto c = iota_bytes(10, 50);
+    const auto ve = visible_record(a) + visible_record(b);
+
+    SECTION( "with a storage unit label" ) {
+        /* the records split the envelope in the middle of a visible record */
+        const auto file = tapeimage({
+            storage_unit_label() + bytes(ve.begin(), ve.begin() + 10),
+            bytes(ve.begin() + 10, ve.end()) + visible_record(c),
+        });
+
+        int layers = 0;
+        auto* f = lfp_open_auto(create_memfile_handle(file), &layers);
+        REQUIRE(f);
+        CHECK(layers == (LFP_AUTO_TAPEIMAGE | LFP_AUTO_SUL | LFP_AUTO_RP66));
+        CHECK_THAT(read_all(f, 100), Equals(a + b + c));
+
+        /* the label is right under rp66 */
+        lfp_protocol* tif = nullptr;
+        REQUIRE(lfp_peek(f, &tif) == LFP_OK);
+        auto label = bytes(80);
+        std::int64_t nread = -1;
+        CHECK(lfp_pread(tif, label.data(), 80, 0, &nread) == LFP_OK);
+        CHECK_THAT(label, Equals(storage_unit_label()));
+
+        CHECK(lfp_seek(f, 25) == LFP_OK);
+        CHECK_THAT(read_all(f, 5), Equals(iota_bytes(5, 25)));
+        CHECK(lfp_close(f) == LFP_OK);
+    }
+
+    SECTION( "without a storage unit label" ) {
+        const auto file = tapeimage({ ve, visible_record(c) });
+
+        int layers = 0;
+        auto* f = lfp_open_auto(create_memfile_handle(file), &layers);
+        REQUIRE(f);
+        CHECK(layers == (LFP_AUTO_TAPEIMAGE | LFP_AUTO_RP66));
+        CHECK_THAT(read_all(f, 100), Equals(a + b + c));
+        CHECK(lfp_close(f) == LFP_OK);
+    }
+}
+
+TEST_CASE(
+    "Visible Envelopes without tape image are opened as rp66",
+    "[auto][rp66]") {
+    const auto a = iota_bytes(20, 0);
+    const auto b = iota_bytes(30, 20);
+    const auto ve = visible_record(a) + visible_record(b);
+
+    const auto sul = GENERATE(true, false);
+    const auto file = sul ? storage_unit_label() + ve : ve;
+
+    int layers = 0;
+    auto* f = lfp_open_auto(create_memfile_handle(file), &layers);
+    REQUIRE(f);
+    const auto expected = sul ? LFP_AUTO_SUL | LFP_AUTO_RP66 : LFP_AUTO_RP66;
+    CHECK(layers == expected);
+    CHECK_THAT(read_all(f, 100), Equals(a + b));
+    CHECK(lfp_close(f) == LFP_OK);
+}
+
+TEST_CASE(
+    "Tape images of other formats are opened as tapeimage only",
+    "[auto][tapeimage]") {
+    const auto a = iota_bytes(20, 100);
+    const auto b = iota_bytes(5000, 0);
+    const auto file = tapeimage({ a, b });
+
+    int layers = 0;
+    auto* f = lfp_open_auto(create_memfile_handle(file), &layers);
+    REQUIRE(f);
+    CHECK(layers == LFP_AUTO_TAPEIMAGE);
+    CHECK_THAT(read_all(f, 10000), Equals(a + b));
+
+    /* seeks back into the probed bytes, and past them */
+    CHECK(lfp_seek(f, 10) == LFP_OK);
+    CHECK_THAT(read_all(f, 10), Equals(iota_bytes(10, 110)));
+    CHECK(lfp_seek(f, 4500) == LFP_OK);
+    CHECK_THAT(read_all(f, 10), Equals(bytes(b.begin() + 4480,
+                                             b.begin() + 4490)));
+    CHECK(lfp_close(f) == LFP_OK);
+}
+
+TEST_CASE(
+    "Files in other formats are opened as they are",
+    "[auto]") {
+    const auto file = iota_bytes(100, 0);
+
+    int layers = -1;
+    auto* f = lfp_open_auto(create_memfile_handle(file), &layers);
+    REQUIRE(f);
+    CHECK(layers == 0);
+    CHECK_THAT(read_all(f, 1000), Equals(file));
+    CHECK(lfp_eof(f));
+
+    CHECK(lfp_seek(f, 50) == LFP_OK);
+    std::int64_t tell = -1;
+    CHECK(lfp_tell(f, &tell) == LFP_OK);
+    CHECK(tell == 50);
+    CHECK(!lfp_eof(f));
+
+    lfp_protocol* inner = nullptr;
+    REQUIRE(lfp_peel(f, &inner) == LFP_OK);
+    CHECK(lfp_close(f) == LFP_OK);
+    CHECK(lfp_close(inner) == LFP_OK);
+}
+
+TEST_CASE(
+    "Probed bytes are only read once from the file",
+    "[auto][stats]") {
+    const auto ve = visible_record(iota_bytes(20, 0))
+                  + visible_record(iota_bytes(30, 20));
+    const auto file = tapeimage({ storage_unit_label() + ve });
+
+    auto* f = lfp_open_auto(create_memfile_handle(file), nullptr);
+    REQUIRE(f);
+    CHECK(read_all(f, 100).size() == 50);
+
+    const auto stats = leaf_stats(f);
+    CHECK(stats.reads <= 2);
+    CHECK(stats.bytes_read == file.size());
+    CHECK(lfp_close(f) == LFP_OK);
+}
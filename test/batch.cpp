@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <atomic>
+#include <ciso646>
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <string>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include <lfp/auto.h>
+#include <lfp/batch.h>
+#include <lfp/custom.h>
+#include <lfp/lfp.h>
+#include <lfp/rp66.h>
+#include <lfp/tapeimage.h>
+
+#include "utils.hpp"
+
+using namespace Catch::Matchers;
+
+namespace {
+
+/*
+ * A tape image of a Visible Envelope, with records of different sizes
+ */
+bytes dlis(int records) {
+    auto ve = storage_unit_label();
+    for (int i = 0; i < records; ++i)
+        ve = ve + visible_record(bytes(10 + i, i));
+
+    std::vector< bytes > bodies;
+    for (std::size_t i = 0; i < ve.size(); i += 50) {
+        const auto end = (std::min)(i + 50, ve.size());
+        bodies.push_back(bytes(ve.begin() + i, ve.begin() + end));
+    }
+    return tapeimage(bodies);
+}
+
+struct tempfiles {
+    ~tempfiles() {
+        for (const auto& path : this->paths)
+            std::remove(path.c_str());
+    }
+
+    const char* add(const bytes& contents) {
+        this->paths.push_back(write_named_tempfile(contents));
+        return this->paths.back().c_str();
+    }
+
+    /* a list, so that adding paths does not move the others */
+    std::list< std::string > paths;
+};
+
+lfp_index_job job(const char* path, std::int64_t device = 0) {
+    lfp_index_job j;
+    std::memset(&j, 0, sizeof(j));
+    j.path = path;
+    j.device = device;
+    return j;
+}
+
+/*
+ * A leaf over a byte vector that counts the open leaves on its device, and
+ * the most it ever was, to check the concurrency limit
+ */
+struct device_counter {
+    std::atomic< int > open { 0 };
+    std::atomic< int > most { 0 };
+};
+
+struct counted_source {
+    const bytes* data;
+    device_counter* device;
+    std::int64_t pos = 0;
+};
+
+int counted_read(void* ctx, void* dst, std::int64_t len, std::int64_t* nread) {
+    auto* s = static_cast< counted_source* >(ctx);
+    const auto size = std::int64_t(s->data->size());
+    const auto n = (std::max)(std::int64_t(0), (std::min)(len, size - s->pos));
+    if (n > 0)
+        std::memcpy(dst, s->data->data() + s->pos, n);
+    s->pos += n;
+    *nread = n;
+    return n == len ? LFP_OK : LFP_EOF;
+}
+
+int counted_seek(void* ctx, std::int64_t n) {
+    static_cast< counted_source* >(ctx)->pos = n;
+    return LFP_OK;
+}
+
+int counted_tell(void* ctx, std::int64_t* n) {
+    *n = static_cast< counted_source* >(ctx)->pos;
+    return LFP_OK;
+}
+
+int counted_close(void* ctx) {
+    auto* s = static_cast< counted_source* >(ctx);
+    s->device->open -= 1;
+    delete s;
+    return LFP_OK;
+}
+
+struct counted_job {
+    const bytes* data;
+    device_counter* device;
+};
+
+lfp_protocol* counted_open(void* ctx, const char*) {
+    auto* j = static_cast< counted_job* >(ctx);
+    const auto now = ++j->device->open;
+    auto most = j->device->most.load();
+    while (now > most and not j->device->most.compare_exchange_weak(most, now))
+        {}
+
+    lfp_custom_ops ops;
+    std::memset(&ops, 0, sizeof(ops));
+    ops.size  = sizeof(ops);
+    ops.read  = counted_read;
+    ops.seek  = counted_seek;
+    ops.tell  = counted_tell;
+    ops.close = counted_close;
+    auto* src = new counted_source();
+    src->data = j->data;
+    src->device = j->device;
+    return lfp_custom_open(&ops, src);
+}
+
+}
+
+TEST_CASE(
+    "Index batch rejects invalid arguments",
+    "[batch]") {
+    auto j = job("does-not-matter");
+    CHECK(lfp_index_batch(nullptr, 1, 1, 1) == LFP_INVALID_ARGS);
+    CHECK(lfp_index_batch(&j, -1, 1, 1) == LFP_INVALID_ARGS);
+    CHECK(lfp_index_batch(&j, 1, -1, 1) == LFP_INVALID_ARGS);
+    CHECK(lfp_index_batch(&j, 1, 1, -1) == LFP_INVALID_ARGS);
+    CHECK(lfp_index_batch(&j, 0, 1, 1) == LFP_OK);
+}
+
+TEST_CASE(
+    "Index batch indexes files like build_index, and reports failures",
+    "[batch][tapeimage][rp66]") {
+    tempfiles files;
+    const auto threads = GENERATE(0, 1, 4);
+    const auto per_device = GENERATE(0, 1, 2);
+
+    const auto contents = std::vector< bytes > {
+        dlis(5),
+        dlis(40),
+        tapeimage({ bytes(100, 1), bytes(7, 2) }),
+        bytes(100, 0x20),
+    };
+
+    std::vector< lfp_index_job > jobs;
+    for (const auto& c : contents)
+        jobs.push_back(job(files.add(c), LFP_INDEX_DEVICE_AUTO));
+    jobs.push_back(job("lfp-batch-does-not-exist.tmp", LFP_INDEX_DEVICE_AUTO));
+
+    const auto count = int(jobs.size());
+    REQUIRE(lfp_index_batch(jobs.data(), count, threads, per_device) == LFP_OK);
+
+    for (int i = 0; i < 2; ++i) {
+        const auto& j = jobs[i];
+        INFO("job " << i << ": " << (j.errmsg ? j.errmsg : ""));
+        CHECK(j.status == LFP_OK);
+        CHECK(!j.errmsg);
+        CHECK(j.layers == (LFP_AUTO_TAPEIMAGE | LFP_AUTO_SUL | LFP_AUTO_RP66));
+        CHECK(j.tapeimage.index);
+        CHECK(j.rp66.index);
+
+        /* the same numbers as indexing the file directly */
+        auto* f = lfp_open_auto(create_memfile_handle(contents[i]), nullptr);
+        REQUIRE(f);
+        lfp_protocol* tif = nullptr;
+        REQUIRE(lfp_peek(f, &tif) == LFP_OK);
+        std::int64_t records = -1;
+        std::int64_t size = -1;
+        CHECK(lfp_tapeimage_build_index(tif, &records, &size) == LFP_OK);
+        CHECK(j.tapeimage.records == records);
+        CHECK(j.tapeimage.size == size);
+        CHECK(lfp_rp66_build_index(f, &records, &size) == LFP_OK);
+        CHECK(j.rp66.records == records);
+        CHECK(j.rp66.size == size);
+        lfp_close(f);
+
+        /* and the exported indices import into a fresh stack */
+        tif = lfp_tapeimage_open(create_memfile_handle(contents[i]));
+        REQUIRE(tif);
+        CHECK(lfp_index_import(tif, j.tapeimage.index, j.tapeimage.index_size)
+              == LFP_OK);
+        CHECK(lfp_seek(tif, 80) == LFP_OK);
+        f = lfp_rp66_open(tif);
+        REQUIRE(f);
+        CHECK(lfp_index_import(f, j.rp66.index, j.rp66.index_size) == LFP_OK);
+        lfp_close(f);
+    }
+
+    CHECK(jobs[2].status == LFP_OK);
+    CHECK(jobs[2].layers == LFP_AUTO_TAPEIMAGE);
+    CHECK(jobs[2].tapeimage.records == 3);
+    CHECK(jobs[2].tapeimage.size == 107);
+    CHECK(jobs[2].tapeimage.index);
+    CHECK(!jobs[2].rp66.index);
+
+    CHECK(jobs[3].status == LFP_INVALID_ARGS);
+    CHECK_THAT(jobs[3].errmsg, Contains("not a tape image"));
+
+    CHECK(jobs[4].status == LFP_IOERROR);
+    CHECK_THAT(jobs[4].errmsg, Contains("lfp-batch-does-not-exist.tmp"));
+
+    lfp_index_batch_free(jobs.data(), count);
+    for (const auto& j : jobs) {
+        CHECK(!j.errmsg);
+        CHECK(!j.tapeimage.index);
+        CHECK(!j.rp66.index);
+    }
+}
+
+TEST_CASE(
+    "Index batch never runs more than per_device jobs on a device",
+    "[batch]") {
+    const auto per_device = GENERATE(1, 2);
+    const auto file = dlis(20);
+
+    device_counter devices[2];
+    std::vector< counted_job > ctxs;
+    for (int i = 0; i < 40; ++i)
+        ctxs.push_back(counted_job { &file, &devices[i % 2] });
+
+    std::vector< lfp_index_job > jobs;
+    for (int i = 0; i < 40; ++i) {
+        auto j = job(nullptr, i % 2);
+        j.open = counted_open;
+        j.ctx = &ctxs[i];
+        jobs.push_back(j);
+    }
+
+    REQUIRE(lfp_index_batch(jobs.data(), 40, 8, per_device) == LFP_OK);
+    for (const auto& j : jobs)
+        CHECK(j.status == LFP_OK);
+
+    for (const auto& d : devices) {
+        CHECK(d.open == 0);
+        CHECK(d.most <= per_device);
+        CHECK(d.most >= 1);
+    }
+
+    lfp_index_batch_free(jobs.data(), 40);
+}
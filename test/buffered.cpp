@@ -0,0 +1,277 @@
+#include <ciso646>
+#include <cstring>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include <lfp/buffered.h>
+#include <lfp/lfp.h>
+#include <lfp/memfile.h>
+#include <lfp/tapeimage.h>
+
+#include "utils.hpp"
+
+using namespace Catch::Matchers;
+
+namespace {
+
+struct random_buffered : random_memfile {
+    random_buffered() {
+        REQUIRE(not expected.empty());
+
+        blocksize = GENERATE(1, 7, 64);
+        readahead = GENERATE(1, 16, 300);
+
+        auto* mem = f;
+        f = lfp_buffered_open(mem, blocksize, readahead);
+        REQUIRE(f);
+    }
+
+    int blocksize;
+    int readahead;
+};
+
+}
+
+TEST_CASE(
+    "Negative block size or read-ahead returns NULL",
+    "[buffered]") {
+    auto* mem = lfp_memfile_open();
+
+    CHECK(!lfp_buffered_open(mem, -1, 0));
+    CHECK(!lfp_buffered_open(mem,  0, -1));
+    CHECK(!lfp_buffered_open(nullptr, 0, 0));
+
+    lfp_close(mem);
+}
+
+TEST_CASE_METHOD(
+    random_buffered,
+    "Buffered can be read",
+    "[buffered][read]") {
+
+    SECTION( "full read" ) {
+        std::int64_t nread = -1;
+        const auto err = lfp_readinto(f, out.data(), out.size(), &nread);
+
+        CHECK(err == LFP_OK);
+        CHECK(nread == expected.size());
+        CHECK_THAT(out, Equals(expected));
+        CHECK(!lfp_eof(f));
+    }
+
+    SECTION( "incomplete read" ) {
+        std::int64_t nread = -1;
+        const auto err = lfp_readinto(f, out.data(), 2*out.size(), &nread);
+
+        CHECK(err == LFP_EOF);
+        CHECK(nread == expected.size());
+        CHECK_THAT(out, Equals(expected));
+        CHECK(lfp_eof(f));
+    }
+
+    SECTION( "A file can be read in multiple, smaller reads" ) {
+        test_split_read(this);
+    }
+
+    SECTION( "A file can be read with multiple buffers" ) {
+        test_split_readv(this);
+    }
+
+    SECTION( "A file can be read with multiple readviews" ) {
+        const auto readsize = GENERATE_COPY(take(1, random(1, (size + 1)/2)));
+        out.clear();
+        while (true) {
+            const void* view = nullptr;
+            std::int64_t nread = -1;
+            const auto err = lfp_readview(f, &view, readsize, &nread);
+            const auto* p = static_cast< const unsigned char* >(view);
+            out.insert(out.end(), p, p + nread);
+
+            if (err == LFP_EOF)
+                break;
+            REQUIRE(err == LFP_OK);
+            REQUIRE(nread == readsize);
+        }
+        CHECK_THAT(out, Equals(expected));
+        CHECK(lfp_eof(f));
+    }
+}
+
+TEST_CASE_METHOD(
+    random_buffered,
+    "Buffered can be seeked",
+    "[buffered][seek]") {
+
+    SECTION( "correct seek" ) {
+        test_random_seek(this);
+    }
+
+    SECTION( "seek back into the window, then read" ) {
+        const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+        std::int64_t nread = -1;
+        auto err = lfp_readinto(f, out.data(), n + 1, &nread);
+        REQUIRE(err == LFP_OK);
+
+        err = lfp_seek(f, n);
+        CHECK(err == LFP_OK);
+
+        std::int64_t tell = -1;
+        lfp_tell(f, &tell);
+        CHECK(tell == n);
+
+        err = lfp_readinto(f, out.data() + n, size - n, &nread);
+        CHECK(err == LFP_OK);
+        CHECK(nread == size - n);
+        CHECK_THAT(out, Equals(expected));
+    }
+
+    SECTION( "seek and ptell account for the read-ahead" ) {
+        const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+        std::int64_t nread = -1;
+        auto err = lfp_readinto(f, out.data(), n, &nread);
+        REQUIRE(err == LFP_OK);
+
+        std::int64_t tell = -1;
+        std::int64_t ptell = -1;
+        lfp_tell(f, &tell);
+        lfp_ptell(f, &ptell);
+        CHECK(tell == n);
+        CHECK(ptell == n);
+    }
+
+    SECTION( "seek past end is forwarded to the underlying protocol" ) {
+        const auto err = lfp_seek(f, size + 1);
+        CHECK(err == LFP_INVALID_ARGS);
+    }
+}
+
+TEST_CASE_METHOD(
+    random_buffered,
+    "Peeled protocol is positioned at the buffered position",
+    "[buffered][peel]") {
+    const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(f, out.data(), n, &nread);
+    REQUIRE(err == LFP_OK);
+
+    lfp_protocol* inner = nullptr;
+    err = lfp_peek(f, &inner);
+    CHECK(err == LFP_OK);
+
+    lfp_protocol* peeled = nullptr;
+    err = lfp_peel(f, &peeled);
+    CHECK(err == LFP_OK);
+    CHECK(peeled == inner);
+
+    std::int64_t tell = -1;
+    lfp_tell(peeled, &tell);
+    CHECK(tell == n);
+
+    err = lfp_readinto(peeled, out.data() + n, size - n, &nread);
+    CHECK(err == LFP_OK);
+    CHECK_THAT(out, Equals(expected));
+    lfp_close(peeled);
+}
+
+TEST_CASE(
+    "Tape image can be read through a buffered protocol",
+    "[buffered][tapeimage]") {
+    const auto contents = std::vector< unsigned char > {
+        /* First record */
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x10, 0x00, 0x00, 0x00,
+
+        0x01, 0x02, 0x03, 0x04,
+
+        /* Second record */
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x24, 0x00, 0x00, 0x00,
+
+        0x05, 0x06, 0x07, 0x08,
+        0x09, 0x0A, 0x0B, 0x0C,
+
+        /* File mark */
+        0x01, 0x00, 0x00, 0x00,
+        0x10, 0x00, 0x00, 0x00,
+        0x30, 0x00, 0x00, 0x00,
+    };
+
+    const auto blocksize = GENERATE(1, 8);
+    const auto readahead = GENERATE(4, 16, 64);
+    auto* inner = create_cfile_handle(contents);
+    auto* tif = lfp_tapeimage_open(lfp_buffered_open(inner, blocksize, readahead));
+    REQUIRE(tif);
+
+    const auto expected = std::vector< unsigned char > {
+        0x01, 0x02, 0x03, 0x04,
+        0x05, 0x06, 0x07, 0x08,
+        0x09, 0x0A, 0x0B, 0x0C,
+    };
+
+    auto out = std::vector< unsigned char >(expected.size() + 1);
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(tif, out.data(), out.size(), &nread);
+    CHECK(err == LFP_EOF);
+    CHECK(nread == expected.size());
+    out.pop_back();
+    CHECK_THAT(out, Equals(expected));
+
+    err = lfp_seek(tif, 2);
+    CHECK(err == LFP_OK);
+    err = lfp_readinto(tif, out.data(), 6, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(out[0] == 0x03);
+    CHECK(out[5] == 0x08);
+
+    lfp_close(tif);
+}
+
+TEST_CASE_METHOD(
+    random_buffered,
+    "Buffered forwards pread, and keeps its window",
+    "[buffered][pread]") {
+    const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(f, out.data(), n, &nread);
+    REQUIRE(err == LFP_OK);
+
+    auto tail = std::vector< unsigned char >(size - n);
+    err = lfp_pread(f, tail.data(), tail.size(), n, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == std::int64_t(tail.size()));
+
+    err = lfp_readinto(f, out.data() + n, size - n, &nread);
+    CHECK(err == LFP_OK);
+    CHECK_THAT(out, Equals(expected));
+    CHECK(std::equal(tail.begin(), tail.end(), expected.begin() + n));
+}
+
+TEST_CASE_METHOD(
+    random_buffered,
+    "A duplicated buffered protocol has its own position",
+    "[buffered][dup]") {
+    const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(f, out.data(), n, &nread);
+    REQUIRE(err == LFP_OK);
+
+    lfp_protocol* dup = nullptr;
+    err = lfp_dup(f, &dup);
+    REQUIRE(err == LFP_OK);
+
+    auto fromdup = std::vector< unsigned char >(size - n);
+    err = lfp_readinto(dup, fromdup.data(), fromdup.size(), &nread);
+    CHECK(err == LFP_OK);
+    CHECK(std::equal(fromdup.begin(), fromdup.end(), expected.begin() + n));
+
+    err = lfp_readinto(f, out.data() + n, size - n, &nread);
+    CHECK(err == LFP_OK);
+    CHECK_THAT(out, Equals(expected));
+
+    lfp_close(dup);
+}
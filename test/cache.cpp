@@ -0,0 +1,358 @@
+#include <ciso646>
+#include <cstring>
+#include <numeric>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include <lfp/cache.h>
+#include <lfp/lfp.h>
+#include <lfp/memfile.h>
+#include <lfp/tapeimage.h>
+
+#include "utils.hpp"
+
+using namespace Catch::Matchers;
+
+namespace {
+
+struct random_cache : random_memfile {
+    random_cache() {
+        REQUIRE(not expected.empty());
+
+        blocksize = GENERATE(1, 7, 64);
+        capacity  = GENERATE(1, 100, 4096);
+
+        auto* mem = f;
+        f = lfp_cache_open(mem, blocksize, capacity);
+        REQUIRE(f);
+    }
+
+    int blocksize;
+    int capacity;
+};
+
+/*
+ * The number of reads on the protocol under the cache, i.e. the cache misses
+ */
+std::int64_t inner_reads(lfp_protocol* f) {
+    lfp_protocol* inner = nullptr;
+    REQUIRE(lfp_peek(f, &inner) == LFP_OK);
+    lfp_stats stats;
+    REQUIRE(lfp_stats_get(inner, &stats) == LFP_OK);
+    return stats.reads;
+}
+
+void read_at(lfp_protocol* f, std::int64_t offset, std::int64_t len) {
+    REQUIRE(lfp_seek(f, offset) == LFP_OK);
+    auto out = std::vector< unsigned char >(len);
+    std::int64_t nread = -1;
+    REQUIRE(lfp_readinto(f, out.data(), len, &nread) == LFP_OK);
+    for (std::int64_t i = 0; i < len; ++i)
+        REQUIRE(out[i] == (unsigned char)(offset + i));
+}
+
+std::vector< unsigned char > iota_bytes(std::size_t size) {
+    auto contents = std::vector< unsigned char >(size);
+    std::iota(contents.begin(), contents.end(), 0);
+    return contents;
+}
+
+}
+
+TEST_CASE(
+    "Negative block size or capacity returns NULL",
+    "[cache]") {
+    auto* mem = lfp_memfile_open();
+
+    CHECK(!lfp_cache_open(mem, -1, 0));
+    CHECK(!lfp_cache_open(mem,  0, -1));
+    CHECK(!lfp_cache_open(nullptr, 0, 0));
+
+    lfp_close(mem);
+}
+
+TEST_CASE_METHOD(
+    random_cache,
+    "Cache can be read",
+    "[cache][read]") {
+
+    SECTION( "full read" ) {
+        std::int64_t nread = -1;
+        const auto err = lfp_readinto(f, out.data(), out.size(), &nread);
+
+        CHECK(err == LFP_OK);
+        CHECK(nread == expected.size());
+        CHECK_THAT(out, Equals(expected));
+        CHECK(!lfp_eof(f));
+    }
+
+    SECTION( "incomplete read" ) {
+        std::int64_t nread = -1;
+        const auto err = lfp_readinto(f, out.data(), 2*out.size(), &nread);
+
+        CHECK(err == LFP_EOF);
+        CHECK(nread == expected.size());
+        CHECK_THAT(out, Equals(expected));
+        CHECK(lfp_eof(f));
+    }
+
+    SECTION( "A file can be read in multiple, smaller reads" ) {
+        test_split_read(this);
+    }
+
+    SECTION( "A file can be read with multiple buffers" ) {
+        test_split_readv(this);
+    }
+
+    SECTION( "A file can be read with multiple readviews" ) {
+        const auto readsize = GENERATE_COPY(take(1, random(1, (size + 1)/2)));
+        out.clear();
+        while (true) {
+            const void* view = nullptr;
+            std::int64_t nread = -1;
+            const auto err = lfp_readview(f, &view, readsize, &nread);
+            const auto* p = static_cast< const unsigned char* >(view);
+            out.insert(out.end(), p, p + nread);
+
+            if (err == LFP_EOF)
+                break;
+            REQUIRE(err == LFP_OK);
+            REQUIRE(nread == readsize);
+        }
+        CHECK_THAT(out, Equals(expected));
+        CHECK(lfp_eof(f));
+    }
+}
+
+TEST_CASE_METHOD(
+    random_cache,
+    "Cache can be seeked",
+    "[cache][seek]") {
+
+    SECTION( "correct seek" ) {
+        test_random_seek(this);
+    }
+
+    SECTION( "read, seek back, and read again" ) {
+        const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+        std::int64_t nread = -1;
+        auto err = lfp_readinto(f, out.data(), size, &nread);
+        REQUIRE(err == LFP_OK);
+
+        std::fill(out.begin(), out.end(), 0);
+        err = lfp_seek(f, n);
+        CHECK(err == LFP_OK);
+
+        std::int64_t tell = -1;
+        lfp_tell(f, &tell);
+        CHECK(tell == n);
+
+        err = lfp_readinto(f, out.data() + n, size - n, &nread);
+        CHECK(err == LFP_OK);
+        CHECK(nread == size - n);
+        CHECK(std::equal(out.begin() + n, out.end(), expected.begin() + n));
+
+        err = lfp_readinto(f, out.data(), 1, &nread);
+        CHECK(err == LFP_EOF);
+        CHECK(nread == 0);
+    }
+
+    SECTION( "ptell follows tell" ) {
+        const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+        std::int64_t nread = -1;
+        auto err = lfp_readinto(f, out.data(), size, &nread);
+        REQUIRE(err == LFP_OK);
+        REQUIRE(lfp_seek(f, n) == LFP_OK);
+
+        std::int64_t tell = -1;
+        std::int64_t ptell = -1;
+        lfp_tell(f, &tell);
+        lfp_ptell(f, &ptell);
+        CHECK(tell == n);
+        CHECK(ptell == n);
+    }
+
+    SECTION( "seek past end is forwarded to the underlying protocol" ) {
+        const auto err = lfp_seek(f, size + 1);
+        CHECK(err == LFP_INVALID_ARGS);
+    }
+}
+
+TEST_CASE_METHOD(
+    random_cache,
+    "Cache serves pread from the shared blocks",
+    "[cache][pread]") {
+    const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+
+    auto tail = std::vector< unsigned char >(size - n + 1);
+    std::int64_t nread = -1;
+    auto err = lfp_pread(f, tail.data(), tail.size(), n, &nread);
+    CHECK(err == LFP_EOF);
+    CHECK(nread == size - n);
+    CHECK(std::equal(tail.begin(), tail.end() - 1, expected.begin() + n));
+
+    std::int64_t tell = -1;
+    lfp_tell(f, &tell);
+    CHECK(tell == 0);
+
+    err = lfp_readinto(f, out.data(), size, &nread);
+    CHECK(err == LFP_OK);
+    CHECK_THAT(out, Equals(expected));
+}
+
+TEST_CASE_METHOD(
+    random_cache,
+    "Peeled protocol is positioned at the cache position",
+    "[cache][peel]") {
+    const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(f, out.data(), n, &nread);
+    REQUIRE(err == LFP_OK);
+
+    lfp_protocol* peeled = nullptr;
+    err = lfp_peel(f, &peeled);
+    CHECK(err == LFP_OK);
+
+    std::int64_t tell = -1;
+    lfp_tell(peeled, &tell);
+    CHECK(tell == n);
+
+    err = lfp_readinto(peeled, out.data() + n, size - n, &nread);
+    CHECK(err == LFP_OK);
+    CHECK_THAT(out, Equals(expected));
+    lfp_close(peeled);
+}
+
+TEST_CASE(
+    "Jumping back to cached blocks does not read the underlying protocol",
+    "[cache][stats]") {
+    const auto contents = iota_bytes(1000);
+    auto* f = lfp_cache_open(create_memfile_handle(contents), 100, 1000);
+    REQUIRE(f);
+
+    /* the head of the file, then further out, and straddling two blocks */
+    read_at(f, 0, 50);
+    read_at(f, 610, 40);
+    read_at(f, 250, 100);
+    CHECK(inner_reads(f) == 4);
+
+    read_at(f, 10, 20);
+    read_at(f, 600, 100);
+    read_at(f, 299, 2);
+    read_at(f, 0, 100);
+    CHECK(inner_reads(f) == 4);
+
+    lfp_close(f);
+}
+
+TEST_CASE(
+    "The least recently used block is evicted first",
+    "[cache][stats]") {
+    const auto contents = iota_bytes(1000);
+    auto* f = lfp_cache_open(create_memfile_handle(contents), 100, 250);
+    REQUIRE(f);
+
+    read_at(f, 0, 10);
+    read_at(f, 100, 10);
+    CHECK(inner_reads(f) == 2);
+
+    /* 0 is now more recently used than 100, so reading 200 evicts 100 */
+    read_at(f, 0, 10);
+    read_at(f, 200, 10);
+    CHECK(inner_reads(f) == 3);
+
+    read_at(f, 0, 10);
+    CHECK(inner_reads(f) == 3);
+    read_at(f, 100, 10);
+    CHECK(inner_reads(f) == 4);
+
+    lfp_close(f);
+}
+
+TEST_CASE(
+    "Duplicated cache protocols share the blocks",
+    "[cache][dup]") {
+    const auto contents = iota_bytes(1000);
+    auto* f = lfp_cache_open(create_memfile_handle(contents), 100, 1000);
+    REQUIRE(f);
+
+    read_at(f, 0, 1000);
+    CHECK(inner_reads(f) == 10);
+
+    lfp_protocol* dup = nullptr;
+    REQUIRE(lfp_dup(f, &dup) == LFP_OK);
+
+    std::int64_t tell = -1;
+    lfp_tell(dup, &tell);
+    CHECK(tell == 1000);
+
+    read_at(dup, 450, 300);
+    CHECK(inner_reads(dup) == 0);
+
+    /* the original can be closed, and the duplicate keeps the cache */
+    lfp_close(f);
+    read_at(dup, 0, 999);
+    CHECK(inner_reads(dup) == 0);
+
+    lfp_close(dup);
+}
+
+TEST_CASE(
+    "Tape image can be read through a cache protocol",
+    "[cache][tapeimage]") {
+    const auto contents = std::vector< unsigned char > {
+        /* First record */
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x10, 0x00, 0x00, 0x00,
+
+        0x01, 0x02, 0x03, 0x04,
+
+        /* Second record */
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x24, 0x00, 0x00, 0x00,
+
+        0x05, 0x06, 0x07, 0x08,
+        0x09, 0x0A, 0x0B, 0x0C,
+
+        /* File mark */
+        0x01, 0x00, 0x00, 0x00,
+        0x10, 0x00, 0x00, 0x00,
+        0x30, 0x00, 0x00, 0x00,
+    };
+
+    const auto blocksize = GENERATE(1, 8, 64);
+    const auto capacity  = GENERATE(8, 128);
+    auto* inner = create_cfile_handle(contents);
+    auto* tif = lfp_tapeimage_open(lfp_cache_open(inner, blocksize, capacity));
+    REQUIRE(tif);
+
+    const auto expected = std::vector< unsigned char > {
+        0x01, 0x02, 0x03, 0x04,
+        0x05, 0x06, 0x07, 0x08,
+        0x09, 0x0A, 0x0B, 0x0C,
+    };
+
+    auto out = std::vector< unsigned char >(expected.size() + 1);
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(tif, out.data(), out.size(), &nread);
+    CHECK(err == LFP_EOF);
+    CHECK(nread == expected.size());
+    out.pop_back();
+    CHECK_THAT(out, Equals(expected));
+
+    err = lfp_seek(tif, 2);
+    CHECK(err == LFP_OK);
+    err = lfp_readinto(tif, out.data(), 6, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(out[0] == 0x03);
+    CHECK(out[5] == 0x08);
+
+    std::int64_t ptell = -1;
+    CHECK(lfp_ptell(tif, &ptell) == LFP_OK);
+    CHECK(ptell == 12 + 4 + 12 + 4);
+
+    lfp_close(tif);
+}
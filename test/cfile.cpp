@@ -217,6 +217,10 @@ TEST_CASE_METHOD(
         test_split_read(this);
     }
 
+    SECTION( "A file can be read with multiple buffers" ) {
+        test_split_readv(this);
+    }
+
     SECTION( "negative read" ) {
         std::int64_t nread = -1;
         const auto err = lfp_readinto(f, out.data(), -1, &nread);
@@ -460,3 +464,82 @@ TEST_CASE(
         CHECK(err == LFP_OK);
     }
 }
+
+TEST_CASE_METHOD(
+    random_cfile_with_random_zero,
+    "Cfile pread is relative to zero, and does not move the position",
+    "[cfile][pread]") {
+    const auto n = GENERATE_COPY(take(1, random(0, size - 1 - zero)));
+    auto err = lfp_seek(f, n);
+    REQUIRE(err == LFP_OK);
+
+    const auto offset = GENERATE_COPY(take(1, random(0, size - 1 - zero)));
+    const auto len = size - zero - offset;
+    std::int64_t nread = -1;
+
+    SECTION( "complete read" ) {
+        err = lfp_pread(f, out.data(), len, offset, &nread);
+        CHECK(err == LFP_OK);
+        CHECK(nread == len);
+    }
+
+    SECTION( "read past end-of-file" ) {
+        err = lfp_pread(f, out.data(), len + 1, offset, &nread);
+        CHECK(err == LFP_EOF);
+        CHECK(nread == len);
+        CHECK(not lfp_eof(f));
+    }
+
+    const auto begin = expected.begin() + zero + offset;
+    CHECK(std::equal(out.begin(), out.begin() + len, begin));
+
+    std::int64_t tell = -1;
+    err = lfp_tell(f, &tell);
+    CHECK(err == LFP_OK);
+    CHECK(tell == n);
+
+    /* reading from the position continues where seek left it */
+    err = lfp_readinto(f, out.data(), 1, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(out[0] == expected[zero + n]);
+}
+
+TEST_CASE_METHOD(
+    random_cfile_with_random_zero,
+    "A duplicated cfile has its own position",
+    "[cfile][dup]") {
+    const auto n = GENERATE_COPY(take(1, random(0, size - 1 - zero)));
+    auto err = lfp_seek(f, n);
+    REQUIRE(err == LFP_OK);
+
+    lfp_protocol* dup = nullptr;
+    err = lfp_dup(f, &dup);
+    REQUIRE(err == LFP_OK);
+
+    std::int64_t tell = -1;
+    err = lfp_tell(dup, &tell);
+    CHECK(err == LFP_OK);
+    CHECK(tell == n);
+
+    std::int64_t ptell = -1;
+    err = lfp_ptell(dup, &ptell);
+    CHECK(err == LFP_OK);
+    CHECK(ptell == zero + n);
+
+    /* interleave reads, which must not disturb each other */
+    const auto len = size - zero - n;
+    auto fromdup = std::vector< unsigned char >(len);
+    std::int64_t nread = -1;
+    for (std::int64_t i = 0; i < len; ++i) {
+        err = lfp_readinto(f, out.data() + i, 1, &nread);
+        CHECK(err == LFP_OK);
+        err = lfp_readinto(dup, fromdup.data() + i, 1, &nread);
+        CHECK(err == LFP_OK);
+    }
+
+    const auto begin = expected.begin() + zero + n;
+    CHECK(std::equal(out.begin(), out.begin() + len, begin));
+    CHECK(std::equal(fromdup.begin(), fromdup.end(), begin));
+
+    CHECK(lfp_close(dup) == LFP_OK);
+}
@@ -0,0 +1,391 @@
+#include <algorithm>
+#include <ciso646>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include <lfp/custom.h>
+#include <lfp/lfp.h>
+#include <lfp/rp66.h>
+#include <lfp/tapeimage.h>
+
+#include "utils.hpp"
+
+using namespace Catch::Matchers;
+
+namespace {
+
+/*
+ * A custom leaf over a vector, written like an embedder would in C, which
+ * counts how it is called
+ */
+struct source {
+    std::vector< unsigned char > data;
+    std::int64_t pos = 0;
+    int closes = 0;
+    int reads = 0;
+    int views = 0;
+    bool broken = false;
+};
+
+std::int64_t remaining(const source* s, std::int64_t offset, std::int64_t len) {
+    const auto size = std::int64_t(s->data.size());
+    return (std::max)(std::int64_t(0), (std::min)(len, size - offset));
+}
+
+int src_read(void* ctx, void* dst, std::int64_t len, std::int64_t* nread) {
+    auto* s = static_cast< source* >(ctx);
+    s->reads += 1;
+    if (s->broken)
+        return LFP_IOERROR;
+
+    const auto n = remaining(s, s->pos, len);
+    if (n > 0)
+        std::memcpy(dst, s->data.data() + s->pos, n);
+    s->pos += n;
+    *nread = n;
+    return n == len ? LFP_OK : LFP_EOF;
+}
+
+int src_pread(void* ctx,
+              void* dst,
+              std::int64_t len,
+              std::int64_t offset,
+              std::int64_t* nread) {
+    auto* s = static_cast< source* >(ctx);
+    const auto n = remaining(s, offset, len);
+    if (n > 0)
+        std::memcpy(dst, s->data.data() + offset, n);
+    *nread = n;
+    return n == len ? LFP_OK : LFP_EOF;
+}
+
+int src_seek(void* ctx, std::int64_t n) {
+    auto* s = static_cast< source* >(ctx);
+    if (n > std::int64_t(s->data.size()))
+        return LFP_INVALID_ARGS;
+    s->pos = n;
+    return LFP_OK;
+}
+
+int src_tell(void* ctx, std::int64_t* n) {
+    *n = static_cast< source* >(ctx)->pos;
+    return LFP_OK;
+}
+
+int src_readview(void* ctx,
+                 const void** view,
+                 std::int64_t len,
+                 std::int64_t* nread) {
+    auto* s = static_cast< source* >(ctx);
+    s->views += 1;
+    const auto n = remaining(s, s->pos, len);
+    *view = s->data.data() + s->pos;
+    s->pos += n;
+    *nread = n;
+    return n == len ? LFP_OK : LFP_EOF;
+}
+
+int src_close(void* ctx) {
+    static_cast< source* >(ctx)->closes += 1;
+    return LFP_OK;
+}
+
+const char* src_errmsg(void*) {
+    return "the source is broken";
+}
+
+lfp_custom_ops all_ops() {
+    lfp_custom_ops ops;
+    std::memset(&ops, 0, sizeof(ops));
+    ops.size     = sizeof(ops);
+    ops.read     = src_read;
+    ops.pread    = src_pread;
+    ops.seek     = src_seek;
+    ops.tell     = src_tell;
+    ops.readview = src_readview;
+    ops.close    = src_close;
+    ops.errmsg   = src_errmsg;
+    return ops;
+}
+
+lfp_custom_ops read_only_ops() {
+    lfp_custom_ops ops;
+    std::memset(&ops, 0, sizeof(ops));
+    ops.size = sizeof(ops);
+    ops.read = src_read;
+    return ops;
+}
+
+lfp_custom_ops no_tell_ops() {
+    auto ops = read_only_ops();
+    ops.seek  = src_seek;
+    ops.close = src_close;
+    return ops;
+}
+
+struct random_custom : random_memfile {
+    random_custom() {
+        REQUIRE(not expected.empty());
+        lfp_close(f);
+
+        src.data = expected;
+        const auto ops = all_ops();
+        f = lfp_custom_open(&ops, &src);
+        REQUIRE(f);
+    }
+
+    ~random_custom() {
+        /* close before src goes away, as closing calls into it */
+        lfp_close(f);
+        f = nullptr;
+    }
+
+    source src;
+};
+
+}
+
+TEST_CASE(
+    "Custom protocols need read and a valid size",
+    "[custom]") {
+    source src;
+    CHECK(!lfp_custom_open(nullptr, &src));
+
+    auto ops = all_ops();
+    ops.read = nullptr;
+    CHECK(!lfp_custom_open(&ops, &src));
+
+    ops = all_ops();
+    ops.size = 1;
+    CHECK(!lfp_custom_open(&ops, &src));
+
+    /* the ctx is not closed when open fails */
+    CHECK(src.closes == 0);
+}
+
+TEST_CASE_METHOD(
+    random_custom,
+    "Custom protocol can be read",
+    "[custom][read]") {
+
+    SECTION( "full read" ) {
+        std::int64_t nread = -1;
+        const auto err = lfp_readinto(f, out.data(), out.size(), &nread);
+        CHECK(err == LFP_OK);
+        CHECK(nread == expected.size());
+        CHECK_THAT(out, Equals(expected));
+        CHECK(!lfp_eof(f));
+    }
+
+    SECTION( "incomplete read" ) {
+        std::int64_t nread = -1;
+        const auto err = lfp_readinto(f, out.data(), 2*out.size(), &nread);
+        CHECK(err == LFP_EOF);
+        CHECK(nread == expected.size());
+        CHECK_THAT(out, Equals(expected));
+        CHECK(lfp_eof(f));
+
+        CHECK(lfp_seek(f, 0) == LFP_OK);
+        CHECK(!lfp_eof(f));
+    }
+
+    SECTION( "A file can be read in multiple, smaller reads" ) {
+        test_split_read(this);
+    }
+
+    SECTION( "A file can be read with multiple buffers" ) {
+        test_split_readv(this);
+    }
+
+    SECTION( "correct seek" ) {
+        test_random_seek(this);
+    }
+
+    SECTION( "pread does not move the position" ) {
+        const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+        std::int64_t nread = -1;
+        const auto err = lfp_pread(f, out.data(), size, n, &nread);
+        CHECK(err == (n == 0 ? LFP_OK : LFP_EOF));
+        CHECK(nread == size - n);
+        CHECK(std::equal(out.begin(), out.begin() + nread,
+                         expected.begin() + n));
+
+        std::int64_t tell = -1;
+        std::int64_t ptell = -1;
+        lfp_tell(f, &tell);
+        lfp_ptell(f, &ptell);
+        CHECK(tell == 0);
+        CHECK(ptell == 0);
+    }
+}
+
+TEST_CASE_METHOD(
+    random_custom,
+    "Custom readview does not copy",
+    "[custom][readview]") {
+    const void* view = nullptr;
+    std::int64_t nread = -1;
+    const auto err = lfp_readview(f, &view, size, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == size);
+    CHECK(view == src.data.data());
+    CHECK(src.views == 1);
+    CHECK(src.reads == 0);
+}
+
+TEST_CASE(
+    "Custom protocol without the optional functions",
+    "[custom]") {
+    source src;
+    src.data = std::vector< unsigned char >(10, 0xAB);
+    const auto ops = read_only_ops();
+    auto* f = lfp_custom_open(&ops, &src);
+    REQUIRE(f);
+
+    CHECK(lfp_seek(f, 1) == LFP_NOTIMPLEMENTED);
+    std::int64_t tell = -1;
+    CHECK(lfp_tell(f, &tell) == LFP_NOTIMPLEMENTED);
+    unsigned char out[10];
+    std::int64_t nread = -1;
+    CHECK(lfp_pread(f, out, 10, 0, &nread) == LFP_NOTIMPLEMENTED);
+
+    /* views are read into a buffer instead */
+    const void* view = nullptr;
+    CHECK(lfp_readview(f, &view, 10, &nread) == LFP_OK);
+    CHECK(nread == 10);
+    CHECK(view != src.data.data());
+    CHECK(static_cast< const unsigned char* >(view)[9] == 0xAB);
+    CHECK(src.reads == 1);
+
+    lfp_protocol* inner = nullptr;
+    CHECK(lfp_peel(f, &inner) == LFP_LEAF_PROTOCOL);
+    CHECK(lfp_peek(f, &inner) == LFP_LEAF_PROTOCOL);
+
+    CHECK(lfp_close(f) == LFP_OK);
+}
+
+TEST_CASE(
+    "Custom protocol failures report status and message",
+    "[custom]") {
+    source src;
+    src.data = std::vector< unsigned char >(10);
+    src.broken = true;
+    const auto ops = all_ops();
+    auto* f = lfp_custom_open(&ops, &src);
+    REQUIRE(f);
+
+    unsigned char out[10];
+    std::int64_t nread = -1;
+    CHECK(lfp_readinto(f, out, 10, &nread) == LFP_IOERROR);
+    CHECK(nread == 0);
+    CHECK_THAT(lfp_errormsg(f), Contains("the source is broken"));
+
+    CHECK(lfp_seek(f, 100) == LFP_INVALID_ARGS);
+    CHECK_THAT(lfp_errormsg(f), Contains("seek"));
+
+    CHECK(lfp_close(f) == LFP_OK);
+    CHECK(src.closes == 1);
+}
+
+TEST_CASE(
+    "Tape image can be read from a custom protocol without copying",
+    "[custom][tapeimage][readview]") {
+    source src;
+    src.data = std::vector< unsigned char > {
+        /* First record */
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x10, 0x00, 0x00, 0x00,
+
+        0x01, 0x02, 0x03, 0x04,
+
+        /* Second record */
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x24, 0x00, 0x00, 0x00,
+
+        0x05, 0x06, 0x07, 0x08,
+        0x09, 0x0A, 0x0B, 0x0C,
+
+        /* File mark */
+        0x01, 0x00, 0x00, 0x00,
+        0x10, 0x00, 0x00, 0x00,
+        0x30, 0x00, 0x00, 0x00,
+    };
+
+    const auto ops = all_ops();
+    auto* tif = lfp_tapeimage_open(lfp_custom_open(&ops, &src));
+    REQUIRE(tif);
+
+    /* a view within the second record points straight into the source */
+    REQUIRE(lfp_seek(tif, 5) == LFP_OK);
+    const void* view = nullptr;
+    std::int64_t nread = -1;
+    auto err = lfp_readview(tif, &view, 6, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == 6);
+    CHECK(view == src.data.data() + 12 + 4 + 12 + 1);
+
+    auto out = std::vector< unsigned char >(12);
+    REQUIRE(lfp_seek(tif, 0) == LFP_OK);
+    err = lfp_readinto(tif, out.data(), 12, &nread);
+    CHECK(err == LFP_OK);
+    CHECK_THAT(out, Equals(std::vector< unsigned char > {
+        0x01, 0x02, 0x03, 0x04,
+        0x05, 0x06, 0x07, 0x08,
+        0x09, 0x0A, 0x0B, 0x0C,
+    }));
+
+    CHECK(lfp_close(tif) == LFP_OK);
+    CHECK(src.closes == 1);
+}
+
+TEST_CASE(
+    "Tape image and rp66 seek in a custom protocol that can not tell",
+    "[custom][tapeimage][rp66][seek]") {
+    const auto records = std::vector< bytes > {
+        bytes { 0x01, 0x02, 0x03, 0x04 },
+        bytes { 0x05, 0x06, 0x07, 0x08 },
+    };
+
+    source src;
+    lfp_protocol* f = nullptr;
+    const auto ops = no_tell_ops();
+    SECTION( "tape image" ) {
+        src.data = tapeimage(records);
+        f = lfp_tapeimage_open(lfp_custom_open(&ops, &src));
+    }
+    SECTION( "visible envelope" ) {
+        src.data = visible_record(records[0]) + visible_record(records[1]);
+        f = lfp_rp66_open(lfp_custom_open(&ops, &src));
+    }
+    REQUIRE(f);
+
+    auto out = bytes(8);
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(f, out.data(), 6, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == 6);
+
+    /* back into the first record, which is already indexed */
+    err = lfp_seek(f, 2);
+    CHECK(err == LFP_OK);
+    err = lfp_readinto(f, out.data(), 6, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == 6);
+    out.resize(6);
+    CHECK_THAT(out, Equals(bytes { 0x03, 0x04, 0x05, 0x06, 0x07, 0x08 }));
+
+    err = lfp_seek(f, 0);
+    CHECK(err == LFP_OK);
+    out.resize(1);
+    err = lfp_readinto(f, out.data(), 1, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(out[0] == 0x01);
+
+    CHECK(lfp_close(f) == LFP_OK);
+    CHECK(src.closes == 1);
+}
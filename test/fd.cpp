@@ -0,0 +1,367 @@
+#include <atomic>
+#include <ciso646>
+#include <cstdio>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include <lfp/fd.h>
+#include <lfp/lfp.h>
+#include <lfp/tapeimage.h>
+
+#include "utils.hpp"
+
+using namespace Catch::Matchers;
+
+namespace {
+
+struct random_fd : random_memfile {
+    random_fd() {
+        REQUIRE(not expected.empty());
+
+        lfp_close(f);
+        f = nullptr;
+
+        const auto flags = GENERATE(
+            LFP_FD_NORMAL,
+            LFP_FD_SEQUENTIAL,
+            LFP_FD_RANDOM
+        );
+
+        f = lfp_fd_open(open_named_tempfile(expected), flags);
+        REQUIRE(f);
+    }
+};
+
+}
+
+TEST_CASE(
+    "Opening invalid descriptor returns NULL",
+    "[fd][filehandle]") {
+    auto* f = lfp_fd_open(-1, LFP_FD_NORMAL);
+    CHECK(!f);
+
+    auto* tif = lfp_tapeimage_open(f);
+    CHECK(!tif);
+}
+
+TEST_CASE(
+    "Empty fd can be opened and read from",
+    "[fd][filehandle]") {
+    auto* f = create_fd_handle(std::vector< unsigned char >());
+    REQUIRE(f);
+
+    char buf;
+    std::int64_t nread = -1;
+    CHECK(!lfp_eof(f));
+    const auto err = lfp_readinto(f, &buf, 1, &nread);
+    CHECK(err == LFP_EOF);
+    CHECK(nread == 0);
+    CHECK(lfp_eof(f));
+
+    CHECK(lfp_close(f) == LFP_OK);
+}
+
+TEST_CASE(
+    "Unsupported peel and peek leaves the fd intact",
+    "[fd][peel][peek]") {
+    auto* f = create_fd_handle(std::vector< unsigned char >(8, 0xFF));
+    REQUIRE(f);
+
+    lfp_protocol* inner = nullptr;
+    CHECK(lfp_peel(f, &inner) == LFP_LEAF_PROTOCOL);
+    CHECK(lfp_peek(f, &inner) == LFP_LEAF_PROTOCOL);
+    CHECK(!inner);
+
+    auto out = std::vector< unsigned char >(8);
+    std::int64_t nread = -1;
+    CHECK(lfp_readinto(f, out.data(), 8, &nread) == LFP_OK);
+    CHECK(nread == 8);
+    lfp_close(f);
+}
+
+TEST_CASE_METHOD(
+    random_fd,
+    "Fd can be read, seeked and read with pread",
+    "[fd][read][seek][pread]") {
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(f, out.data(), size, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == size);
+    CHECK_THAT(out, Equals(expected));
+    CHECK(!lfp_eof(f));
+
+    SECTION("reading past end-of-file reports EOF") {
+        unsigned char byte;
+        err = lfp_readinto(f, &byte, 1, &nread);
+        CHECK(err == LFP_EOF);
+        CHECK(nread == 0);
+        CHECK(lfp_eof(f));
+    }
+
+    SECTION("seek and read") {
+        const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+        err = lfp_seek(f, n);
+        REQUIRE(err == LFP_OK);
+
+        std::int64_t tell = -1;
+        lfp_tell(f, &tell);
+        CHECK(tell == n);
+
+        std::fill(out.begin(), out.end(), 0);
+        err = lfp_readinto(f, out.data(), size, &nread);
+        CHECK(err == (n == 0 ? LFP_OK : LFP_EOF));
+        CHECK(nread == size - n);
+        CHECK(std::equal(out.begin(), out.begin() + nread,
+                         expected.begin() + n));
+    }
+
+    SECTION("pread does not move the position") {
+        const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+        err = lfp_seek(f, 0);
+        REQUIRE(err == LFP_OK);
+
+        std::fill(out.begin(), out.end(), 0);
+        err = lfp_pread(f, out.data(), size - n, n, &nread);
+        CHECK(err == LFP_OK);
+        CHECK(nread == size - n);
+        CHECK(std::equal(out.begin(), out.begin() + nread,
+                         expected.begin() + n));
+
+        std::int64_t tell = -1;
+        lfp_tell(f, &tell);
+        CHECK(tell == 0);
+    }
+}
+
+TEST_CASE_METHOD(
+    random_fd,
+    "Fd can be read with readv",
+    "[fd][readv]") {
+    const auto cut = GENERATE_COPY(take(1, random(0, size)));
+    out.resize(size + 10);
+    lfp_iovec iov[3] = {
+        { out.data(),       cut },
+        { out.data() + cut, 0 },
+        { out.data() + cut, size - cut + 10 },
+    };
+
+    std::int64_t nread = -1;
+    const auto err = lfp_readv(f, iov, 3, &nread);
+    CHECK(err == LFP_EOF);
+    CHECK(nread == size);
+    CHECK(std::equal(expected.begin(), expected.end(), out.begin()));
+
+    std::int64_t tell = -1;
+    lfp_tell(f, &tell);
+    CHECK(tell == size);
+}
+
+TEST_CASE(
+    "Fd starts at the current offset of the descriptor",
+    "[fd][zero]") {
+    auto contents = std::vector< unsigned char >(100);
+    std::iota(contents.begin(), contents.end(), 0);
+
+    const auto fd = open_named_tempfile(contents);
+#if defined(_WIN32)
+    REQUIRE(_lseek(fd, 10, SEEK_SET) == 10);
+#else
+    REQUIRE(::lseek(fd, 10, SEEK_SET) == 10);
+#endif
+    auto* f = lfp_fd_open(fd, LFP_FD_NORMAL);
+    REQUIRE(f);
+
+    std::int64_t tell = -1;
+    lfp_tell(f, &tell);
+    CHECK(tell == 0);
+
+    unsigned char byte = 0;
+    std::int64_t nread = -1;
+    lfp_readinto(f, &byte, 1, &nread);
+    CHECK(byte == 10);
+
+    std::int64_t ptell = -1;
+    CHECK(lfp_ptell(f, &ptell) == LFP_OK);
+    CHECK(ptell == 11);
+    lfp_close(f);
+}
+
+TEST_CASE_METHOD(
+    random_fd,
+    "A duplicated fd has its own position, and outlives the original",
+    "[fd][dup]") {
+    const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+    auto err = lfp_seek(f, n);
+    REQUIRE(err == LFP_OK);
+
+    lfp_protocol* dup = nullptr;
+    err = lfp_dup(f, &dup);
+    REQUIRE(err == LFP_OK);
+
+    err = lfp_seek(f, 0);
+    REQUIRE(err == LFP_OK);
+    CHECK(lfp_close(f) == LFP_OK);
+    f = nullptr;
+
+    std::int64_t nread = -1;
+    err = lfp_readinto(dup, out.data() + n, size - n, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == size - n);
+    CHECK(std::equal(out.begin() + n, out.end(), expected.begin() + n));
+    CHECK(lfp_close(dup) == LFP_OK);
+}
+
+TEST_CASE(
+    "Direct I/O reads any offset and length",
+    "[fd][direct]") {
+    /*
+     * Make the file span a few direct I/O blocks and bounce buffers, with an
+     * unaligned tail
+     */
+    auto contents = std::vector< unsigned char >(3 * 1024 * 1024 + 1234);
+    for (std::size_t i = 0; i < contents.size(); ++i)
+        contents[i] = (unsigned char)(i * 7 + i / 4096);
+
+    const auto fd = open_named_tempfile(contents);
+    auto* f = lfp_fd_open(fd, LFP_FD_DIRECT | LFP_FD_SEQUENTIAL);
+    if (not f) {
+#if defined(_WIN32)
+        _close(fd);
+#else
+        ::close(fd);
+#endif
+        WARN("direct I/O is not supported for temporary files here");
+        return;
+    }
+
+    const auto size = std::int64_t(contents.size());
+    auto out = std::vector< unsigned char >(contents.size());
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(f, out.data(), size, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == size);
+    CHECK(out == contents);
+
+    struct span { std::int64_t offset, len; };
+    const auto spans = {
+        span { 0,              1 },
+        span { 4095,           2 },
+        span { 4096,           4096 },
+        span { 12345,          1024 * 1024 + 17 },
+        span { size - 10,      100 },
+        span { size + 4096,    10 },
+    };
+    for (const auto& s : spans) {
+        INFO("offset = " << s.offset << ", len = " << s.len);
+        const auto expected_len = (std::max)(
+            std::int64_t(0), (std::min)(s.len, size - s.offset)
+        );
+
+        std::fill(out.begin(), out.end(), 0);
+        err = lfp_seek(f, s.offset);
+        REQUIRE(err == LFP_OK);
+        err = lfp_readinto(f, out.data(), s.len, &nread);
+        CHECK(err == (expected_len == s.len ? LFP_OK : LFP_EOF));
+        CHECK(nread == expected_len);
+        CHECK(std::equal(out.begin(), out.begin() + nread,
+                         contents.begin() + (std::min)(s.offset, size)));
+    }
+
+    lfp_close(f);
+}
+
+TEST_CASE(
+    "Direct I/O preads can run concurrently",
+    "[fd][direct][pread]") {
+    auto contents = std::vector< unsigned char >(4 * 1024 * 1024);
+    for (std::size_t i = 0; i < contents.size(); ++i)
+        contents[i] = (unsigned char)(i * 7 + i / 4096);
+
+    const auto fd = open_named_tempfile(contents);
+    auto* f = lfp_fd_open(fd, LFP_FD_DIRECT);
+    if (not f) {
+#if defined(_WIN32)
+        _close(fd);
+#else
+        ::close(fd);
+#endif
+        WARN("direct I/O is not supported for temporary files here");
+        return;
+    }
+
+    /*
+     * Every thread reads from its own part of the file, at unaligned offsets,
+     * so that any sharing of the bounce buffer shows up as wrong bytes
+     */
+    std::atomic< int > failures { 0 };
+    std::vector< std::thread > threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t] {
+            auto out = std::vector< unsigned char >(5000);
+            for (int i = 0; i < 200; ++i) {
+                const auto offset = std::int64_t(t) * 1024 * 1024 + i * 4099;
+                std::int64_t nread = -1;
+                const auto len = std::int64_t(out.size());
+                const auto err = lfp_pread(f, out.data(), len, offset, &nread);
+                const auto expected = contents.begin() + offset;
+                if (err != LFP_OK or nread != len
+                    or not std::equal(out.begin(), out.end(), expected))
+                    failures += 1;
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    CHECK(failures == 0);
+    lfp_close(f);
+}
+
+#if !defined(_WIN32)
+
+TEST_CASE(
+    "Fd over a pipe can be read, but not seeked",
+    "[fd][pipe]") {
+    int fds[2];
+    REQUIRE(::pipe(fds) == 0);
+
+    const auto contents = std::vector< unsigned char > { 1, 2, 3, 4, 5 };
+    REQUIRE(::write(fds[1], contents.data(), contents.size()) == 5);
+    ::close(fds[1]);
+
+    auto* f = lfp_fd_open(fds[0], LFP_FD_NORMAL);
+    REQUIRE(f);
+
+    CHECK(lfp_seek(f, 1) == LFP_NOTSUPPORTED);
+    std::int64_t tell = -1;
+    CHECK(lfp_tell(f, &tell) == LFP_NOTSUPPORTED);
+
+    auto out = std::vector< unsigned char >(10);
+    std::int64_t nread = -1;
+    const auto err = lfp_readinto(f, out.data(), 10, &nread);
+    CHECK(err == LFP_EOF);
+    CHECK(nread == 5);
+    out.resize(nread);
+    CHECK_THAT(out, Equals(contents));
+
+    lfp_protocol* dup = nullptr;
+    CHECK(lfp_dup(f, &dup) == LFP_NOTSUPPORTED);
+    lfp_close(f);
+}
+
+TEST_CASE(
+    "Direct I/O is not supported over a pipe, and the caller keeps the fd",
+    "[fd][pipe][direct]") {
+    int fds[2];
+    REQUIRE(::pipe(fds) == 0);
+
+    auto* f = lfp_fd_open(fds[0], LFP_FD_DIRECT);
+    CHECK(!f);
+    CHECK(::close(fds[0]) == 0);
+    ::close(fds[1]);
+}
+
+#endif
@@ -0,0 +1,403 @@
+#include <ciso646>
+#include <cstring>
+#include <vector>
+
+#include <catch2/catch.hpp>
+#include <zlib.h>
+
+#include <lfp/auto.h>
+#include <lfp/gzip.h>
+#include <lfp/lfp.h>
+#include <lfp/memfile.h>
+#include <lfp/tapeimage.h>
+
+#include "utils.hpp"
+
+using namespace Catch::Matchers;
+
+namespace {
+
+/*
+ * Compress a single gzip member, like gzip(1) would
+ */
+std::vector< unsigned char > compress(const std::vector< unsigned char >& src) {
+    z_stream strm;
+    std::memset(&strm, 0, sizeof(strm));
+    REQUIRE(deflateInit2(&strm, 6, Z_DEFLATED, 15 + 16, 8,
+                         Z_DEFAULT_STRATEGY) == Z_OK);
+
+    auto dst = std::vector< unsigned char >(deflateBound(&strm, src.size()));
+    strm.next_in   = const_cast< unsigned char* >(src.data());
+    strm.avail_in  = uInt(src.size());
+    strm.next_out  = dst.data();
+    strm.avail_out = uInt(dst.size());
+    REQUIRE(deflate(&strm, Z_FINISH) == Z_STREAM_END);
+    dst.resize(strm.total_out);
+    deflateEnd(&strm);
+    return dst;
+}
+
+lfp_protocol* gzip_open(const std::vector< unsigned char >& compressed,
+                        std::int64_t spacing = 0) {
+    auto* f = lfp_gzip_open(create_memfile_handle(compressed), spacing);
+    REQUIRE(f);
+    return f;
+}
+
+/*
+ * Bytes from a small alphabet, which compress to many deflate blocks
+ */
+std::vector< unsigned char > compressible(std::size_t size) {
+    auto contents = std::vector< unsigned char >(size);
+    std::uint32_t x = 2463534242;
+    for (auto& c : contents) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        c = 'a' + (x % 16);
+    }
+    return contents;
+}
+
+std::int64_t inner_bytes_read(lfp_protocol* f) {
+    lfp_protocol* inner = nullptr;
+    REQUIRE(lfp_peek(f, &inner) == LFP_OK);
+    lfp_stats stats;
+    REQUIRE(lfp_stats_get(inner, &stats) == LFP_OK);
+    return stats.bytes_read;
+}
+
+void check_read_at(lfp_protocol* f,
+                   const std::vector< unsigned char >& expected,
+                   std::int64_t offset,
+                   std::int64_t len) {
+    REQUIRE(lfp_seek(f, offset) == LFP_OK);
+    auto out = std::vector< unsigned char >(len);
+    std::int64_t nread = -1;
+    REQUIRE(lfp_readinto(f, out.data(), len, &nread) == LFP_OK);
+    CHECK(nread == len);
+    CHECK(std::equal(out.begin(), out.end(), expected.begin() + offset));
+}
+
+struct random_gzip : random_memfile {
+    random_gzip() {
+        REQUIRE(not expected.empty());
+        lfp_close(f);
+        f = nullptr;
+
+        spacing = GENERATE(0, 1, 100);
+        f = gzip_open(compress(expected), spacing);
+    }
+
+    int spacing;
+};
+
+}
+
+TEST_CASE(
+    "Opening gzip with a negative spacing returns NULL",
+    "[gzip]") {
+    CHECK(!lfp_gzip_open(nullptr, 0));
+    auto* mem = lfp_memfile_open();
+    CHECK(!lfp_gzip_open(mem, -1));
+    lfp_close(mem);
+}
+
+TEST_CASE_METHOD(
+    random_gzip,
+    "Gzip protocol can be read",
+    "[gzip][read]") {
+
+    SECTION( "full read" ) {
+        std::int64_t nread = -1;
+        const auto err = lfp_readinto(f, out.data(), out.size(), &nread);
+        CHECK(err == LFP_OK);
+        CHECK(nread == expected.size());
+        CHECK_THAT(out, Equals(expected));
+        CHECK(!lfp_eof(f));
+    }
+
+    SECTION( "incomplete read" ) {
+        std::int64_t nread = -1;
+        const auto err = lfp_readinto(f, out.data(), 2*out.size(), &nread);
+        CHECK(err == LFP_EOF);
+        CHECK(nread == expected.size());
+        CHECK_THAT(out, Equals(expected));
+        CHECK(lfp_eof(f));
+
+        CHECK(lfp_seek(f, 0) == LFP_OK);
+        CHECK(!lfp_eof(f));
+    }
+
+    SECTION( "A file can be read in multiple, smaller reads" ) {
+        test_split_read(this);
+    }
+
+    SECTION( "A file can be read with multiple buffers" ) {
+        test_split_readv(this);
+    }
+
+    SECTION( "correct seek" ) {
+        test_random_seek(this);
+    }
+
+    SECTION( "ptell is the decompressed offset" ) {
+        const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+        REQUIRE(lfp_seek(f, n) == LFP_OK);
+        std::int64_t tell = -1;
+        std::int64_t ptell = -1;
+        CHECK(lfp_tell(f, &tell) == LFP_OK);
+        CHECK(lfp_ptell(f, &ptell) == LFP_OK);
+        CHECK(tell == n);
+        CHECK(ptell == n);
+    }
+
+    SECTION( "seek past end moves to the end" ) {
+        CHECK(lfp_seek(f, size + 10) == LFP_INVALID_ARGS);
+        std::int64_t tell = -1;
+        CHECK(lfp_tell(f, &tell) == LFP_OK);
+        CHECK(tell == size);
+
+        std::int64_t nread = -1;
+        CHECK(lfp_readinto(f, out.data(), 1, &nread) == LFP_EOF);
+        CHECK(nread == 0);
+    }
+}
+
+TEST_CASE(
+    "Gzip seeks back and forth through a large file",
+    "[gzip][seek]") {
+    const auto expected = compressible(1024 * 1024);
+    const auto compressed = compress(expected);
+    REQUIRE(compressed.size() < expected.size());
+    auto* f = gzip_open(compressed, 32 * 1024);
+
+    /* the first pass decompresses everything, and makes the seek points */
+    auto out = std::vector< unsigned char >(expected.size());
+    std::int64_t nread = -1;
+    REQUIRE(lfp_readinto(f, out.data(), out.size(), &nread) == LFP_OK);
+    CHECK_THAT(out, Equals(expected));
+
+    SECTION( "seeking back only decompresses from the closest point" ) {
+        const auto before = inner_bytes_read(f);
+        check_read_at(f, expected, expected.size() - 100, 100);
+        const auto consumed = inner_bytes_read(f) - before;
+        CHECK(consumed < std::int64_t(compressed.size() / 4));
+    }
+
+    SECTION( "random seeks read the right bytes" ) {
+        const auto n = GENERATE(take(20, random(0, 1024 * 1024 - 1000)));
+        check_read_at(f, expected, n, 1000);
+        const auto back = GENERATE(take(1, random(0, 1024 * 1024 - 1000)));
+        check_read_at(f, expected, back, 1000);
+    }
+
+    CHECK(lfp_close(f) == LFP_OK);
+}
+
+TEST_CASE(
+    "Seeking forward before the file is read decompresses up to the target",
+    "[gzip][seek]") {
+    const auto expected = compressible(256 * 1024);
+    auto* f = gzip_open(compress(expected), 16 * 1024);
+
+    const auto n = GENERATE(take(5, random(0, 256 * 1024 - 100)));
+    check_read_at(f, expected, n, 100);
+    check_read_at(f, expected, 0, 100);
+    check_read_at(f, expected, n, 100);
+
+    CHECK(lfp_close(f) == LFP_OK);
+}
+
+TEST_CASE(
+    "Gzip files with multiple members are read as one",
+    "[gzip][read]") {
+    const auto first  = compressible(70 * 1000);
+    const auto second = std::vector< unsigned char >(5000, 'x');
+    auto compressed = compress(first);
+    const auto tail = compress(second);
+    compressed.insert(compressed.end(), tail.begin(), tail.end());
+    /* zero padding after the last member is ignored, like gzip(1) does */
+    compressed.insert(compressed.end(), 16, 0);
+
+    auto expected = first;
+    expected.insert(expected.end(), second.begin(), second.end());
+
+    auto* f = gzip_open(compressed, 1);
+    auto out = std::vector< unsigned char >(expected.size() + 1);
+    std::int64_t nread = -1;
+    CHECK(lfp_readinto(f, out.data(), out.size(), &nread) == LFP_EOF);
+    CHECK(nread == expected.size());
+    out.resize(nread);
+    CHECK_THAT(out, Equals(expected));
+
+    /* back into the first member, and then into the second */
+    check_read_at(f, expected, 10, 100);
+    check_read_at(f, expected, first.size() + 10, 100);
+    check_read_at(f, expected, first.size() - 50, 100);
+
+    CHECK(lfp_close(f) == LFP_OK);
+}
+
+TEST_CASE(
+    "Corrupt and truncated gzip files are reported",
+    "[gzip]") {
+    const auto expected = compressible(10 * 1000);
+    auto compressed = compress(expected);
+    auto out = std::vector< unsigned char >(expected.size());
+    std::int64_t nread = -1;
+
+    SECTION( "corrupt" ) {
+        for (std::size_t i = 100; i < 110; ++i)
+            compressed[i] ^= 0xFF;
+        auto* f = gzip_open(compressed);
+        const auto err = lfp_readinto(f, out.data(), out.size(), &nread);
+        CHECK(err == LFP_PROTOCOL_FATAL_ERROR);
+        CHECK_THAT(lfp_errormsg(f), Contains("gzip"));
+        lfp_close(f);
+    }
+
+    SECTION( "truncated" ) {
+        compressed.resize(compressed.size() - 20);
+        auto* f = gzip_open(compressed);
+        const auto err = lfp_readinto(f, out.data(), out.size(), &nread);
+        CHECK(err == LFP_UNEXPECTED_EOF);
+        lfp_close(f);
+    }
+
+    SECTION( "not gzip" ) {
+        auto* f = gzip_open(expected);
+        const auto err = lfp_readinto(f, out.data(), out.size(), &nread);
+        CHECK(err == LFP_PROTOCOL_FATAL_ERROR);
+        lfp_close(f);
+    }
+}
+
+TEST_CASE(
+    "Tape image can be read from a gzip-compressed file",
+    "[gzip][tapeimage]") {
+    const auto tif = std::vector< unsigned char > {
+        /* First record */
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x10, 0x00, 0x00, 0x00,
+
+        0x01, 0x02, 0x03, 0x04,
+
+        /* Second record */
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x24, 0x00, 0x00, 0x00,
+
+        0x05, 0x06, 0x07, 0x08,
+        0x09, 0x0A, 0x0B, 0x0C,
+
+        /* File mark */
+        0x01, 0x00, 0x00, 0x00,
+        0x10, 0x00, 0x00, 0x00,
+        0x30, 0x00, 0x00, 0x00,
+    };
+
+    auto* f = lfp_tapeimage_open(gzip_open(compress(tif)));
+    REQUIRE(f);
+
+    auto out = std::vector< unsigned char >(12);
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(f, out.data(), 12, &nread);
+    CHECK(err == LFP_OK);
+    CHECK_THAT(out, Equals(std::vector< unsigned char > {
+        0x01, 0x02, 0x03, 0x04,
+        0x05, 0x06, 0x07, 0x08,
+        0x09, 0x0A, 0x0B, 0x0C,
+    }));
+
+    REQUIRE(lfp_seek(f, 2) == LFP_OK);
+    out.resize(4);
+    err = lfp_readinto(f, out.data(), 4, &nread);
+    CHECK(err == LFP_OK);
+    CHECK_THAT(out, Equals(std::vector< unsigned char > {
+        0x03, 0x04, 0x05, 0x06,
+    }));
+
+    CHECK(lfp_close(f) == LFP_OK);
+}
+
+TEST_CASE(
+    "Tape images with many small records are read from gzip without restarts",
+    "[gzip][tapeimage][seek]") {
+    std::vector< bytes > records;
+    bytes expected;
+    for (int i = 0; i < 20000; ++i) {
+        records.push_back(bytes(1 + i % 50, (unsigned char)(i)));
+        expected.insert(expected.end(), records.back().begin(),
+                                        records.back().end());
+    }
+
+    auto* f = lfp_tapeimage_open(gzip_open(compress(tapeimage(records))));
+    REQUIRE(f);
+
+    auto out = bytes(expected.size());
+    const auto size = std::int64_t(out.size());
+    std::int64_t n = 0;
+    int err = LFP_OK;
+    while (n < size and err == LFP_OK) {
+        const auto len = (std::min)(std::int64_t(64), size - n);
+        std::int64_t nread = -1;
+        err = lfp_readinto(f, out.data() + n, len, &nread);
+        n += nread;
+    }
+    CHECK(err == LFP_OK);
+    CHECK(n == size);
+    CHECK_THAT(out, Equals(expected));
+
+    /*
+     * The tape image steps back whenever a batched read overshoots a record,
+     * which gzip serves from its history, without restarting decompression,
+     * which would seek the compressed file
+     */
+    lfp_protocol* gz = nullptr;
+    REQUIRE(lfp_peek(f, &gz) == LFP_OK);
+    lfp_stats stats;
+    REQUIRE(lfp_stats_get(gz, &stats) == LFP_OK);
+    CHECK(stats.seeks > 1000);
+
+    lfp_protocol* leaf = nullptr;
+    REQUIRE(lfp_peek(gz, &leaf) == LFP_OK);
+    REQUIRE(lfp_stats_get(leaf, &stats) == LFP_OK);
+    CHECK(stats.seeks == 0);
+
+    lfp_close(f);
+}
+
+TEST_CASE(
+    "Gzip-compressed tape images are recognised by lfp_open_auto",
+    "[gzip][auto][tapeimage]") {
+    const auto body = compressible(10 * 1000);
+    auto tif = std::vector< unsigned char > {
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x1C, 0x27, 0x00, 0x00,
+    };
+    tif.insert(tif.end(), body.begin(), body.end());
+    const auto mark = std::vector< unsigned char > {
+        0x01, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x28, 0x27, 0x00, 0x00,
+    };
+    tif.insert(tif.end(), mark.begin(), mark.end());
+
+    int layers = 0;
+    auto* f = lfp_open_auto(create_memfile_handle(compress(tif)), &layers);
+    REQUIRE(f);
+    CHECK(layers == (LFP_AUTO_GZIP | LFP_AUTO_TAPEIMAGE));
+
+    auto out = std::vector< unsigned char >(body.size() + 1);
+    std::int64_t nread = -1;
+    CHECK(lfp_readinto(f, out.data(), out.size(), &nread) == LFP_EOF);
+    CHECK(nread == body.size());
+    out.resize(nread);
+    CHECK_THAT(out, Equals(body));
+
+    check_read_at(f, body, 5000, 100);
+    CHECK(lfp_close(f) == LFP_OK);
+}
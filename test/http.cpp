@@ -0,0 +1,230 @@
+#include <ciso646>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include <lfp/http.h>
+#include <lfp/lfp.h>
+#include <lfp/tapeimage.h>
+
+#include "utils.hpp"
+
+using namespace Catch::Matchers;
+
+/*
+ * libcurl supports range requests for file:// urls too, which exercises
+ * everything but the response codes, without a server
+ */
+
+namespace {
+
+struct named_tempfile {
+    explicit named_tempfile(const std::vector< unsigned char >& contents) :
+        path(write_named_tempfile(contents))
+    {
+        char abs[PATH_MAX];
+        REQUIRE(::realpath(this->path.c_str(), abs));
+        this->url = std::string("file://") + abs;
+    }
+
+    ~named_tempfile() {
+        std::remove(this->path.c_str());
+    }
+
+    std::string path;
+    std::string url;
+};
+
+struct random_http : random_memfile {
+    random_http() : file(expected) {
+        lfp_close(f);
+        f = nullptr;
+
+        blocksize = GENERATE(16, 100, 4096);
+        parallel  = GENERATE(1, 4);
+        f = lfp_http_open(file.url.c_str(), nullptr, blocksize, parallel);
+        REQUIRE(f);
+    }
+
+    named_tempfile file;
+    int blocksize;
+    int parallel;
+};
+
+}
+
+TEST_CASE(
+    "Opening a file that does not exist returns NULL",
+    "[http]") {
+    CHECK(!lfp_http_open("file:///lfp/does/not/exist", nullptr, 0, 0));
+    CHECK(!lfp_http_open(nullptr, nullptr, 0, 0));
+}
+
+TEST_CASE(
+    "Negative block size or parallel returns NULL",
+    "[http]") {
+    const named_tempfile file(std::vector< unsigned char >(10));
+    CHECK(!lfp_http_open(file.url.c_str(), nullptr, -1, 0));
+    CHECK(!lfp_http_open(file.url.c_str(), nullptr, 0, -1));
+
+    const char* headers[] = { "X-Lfp-Test: 1", nullptr };
+    auto* f = lfp_http_open(file.url.c_str(), headers, 0, 0);
+    CHECK(f);
+    lfp_close(f);
+}
+
+TEST_CASE_METHOD(
+    random_http,
+    "Http can be read",
+    "[http][read]") {
+
+    SECTION( "full read" ) {
+        std::int64_t nread = -1;
+        const auto err = lfp_readinto(f, out.data(), out.size(), &nread);
+
+        CHECK(err == LFP_OK);
+        CHECK(nread == expected.size());
+        CHECK_THAT(out, Equals(expected));
+        CHECK(!lfp_eof(f));
+    }
+
+    SECTION( "incomplete read" ) {
+        std::int64_t nread = -1;
+        const auto err = lfp_readinto(f, out.data(), 2*out.size(), &nread);
+
+        CHECK(err == LFP_EOF);
+        CHECK(nread == expected.size());
+        CHECK_THAT(out, Equals(expected));
+        CHECK(lfp_eof(f));
+    }
+
+    SECTION( "A file can be read in multiple, smaller reads" ) {
+        test_split_read(this);
+    }
+
+    SECTION( "A file can be read with multiple buffers" ) {
+        test_split_readv(this);
+    }
+}
+
+TEST_CASE_METHOD(
+    random_http,
+    "Http can be seeked",
+    "[http][seek]") {
+
+    SECTION( "correct seek" ) {
+        test_random_seek(this);
+    }
+
+    SECTION( "seek back after reading ahead" ) {
+        const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+        std::int64_t nread = -1;
+        auto err = lfp_readinto(f, out.data(), size, &nread);
+        REQUIRE(err == LFP_OK);
+
+        std::fill(out.begin(), out.end(), 0);
+        REQUIRE(lfp_seek(f, n) == LFP_OK);
+        err = lfp_readinto(f, out.data() + n, size - n, &nread);
+        CHECK(err == LFP_OK);
+        CHECK(nread == size - n);
+        CHECK(std::equal(out.begin() + n, out.end(), expected.begin() + n));
+    }
+
+    SECTION( "seek past end is allowed, and reads report EOF" ) {
+        REQUIRE(lfp_seek(f, size + 10) == LFP_OK);
+
+        std::int64_t tell = -1;
+        lfp_tell(f, &tell);
+        CHECK(tell == size + 10);
+
+        std::int64_t nread = -1;
+        const auto err = lfp_readinto(f, out.data(), 1, &nread);
+        CHECK(err == LFP_EOF);
+        CHECK(nread == 0);
+        CHECK(lfp_eof(f));
+    }
+}
+
+TEST_CASE_METHOD(
+    random_http,
+    "Http supports pread and dup",
+    "[http][pread][dup]") {
+    const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+
+    auto tail = std::vector< unsigned char >(size - n + 1);
+    std::int64_t nread = -1;
+    auto err = lfp_pread(f, tail.data(), tail.size(), n, &nread);
+    CHECK(err == LFP_EOF);
+    CHECK(nread == size - n);
+    CHECK(std::equal(tail.begin(), tail.end() - 1, expected.begin() + n));
+
+    REQUIRE(lfp_seek(f, n) == LFP_OK);
+    lfp_protocol* dup = nullptr;
+    REQUIRE(lfp_dup(f, &dup) == LFP_OK);
+    lfp_close(f);
+    f = nullptr;
+
+    err = lfp_readinto(dup, out.data() + n, size - n, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(std::equal(out.begin() + n, out.end(), expected.begin() + n));
+    lfp_close(dup);
+}
+
+TEST_CASE(
+    "Tape image can be read and indexed over http",
+    "[http][tapeimage]") {
+    /*
+     * A tape of many small records, so that building the index chases a lot
+     * of headers through the read-ahead
+     */
+    std::vector< unsigned char > contents;
+    std::vector< unsigned char > expected;
+    std::uint32_t prev = 0;
+    for (int i = 0; i < 200; ++i) {
+        const auto head = std::uint32_t(contents.size());
+        const std::uint32_t len = 1 + i % 13;
+        const std::uint32_t next = head + 12 + len;
+        for (const auto x : { std::uint32_t(0), prev, next }) {
+            for (int k = 0; k < 4; ++k)
+                contents.push_back((unsigned char)(x >> (8 * k)));
+        }
+        for (std::uint32_t k = 0; k < len; ++k) {
+            contents.push_back((unsigned char)(i + k));
+            expected.push_back((unsigned char)(i + k));
+        }
+        prev = head;
+    }
+    const auto head = std::uint32_t(contents.size());
+    for (const auto x : { std::uint32_t(1), prev, head + 12 }) {
+        for (int k = 0; k < 4; ++k)
+            contents.push_back((unsigned char)(x >> (8 * k)));
+    }
+
+    const named_tempfile file(contents);
+    const auto blocksize = GENERATE(64, 1024);
+    auto* tif = lfp_tapeimage_open(
+        lfp_http_open(file.url.c_str(), nullptr, blocksize, 4)
+    );
+    REQUIRE(tif);
+    std::int64_t records = -1;
+    std::int64_t size = -1;
+    REQUIRE(lfp_tapeimage_build_index(tif, &records, &size) == LFP_OK);
+    CHECK(records == 201);
+    CHECK(size == std::int64_t(expected.size()));
+
+    std::int64_t nread = -1;
+    auto out = std::vector< unsigned char >(expected.size() + 1);
+    REQUIRE(lfp_seek(tif, 0) == LFP_OK);
+    const auto err = lfp_readinto(tif, out.data(), out.size(), &nread);
+    CHECK(err == LFP_EOF);
+    CHECK(nread == std::int64_t(expected.size()));
+    out.pop_back();
+    CHECK_THAT(out, Equals(expected));
+
+    lfp_close(tif);
+}
@@ -156,3 +156,307 @@ TEST_CASE_METHOD(
     CHECK(tell == n);
     CHECK(tell == ptell);
 }
+
+TEST_CASE(
+    "A mem-file view borrows the memory without copying",
+    "[mem][view]") {
+    auto contents = std::vector< unsigned char > {
+        0x01, 0x02, 0x03, 0x04,
+    };
+
+    auto* f = lfp_memfile_openview(contents.data(), contents.size());
+    REQUIRE(f);
+
+    /*
+     * Modifying the memory after open is visible through the protocol, which
+     * would not be the case had it been copied
+     */
+    contents[2] = 0xFF;
+
+    auto out = std::vector< unsigned char >(4, 0x00);
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(f, out.data(), out.size(), &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == 4);
+    CHECK_THAT(out, Equals(contents));
+
+    err = lfp_seek(f, 1);
+    CHECK(err == LFP_OK);
+    err = lfp_readinto(f, out.data(), out.size(), &nread);
+    CHECK(err == LFP_EOF);
+    CHECK(nread == 3);
+
+    CHECK(lfp_close(f) == LFP_OK);
+}
+
+TEST_CASE(
+    "An empty mem-file view can be read from",
+    "[mem][view]") {
+    auto* f = lfp_memfile_openview(nullptr, 0);
+    REQUIRE(f);
+
+    char buf;
+    std::int64_t nread = -1;
+    const auto err = lfp_readinto(f, &buf, 1, &nread);
+    CHECK(err == LFP_EOF);
+    CHECK(nread == 0);
+
+    CHECK(lfp_close(f) == LFP_OK);
+}
+
+namespace {
+
+struct release_counter {
+    int calls = 0;
+    static void release(void* ctx) {
+        static_cast< release_counter* >(ctx)->calls += 1;
+    }
+};
+
+}
+
+TEST_CASE(
+    "An adopted mem-file releases the memory once on close",
+    "[mem][view]") {
+    const auto contents = std::vector< unsigned char > {
+        0x01, 0x02, 0x03, 0x04,
+    };
+    release_counter counter;
+
+    auto* f = lfp_memfile_adopt(
+        contents.data(),
+        contents.size(),
+        release_counter::release,
+        &counter
+    );
+    REQUIRE(f);
+
+    auto out = std::vector< unsigned char >(4, 0x00);
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(f, out.data(), out.size(), &nread);
+    CHECK(err == LFP_OK);
+    CHECK_THAT(out, Equals(contents));
+    CHECK(counter.calls == 0);
+
+    SECTION( "when closed directly" ) {
+        CHECK(lfp_close(f) == LFP_OK);
+        CHECK(counter.calls == 1);
+    }
+
+    SECTION( "when closed through an outer protocol" ) {
+        auto* outer = lfp_tapeimage_open(f);
+        REQUIRE(outer);
+        CHECK(lfp_close(outer) == LFP_OK);
+        CHECK(counter.calls == 1);
+    }
+}
+
+TEST_CASE(
+    "A duplicated mem-file releases the memory when the last is closed",
+    "[mem][view][dup]") {
+    const auto contents = std::vector< unsigned char > {
+        0x01, 0x02, 0x03, 0x04,
+    };
+    release_counter counter;
+
+    auto* f = lfp_memfile_adopt(
+        contents.data(),
+        contents.size(),
+        release_counter::release,
+        &counter
+    );
+    REQUIRE(f);
+
+    lfp_protocol* dup = nullptr;
+    auto err = lfp_dup(f, &dup);
+    REQUIRE(err == LFP_OK);
+    REQUIRE(dup);
+
+    CHECK(lfp_close(f) == LFP_OK);
+    CHECK(counter.calls == 0);
+
+    auto out = std::vector< unsigned char >(4, 0x00);
+    std::int64_t nread = -1;
+    err = lfp_readinto(dup, out.data(), out.size(), &nread);
+    CHECK(err == LFP_OK);
+    CHECK_THAT(out, Equals(contents));
+
+    CHECK(lfp_close(dup) == LFP_OK);
+    CHECK(counter.calls == 1);
+}
+
+TEST_CASE(
+    "readview on a mem-file points into the memory",
+    "[mem][readview]") {
+    const auto contents = std::vector< unsigned char > {
+        0x01, 0x02, 0x03, 0x04,
+        0x05, 0x06, 0x07, 0x08,
+    };
+
+    auto* f = lfp_memfile_openview(contents.data(), contents.size());
+    REQUIRE(f);
+
+    const void* view = nullptr;
+    std::int64_t nread = -1;
+    auto err = lfp_readview(f, &view, 3, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == 3);
+    CHECK(view == contents.data());
+
+    err = lfp_readview(f, &view, 3, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == 3);
+    CHECK(view == contents.data() + 3);
+
+    std::int64_t tell;
+    err = lfp_tell(f, &tell);
+    CHECK(err == LFP_OK);
+    CHECK(tell == 6);
+
+    err = lfp_readview(f, &view, 3, &nread);
+    CHECK(err == LFP_EOF);
+    CHECK(nread == 2);
+    CHECK(view == contents.data() + 6);
+
+    CHECK(lfp_close(f) == LFP_OK);
+}
+
+TEST_CASE_METHOD(
+        random_memfile,
+        "A mem-file can be read with multiple buffers",
+        "[mem][readv]") {
+    test_split_readv(this);
+}
+
+TEST_CASE("Negative readv count or length return invalid args", "[mem][readv]") {
+    auto out = std::vector< unsigned char >(4);
+    auto f = memopen(out);
+
+    lfp_iovec iov[2];
+    iov[0].base = out.data();
+    iov[0].len  = 2;
+    iov[1].base = out.data() + 2;
+    iov[1].len  = -1;
+
+    std::int64_t nread;
+    auto err = lfp_readv(f.get(), iov, -1, &nread);
+    CHECK(err == LFP_INVALID_ARGS);
+
+    err = lfp_readv(f.get(), iov, 2, &nread);
+    CHECK(err == LFP_INVALID_ARGS);
+    auto msg = std::string(lfp_errormsg(f.get()));
+    CHECK_THAT(msg, Contains("iov[1].len"));
+}
+
+TEST_CASE_METHOD(
+        random_memfile,
+        "pread on a mem-file does not move the position",
+        "[mem][pread]") {
+    const auto offset = GENERATE_COPY(take(1, random(0, size - 1)));
+    const auto len = size - offset;
+
+    std::int64_t nread = -1;
+    auto err = lfp_pread(f, out.data(), len, offset, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == len);
+    CHECK(std::equal(out.begin(), out.begin() + len, expected.begin() + offset));
+
+    std::int64_t tell = -1;
+    lfp_tell(f, &tell);
+    CHECK(tell == 0);
+
+    SECTION( "reading past the end is EOF" ) {
+        err = lfp_pread(f, out.data(), len + 1, offset, &nread);
+        CHECK(err == LFP_EOF);
+        CHECK(nread == len);
+
+        err = lfp_pread(f, out.data(), 1, size + 10, &nread);
+        CHECK(err == LFP_EOF);
+        CHECK(nread == 0);
+        CHECK(not lfp_eof(f));
+    }
+
+    SECTION( "negative offsets are rejected" ) {
+        err = lfp_pread(f, out.data(), 1, -1, &nread);
+        CHECK(err == LFP_INVALID_ARGS);
+    }
+}
+
+TEST_CASE_METHOD(
+        random_memfile,
+        "A duplicated mem-file has its own position",
+        "[mem][dup]") {
+    const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(f, out.data(), n, &nread);
+    REQUIRE(err == LFP_OK);
+
+    lfp_protocol* dup = nullptr;
+    err = lfp_dup(f, &dup);
+    REQUIRE(err == LFP_OK);
+
+    std::int64_t tell = -1;
+    lfp_tell(dup, &tell);
+    CHECK(tell == n);
+
+    err = lfp_readinto(dup, out.data() + n, size - n, &nread);
+    CHECK(err == LFP_OK);
+    CHECK_THAT(out, Equals(expected));
+
+    lfp_tell(f, &tell);
+    CHECK(tell == n);
+
+    lfp_close(dup);
+}
+
+TEST_CASE("Leaf protocols have no index to export", "[mem][index]") {
+    auto f = memopen();
+
+    std::int64_t size = -1;
+    auto err = lfp_index_export(f.get(), nullptr, 0, &size);
+    CHECK(err == LFP_NOTIMPLEMENTED);
+
+    const unsigned char blob[1] = {};
+    err = lfp_index_import(f.get(), blob, sizeof(blob));
+    CHECK(err == LFP_NOTIMPLEMENTED);
+}
+
+TEST_CASE("memfile counts reads and seeks", "[mem][stats]") {
+    const auto contents = std::vector< unsigned char > {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    };
+    auto f = memopen(contents);
+
+    auto out = std::vector< unsigned char >(contents.size());
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(f.get(), out.data(), 3, &nread);
+    REQUIRE(err == LFP_OK);
+
+    const void* view = nullptr;
+    err = lfp_readview(f.get(), &view, 2, nullptr);
+    REQUIRE(err == LFP_OK);
+
+    err = lfp_pread(f.get(), out.data(), 10, 4, &nread);
+    REQUIRE(err == LFP_EOF);
+
+    err = lfp_seek(f.get(), 1);
+    REQUIRE(err == LFP_OK);
+
+    lfp_stats stats;
+    err = lfp_stats_get(f.get(), &stats);
+    REQUIRE(err == LFP_OK);
+    CHECK(stats.reads == 3);
+    CHECK(stats.bytes_read == 3 + 2 + 4);
+    CHECK(stats.seeks == 1);
+    CHECK(stats.headers_read == 0);
+    CHECK(stats.index_records == 0);
+    CHECK(stats.inner_time_ns == 0);
+
+    err = lfp_stats_reset(f.get());
+    REQUIRE(err == LFP_OK);
+    lfp_stats_get(f.get(), &stats);
+    CHECK(stats.reads == 0);
+    CHECK(stats.bytes_read == 0);
+    CHECK(stats.seeks == 0);
+    CHECK(stats.time_ns == 0);
+}
@@ -0,0 +1,306 @@
+#include <ciso646>
+#include <cstdio>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include <lfp/lfp.h>
+#include <lfp/mmap.h>
+#include <lfp/tapeimage.h>
+
+#include "utils.hpp"
+
+using namespace Catch::Matchers;
+
+namespace {
+
+struct random_mmap : random_memfile {
+    random_mmap() {
+        REQUIRE(not expected.empty());
+
+        lfp_close(f);
+        f = nullptr;
+
+        const auto advice = GENERATE(
+            LFP_MMAP_NORMAL,
+            LFP_MMAP_SEQUENTIAL,
+            LFP_MMAP_RANDOM
+        );
+
+        const auto path = write_named_tempfile(expected);
+        f = lfp_mmap_open(path.c_str(), advice);
+        std::remove(path.c_str());
+        REQUIRE(f);
+    }
+};
+
+}
+
+TEST_CASE(
+    "Opening non-existing file returns NULL",
+    "[mmap][filehandle]") {
+    auto* f = lfp_mmap_open("this-file-does-not-exist", LFP_MMAP_NORMAL);
+    CHECK(!f);
+
+    auto* tif = lfp_tapeimage_open(f);
+    CHECK(!tif);
+}
+
+TEST_CASE(
+    "Empty file can be opened and read from",
+    "[mmap][filehandle]") {
+    auto* f = create_mmap_handle(std::vector< unsigned char >());
+    REQUIRE(f);
+
+    char buf;
+    std::int64_t nread = -1;
+    CHECK(!lfp_eof(f));
+    const auto err = lfp_readinto(f, &buf, 1, &nread);
+    CHECK(err == LFP_EOF);
+    CHECK(nread == 0);
+    CHECK(lfp_eof(f));
+
+    CHECK(lfp_close(f) == LFP_OK);
+}
+
+TEST_CASE(
+    "Layered mmap closes correctly",
+    "[mmap][close]") {
+    const auto contents = std::vector< unsigned char > {
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x18, 0x00, 0x00, 0x00,
+
+        0x01, 0x02, 0x03, 0x04,
+        0x54, 0x41, 0x50, 0x45,
+        0x4D, 0x41, 0x52, 0x4B,
+
+        0x01, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x24, 0x00, 0x00, 0x00,
+    };
+    auto* mmap  = create_mmap_handle(contents);
+    auto* outer = lfp_tapeimage_open(mmap);
+
+    auto err = lfp_close(outer);
+    CHECK(err == LFP_OK);
+}
+
+TEST_CASE(
+    "Unsupported peel and peek leaves the protocol intact",
+    "[mmap][peel][peek]") {
+    const auto contents = std::vector< unsigned char > {
+        0x01, 0x02, 0x03, 0x04,
+    };
+    auto* mmap = create_mmap_handle(contents);
+
+    lfp_protocol* protocol;
+    auto err = lfp_peel(mmap, &protocol);
+    CHECK(err == LFP_LEAF_PROTOCOL);
+
+    err = lfp_peek(mmap, &protocol);
+    CHECK(err == LFP_LEAF_PROTOCOL);
+
+    auto out = std::vector< unsigned char >(5, 0xFF);
+    std::int64_t nread;
+    err = lfp_readinto(mmap, out.data(), 5, &nread);
+    CHECK(err == LFP_EOF);
+    CHECK(nread == 4);
+
+    err = lfp_close(mmap);
+    CHECK(err == LFP_OK);
+}
+
+TEST_CASE_METHOD(
+    random_mmap,
+    "Mmap can be read",
+    "[mmap][read]") {
+
+    SECTION( "full read" ) {
+        std::int64_t nread = -1;
+        const auto err = lfp_readinto(f, out.data(), out.size(), &nread);
+
+        CHECK(err == LFP_OK);
+        CHECK(nread == expected.size());
+        CHECK_THAT(out, Equals(expected));
+    }
+
+    SECTION( "incomplete read" ) {
+        std::int64_t nread = -1;
+        const auto err = lfp_readinto(f, out.data(), 2*out.size(), &nread);
+
+        CHECK(err == LFP_EOF);
+        CHECK(nread == expected.size());
+        CHECK_THAT(out, Equals(expected));
+    }
+
+    SECTION( "A file can be read in multiple, smaller reads" ) {
+        test_split_read(this);
+    }
+
+    SECTION( "A file can be read with multiple buffers" ) {
+        test_split_readv(this);
+    }
+
+    SECTION( "zero read" ) {
+        std::int64_t nread = -1;
+        const auto err = lfp_readinto(f, out.data(), 0, &nread);
+
+        CHECK(err == LFP_OK);
+        CHECK(nread == 0);
+    }
+}
+
+TEST_CASE_METHOD(
+    random_mmap,
+    "Mmap can be seeked",
+    "[mmap][seek]") {
+
+    SECTION( "correct seek" ) {
+        test_random_seek(this);
+    }
+
+    SECTION( "seek beyond file end, then read" ) {
+        auto err = lfp_seek(f, size + 10);
+        CHECK(err == LFP_OK);
+
+        std::int64_t tell;
+        err = lfp_tell(f, &tell);
+        CHECK(err == LFP_OK);
+        CHECK(tell == size + 10);
+
+        std::int64_t nread = -1;
+        err = lfp_readinto(f, out.data(), 1, &nread);
+        CHECK(err == LFP_EOF);
+        CHECK(nread == 0);
+    }
+
+    SECTION( "tell and ptell return the same result" ) {
+        const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+        auto err = lfp_seek(f, n);
+        REQUIRE(err == LFP_OK);
+
+        std::int64_t tell;
+        err = lfp_tell(f, &tell);
+        CHECK(err == LFP_OK);
+
+        std::int64_t ptell;
+        err = lfp_ptell(f, &ptell);
+        CHECK(err == LFP_OK);
+
+        CHECK(tell == n);
+        CHECK(tell == ptell);
+    }
+}
+
+TEST_CASE_METHOD(
+    random_mmap,
+    "Mmap eof",
+    "[mmap][eof]") {
+
+    SECTION( "eof reports after read past-end" ) {
+        std::int64_t nread = -1;
+        const auto err = lfp_readinto(f, out.data(), out.size() +1, &nread);
+
+        CHECK(err == LFP_EOF);
+        CHECK(lfp_eof(f));
+    }
+
+    SECTION( "eof not reported on read to end" ) {
+        std::int64_t nread = -1;
+        const auto err = lfp_readinto(f, out.data(), out.size(), &nread);
+
+        CHECK(err == LFP_OK);
+        CHECK(!lfp_eof(f));
+    }
+
+    SECTION( "eof not reported on seek to end" ) {
+        const auto err = lfp_seek(f, out.size());
+
+        CHECK(err == LFP_OK);
+        CHECK(!lfp_eof(f));
+    }
+
+    SECTION( "eof not repored on seek to start after read past-end" ) {
+        std::int64_t nread = -1;
+        auto err = lfp_readinto(f, out.data(), out.size() +1, &nread);
+        REQUIRE(err == LFP_EOF);
+        REQUIRE(lfp_eof(f));
+
+        err = lfp_seek(f, 0);
+        CHECK(err == LFP_OK);
+        CHECK(!lfp_eof(f));
+    }
+}
+
+TEST_CASE_METHOD(
+    random_mmap,
+    "Mmap can be read with readview",
+    "[mmap][readview]") {
+    const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+    auto err = lfp_seek(f, n);
+    REQUIRE(err == LFP_OK);
+
+    const void* view = nullptr;
+    std::int64_t nread = -1;
+    err = lfp_readview(f, &view, size - n, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == size - n);
+
+    const auto* begin = static_cast< const unsigned char* >(view);
+    const auto result = std::vector< unsigned char >(begin, begin + nread);
+    const auto tail = std::vector< unsigned char >(
+        expected.begin() + n,
+        expected.end()
+    );
+    CHECK_THAT(result, Equals(tail));
+    CHECK(!lfp_eof(f));
+
+    err = lfp_readview(f, &view, 1, &nread);
+    CHECK(err == LFP_EOF);
+    CHECK(nread == 0);
+    CHECK(lfp_eof(f));
+}
+
+TEST_CASE_METHOD(
+    random_mmap,
+    "Mmap can be read with pread",
+    "[mmap][pread]") {
+    const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+
+    std::int64_t nread = -1;
+    auto err = lfp_pread(f, out.data(), size - n + 1, n, &nread);
+    CHECK(err == LFP_EOF);
+    CHECK(nread == size - n);
+    CHECK(std::equal(out.begin(), out.begin() + nread, expected.begin() + n));
+    CHECK(!lfp_eof(f));
+
+    std::int64_t tell = -1;
+    lfp_tell(f, &tell);
+    CHECK(tell == 0);
+}
+
+TEST_CASE_METHOD(
+    random_mmap,
+    "A duplicated mmap has its own position, and outlives the original",
+    "[mmap][dup]") {
+    const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+    auto err = lfp_seek(f, n);
+    REQUIRE(err == LFP_OK);
+
+    lfp_protocol* dup = nullptr;
+    err = lfp_dup(f, &dup);
+    REQUIRE(err == LFP_OK);
+
+    err = lfp_seek(f, 0);
+    REQUIRE(err == LFP_OK);
+    CHECK(lfp_close(f) == LFP_OK);
+    f = nullptr;
+
+    std::int64_t nread = -1;
+    err = lfp_readinto(dup, out.data() + n, size - n, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == size - n);
+    CHECK(std::equal(out.begin() + n, out.end(), expected.begin() + n));
+    CHECK(lfp_close(dup) == LFP_OK);
+}
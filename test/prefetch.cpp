@@ -0,0 +1,355 @@
+#include <ciso646>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include <lfp/lfp.h>
+#include <lfp/memfile.h>
+#include <lfp/prefetch.h>
+#include <lfp/protocol.hpp>
+#include <lfp/tapeimage.h>
+
+#include "utils.hpp"
+
+using namespace Catch::Matchers;
+
+namespace {
+
+struct random_prefetch : random_memfile {
+    random_prefetch() {
+        REQUIRE(not expected.empty());
+
+        blocksize = GENERATE(1, 13, 512);
+        blocks = GENERATE(1, 3);
+
+        auto* mem = f;
+        f = lfp_prefetch_open(mem, blocksize, blocks);
+        REQUIRE(f);
+    }
+
+    int blocksize;
+    int blocks;
+};
+
+/*
+ * A leaf that reads zeros, and fails with an I/O error after size bytes
+ */
+class failing : public lfp_protocol {
+public:
+    explicit failing(std::int64_t n) : size(n) {}
+
+    void close() noexcept (false) override {}
+
+    lfp_status readinto(void* dst, std::int64_t len, std::int64_t* nread)
+    noexcept (false) override {
+        if (this->pos == this->size)
+            throw lfp::io_error("failing: device on fire");
+
+        const auto n = (std::min)(len, this->size - this->pos);
+        std::memset(dst, 0, n);
+        this->pos += n;
+        if (nread) *nread = n;
+        return n == len ? LFP_OK : LFP_OKINCOMPLETE;
+    }
+
+    int eof() const noexcept (true) override { return false; }
+    std::int64_t tell() const noexcept (true) override { return this->pos; }
+
+    lfp_protocol* peel() noexcept (false) override {
+        throw lfp::leaf_protocol("failing: leaf");
+    }
+
+    lfp_protocol* peek() const noexcept (false) override {
+        throw lfp::leaf_protocol("failing: leaf");
+    }
+
+private:
+    std::int64_t size;
+    std::int64_t pos = 0;
+};
+
+}
+
+TEST_CASE(
+    "Negative block size or count returns NULL",
+    "[prefetch]") {
+    auto* mem = lfp_memfile_open();
+
+    CHECK(!lfp_prefetch_open(mem, -1, 0));
+    CHECK(!lfp_prefetch_open(mem,  0, -1));
+    CHECK(!lfp_prefetch_open(nullptr, 0, 0));
+
+    lfp_close(mem);
+}
+
+TEST_CASE_METHOD(
+    random_prefetch,
+    "Prefetch can be read",
+    "[prefetch][read]") {
+
+    SECTION( "full read" ) {
+        std::int64_t nread = -1;
+        const auto err = lfp_readinto(f, out.data(), out.size(), &nread);
+
+        CHECK(err == LFP_OK);
+        CHECK(nread == expected.size());
+        CHECK_THAT(out, Equals(expected));
+        CHECK(!lfp_eof(f));
+    }
+
+    SECTION( "incomplete read" ) {
+        std::int64_t nread = -1;
+        const auto err = lfp_readinto(f, out.data(), 2*out.size(), &nread);
+
+        CHECK(err == LFP_EOF);
+        CHECK(nread == expected.size());
+        CHECK_THAT(out, Equals(expected));
+        CHECK(lfp_eof(f));
+    }
+
+    SECTION( "A file can be read in multiple, smaller reads" ) {
+        test_split_read(this);
+    }
+
+    SECTION( "A file can be read with multiple buffers" ) {
+        test_split_readv(this);
+    }
+
+    SECTION( "A file can be read with readview" ) {
+        const void* view = nullptr;
+        std::int64_t nread = -1;
+        const auto err = lfp_readview(f, &view, size, &nread);
+        CHECK(err == LFP_OK);
+        CHECK(nread == size);
+
+        const auto* p = static_cast< const unsigned char* >(view);
+        out.assign(p, p + nread);
+        CHECK_THAT(out, Equals(expected));
+    }
+}
+
+TEST_CASE_METHOD(
+    random_prefetch,
+    "Prefetch can be seeked",
+    "[prefetch][seek]") {
+
+    SECTION( "correct seek" ) {
+        test_random_seek(this);
+    }
+
+    SECTION( "seek back, then read" ) {
+        std::int64_t nread = -1;
+        auto err = lfp_readinto(f, out.data(), size, &nread);
+        REQUIRE(err == LFP_OK);
+
+        const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+        err = lfp_seek(f, n);
+        CHECK(err == LFP_OK);
+
+        std::int64_t tell = -1;
+        lfp_tell(f, &tell);
+        CHECK(tell == n);
+
+        out.assign(size, 0);
+        err = lfp_readinto(f, out.data() + n, size - n, &nread);
+        CHECK(err == LFP_OK);
+        CHECK(nread == size - n);
+
+        const auto tail = std::vector< unsigned char >(
+            expected.begin() + n,
+            expected.end()
+        );
+        out.erase(out.begin(), out.begin() + n);
+        CHECK_THAT(out, Equals(tail));
+    }
+
+    SECTION( "tell and ptell follow reads" ) {
+        const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+        std::int64_t nread = -1;
+        auto err = lfp_readinto(f, out.data(), n, &nread);
+        REQUIRE(err == LFP_OK);
+
+        std::int64_t tell = -1;
+        std::int64_t ptell = -1;
+        lfp_tell(f, &tell);
+        lfp_ptell(f, &ptell);
+        CHECK(tell == n);
+        CHECK(ptell == n);
+    }
+
+    SECTION( "failed seek leaves the protocol usable" ) {
+        auto err = lfp_seek(f, size + 1);
+        CHECK(err == LFP_INVALID_ARGS);
+
+        std::int64_t nread = -1;
+        err = lfp_readinto(f, out.data(), out.size(), &nread);
+        CHECK(err == LFP_OK);
+        CHECK_THAT(out, Equals(expected));
+    }
+}
+
+TEST_CASE_METHOD(
+    random_prefetch,
+    "Peeled protocol is positioned at the prefetch position",
+    "[prefetch][peel]") {
+    const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(f, out.data(), n, &nread);
+    REQUIRE(err == LFP_OK);
+
+    lfp_protocol* peeled = nullptr;
+    err = lfp_peel(f, &peeled);
+    CHECK(err == LFP_OK);
+
+    std::int64_t tell = -1;
+    lfp_tell(peeled, &tell);
+    CHECK(tell == n);
+
+    err = lfp_readinto(peeled, out.data() + n, size - n, &nread);
+    CHECK(err == LFP_OK);
+    CHECK_THAT(out, Equals(expected));
+    lfp_close(peeled);
+}
+
+TEST_CASE(
+    "Prefetch reports errors after the data read before them",
+    "[prefetch][error]") {
+    auto* f = lfp_prefetch_open(new failing(100), 16, 2);
+    REQUIRE(f);
+
+    auto out = std::vector< unsigned char >(200, 0xFF);
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(f, out.data(), 60, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == 60);
+
+    err = lfp_readinto(f, out.data(), 60, &nread);
+    CHECK(err == LFP_OKINCOMPLETE);
+    CHECK(nread == 40);
+
+    err = lfp_readinto(f, out.data(), 60, &nread);
+    CHECK(err == LFP_IOERROR);
+    CHECK_THAT(std::string(lfp_errormsg(f)), Contains("device on fire"));
+
+    /* the error is sticky */
+    err = lfp_readinto(f, out.data(), 60, &nread);
+    CHECK(err == LFP_IOERROR);
+
+    CHECK(lfp_close(f) == LFP_OK);
+}
+
+TEST_CASE(
+    "Prefetch can be closed while reading ahead",
+    "[prefetch][close]") {
+    auto contents = std::vector< unsigned char >(1 << 20, 0xAB);
+    auto* f = lfp_prefetch_open(create_cfile_handle(contents), 4096, 8);
+    REQUIRE(f);
+
+    unsigned char x = 0;
+    std::int64_t nread = -1;
+    const auto err = lfp_readinto(f, &x, 1, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(x == 0xAB);
+
+    CHECK(lfp_close(f) == LFP_OK);
+}
+
+TEST_CASE(
+    "Tape image can be read through a prefetch protocol",
+    "[prefetch][tapeimage]") {
+    const auto contents = std::vector< unsigned char > {
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x10, 0x00, 0x00, 0x00,
+
+        0x01, 0x02, 0x03, 0x04,
+
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x24, 0x00, 0x00, 0x00,
+
+        0x05, 0x06, 0x07, 0x08,
+        0x09, 0x0A, 0x0B, 0x0C,
+
+        0x01, 0x00, 0x00, 0x00,
+        0x10, 0x00, 0x00, 0x00,
+        0x30, 0x00, 0x00, 0x00,
+    };
+
+    const auto blocksize = GENERATE(1, 5, 64);
+    auto* inner = create_cfile_handle(contents);
+    auto* tif = lfp_tapeimage_open(lfp_prefetch_open(inner, blocksize, 2));
+    REQUIRE(tif);
+
+    const auto expected = std::vector< unsigned char > {
+        0x01, 0x02, 0x03, 0x04,
+        0x05, 0x06, 0x07, 0x08,
+        0x09, 0x0A, 0x0B, 0x0C,
+    };
+
+    auto out = std::vector< unsigned char >(expected.size() + 1);
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(tif, out.data(), out.size(), &nread);
+    CHECK(err == LFP_EOF);
+    CHECK(nread == expected.size());
+    out.pop_back();
+    CHECK_THAT(out, Equals(expected));
+
+    err = lfp_seek(tif, 2);
+    CHECK(err == LFP_OK);
+    err = lfp_readinto(tif, out.data(), 6, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(out[0] == 0x03);
+    CHECK(out[5] == 0x08);
+
+    lfp_close(tif);
+}
+
+TEST_CASE_METHOD(
+    random_prefetch,
+    "A duplicated prefetch protocol has its own position",
+    "[prefetch][dup]") {
+    const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(f, out.data(), n, &nread);
+    REQUIRE(err == LFP_OK);
+
+    lfp_protocol* dup = nullptr;
+    err = lfp_dup(f, &dup);
+    REQUIRE(err == LFP_OK);
+
+    auto fromdup = std::vector< unsigned char >(size - n);
+    err = lfp_readinto(dup, fromdup.data(), fromdup.size(), &nread);
+    CHECK(err == LFP_OK);
+    CHECK(std::equal(fromdup.begin(), fromdup.end(), expected.begin() + n));
+
+    err = lfp_readinto(f, out.data() + n, size - n, &nread);
+    CHECK(err == LFP_OK);
+    CHECK_THAT(out, Equals(expected));
+
+    lfp_close(dup);
+}
+
+TEST_CASE(
+    "Prefetch can not be duplicated without duplicating the inner protocol",
+    "[prefetch][dup]") {
+    auto* f = lfp_prefetch_open(new failing(100), 16, 2);
+    REQUIRE(f);
+
+    lfp_protocol* dup = nullptr;
+    auto err = lfp_dup(f, &dup);
+    CHECK(err == LFP_NOTIMPLEMENTED);
+    CHECK(dup == nullptr);
+
+    /* prefetching picks up again */
+    auto out = std::vector< unsigned char >(50);
+    std::int64_t nread = -1;
+    err = lfp_readinto(f, out.data(), out.size(), &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == 50);
+
+    lfp_close(f);
+}
@@ -1,6 +1,9 @@
 #include <ciso646>
 #include <vector>
 #include <cstring>
+#include <algorithm>
+#include <numeric>
+#include <random>
 
 #include <catch2/catch.hpp>
 
@@ -258,6 +261,16 @@ TEST_CASE_METHOD(
     test_split_read(this);
 }
 
+TEST_CASE_METHOD(
+    random_rp66,
+    "Visible Envelope: A file can be read with multiple buffers",
+    "[visible envelope][rp66][readv]") {
+    const auto records = GENERATE(1, 2, 3, 5, 8, 13);
+    make(records);
+
+    test_split_readv(this);
+}
+
 TEST_CASE_METHOD(
     random_rp66,
     "Visible Envelope: single seek matches underlying handle",
@@ -1092,3 +1105,654 @@ TEST_CASE_METHOD(
     }
 
 }
+
+TEST_CASE_METHOD(
+    random_rp66,
+    "Visible Envelope: A file can be read with multiple readviews",
+    "[visible envelope][rp66][readview]") {
+    const auto records = GENERATE(1, 2, 3, 5, 8, 13);
+    make(records);
+
+    const auto readsize = GENERATE_COPY(take(1, random(1, (size + 1) / 2)));
+    out.clear();
+    while (true) {
+        const void* view = nullptr;
+        std::int64_t nread = -1;
+        const auto err = lfp_readview(f, &view, readsize, &nread);
+        const auto* p = static_cast< const unsigned char* >(view);
+        out.insert(out.end(), p, p + nread);
+
+        if (err == LFP_EOF)
+            break;
+        REQUIRE(err == LFP_OK);
+        REQUIRE(nread == readsize);
+    }
+
+    CHECK_THAT(out, Equals(expected));
+}
+
+TEST_CASE(
+    "Visible Envelope: readview inside a record borrows from the underlying handle",
+    "[visible envelope][rp66][readview]") {
+    const auto contents = std::vector< unsigned char > {
+        0x00, 0x0C, 0xFF, 0x01,
+        0x01, 0x02, 0x03, 0x04,
+        0x05, 0x06, 0x07, 0x08,
+
+        0x00, 0x08, 0xFF, 0x01,
+        0x09, 0x0A, 0x0B, 0x0C,
+    };
+
+    auto* mem = lfp_memfile_openview(contents.data(), contents.size());
+    auto* rp66 = lfp_rp66_open(mem);
+    REQUIRE(rp66);
+
+    const void* view = nullptr;
+    std::int64_t nread = -1;
+    auto err = lfp_readview(rp66, &view, 6, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == 6);
+    CHECK(view == contents.data() + 4);
+
+    /* crosses the record boundary, so must be copied */
+    err = lfp_readview(rp66, &view, 4, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == 4);
+    const auto* p = static_cast< const unsigned char* >(view);
+    const auto spanning = std::vector< unsigned char >(p, p + nread);
+    CHECK_THAT(spanning, Equals(std::vector< unsigned char > {
+        0x07, 0x08, 0x09, 0x0A,
+    }));
+
+    err = lfp_readview(rp66, &view, 2, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == 2);
+    CHECK(view == contents.data() + 18);
+
+    lfp_close(rp66);
+}
+
+TEST_CASE_METHOD(
+    random_rp66,
+    "Visible envelope: an exported index can be imported into a new handle",
+    "[visible envelope][rp66][index]") {
+    const auto records = GENERATE(1, 2, 5, 13);
+    make(records);
+
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(f, out.data(), out.size() + 1, &nread);
+    REQUIRE(err == LFP_EOF);
+
+    std::int64_t blobsize = -1;
+    err = lfp_index_export(f, nullptr, 0, &blobsize);
+    CHECK(err == LFP_OK);
+    CHECK(blobsize == 48 + 2 * records);
+
+    auto blob = std::vector< unsigned char >(blobsize);
+    err = lfp_index_export(f, blob.data(), blob.size(), &blobsize);
+    CHECK(err == LFP_OK);
+
+    SECTION( "the imported index can be seeked and read" ) {
+        auto* g = lfp_rp66_open(
+            lfp_memfile_openwith(bytes.data(), bytes.size())
+        );
+        REQUIRE(g);
+        err = lfp_index_import(g, blob.data(), blob.size());
+        CHECK(err == LFP_OK);
+
+        const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+        err = lfp_seek(g, n);
+        CHECK(err == LFP_OK);
+
+        out.assign(size - n, 0);
+        err = lfp_readinto(g, out.data(), out.size() + 1, &nread);
+        CHECK(err == LFP_EOF);
+        CHECK(nread == size - n);
+
+        const auto tail = std::vector< unsigned char >(
+            expected.begin() + n,
+            expected.end()
+        );
+        CHECK_THAT(out, Equals(tail));
+        lfp_close(g);
+    }
+
+    SECTION( "the imported index knows where the file ends" ) {
+        auto* g = lfp_rp66_open(
+            lfp_memfile_openwith(bytes.data(), bytes.size())
+        );
+        REQUIRE(g);
+        err = lfp_index_import(g, blob.data(), blob.size());
+        CHECK(err == LFP_OK);
+
+        unsigned char x[10];
+        err = lfp_pread(g, x, sizeof(x), size - 1, &nread);
+        CHECK(err == LFP_EOF);
+        CHECK(nread == 1);
+        CHECK(x[0] == expected.back());
+
+        err = lfp_pread(g, x, sizeof(x), size, &nread);
+        CHECK(err == LFP_EOF);
+        CHECK(nread == 0);
+        lfp_close(g);
+    }
+
+    SECTION( "complete index for a larger file is rejected" ) {
+        auto extended = bytes;
+        extended.push_back(0x00);
+        auto* g = lfp_rp66_open(
+            lfp_memfile_openwith(extended.data(), extended.size())
+        );
+        REQUIRE(g);
+        err = lfp_index_import(g, blob.data(), blob.size());
+        CHECK(err == LFP_INVALID_ARGS);
+        lfp_close(g);
+    }
+
+    SECTION( "index for a different file is rejected" ) {
+        auto modified = bytes;
+        /* a broken format version in the first header */
+        modified[2] = 0xFE;
+        auto* g = lfp_rp66_open(
+            lfp_memfile_openwith(modified.data(), modified.size())
+        );
+        REQUIRE(g);
+        err = lfp_index_import(g, blob.data(), blob.size());
+        CHECK(err == LFP_INVALID_ARGS);
+        lfp_close(g);
+    }
+
+    SECTION( "index for a tape image is rejected" ) {
+        blob[6] = 'T';
+        auto* g = lfp_rp66_open(
+            lfp_memfile_openwith(bytes.data(), bytes.size())
+        );
+        REQUIRE(g);
+        err = lfp_index_import(g, blob.data(), blob.size());
+        CHECK(err == LFP_INVALID_ARGS);
+        lfp_close(g);
+    }
+}
+
+TEST_CASE_METHOD(
+    random_rp66,
+    "Visible envelope: build_index indexes the full file",
+    "[visible envelope][rp66][index]") {
+    const auto records = GENERATE(1, 2, 5, 13);
+    make(records);
+
+    /* start somewhere inside the file, which must be preserved */
+    const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(f, out.data(), n, &nread);
+    REQUIRE(err == LFP_OK);
+
+    std::int64_t indexed = -1;
+    std::int64_t logical = -1;
+    err = lfp_rp66_build_index(f, &indexed, &logical);
+    CHECK(err == LFP_OK);
+    CHECK(indexed == records);
+    CHECK(logical == size);
+
+    std::int64_t tell = -1;
+    lfp_tell(f, &tell);
+    CHECK(tell == n);
+
+    err = lfp_readinto(f, out.data() + n, size - n, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == size - n);
+    CHECK_THAT(out, Equals(expected));
+
+    err = lfp_seek(f, n);
+    CHECK(err == LFP_OK);
+    err = lfp_readinto(f, out.data(), size - n, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == size - n);
+}
+
+TEST_CASE(
+    "Visible envelope: build_index rejects other protocols",
+    "[visible envelope][rp66][index]") {
+    auto* f = lfp_memfile_open();
+    const auto err = lfp_rp66_build_index(f, nullptr, nullptr);
+    CHECK(err == LFP_INVALID_ARGS);
+    lfp_close(f);
+}
+
+TEST_CASE(
+    "Visible envelope: build_index reports truncated headers",
+    "[visible envelope][rp66][index]") {
+    const auto contents = std::vector< unsigned char > {
+        /* Visible Record 1 */
+        0x00, 0x08, 0xFF, 0x01,
+        0x01, 0x02, 0x03, 0x04,
+
+        /* incomplete header of Visible Record 2 */
+        0x00, 0x08,
+    };
+    auto* f = lfp_rp66_open(create_memfile_handle(contents));
+    REQUIRE(f);
+
+    const auto err = lfp_rp66_build_index(f, nullptr, nullptr);
+    CHECK(err == LFP_UNEXPECTED_EOF);
+
+    auto out = std::vector< unsigned char >(4);
+    std::int64_t nread = -1;
+    lfp_readinto(f, out.data(), out.size(), &nread);
+    CHECK(nread == 4);
+    CHECK(out == std::vector< unsigned char > { 0x01, 0x02, 0x03, 0x04 });
+
+    lfp_close(f);
+}
+
+TEST_CASE(
+    "Visible envelope: build_index reports the broken Visible Record",
+    "[visible envelope][rp66][index]") {
+    /*
+     * The Visible Records all fit in one batch, where most headers are
+     * indexed in bulk, which must not change which record is reported
+     */
+    bytes file;
+    for (int i = 0; i < 50; ++i)
+        file = file + visible_record(bytes(10, i));
+
+    const auto at = std::size_t(30 * 14);
+    std::string expected;
+    SECTION( "wrong format version" ) {
+        file[at + 2] = 0xFE;
+        expected = "Incorrect format version in Visible Record 31";
+    }
+    SECTION( "too short length" ) {
+        file[at + 1] = 3;
+        expected = "Too short record length in Visible Record 31";
+    }
+
+    auto* f = lfp_rp66_open(create_memfile_handle(file));
+    REQUIRE(f);
+
+    std::int64_t records = -1;
+    const auto err = lfp_rp66_build_index(f, &records, nullptr);
+    CHECK(err == LFP_PROTOCOL_FATAL_ERROR);
+    CHECK_THAT(lfp_errormsg(f), Contains(expected));
+
+    lfp_close(f);
+}
+
+TEST_CASE_METHOD(
+    random_rp66,
+    "Visible envelope: pread translates offsets through the index",
+    "[visible envelope][rp66][pread]") {
+    const auto records = GENERATE(1, 2, 5, 13);
+    make(records);
+
+    const auto offset = GENERATE_COPY(take(1, random(0, size - 1)));
+    const auto len = size - offset;
+    std::int64_t nread = -1;
+
+    SECTION( "offsets that are not indexed are rejected" ) {
+        auto err = lfp_pread(f, out.data(), len, offset, &nread);
+        CHECK(err == LFP_INVALID_ARGS);
+    }
+
+    SECTION( "indexed offsets can be read, without moving the position" ) {
+        auto err = lfp_rp66_build_index(f, nullptr, nullptr);
+        REQUIRE(err == LFP_OK);
+
+        err = lfp_pread(f, out.data(), len, offset, &nread);
+        CHECK(err == LFP_OK);
+        CHECK(nread == len);
+        CHECK(std::equal(out.begin(), out.begin() + len,
+                         expected.begin() + offset));
+
+        err = lfp_pread(f, out.data(), len + 1, offset, &nread);
+        CHECK(err == LFP_EOF);
+        CHECK(nread == len);
+
+        std::int64_t tell = -1;
+        lfp_tell(f, &tell);
+        CHECK(tell == 0);
+
+        err = lfp_readinto(f, out.data(), size, &nread);
+        CHECK(err == LFP_OK);
+        CHECK_THAT(out, Equals(expected));
+    }
+}
+
+TEST_CASE_METHOD(
+    random_rp66,
+    "Visible envelope: duplicates share the index, but have their own position",
+    "[visible envelope][rp66][dup]") {
+    const auto records = GENERATE(1, 2, 5, 13);
+    make(records);
+
+    const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(f, out.data(), n, &nread);
+    REQUIRE(err == LFP_OK);
+
+    lfp_protocol* dup = nullptr;
+    err = lfp_dup(f, &dup);
+    REQUIRE(err == LFP_OK);
+
+    auto fromdup = std::vector< unsigned char >(size, 0);
+    err = lfp_readinto(dup, fromdup.data() + n, size - n, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == size - n);
+
+    err = lfp_readinto(f, out.data() + n, size - n, &nread);
+    CHECK(err == LFP_OK);
+    CHECK_THAT(out, Equals(expected));
+
+    err = lfp_seek(dup, 0);
+    CHECK(err == LFP_OK);
+    err = lfp_readinto(dup, fromdup.data(), n, &nread);
+    CHECK(err == LFP_OK);
+    CHECK_THAT(fromdup, Equals(expected));
+
+    lfp_close(dup);
+}
+
+TEST_CASE_METHOD(
+    random_rp66,
+    "Visible Envelope: sequential reads parse headers and bodies in batches",
+    "[visible envelope][rp66][batch]") {
+    const auto records = GENERATE(2, 5, 13, 50);
+    make(records);
+
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(f, out.data(), size, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == size);
+    CHECK_THAT(out, Equals(expected));
+
+    unsigned char byte;
+    err = lfp_readinto(f, &byte, 1, &nread);
+    CHECK(err == LFP_EOF);
+    CHECK(nread == 0);
+
+    lfp_protocol* inner = nullptr;
+    err = lfp_peek(f, &inner);
+    REQUIRE(err == LFP_OK);
+
+    lfp_stats stats;
+    lfp_stats_get(inner, &stats);
+    /* reading headers and bodies one at a time needs two reads per record */
+    CHECK(stats.reads <= records + 1);
+    lfp_stats_get(f, &stats);
+    CHECK(stats.headers_read == records);
+}
+
+TEST_CASE_METHOD(
+    random_rp66,
+    "Visible Envelope: records can be iterated without reading them",
+    "[visible envelope][rp66][record]") {
+    const auto records = GENERATE(1, 2, 5, 13);
+    make(records);
+
+    std::vector< lfp_record > recs;
+    lfp_record rec;
+    while (lfp_record_next(f, &rec) == LFP_OK) {
+        std::int64_t tell = -1;
+        lfp_tell(f, &tell);
+        CHECK(tell == rec.offset);
+        recs.push_back(rec);
+    }
+
+    REQUIRE(recs.size() == std::size_t(records));
+    std::int64_t offset = 0;
+    std::int64_t header_offset = 0;
+    for (const auto& r : recs) {
+        CHECK(r.offset == offset);
+        CHECK(r.header_offset == header_offset);
+        CHECK(r.type == 0);
+        offset += r.length;
+        header_offset += r.length + 4;
+    }
+    CHECK(offset == size);
+
+    auto err = lfp_record_next(f, &rec);
+    CHECK(err == LFP_EOF);
+
+    SECTION( "records can be partially read before moving on" ) {
+        err = lfp_seek(f, 0);
+        REQUIRE(err == LFP_OK);
+
+        /* after the seek, the protocol is in the first record */
+        for (std::size_t i = 0; i < recs.size(); ++i) {
+            const auto& r = recs[i];
+            const auto n = (i % 2 == 0) ? r.length : r.length / 2;
+            /* empty reads move past empty records, so only read data */
+            if (n > 0) {
+                std::int64_t nread = -1;
+                err = lfp_readinto(f, out.data(), n, &nread);
+                CHECK(err == LFP_OK);
+                CHECK(nread == n);
+                CHECK(std::equal(out.begin(),
+                                 out.begin() + nread,
+                                 expected.begin() + r.offset));
+            }
+
+            err = lfp_record_next(f, &rec);
+            if (i + 1 < recs.size()) {
+                CHECK(err == LFP_OK);
+                CHECK(rec.offset == recs[i + 1].offset);
+            } else {
+                CHECK(err == LFP_EOF);
+            }
+        }
+    }
+}
+
+TEST_CASE_METHOD(
+    random_rp66,
+    "Visible Envelope: seeks find the record in files of one-byte records",
+    "[visible envelope][rp66][index]") {
+    make(int(size));
+
+    auto err = lfp_rp66_build_index(f, nullptr, nullptr);
+    REQUIRE(err == LFP_OK);
+
+    auto offsets = std::vector< std::int64_t >(size);
+    std::iota(offsets.begin(), offsets.end(), 0);
+    std::shuffle(offsets.begin(), offsets.end(), std::mt19937(size));
+
+    int mismatches = 0;
+    for (const auto n : offsets) {
+        unsigned char byte = 0;
+        std::int64_t nread = -1;
+        err = lfp_seek(f, n);
+        if (err == LFP_OK)
+            err = lfp_readinto(f, &byte, 1, &nread);
+        if (err != LFP_OK or nread != 1 or byte != expected[n])
+            mismatches += 1;
+    }
+    CHECK(mismatches == 0);
+}
+
+TEST_CASE(
+    "Visible Envelope: the index spans many blocks, also when duplicated",
+    "[visible envelope][rp66][index][dup]") {
+    const int records = 10000;
+    auto file = std::vector< unsigned char >();
+    auto expected = std::vector< unsigned char >();
+    for (int i = 0; i < records; ++i) {
+        const auto len = 1 + i % 7;
+        file.push_back(0x00);
+        file.push_back(std::uint8_t(len + 4));
+        file.push_back(0xFF);
+        file.push_back(0x01);
+        for (int k = 0; k < len; ++k) {
+            expected.push_back(std::uint8_t(i + k));
+            file.push_back(expected.back());
+        }
+    }
+
+    auto* f = lfp_rp66_open(lfp_memfile_openwith(file.data(), file.size()));
+    REQUIRE(f);
+
+    const auto half = std::int64_t(expected.size() / 2);
+    auto out = std::vector< unsigned char >(expected.size());
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(f, out.data(), half, &nread);
+    REQUIRE(err == LFP_OK);
+
+    lfp_protocol* dup = nullptr;
+    err = lfp_dup(f, &dup);
+    REQUIRE(err == LFP_OK);
+
+    const auto rest = std::int64_t(expected.size()) - half;
+    auto dupout = out;
+    err = lfp_readinto(dup, dupout.data() + half, rest, &nread);
+    CHECK(err == LFP_OK);
+    err = lfp_readinto(f, out.data() + half, rest, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(out == expected);
+    CHECK(dupout == expected);
+
+    std::int64_t size = -1;
+    err = lfp_rp66_build_index(f, nullptr, &size);
+    CHECK(err == LFP_OK);
+    CHECK(size == std::int64_t(expected.size()));
+
+    lfp_stats stats;
+    lfp_stats_get(f, &stats);
+    CHECK(stats.index_records == records);
+    CHECK(stats.index_bytes < records * 8);
+
+    auto rng = std::mt19937(records);
+    auto dist = std::uniform_int_distribution< std::int64_t >(
+        0, expected.size() - 1
+    );
+    int mismatches = 0;
+    for (int i = 0; i < 1000; ++i) {
+        const auto n = dist(rng);
+        for (auto* handle : { f, dup }) {
+            unsigned char byte = 0;
+            err = lfp_seek(handle, n);
+            if (err == LFP_OK)
+                err = lfp_readinto(handle, &byte, 1, &nread);
+            if (err != LFP_OK or nread != 1 or byte != expected[n])
+                mismatches += 1;
+        }
+    }
+    CHECK(mismatches == 0);
+
+    lfp_close(dup);
+    lfp_close(f);
+}
+
+TEST_CASE_METHOD(
+    random_rp66,
+    "rp66: seeks to the current position leave the underlying file alone",
+    "[rp66][seek][stats]") {
+    const auto records = GENERATE(1, 5, 13);
+    make(records);
+
+    /*
+     * Stop in the middle of the first record, as a seek to a record boundary
+     * moves past the header of the next record
+     */
+    const std::int64_t record_size = std::ceil(double(size) / records);
+    if (record_size < 2)
+        return;
+    const auto pos = record_size / 2;
+
+    auto err = lfp_rp66_build_index(f, nullptr, nullptr);
+    REQUIRE(err == LFP_OK);
+
+    lfp_protocol* inner = nullptr;
+    REQUIRE(lfp_peek(f, &inner) == LFP_OK);
+
+    std::int64_t nread = -1;
+    err = lfp_readinto(f, out.data(), pos, &nread);
+    REQUIRE(err == LFP_OK);
+    REQUIRE(nread == pos);
+
+    lfp_stats before;
+    lfp_stats_get(inner, &before);
+    for (int i = 0; i < 3; ++i) {
+        err = lfp_seek(f, pos);
+        REQUIRE(err == LFP_OK);
+    }
+    lfp_stats after;
+    lfp_stats_get(inner, &after);
+    CHECK(after.seeks == before.seeks);
+
+    lfp_stats_get(f, &after);
+    CHECK(after.seeks_in_record == 3);
+
+    err = lfp_readinto(f, out.data() + pos, size - pos, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == size - pos);
+    CHECK_THAT(out, Equals(expected));
+}
+
+TEST_CASE(
+    "Visible envelope: streams are read forwards without seeking, "
+    "in bounded memory",
+    "[rp66][stream]") {
+    bytes ve;
+    bytes expected;
+    for (int i = 0; i < 20000; ++i) {
+        const auto body = bytes(1 + i % 7, (unsigned char)(i));
+        ve = ve + visible_record(body);
+        expected = expected + body;
+    }
+
+    lfp_protocol* f = nullptr;
+    SECTION( "over a pipe" ) {
+        f = lfp_rp66_open_stream(open_pipe(ve));
+    }
+    SECTION( "over a tape image stream" ) {
+        std::vector< bytes > bodies;
+        for (std::size_t i = 0; i < ve.size(); i += 100) {
+            const auto end = (std::min)(i + 100, ve.size());
+            bodies.push_back(bytes(ve.begin() + i, ve.begin() + end));
+        }
+        auto* tif = lfp_tapeimage_open_stream(open_pipe(tapeimage(bodies)));
+        REQUIRE(tif);
+        f = lfp_rp66_open_stream(tif);
+    }
+    REQUIRE(f);
+
+    auto out = bytes(expected.size());
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(f, out.data(), 100, &nread);
+    CHECK(err == LFP_OK);
+
+    err = lfp_seek(f, 50);
+    CHECK(err == LFP_NOTSUPPORTED);
+    CHECK_THAT(lfp_errormsg(f), Contains("backwards"));
+    err = lfp_seek(f, 20000);
+    CHECK(err == LFP_OK);
+    std::int64_t tell = -1;
+    CHECK(lfp_tell(f, &tell) == LFP_OK);
+    CHECK(tell == 20000);
+
+    err = lfp_readinto(f, out.data() + 20000, out.size(), &nread);
+    CHECK(err == LFP_EOF);
+    CHECK(nread == std::int64_t(expected.size()) - 20000);
+    std::copy(expected.begin() + 100, expected.begin() + 20000,
+              out.begin() + 100);
+    CHECK_THAT(out, Equals(expected));
+
+    lfp_stats stats;
+    REQUIRE(lfp_stats_get(f, &stats) == LFP_OK);
+    CHECK(stats.index_records == 20000);
+    const auto stream_bytes = stats.index_bytes;
+
+    auto* whole = lfp_rp66_open(create_memfile_handle(ve));
+    REQUIRE(whole);
+    CHECK(lfp_rp66_build_index(whole, nullptr, nullptr) == LFP_OK);
+    REQUIRE(lfp_stats_get(whole, &stats) == LFP_OK);
+    CHECK(stream_bytes * 2 < stats.index_bytes);
+    lfp_close(whole);
+
+    auto buf = bytes(10);
+    CHECK(lfp_pread(f, buf.data(), 10, 0, &nread) == LFP_NOTSUPPORTED);
+    CHECK(lfp_rp66_build_index(f, nullptr, nullptr) == LFP_NOTSUPPORTED);
+    lfp_protocol* dup = nullptr;
+    CHECK(lfp_dup(f, &dup) == LFP_NOTSUPPORTED);
+
+    lfp_close(f);
+}
@@ -1,6 +1,10 @@
+#include <algorithm>
 #include <ciso646>
 #include <cstring>
 #include <memory>
+#include <numeric>
+#include <random>
+#include <thread>
 #include <vector>
 
 #include <catch2/catch.hpp>
@@ -195,6 +199,16 @@ TEST_CASE_METHOD(
     test_split_read(this);
 }
 
+TEST_CASE_METHOD(
+    random_tapeimage,
+    "Tape image: A file can be read with multiple buffers",
+    "[tapeimage][tif][readv]") {
+    const auto records = GENERATE(1, 2, 3, 5, 8, 13);
+    make(records);
+
+    test_split_readv(this);
+}
+
 TEST_CASE_METHOD(
     random_tapeimage,
     "Tape image: single seek matches underlying handle",
@@ -1817,4 +1831,1315 @@ TEST_CASE(
 
     lfp_close(tif);
 }
+
+namespace {
+
+/*
+ * A large, sparse file of zeros, with a few chunks of data at set offsets.
+ * Only the chunks take up memory, so files over 4GB can be emulated without
+ * allocating (or writing) them.
+ */
+class sparsefile : public lfp_protocol {
+public:
+    using chunk = std::pair< std::int64_t, std::vector< unsigned char > >;
+
+    sparsefile(std::int64_t size, std::vector< chunk > chunks) :
+        size(size),
+        chunks(std::move(chunks))
+    {}
+
+    void close() noexcept (true) override {}
+
+    lfp_status readinto(
+        void* dst,
+        std::int64_t len,
+        std::int64_t* bytes_read) noexcept (true) override {
+        const auto n = (std::min)(len, this->size - this->pos);
+        auto* out = static_cast< unsigned char* >(dst);
+        std::memset(out, 0, n);
+
+        for (const auto& c : this->chunks) {
+            const auto begin = (std::max)(c.first, this->pos);
+            const auto end = (std::min)(c.first + std::int64_t(c.second.size()),
+                                        this->pos + n);
+            if (begin < end)
+                std::memcpy(out + (begin - this->pos),
+                            c.second.data() + (begin - c.first),
+                            end - begin);
+        }
+
+        this->pos += n;
+        this->at_eof = n < len;
+        if (bytes_read) *bytes_read = n;
+        return this->at_eof ? LFP_EOF : LFP_OK;
+    }
+
+    int eof() const noexcept (true) override { return this->at_eof; }
+
+    void seek(std::int64_t n) noexcept (true) override {
+        this->pos = n;
+        this->at_eof = false;
+    }
+
+    std::int64_t tell() const noexcept (true) override { return this->pos; }
+    std::int64_t ptell() const noexcept (true) override { return this->pos; }
+
+    lfp_protocol* peel() noexcept (false) override {
+        throw lfp::not_supported("sparsefile: peel");
+    }
+
+    lfp_protocol* peek() const noexcept (false) override {
+        throw lfp::not_supported("sparsefile: peek");
+    }
+
+private:
+    std::int64_t size;
+    std::vector< chunk > chunks;
+    std::int64_t pos = 0;
+    bool at_eof = false;
+};
+
+std::vector< unsigned char > tifheader(std::uint32_t type,
+                                       std::int64_t prev,
+                                       std::int64_t next) {
+    std::vector< unsigned char > h;
+    for (const auto x : { std::uint32_t(type),
+                          std::uint32_t(prev),
+                          std::uint32_t(next) }) {
+        h.push_back(x >>  0);
+        h.push_back(x >>  8);
+        h.push_back(x >> 16);
+        h.push_back(x >> 24);
+    }
+    return h;
+}
+
+}
+
+TEST_CASE(
+    "Tape image: files over 4GB can be opened as large",
+    "[tapeimage][4GB][large]") {
+    constexpr const std::int64_t GB = 1024 * 1024 * 1024;
+    const auto data = std::vector< unsigned char > { 1, 2, 3, 4, 5, 6, 7, 8 };
+
+    /*
+     * Four records, where the second one crosses the 4GB boundary, and the
+     * last two (a record and the file mark) are entirely past it
+     */
+    const auto make = [&] {
+        return new sparsefile(5*GB + 112 + 12, {
+            { 0,            tifheader(0, 0,       3*GB) },
+            { 3*GB,         tifheader(0, 0,       5*GB) },
+            { 4*GB - 4,     data },
+            { 5*GB,         tifheader(0, 3*GB,    5*GB + 112) },
+            { 5*GB + 12,    data },
+            { 5*GB + 112,   tifheader(1, 5*GB,    5*GB + 124) },
+        });
+    };
+
+    /* the logical offsets of the data */
+    const auto crossing = 4*GB - 4 - 2 * 12;
+    const auto beyond   = 5*GB + 12 - 3 * 12;
+    const auto end      = 5*GB + 112 - 3 * 12;
+
+    std::vector< unsigned char > out(data.size());
+    std::int64_t nread = 0;
+
+    SECTION( "the wrapped headers are rejected by default" ) {
+        auto* tif = lfp_tapeimage_open(make());
+        REQUIRE(tif);
+        std::int64_t records = 0;
+        const auto err = lfp_tapeimage_build_index(tif, &records, nullptr);
+        CHECK(err == LFP_PROTOCOL_FATAL_ERROR);
+        CHECK_THAT(lfp_errormsg(tif), Contains("lfp_tapeimage_open_large"));
+        lfp_close(tif);
+    }
+
+    SECTION( "seeks and reads cross the 4GB boundary" ) {
+        auto* tif = lfp_tapeimage_open_large(make());
+        REQUIRE(tif);
+
+        auto err = lfp_seek(tif, beyond);
+        CHECK(err == LFP_OK);
+        err = lfp_readinto(tif, out.data(), out.size(), &nread);
+        CHECK(err == LFP_OK);
+        CHECK(out == data);
+
+        err = lfp_seek(tif, crossing);
+        CHECK(err == LFP_OK);
+        err = lfp_readinto(tif, out.data(), out.size(), &nread);
+        CHECK(err == LFP_OK);
+        CHECK(out == data);
+
+        std::int64_t tell = 0;
+        lfp_tell(tif, &tell);
+        CHECK(tell == crossing + std::int64_t(data.size()));
+
+        err = lfp_seek(tif, end - 1);
+        CHECK(err == LFP_OK);
+        err = lfp_readinto(tif, out.data(), out.size(), &nread);
+        CHECK(err == LFP_EOF);
+        CHECK(nread == 1);
+        lfp_close(tif);
+    }
+
+    SECTION( "the index can be built, exported and imported" ) {
+        auto* tif = lfp_tapeimage_open_large(make());
+        REQUIRE(tif);
+
+        std::int64_t records = 0;
+        std::int64_t size = 0;
+        auto err = lfp_tapeimage_build_index(tif, &records, &size);
+        CHECK(err == LFP_OK);
+        CHECK(records == 4);
+        CHECK(size == end);
+
+        std::int64_t len = 0;
+        err = lfp_index_export(tif, nullptr, 0, &len);
+        REQUIRE(err == LFP_OK);
+        std::vector< unsigned char > index(len);
+        err = lfp_index_export(tif, index.data(), len, &len);
+        REQUIRE(err == LFP_OK);
+        lfp_close(tif);
+
+        tif = lfp_tapeimage_open_large(make());
+        REQUIRE(tif);
+        err = lfp_index_import(tif, index.data(), len);
+        CHECK(err == LFP_OK);
+
+        err = lfp_seek(tif, crossing);
+        CHECK(err == LFP_OK);
+        err = lfp_readinto(tif, out.data(), out.size(), &nread);
+        CHECK(err == LFP_OK);
+        CHECK(out == data);
+
+        lfp_stats stats;
+        lfp_stats_get(tif, &stats);
+        CHECK(stats.headers_read == 0);
+        lfp_close(tif);
+    }
+}
+
+TEST_CASE(
+    "Tape image: the index stores headers as compactly as they are on disk",
+    "[tapeimage][tif][stats]") {
+    constexpr const int records = 10000;
+    const auto file = tapeimage(std::vector< bytes >(records, bytes(3, 1)));
+    auto* tif = lfp_tapeimage_open(create_memfile_handle(file));
+    REQUIRE(tif);
+    REQUIRE(lfp_tapeimage_build_index(tif, nullptr, nullptr) == LFP_OK);
+
+    /* 12 bytes per header, with room to grow */
+    lfp_stats stats;
+    lfp_stats_get(tif, &stats);
+    CHECK(stats.index_records == records + 1);
+    CHECK(stats.index_bytes >= stats.index_records * 12);
+    CHECK(stats.index_bytes < stats.index_records * 24);
+    lfp_close(tif);
+}
+
+TEST_CASE(
+    "Tape image: files that cross 4GB many times are indexed like any other",
+    "[tapeimage][4GB][large]") {
+    constexpr const std::int64_t GB = 1024 * 1024 * 1024;
+    constexpr const int records = 6;
+
+    /*
+     * Records of 3GB, so that most of them cross a 4GB boundary, with the
+     * record number at the start of the data
+     */
+    std::vector< sparsefile::chunk > chunks;
+    std::int64_t prev = 0;
+    std::int64_t at = 0;
+    for (int i = 0; i < records; ++i) {
+        const auto next = at + 12 + 3*GB;
+        chunks.push_back({ at, tifheader(0, prev, next) });
+        chunks.push_back({ at + 12, { (unsigned char)(i + 1) } });
+        prev = at;
+        at = next;
+    }
+    chunks.push_back({ at, tifheader(1, prev, at + 12) });
+    const auto make = [&] { return new sparsefile(at + 12, chunks); };
+
+    auto* tif = lfp_tapeimage_open_large(make());
+    REQUIRE(tif);
+
+    std::int64_t count = 0;
+    std::int64_t size = 0;
+    auto err = lfp_tapeimage_build_index(tif, &count, &size);
+    CHECK(err == LFP_OK);
+    CHECK(count == records + 1);
+    CHECK(size == records * 3*GB);
+
+    /* the index is as small as for any other file */
+    lfp_stats stats;
+    lfp_stats_get(tif, &stats);
+    CHECK(stats.index_bytes < 1024);
+
+    std::int64_t len = 0;
+    REQUIRE(lfp_index_export(tif, nullptr, 0, &len) == LFP_OK);
+    std::vector< unsigned char > index(len);
+    REQUIRE(lfp_index_export(tif, index.data(), len, &len) == LFP_OK);
+
+    auto* imported = lfp_tapeimage_open_large(make());
+    REQUIRE(imported);
+    REQUIRE(lfp_index_import(imported, index.data(), len) == LFP_OK);
+
+    for (auto* f : { tif, imported }) {
+        for (int i = records - 1; i >= 0; --i) {
+            INFO("record " << i);
+            unsigned char byte = 0;
+            std::int64_t nread = 0;
+            CHECK(lfp_seek(f, i * 3*GB) == LFP_OK);
+            CHECK(lfp_readinto(f, &byte, 1, &nread) == LFP_OK);
+            CHECK(byte == i + 1);
+        }
+    }
+
+    lfp_close(imported);
+    lfp_close(tif);
+}
 #endif
+
+TEST_CASE_METHOD(
+    random_tapeimage,
+    "Tape image: A file can be read with multiple readviews",
+    "[tapeimage][tif][readview]") {
+    const auto records = GENERATE(1, 2, 3, 5, 8, 13);
+    make(records);
+
+    const auto readsize = GENERATE_COPY(take(1, random(1, (size + 1) / 2)));
+    out.clear();
+    while (true) {
+        const void* view = nullptr;
+        std::int64_t nread = -1;
+        const auto err = lfp_readview(f, &view, readsize, &nread);
+        const auto* p = static_cast< const unsigned char* >(view);
+        out.insert(out.end(), p, p + nread);
+
+        if (err == LFP_EOF)
+            break;
+        REQUIRE(err == LFP_OK);
+        REQUIRE(nread == readsize);
+    }
+
+    CHECK_THAT(out, Equals(expected));
+}
+
+TEST_CASE(
+    "Tape image: readview inside a record borrows from the underlying handle",
+    "[tapeimage][tif][readview]") {
+    const auto contents = std::vector< unsigned char > {
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x14, 0x00, 0x00, 0x00,
+
+        0x01, 0x02, 0x03, 0x04,
+        0x05, 0x06, 0x07, 0x08,
+
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x24, 0x00, 0x00, 0x00,
+
+        0x09, 0x0A, 0x0B, 0x0C,
+
+        0x01, 0x00, 0x00, 0x00,
+        0x14, 0x00, 0x00, 0x00,
+        0x30, 0x00, 0x00, 0x00,
+    };
+
+    auto* mem = lfp_memfile_openview(contents.data(), contents.size());
+    auto* tif = lfp_tapeimage_open(mem);
+    REQUIRE(tif);
+
+    const void* view = nullptr;
+    std::int64_t nread = -1;
+    auto err = lfp_readview(tif, &view, 6, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == 6);
+    CHECK(view == contents.data() + 12);
+
+    /* crosses the record boundary, so must be copied */
+    err = lfp_readview(tif, &view, 4, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == 4);
+    const auto* p = static_cast< const unsigned char* >(view);
+    const auto spanning = std::vector< unsigned char >(p, p + nread);
+    CHECK_THAT(spanning, Equals(std::vector< unsigned char > {
+        0x07, 0x08, 0x09, 0x0A,
+    }));
+
+    err = lfp_readview(tif, &view, 2, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == 2);
+    CHECK(view == contents.data() + 34);
+
+    err = lfp_readview(tif, &view, 1, &nread);
+    CHECK(err == LFP_EOF);
+    CHECK(nread == 0);
+
+    lfp_close(tif);
+}
+
+TEST_CASE_METHOD(
+    random_tapeimage,
+    "Tape image: an exported index can be imported into a new handle",
+    "[tapeimage][tif][index]") {
+    const auto records = GENERATE(1, 2, 5, 13);
+    make(records);
+
+    /*
+     * Read past the end, so that every header, including the trailing file
+     * mark, is indexed
+     */
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(f, out.data(), out.size() + 1, &nread);
+    REQUIRE(err == LFP_EOF);
+
+    std::int64_t blobsize = -1;
+    err = lfp_index_export(f, nullptr, 0, &blobsize);
+    CHECK(err == LFP_OK);
+    CHECK(blobsize == 48 + 12 * (records + 1));
+
+    auto blob = std::vector< unsigned char >(blobsize);
+    err = lfp_index_export(f, blob.data(), blob.size() - 1, &blobsize);
+    CHECK(err == LFP_INVALID_ARGS);
+    err = lfp_index_export(f, blob.data(), blob.size(), &blobsize);
+    CHECK(err == LFP_OK);
+
+    SECTION( "the imported index can be seeked and read" ) {
+        auto* g = lfp_tapeimage_open(
+            lfp_memfile_openwith(tape.data(), tape.size())
+        );
+        REQUIRE(g);
+        err = lfp_index_import(g, blob.data(), blob.size());
+        CHECK(err == LFP_OK);
+
+        const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+        err = lfp_seek(g, n);
+        CHECK(err == LFP_OK);
+
+        std::int64_t tell = -1;
+        lfp_tell(g, &tell);
+        CHECK(tell == n);
+
+        out.assign(size - n, 0);
+        err = lfp_readinto(g, out.data(), out.size(), &nread);
+        CHECK(err == LFP_OK);
+        CHECK(nread == size - n);
+
+        const auto tail = std::vector< unsigned char >(
+            expected.begin() + n,
+            expected.end()
+        );
+        CHECK_THAT(out, Equals(tail));
+        lfp_close(g);
+    }
+
+    SECTION( "import after read is rejected" ) {
+        auto* g = lfp_tapeimage_open(
+            lfp_memfile_openwith(tape.data(), tape.size())
+        );
+        REQUIRE(g);
+        unsigned char x;
+        lfp_readinto(g, &x, 1, &nread);
+        err = lfp_index_import(g, blob.data(), blob.size());
+        CHECK(err == LFP_INVALID_ARGS);
+        lfp_close(g);
+    }
+
+    SECTION( "malformed index is rejected" ) {
+        auto* g = lfp_tapeimage_open(
+            lfp_memfile_openwith(tape.data(), tape.size())
+        );
+        REQUIRE(g);
+
+        err = lfp_index_import(g, blob.data(), blob.size() - 1);
+        CHECK(err == LFP_INVALID_ARGS);
+
+        auto garbage = blob;
+        garbage[0] = 'X';
+        err = lfp_index_import(g, garbage.data(), garbage.size());
+        CHECK(err == LFP_INVALID_ARGS);
+
+        /* the protocol is left unchanged, and still reads normally */
+        err = lfp_readinto(g, out.data(), out.size(), &nread);
+        CHECK(err == LFP_OK);
+        CHECK_THAT(out, Equals(expected));
+        lfp_close(g);
+    }
+
+    SECTION( "index for a different file is rejected" ) {
+        auto modified = tape;
+        /* the first record is still valid, but one byte of data shorter */
+        modified[8] -= 1;
+        auto* g = lfp_tapeimage_open(
+            lfp_memfile_openwith(modified.data(), modified.size())
+        );
+        REQUIRE(g);
+        err = lfp_index_import(g, blob.data(), blob.size());
+        CHECK(err == LFP_INVALID_ARGS);
+        lfp_close(g);
+    }
+
+    SECTION( "index for a larger file is rejected" ) {
+        auto* g = lfp_tapeimage_open(
+            lfp_memfile_openwith(tape.data(), tape.size() - 1)
+        );
+        REQUIRE(g);
+        err = lfp_index_import(g, blob.data(), blob.size());
+        CHECK(err == LFP_INVALID_ARGS);
+        lfp_close(g);
+    }
+}
+
+TEST_CASE(
+    "Tape image: an imported index without a file mark knows where the file ends",
+    "[tapeimage][tif][index]") {
+    auto file = tapeimage({ bytes(100, 0xAA), bytes(50, 0xBB) });
+    /* drop the trailing file mark */
+    file.resize(file.size() - 12);
+
+    auto* f = lfp_tapeimage_open(
+        lfp_memfile_openwith(file.data(), file.size())
+    );
+    REQUIRE(f);
+    auto err = lfp_tapeimage_build_index(f, nullptr, nullptr);
+    REQUIRE(err == LFP_OK);
+
+    std::int64_t blobsize = -1;
+    err = lfp_index_export(f, nullptr, 0, &blobsize);
+    REQUIRE(err == LFP_OK);
+    auto blob = std::vector< unsigned char >(blobsize);
+    err = lfp_index_export(f, blob.data(), blob.size(), &blobsize);
+    REQUIRE(err == LFP_OK);
+    lfp_close(f);
+
+    SECTION( "pread at the end reports end-of-file" ) {
+        auto* g = lfp_tapeimage_open(
+            lfp_memfile_openwith(file.data(), file.size())
+        );
+        REQUIRE(g);
+        err = lfp_index_import(g, blob.data(), blob.size());
+        CHECK(err == LFP_OK);
+
+        unsigned char x[10];
+        std::int64_t nread = -1;
+        err = lfp_pread(g, x, sizeof(x), 149, &nread);
+        CHECK(err == LFP_EOF);
+        CHECK(nread == 1);
+        CHECK(x[0] == 0xBB);
+
+        err = lfp_pread(g, x, sizeof(x), 150, &nread);
+        CHECK(err == LFP_EOF);
+        CHECK(nread == 0);
+        lfp_close(g);
+    }
+
+    SECTION( "a file that has grown since is rejected" ) {
+        auto grown = file;
+        grown.push_back(0x00);
+        auto* g = lfp_tapeimage_open(
+            lfp_memfile_openwith(grown.data(), grown.size())
+        );
+        REQUIRE(g);
+        err = lfp_index_import(g, blob.data(), blob.size());
+        CHECK(err == LFP_INVALID_ARGS);
+        lfp_close(g);
+    }
+}
+
+TEST_CASE_METHOD(
+    random_tapeimage,
+    "Tape image: build_index indexes the full file",
+    "[tapeimage][tif][index]") {
+    const auto records = GENERATE(1, 2, 5, 13);
+    make(records);
+
+    /* start somewhere inside the file, which must be preserved */
+    const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(f, out.data(), n, &nread);
+    REQUIRE(err == LFP_OK);
+
+    std::int64_t indexed = -1;
+    std::int64_t logical = -1;
+    err = lfp_tapeimage_build_index(f, &indexed, &logical);
+    CHECK(err == LFP_OK);
+    CHECK(indexed == records + 1);
+    CHECK(logical == size);
+
+    std::int64_t tell = -1;
+    lfp_tell(f, &tell);
+    CHECK(tell == n);
+
+    err = lfp_readinto(f, out.data() + n, size - n, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == size - n);
+    CHECK_THAT(out, Equals(expected));
+
+    SECTION( "building the index again is a no-op" ) {
+        err = lfp_tapeimage_build_index(f, &indexed, nullptr);
+        CHECK(err == LFP_OK);
+        CHECK(indexed == records + 1);
+    }
+}
+
+TEST_CASE(
+    "Tape image: build_index reads headers across batches",
+    "[tapeimage][tif][index]") {
+    /*
+     * Many small records, so that headers straddle the batch boundaries, and
+     * a few large ones, so that some headers are not in a batch at all
+     */
+    auto sizes = std::vector< std::uint32_t >(20000, 7);
+    sizes[100] = 100000;
+    sizes[101] = 70000;
+    sizes.push_back(0);
+
+    std::vector< unsigned char > file;
+    std::vector< unsigned char > data;
+    std::uint32_t prev = 0;
+    for (std::size_t i = 0; i < sizes.size(); ++i) {
+        const std::uint32_t type = i + 1 == sizes.size() ? 1 : 0;
+        const std::uint32_t next = file.size() + 12 + sizes[i];
+        unsigned char head[12];
+        std::memcpy(head + 0, &type, 4);
+        std::memcpy(head + 4, &prev, 4);
+        std::memcpy(head + 8, &next, 4);
+        #if (defined(IS_BIG_ENDIAN) || \
+            (defined(__BYTE_ORDER__) && \
+            (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)))
+            std::reverse(head + 0, head + 4);
+            std::reverse(head + 4, head + 8);
+            std::reverse(head + 8, head + 12);
+        #endif
+        prev = file.size();
+        file.insert(file.end(), head, head + 12);
+        for (std::uint32_t k = 0; k < sizes[i]; ++k) {
+            data.push_back(static_cast< unsigned char >(i + k));
+            file.push_back(data.back());
+        }
+    }
+
+    auto* f = lfp_tapeimage_open(create_cfile_handle(file));
+    REQUIRE(f);
+
+    std::int64_t records = -1;
+    std::int64_t size = -1;
+    auto err = lfp_tapeimage_build_index(f, &records, &size);
+    CHECK(err == LFP_OK);
+    CHECK(records == std::int64_t(sizes.size()));
+    CHECK(size == std::int64_t(data.size()));
+
+    const auto n = GENERATE_COPY(take(5, random(0, int(data.size()) - 1)));
+    err = lfp_seek(f, n);
+    CHECK(err == LFP_OK);
+
+    auto out = std::vector< unsigned char >(data.size() - n);
+    std::int64_t nread = -1;
+    err = lfp_readinto(f, out.data(), out.size(), &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == std::int64_t(out.size()));
+    CHECK(std::equal(out.begin(), out.end(), data.begin() + n));
+
+    lfp_close(f);
+}
+
+TEST_CASE(
+    "Tape image: build_index reports broken headers like reading does",
+    "[tapeimage][tif][index]") {
+    /*
+     * Records that all fit in one batch, where most headers are indexed in
+     * bulk. Breaking a header in the middle must give the same errors, and
+     * recovery, as when the headers are read one at a time.
+     */
+    std::vector< bytes > bodies;
+    bytes data;
+    for (int i = 0; i < 50; ++i) {
+        bodies.push_back(bytes(7, i));
+        data = data + bodies.back();
+    }
+    const auto pristine = tapeimage(bodies);
+    const auto at = [](int record, int field) {
+        return std::size_t(record * (12 + 7) + field * 4);
+    };
+
+    auto file = pristine;
+    SECTION( "broken back pointer" ) {
+        file[at(30, 1)] += 1;
+    }
+    SECTION( "unknown record type" ) {
+        file[at(30, 0)] = 5;
+    }
+    SECTION( "next before the header" ) {
+        file[at(30, 2)] = 0;
+        file[at(30, 2) + 1] = 0;
+    }
+    SECTION( "a second error in recovery" ) {
+        file[at(20, 1)] += 1;
+        file[at(40, 0)] = 5;
+    }
+
+    const auto read_all = [&](lfp_protocol* f, bytes& out) {
+        out = bytes(data.size() + 1);
+        std::int64_t nread = 0;
+        const auto err = lfp_readinto(f, out.data(), out.size(), &nread);
+        out.resize(nread);
+        return err;
+    };
+
+    auto* seq = lfp_tapeimage_open(create_memfile_handle(file));
+    REQUIRE(seq);
+    bytes expected;
+    const auto read_err = read_all(seq, expected);
+    const auto read_msg = std::string(lfp_errormsg(seq));
+    CHECK(read_err != LFP_OK);
+
+    auto* f = lfp_tapeimage_open(create_memfile_handle(file));
+    REQUIRE(f);
+    auto err = lfp_tapeimage_build_index(f, nullptr, nullptr);
+    bytes out;
+    if (err == LFP_OK)
+        err = read_all(f, out);
+    CHECK(err == read_err);
+    CHECK(std::string(lfp_errormsg(f)) == read_msg);
+    if (err == LFP_PROTOCOL_TRYRECOVERY)
+        CHECK_THAT(out, Equals(expected));
+
+    lfp_close(seq);
+    lfp_close(f);
+}
+
+TEST_CASE(
+    "Tape image: build_index rejects other protocols",
+    "[tapeimage][tif][index]") {
+    auto* f = lfp_memfile_open();
+    std::int64_t records = -1;
+    const auto err = lfp_tapeimage_build_index(f, &records, nullptr);
+    CHECK(err == LFP_INVALID_ARGS);
+    CHECK(records == -1);
+    lfp_close(f);
+}
+
+TEST_CASE_METHOD(
+    random_tapeimage,
+    "Tape image: pread translates offsets through the index",
+    "[tapeimage][tif][pread]") {
+    const auto records = GENERATE(1, 2, 5, 13);
+    make(records);
+
+    const auto offset = GENERATE_COPY(take(1, random(0, size - 1)));
+    const auto len = size - offset;
+    std::int64_t nread = -1;
+
+    SECTION( "offsets that are not indexed are rejected" ) {
+        auto err = lfp_pread(f, out.data(), len, offset, &nread);
+        CHECK(err == LFP_INVALID_ARGS);
+        CHECK_THAT(lfp_errormsg(f), Contains("not indexed"));
+    }
+
+    SECTION( "indexed offsets can be read, without moving the position" ) {
+        auto err = lfp_tapeimage_build_index(f, nullptr, nullptr);
+        REQUIRE(err == LFP_OK);
+
+        err = lfp_pread(f, out.data(), len, offset, &nread);
+        CHECK(err == LFP_OK);
+        CHECK(nread == len);
+        CHECK(std::equal(out.begin(), out.begin() + len,
+                         expected.begin() + offset));
+
+        err = lfp_pread(f, out.data(), len + 1, offset, &nread);
+        CHECK(err == LFP_EOF);
+        CHECK(nread == len);
+
+        err = lfp_pread(f, out.data(), 1, size, &nread);
+        CHECK(err == LFP_EOF);
+        CHECK(nread == 0);
+
+        std::int64_t tell = -1;
+        lfp_tell(f, &tell);
+        CHECK(tell == 0);
+        CHECK(not lfp_eof(f));
+
+        err = lfp_readinto(f, out.data(), size, &nread);
+        CHECK(err == LFP_OK);
+        CHECK_THAT(out, Equals(expected));
+    }
+}
+
+TEST_CASE_METHOD(
+    random_tapeimage,
+    "Tape image: pread can be called from multiple threads",
+    "[tapeimage][tif][pread]") {
+    make(7);
+    auto err = lfp_tapeimage_build_index(f, nullptr, nullptr);
+    REQUIRE(err == LFP_OK);
+
+    const auto nthreads = 4;
+    auto mismatches = std::vector< int >(nthreads, 0);
+    auto threads = std::vector< std::thread >();
+    for (int t = 0; t < nthreads; ++t) {
+        threads.emplace_back([this, t, &mismatches] {
+            auto rng = std::mt19937(t);
+            auto dist = std::uniform_int_distribution< int >(0, size - 1);
+            auto buffer = std::vector< unsigned char >(size);
+            for (int i = 0; i < 200; ++i) {
+                const auto offset = dist(rng);
+                const auto len = size - offset;
+                std::int64_t nread = -1;
+                const auto err = lfp_pread(f, buffer.data(), len, offset, &nread);
+                const auto ok = err == LFP_OK and nread == len
+                    and std::equal(buffer.begin(), buffer.begin() + len,
+                                   expected.begin() + offset);
+                if (not ok)
+                    mismatches[t] += 1;
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    CHECK(mismatches == std::vector< int >(nthreads, 0));
+}
+
+TEST_CASE_METHOD(
+    random_tapeimage,
+    "Tape image: duplicates share the index, but have their own position",
+    "[tapeimage][tif][dup]") {
+    const auto records = GENERATE(1, 2, 5, 13);
+    make(records);
+
+    /* only index part of the file before duplicating */
+    const auto n = GENERATE_COPY(take(1, random(0, size - 1)));
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(f, out.data(), n, &nread);
+    REQUIRE(err == LFP_OK);
+
+    lfp_protocol* dup = nullptr;
+    err = lfp_dup(f, &dup);
+    REQUIRE(err == LFP_OK);
+
+    std::int64_t tell = -1;
+    lfp_tell(dup, &tell);
+    CHECK(tell == n);
+
+    /*
+     * Both handles discover the rest of the file on their own, which must
+     * not disturb the other
+     */
+    auto fromdup = std::vector< unsigned char >(size, 0);
+    err = lfp_readinto(dup, fromdup.data() + n, size - n, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == size - n);
+
+    err = lfp_readinto(f, out.data() + n, size - n, &nread);
+    CHECK(err == LFP_OK);
+    CHECK_THAT(out, Equals(expected));
+
+    err = lfp_seek(dup, 0);
+    CHECK(err == LFP_OK);
+    err = lfp_readinto(dup, fromdup.data(), n, &nread);
+    CHECK(err == LFP_OK);
+    CHECK_THAT(fromdup, Equals(expected));
+
+    SECTION( "the duplicate outlives the original" ) {
+        lfp_close(f);
+        f = nullptr;
+
+        err = lfp_seek(dup, n);
+        CHECK(err == LFP_OK);
+        err = lfp_readinto(dup, fromdup.data(), size - n, &nread);
+        CHECK(err == LFP_OK);
+        CHECK(std::equal(fromdup.begin(), fromdup.begin() + nread,
+                         expected.begin() + n));
+    }
+
+    lfp_close(dup);
+}
+
+TEST_CASE(
+    "Tape image: duplicates can be read from multiple threads",
+    "[tapeimage][tif][dup]") {
+    auto sizes = std::vector< std::uint32_t >(500, 37);
+    sizes.push_back(0);
+
+    std::vector< unsigned char > file;
+    std::vector< unsigned char > data;
+    std::uint32_t prev = 0;
+    for (std::size_t i = 0; i < sizes.size(); ++i) {
+        const std::uint32_t type = i + 1 == sizes.size() ? 1 : 0;
+        const std::uint32_t next = file.size() + 12 + sizes[i];
+        unsigned char head[12];
+        std::memcpy(head + 0, &type, 4);
+        std::memcpy(head + 4, &prev, 4);
+        std::memcpy(head + 8, &next, 4);
+        #if (defined(IS_BIG_ENDIAN) || \
+            (defined(__BYTE_ORDER__) && \
+            (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)))
+            std::reverse(head + 0, head + 4);
+            std::reverse(head + 4, head + 8);
+            std::reverse(head + 8, head + 12);
+        #endif
+        prev = file.size();
+        file.insert(file.end(), head, head + 12);
+        for (std::uint32_t k = 0; k < sizes[i]; ++k) {
+            data.push_back(static_cast< unsigned char >(i * 3 + k));
+            file.push_back(data.back());
+        }
+    }
+
+    auto* f = lfp_tapeimage_open(create_cfile_handle(file));
+    REQUIRE(f);
+    auto err = lfp_tapeimage_build_index(f, nullptr, nullptr);
+    REQUIRE(err == LFP_OK);
+
+    const auto nthreads = 4;
+    auto dups = std::vector< lfp_protocol* >(nthreads, nullptr);
+    for (auto& dup : dups) {
+        err = lfp_dup(f, &dup);
+        REQUIRE(err == LFP_OK);
+    }
+
+    const auto size = int(data.size());
+    auto mismatches = std::vector< int >(nthreads, 0);
+    auto threads = std::vector< std::thread >();
+    for (int t = 0; t < nthreads; ++t) {
+        threads.emplace_back([t, size, &dups, &data, &mismatches] {
+            auto rng = std::mt19937(t);
+            auto dist = std::uniform_int_distribution< int >(0, size - 1);
+            auto buffer = std::vector< unsigned char >(100);
+            for (int i = 0; i < 200; ++i) {
+                const auto offset = dist(rng);
+                const auto len = (std::min)(100, size - offset);
+                std::int64_t nread = -1;
+                auto err = lfp_seek(dups[t], offset);
+                if (err == LFP_OK)
+                    err = lfp_readinto(dups[t], buffer.data(), len, &nread);
+                const auto ok = err == LFP_OK and nread == len
+                    and std::equal(buffer.begin(), buffer.begin() + len,
+                                   data.begin() + offset);
+                if (not ok)
+                    mismatches[t] += 1;
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    CHECK(mismatches == std::vector< int >(nthreads, 0));
+
+    for (auto* dup : dups)
+        CHECK(lfp_close(dup) == LFP_OK);
+    lfp_close(f);
+}
+
+TEST_CASE_METHOD(
+    random_tapeimage,
+    "Tape image: stats tell how seeks were resolved",
+    "[tapeimage][tif][stats]") {
+    const auto records = GENERATE(2, 5, 13);
+    make(records);
+
+    lfp_stats stats;
+    auto err = lfp_seek(f, size - 1);
+    REQUIRE(err == LFP_OK);
+    lfp_stats_get(f, &stats);
+    CHECK(stats.seeks == 1);
+    CHECK(stats.seeks_chased == 1);
+    CHECK(stats.headers_read > 0);
+    CHECK(stats.headers_read <= records);
+    CHECK(stats.index_records == stats.headers_read);
+    CHECK(stats.index_bytes >= stats.index_records * 12);
+
+    err = lfp_seek(f, 0);
+    REQUIRE(err == LFP_OK);
+    err = lfp_seek(f, 0);
+    REQUIRE(err == LFP_OK);
+    lfp_stats_get(f, &stats);
+    CHECK(stats.seeks == 3);
+    /* the first seek(0) is only in the same record for one-byte files */
+    CHECK(stats.seeks_indexed + stats.seeks_in_record == 2);
+    CHECK(stats.seeks_in_record >= 1);
+    CHECK(stats.seeks_chased == 1);
+
+    std::int64_t nread = -1;
+    err = lfp_readinto(f, out.data(), size, &nread);
+    REQUIRE(err == LFP_OK);
+
+    err = lfp_tapeimage_build_index(f, nullptr, nullptr);
+    REQUIRE(err == LFP_OK);
+
+    lfp_stats_get(f, &stats);
+    CHECK(stats.reads == 1);
+    CHECK(stats.bytes_read == size);
+    CHECK(stats.headers_read == records + 1);
+    CHECK(stats.index_records == records + 1);
+
+    SECTION( "the underlying protocol has stats of its own" ) {
+        lfp_protocol* inner = nullptr;
+        err = lfp_peek(f, &inner);
+        REQUIRE(err == LFP_OK);
+
+        lfp_stats inner_stats;
+        lfp_stats_get(inner, &inner_stats);
+        CHECK(inner_stats.reads >= records + 1);
+        CHECK(inner_stats.bytes_read >= size + (records + 1) * 12);
+        CHECK(inner_stats.seeks >= 1);
+        CHECK(inner_stats.index_records == 0);
+        CHECK(inner_stats.time_ns == stats.inner_time_ns);
+    }
+
+    SECTION( "resetting keeps the index size" ) {
+        err = lfp_stats_reset(f);
+        REQUIRE(err == LFP_OK);
+        lfp_stats_get(f, &stats);
+        CHECK(stats.reads == 0);
+        CHECK(stats.seeks == 0);
+        CHECK(stats.headers_read == 0);
+        CHECK(stats.index_records == records + 1);
+    }
+}
+
+TEST_CASE_METHOD(
+    random_tapeimage,
+    "Tape image: sequential reads parse headers and bodies in batches",
+    "[tapeimage][tif][batch]") {
+    const auto records = GENERATE(2, 5, 13, 50);
+    make(records);
+
+    /*
+     * Put a second file after the file mark, to check that reading does not
+     * leave the underlying file past the first one
+     */
+    auto twofiles = tape;
+    twofiles.insert(twofiles.end(), tape.begin(), tape.end());
+    auto* inner = lfp_memfile_openwith(twofiles.data(), twofiles.size());
+    REQUIRE(inner);
+    auto* tif = lfp_tapeimage_open(inner);
+    REQUIRE(tif);
+
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(tif, out.data(), size, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == size);
+    CHECK_THAT(out, Equals(expected));
+
+    unsigned char byte;
+    err = lfp_readinto(tif, &byte, 1, &nread);
+    CHECK(err == LFP_EOF);
+    CHECK(nread == 0);
+
+    std::int64_t tell = -1;
+    lfp_tell(inner, &tell);
+    CHECK(tell == std::int64_t(tape.size()));
+
+    lfp_stats stats;
+    lfp_stats_get(inner, &stats);
+    /* reading headers and bodies one at a time needs two reads per record */
+    CHECK(stats.reads <= records + 1);
+    lfp_stats_get(tif, &stats);
+    CHECK(stats.headers_read == records + 1);
+
+    lfp_close(tif);
+}
+
+TEST_CASE_METHOD(
+    random_tapeimage,
+    "Tape image: records can be iterated without reading them",
+    "[tapeimage][tif][record]") {
+    const auto records = GENERATE(1, 2, 5, 13);
+    make(records);
+
+    std::vector< lfp_record > recs;
+    lfp_record rec;
+    while (lfp_record_next(f, &rec) == LFP_OK) {
+        std::int64_t tell = -1;
+        lfp_tell(f, &tell);
+        CHECK(tell == rec.offset);
+        recs.push_back(rec);
+    }
+
+    REQUIRE(recs.size() == std::size_t(records + 1));
+    std::int64_t offset = 0;
+    std::int64_t header_offset = 0;
+    for (const auto& r : recs) {
+        CHECK(r.offset == offset);
+        CHECK(r.header_offset == header_offset);
+        offset += r.length;
+        header_offset += r.length + 12;
+    }
+    CHECK(offset == size);
+    CHECK(recs.back().type == 1);
+    CHECK(recs.back().length == 0);
+    CHECK(recs.front().type == 0);
+
+    auto err = lfp_record_next(f, &rec);
+    CHECK(err == LFP_EOF);
+
+    lfp_protocol* inner = nullptr;
+    err = lfp_peek(f, &inner);
+    REQUIRE(err == LFP_OK);
+    /* only the headers, and at most 12 bytes at the end of records, are read */
+    lfp_stats stats;
+    lfp_stats_get(inner, &stats);
+    CHECK(stats.bytes_read <= (records + 1) * (12 + 12));
+
+    SECTION( "records can be partially read before moving on" ) {
+        err = lfp_seek(f, 0);
+        REQUIRE(err == LFP_OK);
+
+        /* after the seek, the protocol is in the first record */
+        for (std::size_t i = 0; i < recs.size(); ++i) {
+            const auto& r = recs[i];
+            const auto n = (i % 2 == 0) ? r.length : r.length / 2;
+            /* empty reads move past empty records, so only read data */
+            if (n > 0) {
+                std::int64_t nread = -1;
+                err = lfp_readinto(f, out.data(), n, &nread);
+                CHECK(err == LFP_OK);
+                CHECK(nread == n);
+                CHECK(std::equal(out.begin(),
+                                 out.begin() + nread,
+                                 expected.begin() + r.offset));
+            }
+
+            err = lfp_record_next(f, &rec);
+            if (i + 1 < recs.size()) {
+                CHECK(err == LFP_OK);
+                CHECK(rec.offset == recs[i + 1].offset);
+            } else {
+                CHECK(err == LFP_EOF);
+            }
+        }
+    }
+}
+
+TEST_CASE_METHOD(
+    random_tapeimage,
+    "Tape image: seeks find the record in files of one-byte records",
+    "[tapeimage][tif][index]") {
+    make(int(size));
+
+    auto err = lfp_tapeimage_build_index(f, nullptr, nullptr);
+    REQUIRE(err == LFP_OK);
+
+    auto offsets = std::vector< std::int64_t >(size);
+    std::iota(offsets.begin(), offsets.end(), 0);
+    std::shuffle(offsets.begin(), offsets.end(), std::mt19937(size));
+
+    int mismatches = 0;
+    for (const auto n : offsets) {
+        unsigned char byte = 0;
+        std::int64_t nread = -1;
+        err = lfp_seek(f, n);
+        if (err == LFP_OK)
+            err = lfp_readinto(f, &byte, 1, &nread);
+        if (err != LFP_OK or nread != 1 or byte != expected[n])
+            mismatches += 1;
+    }
+    CHECK(mismatches == 0);
+}
+
+TEST_CASE(
+    "Tape image: logical files can be found and opened directly",
+    "[tapeimage][tif][files]") {
+    constexpr const int files = 10;
+    std::vector< unsigned char > tape;
+    std::vector< std::int64_t > starts;
+    std::int64_t prev = 0;
+
+    const auto append = [&](std::uint32_t type, std::int64_t len) {
+        const auto next = std::int64_t(tape.size()) + 12 + len;
+        const auto head = tifheader(type, prev, next);
+        prev = tape.size();
+        tape.insert(tape.end(), head.begin(), head.end());
+    };
+
+    /*
+     * File i has i + 1 records of 10 bytes, all with the value i. The tape
+     * either ends with two file marks, with one, or the last file runs to
+     * end-of-file without a file mark.
+     */
+    const int marks = GENERATE(2, 1, 0);
+    for (int i = 0; i < files; ++i) {
+        starts.push_back(tape.size());
+        for (int k = 0; k < i + 1; ++k) {
+            append(0, 10);
+            tape.insert(tape.end(), 10, (unsigned char)(i));
+        }
+        if (i + 1 < files or marks > 0)
+            append(1, 0);
+    }
+    if (marks > 1)
+        append(1, 0);
+
+    auto* mem = lfp_memfile_openwith(tape.data(), tape.size());
+    REQUIRE(mem);
+
+    std::int64_t count = -1;
+    auto err = lfp_tapeimage_files(mem, nullptr, 0, &count);
+    REQUIRE(err == LFP_OK);
+    CHECK(count == files);
+
+    auto offsets = std::vector< std::int64_t >(files + 1, -1);
+    err = lfp_tapeimage_files(mem, offsets.data(), 4, nullptr);
+    REQUIRE(err == LFP_OK);
+    CHECK_THAT(
+        std::vector< std::int64_t >(offsets.begin(), offsets.begin() + 4),
+        Equals(std::vector< std::int64_t >(starts.begin(), starts.begin() + 4))
+    );
+    CHECK(offsets[4] == -1);
+
+    err = lfp_tapeimage_files(mem, offsets.data(), offsets.size(), &count);
+    REQUIRE(err == LFP_OK);
+    offsets.resize(count);
+    CHECK_THAT(offsets, Equals(starts));
+
+    std::int64_t tell = -1;
+    lfp_tell(mem, &tell);
+    CHECK(tell == 0);
+
+    auto* missing = lfp_tapeimage_open_file(mem, files);
+    CHECK(not missing);
+    lfp_tell(mem, &tell);
+    CHECK(tell == 0);
+
+    const int file = GENERATE(0, 1, files - 2, files - 1);
+    auto* tif = lfp_tapeimage_open_file(mem, file);
+    REQUIRE(tif);
+
+    const auto expected = std::vector< unsigned char >(10 * (file + 1), file);
+    auto out = std::vector< unsigned char >(expected.size() + 10, 0xFF);
+    std::int64_t bytes_read = -1;
+    err = lfp_readinto(tif, out.data(), out.size(), &bytes_read);
+    CHECK(err == LFP_EOF);
+    REQUIRE(bytes_read == std::int64_t(expected.size()));
+    out.resize(bytes_read);
+    CHECK_THAT(out, Equals(expected));
+
+    lfp_close(tif);
+}
+
+TEST_CASE_METHOD(
+    random_tapeimage,
+    "Tape image: seeks to the current position leave the underlying file alone",
+    "[tapeimage][tif][seek][stats]") {
+    const auto records = GENERATE(1, 5, 13);
+    make(records);
+
+    /*
+     * Stop in the middle of the first record, as a seek to a record boundary
+     * moves past the header of the next record
+     */
+    const std::int64_t record_size = std::ceil(double(size) / records);
+    if (record_size < 2)
+        return;
+    const auto pos = record_size / 2;
+
+    auto err = lfp_tapeimage_build_index(f, nullptr, nullptr);
+    REQUIRE(err == LFP_OK);
+
+    lfp_protocol* inner = nullptr;
+    REQUIRE(lfp_peek(f, &inner) == LFP_OK);
+
+    std::int64_t nread = -1;
+    err = lfp_readinto(f, out.data(), pos, &nread);
+    REQUIRE(err == LFP_OK);
+    REQUIRE(nread == pos);
+
+    lfp_stats before;
+    lfp_stats_get(inner, &before);
+    for (int i = 0; i < 3; ++i) {
+        err = lfp_seek(f, pos);
+        REQUIRE(err == LFP_OK);
+    }
+    lfp_stats after;
+    lfp_stats_get(inner, &after);
+    CHECK(after.seeks == before.seeks);
+
+    lfp_stats_get(f, &after);
+    CHECK(after.seeks_in_record == 3);
+
+    err = lfp_readinto(f, out.data() + pos, size - pos, &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == size - pos);
+    CHECK_THAT(out, Equals(expected));
+}
+
+TEST_CASE(
+    "Tape image: streams are read forwards without seeking, in bounded memory",
+    "[tapeimage][tif][stream]") {
+    std::vector< bytes > records;
+    bytes expected;
+    for (int i = 0; i < 5000; ++i) {
+        records.push_back(bytes(1 + i % 13, (unsigned char)(i)));
+        expected = expected + records.back();
+    }
+    auto file = tapeimage(records);
+
+    bool recovers = false;
+    SECTION( "intact file" ) {}
+    SECTION( "file read in recovery" ) {
+        /* break the back pointer of the tenth record */
+        std::int64_t at = 0;
+        for (int i = 0; i < 9; ++i)
+            at += 12 + records[i].size();
+        file[at + 4] += 1;
+        recovers = true;
+    }
+
+    auto* tif = lfp_tapeimage_open_stream(open_pipe(file));
+    REQUIRE(tif);
+
+    auto out = bytes(expected.size());
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(tif, out.data(), 100, &nread);
+    CHECK(err == (recovers ? LFP_PROTOCOL_TRYRECOVERY : LFP_OK));
+    CHECK(nread == 100);
+    CHECK(bool(lfp_errormsg(tif)) == recovers);
+
+    /* forwards is read, backwards is not supported */
+    err = lfp_seek(tif, 50);
+    CHECK(err == LFP_NOTSUPPORTED);
+    CHECK_THAT(lfp_errormsg(tif), Contains("backwards"));
+    err = lfp_seek(tif, 1000);
+    CHECK(err == LFP_OK);
+    std::int64_t tell = -1;
+    CHECK(lfp_tell(tif, &tell) == LFP_OK);
+    CHECK(tell == 1000);
+
+    err = lfp_readinto(tif, out.data() + 1000, out.size(), &nread);
+    CHECK(err == (recovers ? LFP_PROTOCOL_TRYRECOVERY : LFP_EOF));
+    CHECK(nread == std::int64_t(expected.size()) - 1000);
+    std::copy(expected.begin() + 100, expected.begin() + 1000,
+              out.begin() + 100);
+    CHECK_THAT(out, Equals(expected));
+
+    lfp_stats stats;
+    REQUIRE(lfp_stats_get(tif, &stats) == LFP_OK);
+    CHECK(stats.index_records == 5001);
+    const auto stream_bytes = stats.index_bytes;
+
+    auto* whole = lfp_tapeimage_open(create_memfile_handle(file));
+    REQUIRE(whole);
+    CHECK(lfp_tapeimage_build_index(whole, nullptr, nullptr) == LFP_OK);
+    REQUIRE(lfp_stats_get(whole, &stats) == LFP_OK);
+    CHECK(stream_bytes * 4 < stats.index_bytes);
+    lfp_close(whole);
+
+    lfp_protocol* inner = nullptr;
+    REQUIRE(lfp_peek(tif, &inner) == LFP_OK);
+    REQUIRE(lfp_stats_get(inner, &stats) == LFP_OK);
+    CHECK(stats.seeks == 0);
+
+    auto buf = bytes(10);
+    CHECK(lfp_pread(tif, buf.data(), 10, 0, &nread) == LFP_NOTSUPPORTED);
+    CHECK(lfp_tapeimage_build_index(tif, nullptr, nullptr) == LFP_NOTSUPPORTED);
+    lfp_protocol* dup = nullptr;
+    CHECK(lfp_dup(tif, &dup) == LFP_NOTSUPPORTED);
+
+    lfp_close(tif);
+}
@@ -0,0 +1,192 @@
+#include <ciso646>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include <lfp/fd.h>
+#include <lfp/lfp.h>
+#include <lfp/memfile.h>
+#include <lfp/uring.h>
+
+#include "utils.hpp"
+
+using namespace Catch::Matchers;
+
+namespace {
+
+struct uring_closer {
+    void operator () (lfp_uring* r) { lfp_uring_close(r); }
+};
+
+using unique_uring = std::unique_ptr< lfp_uring, uring_closer >;
+
+/*
+ * io_uring is optional at build time, and may also be disabled in the kernel
+ * or by the sandbox, so the tests are skipped when a queue can't be opened
+ */
+#define OPEN_URING_OR_SKIP(ring, entries)                                     \
+    unique_uring ring(lfp_uring_open(entries));                               \
+    if (not ring) {                                                           \
+        WARN("io_uring is not available");                                    \
+        return;                                                               \
+    }
+
+}
+
+TEST_CASE(
+    "Reads on many files can be queued and completed on a single thread",
+    "[uring][async]") {
+    OPEN_URING_OR_SKIP(ring, 16);
+
+    constexpr const int files = 8;
+    constexpr const std::int64_t chunk = 100;
+
+    std::vector< std::vector< unsigned char > > contents;
+    std::vector< std::vector< unsigned char > > outs;
+    std::vector< lfp_protocol* > fs;
+    for (int i = 0; i < files; ++i) {
+        auto c = std::vector< unsigned char >(1000 + 37 * i);
+        std::iota(c.begin(), c.end(), (unsigned char)(i));
+        auto* f = lfp_fd_open(open_named_tempfile(c), LFP_FD_SEQUENTIAL);
+        REQUIRE(f);
+
+        outs.emplace_back(c.size() + chunk);
+        contents.push_back(std::move(c));
+        fs.push_back(f);
+    }
+
+    /*
+     * Queue every chunk of every file, round-robin, and poll whenever the
+     * queue is full. user_data encodes the file and the chunk.
+     */
+    struct tag { int file; std::int64_t offset; };
+    std::vector< tag > tags;
+    for (int i = 0; i < files; ++i) {
+        const auto size = std::int64_t(contents[i].size());
+        for (std::int64_t off = 0; off < size; off += chunk)
+            tags.push_back(tag { i, off });
+    }
+
+    std::vector< lfp_completion > done;
+    lfp_completion buffer[8];
+    const auto poll = [&](int wait) {
+        int count = -1;
+        const auto err = lfp_uring_poll(ring.get(), buffer, 8, wait, &count);
+        REQUIRE(err == LFP_OK);
+        done.insert(done.end(), buffer, buffer + count);
+    };
+
+    for (auto& t : tags) {
+        auto* dst = outs[t.file].data() + t.offset;
+        auto err = lfp_readinto_async(ring.get(), fs[t.file], dst, chunk, &t);
+        if (err == LFP_RUNTIME_ERROR) {
+            poll(1);
+            err = lfp_readinto_async(ring.get(), fs[t.file], dst, chunk, &t);
+        }
+        REQUIRE(err == LFP_OKINCOMPLETE);
+    }
+
+    while (done.size() < tags.size())
+        poll(1);
+
+    CHECK(done.size() == tags.size());
+    int mismatches = 0;
+    for (const auto& c : done) {
+        const auto* t = static_cast< const tag* >(c.user_data);
+        const auto size = std::int64_t(contents[t->file].size());
+        const auto expected = (std::min)(chunk, size - t->offset);
+        if (c.bytes_read != expected)
+            mismatches += 1;
+        if (c.status != (expected == chunk ? LFP_OK : LFP_EOF))
+            mismatches += 1;
+    }
+    CHECK(mismatches == 0);
+
+    for (int i = 0; i < files; ++i) {
+        outs[i].resize(contents[i].size());
+        CHECK_THAT(outs[i], Equals(contents[i]));
+
+        std::int64_t tell = -1;
+        lfp_tell(fs[i], &tell);
+        const auto size = std::int64_t(contents[i].size());
+        CHECK(tell == ((size + chunk - 1) / chunk) * chunk);
+        lfp_close(fs[i]);
+    }
+}
+
+TEST_CASE(
+    "A read past end-of-file completes with EOF",
+    "[uring][async][eof]") {
+    OPEN_URING_OR_SKIP(ring, 0);
+
+    auto* f = create_fd_handle(std::vector< unsigned char >(10, 0xAB));
+    REQUIRE(f);
+    REQUIRE(lfp_seek(f, 20) == LFP_OK);
+
+    unsigned char out[10];
+    auto err = lfp_readinto_async(ring.get(), f, out, 10, nullptr);
+    REQUIRE(err == LFP_OKINCOMPLETE);
+
+    lfp_completion c;
+    int count = -1;
+    err = lfp_uring_poll(ring.get(), &c, 1, 1, &count);
+    CHECK(err == LFP_OK);
+    CHECK(count == 1);
+    CHECK(c.status == LFP_EOF);
+    CHECK(c.bytes_read == 0);
+
+    /* nothing is in flight, so waiting returns right away */
+    err = lfp_uring_poll(ring.get(), &c, 1, 1, &count);
+    CHECK(err == LFP_OK);
+    CHECK(count == 0);
+    lfp_close(f);
+}
+
+TEST_CASE(
+    "Async reads are only supported by the fd protocol",
+    "[uring][async]") {
+    OPEN_URING_OR_SKIP(ring, 0);
+
+    auto mem = memopen(std::vector< unsigned char >(10));
+    unsigned char out[10];
+    const auto err = lfp_readinto_async(ring.get(), mem.get(), out, 10, nullptr);
+    CHECK(err == LFP_NOTSUPPORTED);
+    CHECK_THAT(lfp_errormsg(mem.get()), Contains("not an fd protocol"));
+}
+
+TEST_CASE(
+    "Queueing too many reads fails and leaves the position unchanged",
+    "[uring][async]") {
+    OPEN_URING_OR_SKIP(ring, 4);
+
+    auto contents = std::vector< unsigned char >(1000);
+    std::iota(contents.begin(), contents.end(), 0);
+    auto* f = create_fd_handle(contents);
+    REQUIRE(f);
+
+    auto out = std::vector< unsigned char >(contents.size());
+    int queued = 0;
+    int err = LFP_OKINCOMPLETE;
+    while (err == LFP_OKINCOMPLETE and queued < 100) {
+        err = lfp_readinto_async(ring.get(), f, out.data() + queued, 1, nullptr);
+        if (err == LFP_OKINCOMPLETE)
+            queued += 1;
+    }
+    CHECK(err == LFP_RUNTIME_ERROR);
+    CHECK(queued < 100);
+
+    std::int64_t tell = -1;
+    lfp_tell(f, &tell);
+    CHECK(tell == queued);
+
+    auto completions = std::vector< lfp_completion >(queued);
+    int count = -1;
+    err = lfp_uring_poll(ring.get(), completions.data(), queued, queued, &count);
+    CHECK(err == LFP_OK);
+    CHECK(count == queued);
+    CHECK(std::equal(out.begin(), out.begin() + queued, contents.begin()));
+
+    lfp_close(f);
+}
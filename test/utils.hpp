@@ -1,13 +1,30 @@
 #ifndef LFP_TEST_UTILS_HPP
 #define LFP_TEST_UTILS_HPP
 
+#include <algorithm>
+#include <ciso646>
+#include <cstdint>
+#include <cstdio>
 #include <memory>
 #include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+    #include <fcntl.h>
+    #include <io.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
 
 #include <catch2/catch.hpp>
 
+#include <lfp/custom.h>
+#include <lfp/fd.h>
 #include <lfp/lfp.h>
 #include <lfp/memfile.h>
+#include <lfp/mmap.h>
 #include <lfp/protocol.hpp>
 
 namespace {
@@ -96,7 +113,52 @@ lfp_protocol* create_memfile_handle (std::vector< unsigned char > contents) {
                                 contents.size());
 }
 
-enum filehandle { CFILE, MEM };
+std::string write_named_tempfile(const std::vector< unsigned char >& contents) {
+    /*
+     * mmap needs a path, not a FILE, so std::tmpfile() is not enough. Make
+     * the name unique per translation unit, as every test file has its own
+     * copy of the counter.
+     */
+    static int counter = 0;
+    const auto tu = reinterpret_cast< std::uintptr_t >(&counter);
+    const auto path = "lfp-test-" + std::to_string(tu) + "-"
+                    + std::to_string(counter++) + ".tmp";
+
+    std::FILE* fp = std::fopen(path.c_str(), "wb");
+    REQUIRE(fp);
+    /* contents.data() may be null when empty, which fwrite must not get */
+    if (not contents.empty())
+        std::fwrite(contents.data(), 1, contents.size(), fp);
+    std::fclose(fp);
+    return path;
+}
+
+lfp_protocol* create_mmap_handle (std::vector< unsigned char > contents) {
+    const auto path = write_named_tempfile(contents);
+    auto* f = lfp_mmap_open(path.c_str(), LFP_MMAP_NORMAL);
+    /* the mapping outlives the directory entry */
+    std::remove(path.c_str());
+    return f;
+}
+
+int open_named_tempfile(const std::vector< unsigned char >& contents) {
+    const auto path = write_named_tempfile(contents);
+#if defined(_WIN32)
+    const auto fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    const auto fd = ::open(path.c_str(), O_RDONLY);
+#endif
+    /* the descriptor outlives the directory entry */
+    std::remove(path.c_str());
+    REQUIRE(fd != -1);
+    return fd;
+}
+
+lfp_protocol* create_fd_handle (std::vector< unsigned char > contents) {
+    return lfp_fd_open(open_named_tempfile(contents), LFP_FD_NORMAL);
+}
+
+enum filehandle { CFILE, MEM, MMAP, FD };
 
 struct device {
     /* fixture for testing on all currently possible underlying devices */
@@ -105,7 +167,12 @@ struct device {
         /* Catch doesn't like functions as parameters for Generate.
          * Thus using enums to generate values instead.
          */
-        handle = GENERATE(filehandle::CFILE, filehandle::MEM);
+        handle = GENERATE(
+            filehandle::CFILE,
+            filehandle::MEM,
+            filehandle::MMAP,
+            filehandle::FD
+        );
 
         switch (handle) {
             case CFILE : {
@@ -118,6 +185,16 @@ struct device {
                 device_type = "mem";
                 break;
             }
+            case MMAP : {
+                create = create_mmap_handle;
+                device_type = "mmap";
+                break;
+            }
+            case FD : {
+                create = create_fd_handle;
+                device_type = "fd";
+                break;
+            }
         }
     }
 
@@ -229,6 +306,52 @@ void test_split_read(random_memfile* file) {
     CHECK_THAT(file->out, Catch::Matchers::Equals(file->expected));
 }
 
+void test_split_readv(random_memfile* file) {
+    /*
+     * Read the file with lfp_readv(), in batches of count buffers of readsize
+     * bytes each. The last batch is incomplete unless the file size happens
+     * to align with the batches.
+     */
+    const auto readsize = GENERATE_COPY(
+                          take(1, random(1, (file->size + 1) / 2)));
+    const auto count = GENERATE(1, 2, 3, 7);
+
+    auto* p = file->out.data();
+    std::int64_t remaining = file->size;
+    while (true) {
+        auto iov = std::vector< lfp_iovec >(count);
+        std::int64_t batch = 0;
+        for (auto& buf : iov) {
+            buf.base = p + batch;
+            buf.len  = (std::min)(std::int64_t(readsize), remaining - batch);
+            batch += buf.len;
+        }
+
+        std::int64_t nread = -1;
+        const auto err = lfp_readv(file->f, iov.data(), count, &nread);
+        CHECK(nread == batch);
+        p += nread;
+        remaining -= nread;
+
+        if (remaining == 0) {
+            CHECK(err == LFP_OK);
+            break;
+        }
+        REQUIRE(err == LFP_OK);
+    }
+
+    std::int64_t bytes_read = -1;
+    char buf;
+    lfp_iovec past_end;
+    past_end.base = &buf;
+    past_end.len  = 1;
+    const auto err = lfp_readv(file->f, &past_end, 1, &bytes_read);
+    CHECK(err == LFP_EOF);
+    CHECK(bytes_read == 0);
+
+    CHECK_THAT(file->out, Catch::Matchers::Equals(file->expected));
+}
+
 void test_random_seek(random_memfile* file) {
     const auto n = GENERATE_COPY(take(1, random(0, file->size - 1)));
     auto err = lfp_seek(file->f, n);
@@ -360,4 +483,100 @@ namespace {
     };
 }
 
+namespace {
+
+/*
+ * Builders for small files in the formats lfp reads, for checking protocols
+ * that recognise or index them
+ */
+using bytes = std::vector< unsigned char >;
+
+bytes operator + (bytes lhs, const bytes& rhs) {
+    lhs.insert(lhs.end(), rhs.begin(), rhs.end());
+    return lhs;
+}
+
+void put_le32(bytes& b, std::uint32_t x) {
+    b.push_back(x >>  0);
+    b.push_back(x >>  8);
+    b.push_back(x >> 16);
+    b.push_back(x >> 24);
+}
+
+/*
+ * A tape image with one record per body, and a file mark
+ */
+bytes tapeimage(const std::vector< bytes >& records) {
+    bytes out;
+    std::uint32_t prev = 0;
+    for (const auto& body : records) {
+        const auto here = std::uint32_t(out.size());
+        put_le32(out, 0);
+        put_le32(out, prev);
+        put_le32(out, here + 12 + body.size());
+        out = out + body;
+        prev = here;
+    }
+
+    const auto here = std::uint32_t(out.size());
+    put_le32(out, 1);
+    put_le32(out, prev);
+    put_le32(out, here + 12);
+    return out;
+}
+
+bytes visible_record(const bytes& body) {
+    const auto len = body.size() + 4;
+    return bytes { std::uint8_t(len >> 8), std::uint8_t(len), 0xFF, 0x01 }
+         + body;
+}
+
+bytes storage_unit_label() {
+    const std::string sul =
+        "   1V1.00RECORD 8192Default Storage Set                   "
+        "                      ";
+    REQUIRE(sul.size() == 80);
+    return bytes(sul.begin(), sul.end());
+}
+
+/*
+ * A leaf that can only be read, front to back, like a pipe. Seeks and tells
+ * are not supported.
+ */
+struct pipe_source {
+    bytes data;
+    std::size_t pos = 0;
+};
+
+int pipe_read(void* ctx, void* dst, std::int64_t len, std::int64_t* nread) {
+    auto* p = static_cast< pipe_source* >(ctx);
+    const auto left = std::int64_t(p->data.size() - p->pos);
+    const auto n = (std::min)(len, left);
+    if (n > 0)
+        std::memcpy(dst, p->data.data() + p->pos, n);
+    p->pos += n;
+    *nread = n;
+    return n == len ? LFP_OK : LFP_EOF;
+}
+
+int pipe_close(void* ctx) {
+    delete static_cast< pipe_source* >(ctx);
+    return LFP_OK;
+}
+
+lfp_protocol* open_pipe(const bytes& data) {
+    lfp_custom_ops ops;
+    std::memset(&ops, 0, sizeof(ops));
+    ops.size  = sizeof(ops);
+    ops.read  = pipe_read;
+    ops.close = pipe_close;
+    auto* src = new pipe_source();
+    src->data = data;
+    auto* f = lfp_custom_open(&ops, src);
+    REQUIRE(f);
+    return f;
+}
+
+}
+
 #endif //LFP_TEST_UTILS_HPP